@@ -34,6 +34,11 @@ typedef void (*NDBusReplyFunc) (NCore *core,
                                 DBusMessage *msg,
                                 void *userdata);
 
+typedef void (*NDBusBatchDoneFunc) (NCore *core,
+                                    void *userdata);
+
+typedef struct NDBusBatch NDBusBatch;
+
 /** Start listening for DBus signal
  * @param core NCore structure
  * @param cb Callback called when signal witht the specified parameters is seen
@@ -69,6 +74,7 @@ void        n_dbus_remove_match_by_cb (NCore *core, NDBusFilterFunc cb);
  * is set up and the callback is called with the pending call reply
  * contents.
  * Message part of pending call reply is passed to the NDBusFilterFunc callback.
+ * Identical call already in flight is not sent again, but shares the reply.
  * @param core NCore structure
  * @param cb Callback called when pending call reply is received
  * @param userdata Data passed to callback
@@ -105,4 +111,59 @@ gboolean    n_dbus_async_call_full (NCore          *core,
                                     DBusBusType     type,
                                     DBusMessage    *msg);
 
+/** Create a batch of asynchronous DBus calls. Calls added to the batch
+ * are sent immediately, and done callback is called once all replies
+ * have been received (or timed out) after the batch is committed.
+ * @param core NCore structure
+ * @param done Callback called when all calls in the batch are done
+ * @param userdata Data passed to done callback
+ * @return New batch, freed automatically after done callback
+ */
+NDBusBatch* n_dbus_batch_new (NCore               *core,
+                              NDBusBatchDoneFunc   done,
+                              void                *userdata);
+
+/** Add an asynchronous DBus call to a batch. Identical calls without
+ * arguments and with the same timeout already in flight are not sent
+ * again, but share the reply.
+ * If the call times out the callback receives the error reply.
+ * @param batch NDBusBatch structure
+ * @param cb Callback called when pending call reply is received, may be NULL
+ * @param userdata Data passed to callback
+ * @param type Whether to use system or session bus
+ * @param msg DBus message to send
+ * @param timeout Reply timeout in milliseconds, -1 for default
+ * @return TRUE if sending the message succeeded.
+ */
+gboolean    n_dbus_batch_add (NDBusBatch          *batch,
+                              NDBusReplyFunc       cb,
+                              void                *userdata,
+                              DBusBusType          type,
+                              DBusMessage         *msg,
+                              int                  timeout);
+
+/** Add an asynchronous DBus call on a private connection to a batch,
+ * for example a peer-to-peer connection. Calls on private connections
+ * are never shared.
+ * @param batch NDBusBatch structure
+ * @param cb Callback called when pending call reply is received, may be NULL
+ * @param userdata Data passed to callback
+ * @param connection Connection to send the message on
+ * @param msg DBus message to send
+ * @param timeout Reply timeout in milliseconds, -1 for default
+ * @return TRUE if sending the message succeeded.
+ */
+gboolean    n_dbus_batch_add_connection (NDBusBatch      *batch,
+                                         NDBusReplyFunc   cb,
+                                         void            *userdata,
+                                         DBusConnection  *connection,
+                                         DBusMessage     *msg,
+                                         int              timeout);
+
+/** Finish adding calls to a batch. If all replies have already been
+ * received the done callback is called immediately.
+ * @param batch NDBusBatch structure
+ */
+void        n_dbus_batch_commit (NDBusBatch *batch);
+
 #endif
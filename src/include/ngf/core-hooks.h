@@ -57,6 +57,12 @@ typedef enum _NCoreHook
     based on available resources (and for example, vibration status).
     */
     N_CORE_HOOK_FILTER_SINKS,
+    /** Executed:
+    - When metrics are queried with n_core_get_metrics().
+    - After core has added its own counters to the metrics.
+    - Plugins add their own counters, prefixed with the plugin name.
+    */
+    N_CORE_HOOK_COLLECT_METRICS,
     N_CORE_HOOK_LAST
 } NCoreHook;
 
@@ -76,6 +82,11 @@ typedef struct _NCoreHookFilterSinksData
     GList    *sinks;
 } NCoreHookFilterSinksData;
 
+typedef struct _NCoreHookCollectMetricsData
+{
+    NProplist *metrics;
+} NCoreHookCollectMetricsData;
+
 /**
  * Return name of hook as string
  *
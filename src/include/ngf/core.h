@@ -48,6 +48,16 @@ NContext*        n_core_get_context  (NCore *core);
  */
 GList*           n_core_get_requests (NCore *core);
 
+/**
+ * Find an active request by its identifier. A fallback replacing a
+ * failed request keeps the identifier of the original request.
+ *
+ * @param core Core.
+ * @param id Request identifier.
+ * @return Active request or NULL if not found.
+ */
+NRequest*        n_core_lookup_request (NCore *core, guint id);
+
 /**
  * Get list of registered sinks
  *
@@ -91,4 +101,34 @@ int              n_core_connect      (NCore *core, NCoreHook hook, int priority,
  */
 void             n_core_disconnect   (NCore *core, NCoreHook hook, NHookCallback callback, void *userdata);
 
+/**
+ * Accept request property key from input interfaces. Until the first key
+ * is added all keys are accepted. Input interfaces may drop other keys
+ * already when parsing incoming requests.
+ *
+ * @param core Core.
+ * @param key Property key.
+ */
+void             n_core_add_input_key     (NCore *core, const char *key);
+
+/**
+ * Check if request property key from input interface should be kept. Keys
+ * used in event request rules are always accepted.
+ *
+ * @param core Core.
+ * @param key Property key.
+ * @return TRUE if key is accepted.
+ */
+gboolean         n_core_accepts_input_key (NCore *core, const char *key);
+
+/**
+ * Collect runtime metrics: active requests, request rate, latency
+ * percentiles, sink failures and object counts. Plugins can add their
+ * own values in N_CORE_HOOK_COLLECT_METRICS.
+ *
+ * @param core Core.
+ * @return New NProplist, caller frees.
+ */
+NProplist*       n_core_get_metrics       (NCore *core);
+
 #endif /* N_CORE_H */
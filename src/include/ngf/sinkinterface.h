@@ -87,6 +87,22 @@ typedef struct _NSinkInterfaceDecl
      * @return TRUE if playback is stopped
      */
     void (*stop)       (NSinkInterface *iface, NRequest *request);
+
+    /** Prewarm function. Optional. This function is called when the context predicts that the request
+     * will be played soon, so that the interface can speculatively prepare its resources for it.
+     * The request is never played, resources are released with drop_prewarm.
+     * @param iface NSinkInterface structure
+     * @param request Speculative request
+     * @return TRUE if interface holds prewarmed resources for the request
+     */
+    int  (*prewarm)      (NSinkInterface *iface, NRequest *request);
+
+    /** Drop_prewarm function. This function is called when the real request has been prepared or the
+     * prediction timed out, and any prewarmed resources not taken by a real request can be released.
+     * @param iface NSinkInterface structure
+     * @param request Speculative request given to prewarm
+     */
+    void (*drop_prewarm) (NSinkInterface *iface, NRequest *request);
 } NSinkInterfaceDecl;
 
 /** Stores userdata for the sink interface
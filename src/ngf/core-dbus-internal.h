@@ -26,5 +26,6 @@ typedef struct NDBusHelper NDBusHelper;
 
 NDBusHelper*    n_dbus_helper_new   (NCore *core);
 void            n_dbus_helper_free  (NDBusHelper *dbus);
+guint           n_dbus_helper_match_count (NDBusHelper *dbus);
 
 #endif
@@ -41,7 +41,9 @@ struct NDBusHelper {
     NCore          *core;
     guint           id_counter;
     n_dbus_bus      bus[2];
-    GHashTable     *matches;
+    GHashTable     *matches;    /* n_dbus_match_key -> n_dbus_match */
+    GHashTable     *members;    /* member quark -> number of matches */
+    GHashTable     *calls;      /* call key -> in-flight n_dbus_call */
 };
 
 typedef struct n_dbus_cb {
@@ -50,18 +52,42 @@ typedef struct n_dbus_cb {
     void           *userdata;
 } n_dbus_cb;
 
+/* Matches are identified by interned interface, path and member, so that
+ * incoming signals can be looked up without building match strings. */
+typedef struct n_dbus_match_key {
+    DBusBusType     type;
+    GQuark          iface;
+    GQuark          path;
+    GQuark          member;
+} n_dbus_match_key;
+
 typedef struct n_dbus_match {
+    n_dbus_match_key key;
     NDBusHelper    *dbus;
-    DBusBusType     type;
     char           *match_str;
     GSList         *callbacks;
 } n_dbus_match;
 
+struct NDBusBatch {
+    NCore              *core;
+    NDBusBatchDoneFunc  done;
+    void               *userdata;
+    guint               pending;
+    gboolean            committed;
+};
+
+typedef struct n_dbus_reply {
+    NDBusReplyFunc  cb;
+    void           *userdata;
+    NDBusBatch     *batch;
+} n_dbus_reply;
+
 typedef struct n_dbus_call {
     NCore          *core;
     DBusBusType     type;
-    NDBusReplyFunc  cb;
-    void           *userdata;
+    DBusConnection *connection; /* set for calls on a peer connection */
+    char           *key;        /* set when identical calls are shared */
+    GSList         *replies;    /* n_dbus_reply */
 } n_dbus_call;
 
 static char*
@@ -88,29 +114,117 @@ bus_str (DBusBusType type)
     return "session";
 }
 
+static guint
+match_key_hash (gconstpointer data)
+{
+    const n_dbus_match_key *key = data;
+
+    return ((key->member * 31 + key->iface) * 31 + key->path) * 31 + key->type;
+}
+
+static gboolean
+match_key_equal (gconstpointer a, gconstpointer b)
+{
+    const n_dbus_match_key *ka = a;
+    const n_dbus_match_key *kb = b;
+
+    return ka->member == kb->member &&
+           ka->iface  == kb->iface  &&
+           ka->path   == kb->path   &&
+           ka->type   == kb->type;
+}
+
+static n_dbus_match*
+match_lookup (NDBusHelper *dbus, DBusBusType type, const char *iface,
+              const char *path, const char *member)
+{
+    n_dbus_match_key key;
+
+    /* Cheap rejection first: members nobody listens to are not interned
+     * or not in the member set, and no allocation is done for them. */
+    if (!(key.member = g_quark_try_string (member)))
+        return NULL;
+
+    if (!g_hash_table_contains (dbus->members, GUINT_TO_POINTER (key.member)))
+        return NULL;
+
+    if (!(key.iface = g_quark_try_string (iface)))
+        return NULL;
+
+    if (!(key.path = g_quark_try_string (path)))
+        return NULL;
+
+    key.type = type;
+
+    return g_hash_table_lookup (dbus->matches, &key);
+}
+
+static n_dbus_match*
+match_get (NDBusHelper *dbus, DBusBusType type, const char *iface,
+           const char *path, const char *member, gboolean *created)
+{
+    n_dbus_match     *match;
+    n_dbus_match_key  key;
+    gpointer          count;
+
+    key.type    = type;
+    key.iface   = g_quark_from_string (iface);
+    key.path    = g_quark_from_string (path);
+    key.member  = g_quark_from_string (member);
+
+    if ((match = g_hash_table_lookup (dbus->matches, &key))) {
+        *created = FALSE;
+        return match;
+    }
+
+    match               = g_new0 (n_dbus_match, 1);
+    match->key          = key;
+    match->dbus         = dbus;
+    match->match_str    = build_match_string (iface, path, member);
+
+    count = g_hash_table_lookup (dbus->members, GUINT_TO_POINTER (match->key.member));
+    g_hash_table_insert (dbus->members, GUINT_TO_POINTER (match->key.member),
+                         GUINT_TO_POINTER (GPOINTER_TO_UINT (count) + 1));
+    g_hash_table_insert (dbus->matches, &match->key, match);
+    *created = TRUE;
+
+    return match;
+}
+
+static void
+match_free (gpointer userdata)
+{
+    n_dbus_match *match = userdata;
+    gpointer      count;
+
+    count = g_hash_table_lookup (match->dbus->members, GUINT_TO_POINTER (match->key.member));
+    if (GPOINTER_TO_UINT (count) > 1)
+        g_hash_table_insert (match->dbus->members, GUINT_TO_POINTER (match->key.member),
+                             GUINT_TO_POINTER (GPOINTER_TO_UINT (count) - 1));
+    else
+        g_hash_table_remove (match->dbus->members, GUINT_TO_POINTER (match->key.member));
+
+    g_slist_free_full (match->callbacks, g_free);
+    g_free (match->match_str);
+    g_free (match);
+}
+
 static DBusHandlerResult
-filter_cb (DBusConnection *connection, DBusMessage *msg, void *userdata)
+dispatch_signal (NDBusHelper *dbus, DBusBusType type,
+                 DBusConnection *connection, DBusMessage *msg)
 {
-    NDBusHelper    *dbus = userdata;
     n_dbus_match   *match;
-    char           *match_str = NULL;
-    const char     *iface;
-    const char     *path;
-    const char     *member;
     GSList         *i;
     int             ret = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-    iface  = dbus_message_get_interface (msg);
-    path   = dbus_message_get_path (msg);
-    member = dbus_message_get_member (msg);
+    if (dbus_message_get_type (msg) != DBUS_MESSAGE_TYPE_SIGNAL)
+        return ret;
 
-    if ((!iface && !path && !member) || dbus_message_get_type (msg) != DBUS_MESSAGE_TYPE_SIGNAL)
-        goto done;
-
-    match_str = build_match_string (iface, path, member);
-
-    if (!(match = g_hash_table_lookup (dbus->matches, match_str)))
-        goto done;
+    if (!(match = match_lookup (dbus, type,
+                                dbus_message_get_interface (msg),
+                                dbus_message_get_path (msg),
+                                dbus_message_get_member (msg))))
+        return ret;
 
     for (i = match->callbacks; i; i = i->next) {
         n_dbus_cb *cb = i->data;
@@ -119,11 +233,21 @@ filter_cb (DBusConnection *connection, DBusMessage *msg, void *userdata)
             ret = r;
     }
 
-done:
-    g_free (match_str);
     return ret;
 }
 
+static DBusHandlerResult
+filter_cb (DBusConnection *connection, DBusMessage *msg, void *userdata)
+{
+    NDBusHelper    *dbus = userdata;
+    DBusBusType     type;
+
+    type = connection == dbus->bus[DBUS_BUS_SESSION].connection ? DBUS_BUS_SESSION
+                                                                : DBUS_BUS_SYSTEM;
+
+    return dispatch_signal (dbus, type, connection, msg);
+}
+
 static void
 connection_ref (NDBusHelper *dbus, DBusBusType type)
 {
@@ -204,7 +328,6 @@ match_add_callback (n_dbus_match *match, guint id, NDBusFilterFunc cb, void *use
     callback->userdata  = userdata;
 
     match->callbacks = g_slist_append (match->callbacks, callback);
-    connection_ref (match->dbus, match->type);
     N_DEBUG (LOG_CAT "add match callback '%s' -> %u : %p", match->match_str, callback->id, callback->cb);
 }
 
@@ -216,32 +339,50 @@ match_remove_callback (n_dbus_match *match, n_dbus_cb *cb)
 
     N_DEBUG (LOG_CAT "remove match callback '%s' -> %u : %p", match->match_str, cb->id, cb->cb);
     match->callbacks = g_slist_remove (match->callbacks, cb);
-    connection_unref (match->dbus, match->type);
+    connection_unref (match->dbus, match->key.type);
     g_free (cb);
 }
 
 static void
-match_remove_full (gpointer userdata)
+match_remove (n_dbus_match *match)
 {
-    n_dbus_match    *match = userdata;
-    n_dbus_cb       *cb;
-    GSList          *i;
+    NDBusHelper *dbus = match->dbus;
+    DBusBusType  type = match->key.type;
 
-    while (match->callbacks) {
-        i = match->callbacks;
-        cb = i->data;
-        match_remove_callback (match, cb);
-    }
+    g_assert (!match->callbacks);
+    g_assert (dbus->bus[type].connection);
 
-    g_assert (match->dbus->bus[match->type].connection);
+    N_DEBUG (LOG_CAT "remove match '%s'", match->match_str);
+    dbus_bus_remove_match (dbus->bus[type].connection,
+                           match->match_str, NULL);
+    g_hash_table_remove (dbus->matches, &match->key);
+    connection_unref (dbus, type);
+}
 
-    dbus_bus_remove_match (match->dbus->bus[match->type].connection,
+/* removes a match left behind with its callbacks, match_free()
+ * frees it when the table lets go of it */
+static gboolean
+match_remove_full (gpointer key, gpointer value, gpointer userdata)
+{
+    n_dbus_match *match = value;
+    NDBusHelper  *dbus  = match->dbus;
+    DBusBusType   type  = match->key.type;
+
+    (void) key;
+    (void) userdata;
+
+    while (match->callbacks)
+        match_remove_callback (match, match->callbacks->data);
+
+    g_assert (dbus->bus[type].connection);
+
+    dbus_bus_remove_match (dbus->bus[type].connection,
                            match->match_str, NULL);
-    connection_unref (match->dbus, match->type);
+    connection_unref (dbus, type);
 
     N_DEBUG (LOG_CAT "remove match '%s'", match->match_str);
-    g_free (match->match_str);
-    g_free (match);
+
+    return TRUE;
 }
 
 NDBusHelper*
@@ -251,8 +392,10 @@ n_dbus_helper_new (NCore *core)
 
     dbus            = g_new0 (NDBusHelper, 1);
     dbus->core      = core;
-    dbus->matches   = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                             NULL, match_remove_full);
+    dbus->matches   = g_hash_table_new_full (match_key_hash, match_key_equal,
+                                             NULL, match_free);
+    dbus->members   = g_hash_table_new (g_direct_hash, g_direct_equal);
+    dbus->calls     = g_hash_table_new (g_str_hash, g_str_equal);
 
     return dbus;
 }
@@ -262,7 +405,10 @@ n_dbus_helper_free (NDBusHelper *dbus)
 {
     g_assert (dbus);
 
+    g_hash_table_foreach_remove (dbus->matches, match_remove_full, NULL);
     g_hash_table_destroy (dbus->matches);
+    g_hash_table_destroy (dbus->members);
+    g_hash_table_destroy (dbus->calls);
     g_assert (dbus->bus[DBUS_BUS_SYSTEM].ref == 0);
     g_assert (!dbus->bus[DBUS_BUS_SYSTEM].connection);
     g_assert (dbus->bus[DBUS_BUS_SESSION].ref == 0);
@@ -270,6 +416,14 @@ n_dbus_helper_free (NDBusHelper *dbus)
     g_free (dbus);
 }
 
+guint
+n_dbus_helper_match_count (NDBusHelper *dbus)
+{
+    g_assert (dbus);
+
+    return g_hash_table_size (dbus->matches);
+}
+
 guint
 n_dbus_add_match (NCore            *core,
                   NDBusFilterFunc   cb,
@@ -281,29 +435,25 @@ n_dbus_add_match (NCore            *core,
 {
     n_dbus_match   *match;
     DBusConnection *connection;
-    char           *match_str;
+    gboolean        created;
     int             id;
 
     g_assert (core);
     g_assert (core->dbus);
 
+    /* Reference taken here is owned by the new callback. */
     if (!(connection = connection_get (core->dbus, type, TRUE))) {
         N_ERROR (LOG_CAT "could not get %s bus", bus_str(type));
         return 0;
     }
 
-    match_str = build_match_string (iface, path, member);
+    match = match_get (core->dbus, type, iface, path, member, &created);
 
-    if (!(match = g_hash_table_lookup (core->dbus->matches, match_str))) {
-        N_DEBUG (LOG_CAT "new match '%s'", match_str);
-        match           = g_new0 (n_dbus_match, 1);
-        match->type     = type;
-        match->dbus     = core->dbus;
-        match->match_str= match_str;
+    if (created) {
+        N_DEBUG (LOG_CAT "new match '%s'", match->match_str);
         dbus_bus_add_match (connection, match->match_str, NULL);
-        g_hash_table_insert (core->dbus->matches, match->match_str, match);
-    } else
-        g_free (match_str);
+        connection_ref (core->dbus, type);
+    }
 
     id = ++core->dbus->id_counter;
     match_add_callback (match, id, cb, userdata);
@@ -342,8 +492,8 @@ dbus_remove_match (NCore *core, guint match_id, NDBusFilterFunc match_cb)
             break;
     }
 
-    if (match && !match->callbacks)
-        g_hash_table_remove (core->dbus->matches, match->match_str);
+    if (removed && !match->callbacks)
+        match_remove (match);
 
     return removed;
 }
@@ -361,66 +511,139 @@ n_dbus_remove_match_by_cb (NCore *core, NDBusFilterFunc cb)
         N_WARNING (LOG_CAT "tried to remove match by callback %p - not found", cb);
 }
 
+static void
+batch_call_done (NDBusBatch *batch)
+{
+    g_assert (batch->pending > 0);
+
+    if (--batch->pending == 0 && batch->committed) {
+        if (batch->done)
+            batch->done (batch->core, batch->userdata);
+        g_free (batch);
+    }
+}
+
+static char*
+build_call_key (DBusBusType type, DBusMessage *msg, int timeout)
+{
+    const char *signature = dbus_message_get_signature (msg);
+
+    /* Only calls without arguments are shared, comparing argument
+     * contents is not worth it for the few calls we make. Calls with
+     * another timeout are not shared so that each caller gets its own. */
+    if (signature && *signature)
+        return NULL;
+
+    return g_strdup_printf ("%d %d %s %s %s.%s", type, timeout,
+                            dbus_message_get_destination (msg),
+                            dbus_message_get_path (msg),
+                            dbus_message_get_interface (msg),
+                            dbus_message_get_member (msg));
+}
+
 static void
 async_call_cb (DBusPendingCall *pending, void *userdata)
 {
     n_dbus_call *call = userdata;
     DBusMessage *msg  = NULL;
+    GSList      *i;
+
+    if (call->key)
+        g_hash_table_remove (call->core->dbus->calls, call->key);
+
+    msg = dbus_pending_call_steal_reply (pending);
+
+    for (i = call->replies; i; i = i->next) {
+        n_dbus_reply *reply = i->data;
+
+        if (msg && reply->cb)
+            reply->cb (call->core, msg, reply->userdata);
 
-    if (!(msg = dbus_pending_call_steal_reply (pending))) {
-        goto done;
+        if (reply->batch)
+            batch_call_done (reply->batch);
     }
 
-    call->cb (call->core, msg, call->userdata);
-    dbus_message_unref (msg);
+    if (msg)
+        dbus_message_unref (msg);
 
-done:
     dbus_pending_call_unref (pending);
-    connection_unref (call->core->dbus, call->type);
+    if (call->connection)
+        dbus_connection_unref (call->connection);
+    else
+        connection_unref (call->core->dbus, call->type);
+    g_slist_free_full (call->replies, g_free);
+    g_free (call->key);
     g_free (call);
 }
 
-gboolean
-n_dbus_async_call_full (NCore *core,
-                        NDBusReplyFunc cb,
-                        void *userdata,
-                        DBusBusType type,
-                        DBusMessage *msg)
+static gboolean
+async_call (NCore *core,
+            NDBusReplyFunc cb,
+            void *userdata,
+            NDBusBatch *batch,
+            DBusBusType type,
+            DBusMessage *msg,
+            int timeout)
 {
     n_dbus_call     *call;
+    n_dbus_reply    *reply;
     DBusPendingCall *pending_call = NULL;
     DBusConnection  *connection   = NULL;
+    char            *key          = NULL;
 
     g_assert (core);
     g_assert (core->dbus);
     g_assert (msg);
 
-    if (!(connection = connection_get (core->dbus, type, FALSE)))
-        goto fail;
-
-    if (cb) {
-        if (!dbus_connection_send_with_reply (connection,
-                                              msg, &pending_call, -1))
-            goto fail;
-
-        if (!pending_call)
+    if (!cb && !batch) {
+        if (!(connection = connection_get (core->dbus, type, FALSE)))
             goto fail;
-
-        call            = g_new0 (n_dbus_call, 1);
-        call->core      = core;
-        call->type      = type;
-        call->cb        = cb;
-        call->userdata  = userdata;
-
-        dbus_pending_call_set_notify (pending_call, async_call_cb, call, NULL);
-    } else {
         if (!dbus_connection_send (connection, msg, NULL))
             goto fail;
         connection_unref (core->dbus, type);
+        return TRUE;
     }
 
+    reply           = g_new0 (n_dbus_reply, 1);
+    reply->cb       = cb;
+    reply->userdata = userdata;
+    reply->batch    = batch;
+
+    /* Identical call already in flight, wait for the same reply. */
+    if ((key = build_call_key (type, msg, timeout)) &&
+        (call = g_hash_table_lookup (core->dbus->calls, key))) {
+        N_DEBUG (LOG_CAT "share in-flight call %s", key);
+        call->replies = g_slist_append (call->replies, reply);
+        g_free (key);
+        return TRUE;
+    }
+
+    if (!(connection = connection_get (core->dbus, type, FALSE)))
+        goto fail_reply;
+
+    if (!dbus_connection_send_with_reply (connection,
+                                          msg, &pending_call, timeout))
+        goto fail_reply;
+
+    if (!pending_call)
+        goto fail_reply;
+
+    call            = g_new0 (n_dbus_call, 1);
+    call->core      = core;
+    call->type      = type;
+    call->key       = key;
+    call->replies   = g_slist_append (NULL, reply);
+
+    if (key)
+        g_hash_table_insert (core->dbus->calls, key, call);
+
+    dbus_pending_call_set_notify (pending_call, async_call_cb, call, NULL);
+
     return TRUE;
 
+fail_reply:
+    g_free (reply);
+    g_free (key);
 fail:
     if (connection)
         connection_unref (core->dbus, type);
@@ -428,6 +651,16 @@ fail:
     return FALSE;
 }
 
+gboolean
+n_dbus_async_call_full (NCore *core,
+                        NDBusReplyFunc cb,
+                        void *userdata,
+                        DBusBusType type,
+                        DBusMessage *msg)
+{
+    return async_call (core, cb, userdata, NULL, type, msg, -1);
+}
+
 gboolean
 n_dbus_async_call (NCore *core,
                    NDBusReplyFunc cb,
@@ -461,3 +694,94 @@ fail:
     N_ERROR (LOG_CAT "failed to do async call %s %s %s.%s", destination, path, iface, method);
     return FALSE;
 }
+
+NDBusBatch*
+n_dbus_batch_new (NCore *core, NDBusBatchDoneFunc done, void *userdata)
+{
+    NDBusBatch *batch;
+
+    g_assert (core);
+
+    batch           = g_new0 (NDBusBatch, 1);
+    batch->core     = core;
+    batch->done     = done;
+    batch->userdata = userdata;
+
+    return batch;
+}
+
+gboolean
+n_dbus_batch_add (NDBusBatch *batch,
+                  NDBusReplyFunc cb,
+                  void *userdata,
+                  DBusBusType type,
+                  DBusMessage *msg,
+                  int timeout)
+{
+    g_assert (batch);
+    g_assert (!batch->committed);
+
+    batch->pending++;
+
+    if (!async_call (batch->core, cb, userdata, batch, type, msg, timeout)) {
+        batch->pending--;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean
+n_dbus_batch_add_connection (NDBusBatch *batch,
+                             NDBusReplyFunc cb,
+                             void *userdata,
+                             DBusConnection *connection,
+                             DBusMessage *msg,
+                             int timeout)
+{
+    n_dbus_call     *call;
+    n_dbus_reply    *reply;
+    DBusPendingCall *pending_call = NULL;
+
+    g_assert (batch);
+    g_assert (!batch->committed);
+    g_assert (connection);
+    g_assert (msg);
+
+    if (!dbus_connection_send_with_reply (connection,
+                                          msg, &pending_call, timeout) ||
+        !pending_call) {
+        N_ERROR (LOG_CAT "failed to do async call");
+        return FALSE;
+    }
+
+    reply           = g_new0 (n_dbus_reply, 1);
+    reply->cb       = cb;
+    reply->userdata = userdata;
+    reply->batch    = batch;
+
+    call             = g_new0 (n_dbus_call, 1);
+    call->core       = batch->core;
+    call->connection = dbus_connection_ref (connection);
+    call->replies    = g_slist_append (NULL, reply);
+
+    batch->pending++;
+    dbus_pending_call_set_notify (pending_call, async_call_cb, call, NULL);
+
+    return TRUE;
+}
+
+void
+n_dbus_batch_commit (NDBusBatch *batch)
+{
+    g_assert (batch);
+    g_assert (!batch->committed);
+
+    batch->committed = TRUE;
+
+    if (batch->pending == 0) {
+        if (batch->done)
+            batch->done (batch->core, batch->userdata);
+        g_free (batch);
+    }
+}
@@ -35,6 +35,8 @@
 #include "request-internal.h"
 #include "context-internal.h"
 #include "core-dbus-internal.h"
+#include "core-metrics-internal.h"
+#include "core-prewarm-internal.h"
 #include "haptic-internal.h"
 
 struct _NCore
@@ -59,9 +61,13 @@ struct _NCore
 
     NHaptic          *haptic;               /* haptic helper */
     NDBusHelper      *dbus;                 /* dbus helper */
+    NMetrics         *metrics;              /* request counters and latencies */
+    NPrewarm         *prewarm;              /* context predicted prewarming */
 
     GHashTable       *key_types;
+    GHashTable       *input_keys;           /* accepted input keys, NULL accepts all */
     GList            *requests;             /* active requests */
+    GHashTable       *request_ids;          /* request id -> active request */
 
     NHook             hooks[N_CORE_HOOK_LAST];
 
@@ -0,0 +1,290 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include <ngf/log.h>
+#include "core-internal.h"
+#include "core-metrics-internal.h"
+
+#define LOG_CAT "core-metrics: "
+
+#define LATENCY_SAMPLES     (128)   /* latest samples kept per phase */
+#define RATE_WINDOW         (60)    /* request rate window in seconds */
+
+typedef struct NLatencyRing
+{
+    gint64  samples[LATENCY_SAMPLES];
+    guint   count;
+    guint   next;
+} NLatencyRing;
+
+struct NMetrics
+{
+    NCore          *core;
+    guint           requests_total;
+    guint           rate[RATE_WINDOW];  /* requests per second, ring */
+    gint64          rate_second;        /* second of the newest bucket */
+    NLatencyRing    latency[N_METRICS_PHASE_LAST];
+};
+
+static const char *phase_names[N_METRICS_PHASE_LAST] = {
+    "prepare",
+    "total"
+};
+
+NMetrics*
+n_metrics_new (NCore *core)
+{
+    NMetrics *metrics;
+
+    metrics = g_new0 (NMetrics, 1);
+    metrics->core = core;
+    metrics->rate_second = g_get_monotonic_time () / G_USEC_PER_SEC;
+
+    return metrics;
+}
+
+void
+n_metrics_free (NMetrics *metrics)
+{
+    g_free (metrics);
+}
+
+/* move the rate window forward to current second, clearing the buckets
+   that were skipped. */
+static void
+rate_advance (NMetrics *metrics)
+{
+    gint64 now = g_get_monotonic_time () / G_USEC_PER_SEC;
+    gint64 second;
+
+    if (now - metrics->rate_second >= RATE_WINDOW) {
+        memset (metrics->rate, 0, sizeof (metrics->rate));
+        metrics->rate_second = now;
+        return;
+    }
+
+    for (second = metrics->rate_second + 1; second <= now; second++)
+        metrics->rate[second % RATE_WINDOW] = 0;
+
+    metrics->rate_second = now;
+}
+
+void
+n_metrics_request_new (NMetrics *metrics)
+{
+    g_assert (metrics);
+
+    rate_advance (metrics);
+    metrics->rate[metrics->rate_second % RATE_WINDOW]++;
+    metrics->requests_total++;
+}
+
+void
+n_metrics_add_latency (NMetrics *metrics, NMetricsPhase phase, gint64 usec)
+{
+    NLatencyRing *ring;
+
+    g_assert (metrics);
+    g_assert (phase < N_METRICS_PHASE_LAST);
+
+    ring = &metrics->latency[phase];
+    ring->samples[ring->next] = usec;
+    ring->next = (ring->next + 1) % LATENCY_SAMPLES;
+    if (ring->count < LATENCY_SAMPLES)
+        ring->count++;
+}
+
+static int
+sample_cmp (const void *a, const void *b)
+{
+    gint64 x = *(const gint64*) a;
+    gint64 y = *(const gint64*) b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void
+set_counter (NProplist *target, const char *key, gint64 value)
+{
+    n_proplist_set_uint (target, key, (guint) CLAMP (value, 0, G_MAXUINT));
+}
+
+static void
+collect_latency (NMetrics *metrics, NProplist *target)
+{
+    static const guint percentiles[] = { 50, 90, 99 };
+    gint64  sorted[LATENCY_SAMPLES];
+    gchar  *key;
+    guint   phase;
+    guint   i;
+
+    for (phase = 0; phase < N_METRICS_PHASE_LAST; phase++) {
+        NLatencyRing *ring = &metrics->latency[phase];
+
+        key = g_strdup_printf ("core.latency.%s.samples", phase_names[phase]);
+        n_proplist_set_uint (target, key, ring->count);
+        g_free (key);
+
+        if (ring->count == 0)
+            continue;
+
+        /* sorting is done only when metrics are queried, recording a
+           sample is just a store. */
+        memcpy (sorted, ring->samples, ring->count * sizeof (gint64));
+        qsort (sorted, ring->count, sizeof (gint64), sample_cmp);
+
+        for (i = 0; i < G_N_ELEMENTS (percentiles); i++) {
+            key = g_strdup_printf ("core.latency.%s.p%u_us", phase_names[phase], percentiles[i]);
+            set_counter (target, key, sorted[(ring->count - 1) * percentiles[i] / 100]);
+            g_free (key);
+        }
+    }
+}
+
+static void
+increment_counter (NProplist *target, const char *prefix, const char *name)
+{
+    gchar *key = g_strdup_printf ("%s%s", prefix, name);
+
+    n_proplist_set_uint (target, key, n_proplist_get_uint (target, key) + 1);
+    g_free (key);
+}
+
+static void
+collect_requests (NMetrics *metrics, NProplist *target)
+{
+    NCore *core   = metrics->core;
+    guint  active = 0;
+    guint  timers = 0;
+    guint  rate   = 0;
+    GList *iter;
+    GList *sink_iter;
+    guint  i;
+
+    for (iter = g_list_first (core->requests); iter; iter = g_list_next (iter)) {
+        NRequest *request = iter->data;
+
+        active++;
+
+        if (request->event)
+            increment_counter (target, "core.requests.active.event.", request->event->name);
+
+        for (sink_iter = g_list_first (request->all_sinks); sink_iter; sink_iter = g_list_next (sink_iter)) {
+            NSinkInterface *sink = sink_iter->data;
+            increment_counter (target, "core.requests.active.sink.", sink->name);
+        }
+
+        if (request->play_source_id)
+            timers++;
+        if (request->stop_source_id)
+            timers++;
+        if (request->max_timeout_id)
+            timers++;
+    }
+
+    rate_advance (metrics);
+    for (i = 0; i < RATE_WINDOW; i++)
+        rate += metrics->rate[i];
+
+    n_proplist_set_uint (target, "core.requests.active", active);
+    n_proplist_set_uint (target, "core.requests.total", metrics->requests_total);
+    n_proplist_set_uint (target, "core.requests.last_minute", rate);
+    n_proplist_set_uint (target, "core.timers.requests", timers);
+}
+
+static void
+collect_sinks (NMetrics *metrics, NProplist *target)
+{
+    NCore *core = metrics->core;
+    gchar *key;
+    guint  i;
+
+    for (i = 0; i < core->num_sinks; i++) {
+        key = g_strdup_printf ("core.sink.%s.failures", core->sinks[i]->name);
+        n_proplist_set_uint (target, key, core->sinks[i]->num_failures);
+        g_free (key);
+    }
+}
+
+static void
+collect_memory (NMetrics *metrics, NProplist *target)
+{
+    NCore  *core     = metrics->core;
+    gchar  *contents = NULL;
+    gchar **fields   = NULL;
+
+    n_proplist_set_uint (target, "core.objects.events", n_event_list_size (core->eventlist));
+    n_proplist_set_uint (target, "core.objects.rules", g_slist_length (core->eventlist->rule_list));
+    n_proplist_set_uint (target, "core.objects.requests", g_list_length (core->requests));
+    n_proplist_set_uint (target, "core.objects.dbus_matches", n_dbus_helper_match_count (core->dbus));
+
+    n_proplist_set_uint (target, "core.rules.cache_hits", core->eventlist->cache_hits);
+    n_proplist_set_uint (target, "core.rules.cache_misses", core->eventlist->cache_misses);
+
+    /* statm reports sizes in pages: size resident shared ... */
+    if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+        return;
+
+    fields = g_strsplit (contents, " ", 3);
+    if (fields[0] && fields[1])
+        set_counter (target, "core.memory.rss_kb",
+                     g_ascii_strtoll (fields[1], NULL, 10) * (sysconf (_SC_PAGESIZE) / 1024));
+
+    g_strfreev (fields);
+    g_free (contents);
+}
+
+void
+n_metrics_collect (NMetrics *metrics, NProplist *target)
+{
+    g_assert (metrics);
+    g_assert (target);
+
+    collect_requests (metrics, target);
+    collect_latency (metrics, target);
+    collect_sinks (metrics, target);
+    collect_memory (metrics, target);
+    n_prewarm_collect (metrics->core->prewarm, target);
+}
+
+NProplist*
+n_core_get_metrics (NCore *core)
+{
+    NCoreHookCollectMetricsData data;
+    NProplist *metrics;
+
+    g_assert (core);
+
+    metrics = n_proplist_new ();
+    n_metrics_collect (core->metrics, metrics);
+
+    data.metrics = metrics;
+    n_core_fire_hook (core, N_CORE_HOOK_COLLECT_METRICS, &data);
+
+    N_DEBUG (LOG_CAT "collected %d metrics", n_proplist_size (metrics));
+
+    return metrics;
+}
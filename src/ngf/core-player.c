@@ -36,6 +36,7 @@ static void     n_core_fire_new_request_hook          (NRequest *request);
 static void     n_core_fire_transform_properties_hook (NRequest *request);
 static GList*   n_core_fire_filter_sinks_hook         (NRequest *request, GList *sinks);
 static GList*   n_core_query_capable_sinks            (NRequest *request);
+static GList*   n_core_resolve_sinks                  (NRequest *request);
 static void     n_core_merge_request_properties       (NRequest *request, NEvent *event);
 
 static void     n_core_send_reply               (NRequest *request, NCorePlayerState status);
@@ -238,6 +239,9 @@ n_core_sink_synchronize_done_cb (gpointer userdata)
     g_assert (request->play_source_id != 0);
     request->play_source_id = 0;
 
+    n_metrics_add_latency (core->metrics, N_METRICS_PHASE_PREPARE,
+        g_get_monotonic_time () - request->play_time);
+
     /* setup the maximum timeout callback. */
     n_core_setup_max_timeout (request);
 
@@ -373,10 +377,14 @@ n_core_request_done_cb (gpointer userdata)
     /* ensure that maximum timeout is removed. */
     n_core_clear_max_timeout (request);
 
+    n_metrics_add_latency (core->metrics, N_METRICS_PHASE_TOTAL,
+        g_get_monotonic_time () - request->play_time);
+
     /* all sinks have been either completed or the request failed. we will run
        a stop on each sink and then clear out the request. */
 
     core->requests = g_list_remove (core->requests, request);
+    g_hash_table_remove (core->request_ids, GUINT_TO_POINTER (request->id));
 
     N_DEBUG (LOG_CAT "stopping all sinks for request '%s'", request->name);
     n_core_stop_sinks (request->stop_list, request);
@@ -452,6 +460,64 @@ n_core_pending_done (NRequest *request)
     return request->stop_source_id != 0;
 }
 
+static GList*
+n_core_resolve_sinks (NRequest *request)
+{
+    g_assert (request != NULL);
+    g_assert (request->event != NULL);
+
+    GList *sinks = NULL;
+
+    /* fire the hook before merge */
+
+    n_core_fire_new_request_hook (request);
+
+    /* merge and transform */
+
+    n_core_merge_request_properties (request, request->event);
+
+    /* check if fallbacks need to be used */
+    if (request->is_fallback) {
+        NProplist *new_props = n_proplist_copy (request->properties);
+        n_proplist_foreach (request->properties,
+            n_translate_fallback_cb, new_props);
+        n_proplist_free (request->properties);
+        request->properties  = new_props;
+    }
+
+    n_core_fire_transform_properties_hook (request);
+
+    /* query and filter capable sinks */
+
+    sinks = n_core_query_capable_sinks (request);
+    sinks = n_core_fire_filter_sinks_hook (request, sinks);
+
+    /* sort the sinks based on their priority. priority is set automatically for
+       each sink if "core.sink_order" key is set. */
+
+    return g_list_sort (sinks, n_core_sink_priority_cmp);
+}
+
+GList*
+n_core_resolve_prewarm_request (NCore *core, NRequest *request)
+{
+    g_assert (core != NULL);
+    g_assert (request != NULL);
+
+    /* resolve the request exactly like a played one would be, but stop
+       before any sink is asked to prepare it. */
+
+    request->core = core;
+    if (!request->properties)
+        request->properties = n_proplist_new ();
+
+    request->event = n_core_evaluate_request (core, request);
+    if (!request->event)
+        return NULL;
+
+    return n_core_resolve_sinks (request);
+}
+
 int
 n_core_play_request (NCore *core, NRequest *request)
 {
@@ -466,6 +532,11 @@ n_core_play_request (NCore *core, NRequest *request)
     request->original_properties = n_proplist_copy (request->properties);
     request->timeout_ms = n_proplist_get_uint (request->properties, POLICY_TIMEOUT_KEY);
     request->core = core;
+    request->play_time = g_get_monotonic_time ();
+
+    /* a fallback is a re-dispatch of a request already counted. */
+    if (!request->is_fallback)
+        n_metrics_request_new (core->metrics);
 
     /* evaluate the request and context to resolve the correct event for
        this specific request. if no event, then there is no default event
@@ -482,44 +553,17 @@ n_core_play_request (NCore *core, NRequest *request)
     N_DEBUG (LOG_CAT "request '%s' resolved to event '%s'", request->name,
         request->event->name);
 
-    /* fire the hook before merge */
-
-    n_core_fire_new_request_hook (request);
-
-    /* merge and transform */
-
-    n_core_merge_request_properties (request, request->event);
-
-    /* check if fallbacks need to be used */
-    if (request->is_fallback) {
-        NProplist *new_props = n_proplist_copy (request->properties);
-        n_proplist_foreach (request->properties,
-            n_translate_fallback_cb, new_props);
-        n_proplist_free (request->properties);
-        request->properties  = new_props;
-    }
-
-    n_core_fire_transform_properties_hook (request);
-
-    /* query and filter capable sinks */
-
-    all_sinks = n_core_query_capable_sinks (request);
-    all_sinks = n_core_fire_filter_sinks_hook (request, all_sinks);
-
-    /* if no sinks left, then nothing to do. can be that no sinks support the event
-       or that their state / configuration has specific feedback disabled */
+    /* merge, transform and query the sinks. if no sinks left, then nothing
+       to do. can be that no sinks support the event or that their state /
+       configuration has specific feedback disabled */
 
+    all_sinks = n_core_resolve_sinks (request);
     if (!all_sinks) {
         N_DEBUG (LOG_CAT "no sinks that can and want to handle the request '%s'",
             request->name);
         goto fail_request;
     }
 
-    /* sort the sinks based on their priority. priority is set automatically for
-       each sink if "core.sink_order" key is set. */
-
-    all_sinks = g_list_sort (all_sinks, n_core_sink_priority_cmp);
-
     /* setup the sinks for the play data */
 
     g_assert (request->all_sinks == NULL);
@@ -533,13 +577,22 @@ n_core_play_request (NCore *core, NRequest *request)
        function defined within the sink, then it is synchronized immediately. */
 
     core->requests = g_list_append (core->requests, request);
+    g_hash_table_insert (core->request_ids, GUINT_TO_POINTER (request->id), request);
     n_core_prepare_sinks (all_sinks, request);
 
+    /* sinks have taken what they could use from the prewarmed resources,
+       the rest can be dropped. */
+
+    n_prewarm_request_new (core->prewarm, request);
+
     n_core_send_reply (request, N_CORE_EVENT_PLAYING);
 
     return TRUE;
 
 fail_request:
+    if (request->event)
+        n_prewarm_request_new (core->prewarm, request);
+
     request->has_failed = TRUE;
     n_core_setup_done (request, 0);
 
@@ -780,6 +833,8 @@ n_core_fail_sink (NCore *core, NSinkInterface *sink, NRequest *request)
     N_WARNING (LOG_CAT "sink '%s' failed request '%s'",
         sink->name, request->name);
 
+    sink->num_failures++;
+
     /* Do not set 'has_failed' if already stopping */
     if (n_core_pending_done (request))
         return;
@@ -39,6 +39,8 @@ int  n_core_pause_request    (NCore *core, NRequest *request);
 int  n_core_resume_request   (NCore *core, NRequest *request);
 void n_core_stop_request     (NCore *core, NRequest *request, guint timeout);
 
+GList* n_core_resolve_prewarm_request (NCore *core, NRequest *request);
+
 void n_core_set_resync_on_master (NCore *core, NSinkInterface *sink, NRequest *request);
 void n_core_resynchronize_sinks  (NCore *core, NSinkInterface *sink, NRequest *request);
 void n_core_synchronize_sink     (NCore *core, NSinkInterface *sink, NRequest *request);
@@ -0,0 +1,414 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include <ngf/log.h>
+#include "core-internal.h"
+#include "core-player.h"
+#include "core-prewarm-internal.h"
+
+#define LOG_CAT "core-prewarm: "
+
+#define PREWARM_KEY             "core.prewarm"
+#define PREWARM_TIMEOUT_KEY     "core.prewarm_timeout"
+#define PREWARM_TIMEOUT_DEFAULT (5000)
+
+/* Event may declare the context values that predict it will be requested
+   soon, for example
+
+       core.prewarm         = call_state.mode=ringing
+       core.prewarm_timeout = 5000
+
+   Multiple key=value pairs are separated with ',' and any of them
+   matching triggers the prewarm. When triggered, the event is resolved
+   into a speculative request and the sinks are asked to prepare their
+   resources for it. Resources are dropped when the real request arrives
+   or when the timeout expires without one. */
+
+typedef struct NPrewarmCondition
+{
+    gchar          *key;
+    gchar          *value;
+} NPrewarmCondition;
+
+typedef struct NPrewarmEntry
+{
+    NPrewarm       *prewarm;
+    gchar          *name;           /* request name */
+    GSList         *conditions;     /* NPrewarmCondition* */
+    guint           timeout_ms;
+
+    NRequest       *request;        /* speculative request while active */
+    GList          *sinks;          /* sinks holding prewarmed resources */
+    const gchar    *trigger_key;    /* context key that triggered */
+    guint           timeout_id;
+} NPrewarmEntry;
+
+struct NPrewarm
+{
+    NCore          *core;
+    GHashTable     *entries;        /* request name -> NPrewarmEntry* */
+    gboolean        subscribed;
+
+    guint           triggers;
+    guint           hits;
+    guint           wasted;
+};
+
+static void
+prewarm_condition_free (gpointer data)
+{
+    NPrewarmCondition *condition = data;
+
+    g_free (condition->key);
+    g_free (condition->value);
+    g_free (condition);
+}
+
+static void
+prewarm_stop (NPrewarmEntry *entry)
+{
+    GList *iter;
+
+    if (!entry->request)
+        return;
+
+    N_DEBUG (LOG_CAT "dropping prewarmed resources for '%s'", entry->name);
+
+    if (entry->timeout_id) {
+        g_source_remove (entry->timeout_id);
+        entry->timeout_id = 0;
+    }
+
+    for (iter = g_list_first (entry->sinks); iter; iter = g_list_next (iter)) {
+        NSinkInterface *sink = iter->data;
+
+        if (sink->funcs.drop_prewarm)
+            sink->funcs.drop_prewarm (sink, entry->request);
+    }
+
+    g_list_free (entry->sinks);
+    entry->sinks = NULL;
+    entry->trigger_key = NULL;
+
+    n_request_free (entry->request);
+    entry->request = NULL;
+}
+
+static void
+prewarm_entry_free (gpointer data)
+{
+    NPrewarmEntry *entry = data;
+
+    prewarm_stop (entry);
+    g_slist_free_full (entry->conditions, prewarm_condition_free);
+    g_free (entry->name);
+    g_free (entry);
+}
+
+static gboolean
+prewarm_timeout_cb (gpointer userdata)
+{
+    NPrewarmEntry *entry = userdata;
+
+    N_DEBUG (LOG_CAT "'%s' was not requested within %u ms", entry->name,
+        entry->timeout_ms);
+
+    entry->timeout_id = 0;
+    entry->prewarm->wasted++;
+    prewarm_stop (entry);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+prewarm_start (NPrewarmEntry *entry, const gchar *trigger_key)
+{
+    NPrewarm *prewarm = entry->prewarm;
+    NRequest *request;
+    GList    *sinks;
+    GList    *iter;
+
+    /* prediction repeated while still warm, just keep it warm longer. */
+    if (entry->request) {
+        g_source_remove (entry->timeout_id);
+        entry->timeout_id = g_timeout_add (entry->timeout_ms, prewarm_timeout_cb, entry);
+        return;
+    }
+
+    request = n_request_new_with_event (entry->name);
+    sinks = n_core_resolve_prewarm_request (prewarm->core, request);
+
+    for (iter = g_list_first (sinks); iter; iter = g_list_next (iter)) {
+        NSinkInterface *sink = iter->data;
+
+        if (!sink->funcs.prewarm || !sink->funcs.prewarm (sink, request))
+            continue;
+
+        N_DEBUG (LOG_CAT "sink '%s' prewarmed '%s'", sink->name, entry->name);
+        entry->sinks = g_list_append (entry->sinks, sink);
+    }
+
+    g_list_free (sinks);
+
+    if (!entry->sinks) {
+        N_DEBUG (LOG_CAT "no sink prewarmed '%s'", entry->name);
+        n_request_free (request);
+        return;
+    }
+
+    entry->request = request;
+    entry->trigger_key = trigger_key;
+    entry->timeout_id = g_timeout_add (entry->timeout_ms, prewarm_timeout_cb, entry);
+    prewarm->triggers++;
+}
+
+/* plain value for comparing against the declaration */
+static gchar*
+value_to_plain_string (const NValue *value)
+{
+    if (!value)
+        return NULL;
+
+    switch (n_value_type (value)) {
+        case N_VALUE_TYPE_STRING:
+            return g_strdup (n_value_get_string (value));
+        case N_VALUE_TYPE_INT:
+            return g_strdup_printf ("%d", n_value_get_int (value));
+        case N_VALUE_TYPE_UINT:
+            return g_strdup_printf ("%u", n_value_get_uint (value));
+        case N_VALUE_TYPE_BOOL:
+            return g_strdup (n_value_get_bool (value) ? "true" : "false");
+        default:
+            return NULL;
+    }
+}
+
+static void
+context_value_changed_cb (NContext *context, const char *key,
+                          const NValue *old_value, const NValue *new_value,
+                          void *userdata)
+{
+    NPrewarm       *prewarm = userdata;
+    GHashTableIter  iter;
+    NPrewarmEntry  *entry;
+    gchar          *value;
+    GSList         *c;
+
+    (void) context;
+    (void) old_value;
+
+    value = value_to_plain_string (new_value);
+
+    g_hash_table_iter_init (&iter, prewarm->entries);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &entry)) {
+        NPrewarmCondition *matched = NULL;
+        gboolean           watched = FALSE;
+
+        for (c = entry->conditions; c; c = g_slist_next (c)) {
+            NPrewarmCondition *condition = c->data;
+
+            if (!g_str_equal (condition->key, key))
+                continue;
+
+            watched = TRUE;
+            if (value && g_str_equal (condition->value, value)) {
+                matched = condition;
+                break;
+            }
+        }
+
+        if (matched) {
+            N_DEBUG (LOG_CAT "%s=%s predicts '%s'", key, value, entry->name);
+            prewarm_start (entry, matched->key);
+        }
+        else if (watched && entry->trigger_key && g_str_equal (entry->trigger_key, key)) {
+            /* the prediction went away before the request came. */
+            N_DEBUG (LOG_CAT "%s changed, '%s' no longer predicted", key, entry->name);
+            prewarm->wasted++;
+            prewarm_stop (entry);
+        }
+    }
+
+    g_free (value);
+}
+
+static GSList*
+parse_conditions (const char *declaration)
+{
+    GSList  *conditions = NULL;
+    gchar  **pairs;
+    gchar  **pair;
+
+    pairs = g_strsplit (declaration, ",", -1);
+    for (pair = pairs; *pair; ++pair) {
+        NPrewarmCondition *condition;
+        gchar             *sep;
+
+        g_strstrip (*pair);
+        if (!(sep = strchr (*pair, '=')) || sep == *pair) {
+            N_WARNING (LOG_CAT "invalid prewarm condition '%s'", *pair);
+            continue;
+        }
+
+        *sep = '\0';
+        condition = g_new0 (NPrewarmCondition, 1);
+        condition->key   = g_strdup (g_strstrip (*pair));
+        condition->value = g_strdup (g_strstrip (sep + 1));
+        conditions = g_slist_append (conditions, condition);
+    }
+
+    g_strfreev (pairs);
+
+    return conditions;
+}
+
+NPrewarm*
+n_prewarm_new (NCore *core)
+{
+    NPrewarm *prewarm;
+
+    prewarm = g_new0 (NPrewarm, 1);
+    prewarm->core = core;
+    prewarm->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+        NULL, prewarm_entry_free);
+
+    return prewarm;
+}
+
+void
+n_prewarm_free (NPrewarm *prewarm)
+{
+    if (!prewarm)
+        return;
+
+    n_prewarm_clear (prewarm);
+    g_hash_table_destroy (prewarm->entries);
+    g_free (prewarm);
+}
+
+void
+n_prewarm_clear (NPrewarm *prewarm)
+{
+    g_assert (prewarm);
+
+    if (prewarm->subscribed) {
+        n_context_unsubscribe_value_change (prewarm->core->context, NULL,
+            context_value_changed_cb);
+        prewarm->subscribed = FALSE;
+    }
+
+    g_hash_table_remove_all (prewarm->entries);
+}
+
+void
+n_prewarm_load (NPrewarm *prewarm)
+{
+    NPrewarmEntry *entry;
+    const char    *declaration;
+    GList         *iter;
+    GSList        *conditions;
+    gint           timeout;
+
+    g_assert (prewarm);
+
+    n_prewarm_clear (prewarm);
+
+    for (iter = g_list_first (n_core_get_events (prewarm->core)); iter; iter = g_list_next (iter)) {
+        NEvent *event = iter->data;
+
+        if (!(declaration = n_proplist_get_string (event->properties, PREWARM_KEY)))
+            continue;
+
+        if (!(conditions = parse_conditions (declaration)))
+            continue;
+
+        /* rule variants of an event share the same entry. */
+        if (!(entry = g_hash_table_lookup (prewarm->entries, event->name))) {
+            timeout = n_proplist_get_int (event->properties, PREWARM_TIMEOUT_KEY);
+
+            entry = g_new0 (NPrewarmEntry, 1);
+            entry->prewarm    = prewarm;
+            entry->name       = g_strdup (event->name);
+            entry->timeout_ms = timeout > 0 ? (guint) timeout : PREWARM_TIMEOUT_DEFAULT;
+            g_hash_table_insert (prewarm->entries, entry->name, entry);
+        }
+
+        entry->conditions = g_slist_concat (entry->conditions, conditions);
+        N_DEBUG (LOG_CAT "'%s' is prewarmed on '%s'", event->name, declaration);
+    }
+
+    if (g_hash_table_size (prewarm->entries) > 0) {
+        n_context_subscribe_value_change (prewarm->core->context, NULL,
+            context_value_changed_cb, prewarm);
+        prewarm->subscribed = TRUE;
+    }
+}
+
+void
+n_prewarm_request_new (NPrewarm *prewarm, NRequest *request)
+{
+    NPrewarmEntry *entry;
+
+    g_assert (prewarm);
+    g_assert (request);
+
+    if (!(entry = g_hash_table_lookup (prewarm->entries, request->name)))
+        return;
+
+    if (!entry->request)
+        return;
+
+    N_DEBUG (LOG_CAT "'%s' requested while prewarmed", entry->name);
+
+    prewarm->hits++;
+    prewarm_stop (entry);
+}
+
+void
+n_prewarm_collect (NPrewarm *prewarm, NProplist *target)
+{
+    GHashTableIter  iter;
+    NPrewarmEntry  *entry;
+    guint           active = 0;
+
+    g_assert (prewarm);
+    g_assert (target);
+
+    g_hash_table_iter_init (&iter, prewarm->entries);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &entry)) {
+        if (entry->request)
+            active++;
+    }
+
+    n_proplist_set_uint (target, "core.prewarm.declared", g_hash_table_size (prewarm->entries));
+    n_proplist_set_uint (target, "core.prewarm.active", active);
+    n_proplist_set_uint (target, "core.prewarm.triggers", prewarm->triggers);
+    n_proplist_set_uint (target, "core.prewarm.hits", prewarm->hits);
+    n_proplist_set_uint (target, "core.prewarm.wasted", prewarm->wasted);
+
+    /* hit ratio of the prewarms that have been resolved either way. */
+    if (prewarm->hits + prewarm->wasted > 0)
+        n_proplist_set_uint (target, "core.prewarm.hit_rate_percent",
+            prewarm->hits * 100 / (prewarm->hits + prewarm->wasted));
+}
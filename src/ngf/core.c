@@ -318,11 +318,14 @@ n_core_new (int *argc, char **argv)
     core->plugin_path       = n_core_get_path ("NGF_PLUGIN_PATH", G_STRINGIFY(DEFAULT_PLUGIN_PATH));
     core->context           = n_context_new ();
     core->dbus              = n_dbus_helper_new (core);
+    core->metrics           = n_metrics_new (core);
+    core->prewarm           = n_prewarm_new (core);
     core->haptic            = n_haptic_new (core);
     core->eventlist         = n_event_list_new (core);
 
     core->key_types = g_hash_table_new_full (g_str_hash, g_str_equal,
         g_free, NULL);
+    core->request_ids = g_hash_table_new (g_direct_hash, g_direct_equal);
 
     return core;
 }
@@ -338,10 +341,15 @@ n_core_free (NCore *core)
     g_list_free_full (core->sink_order, g_free);
 
     g_hash_table_destroy (core->key_types);
+    g_hash_table_destroy (core->request_ids);
+    if (core->input_keys)
+        g_hash_table_destroy (core->input_keys);
 
     n_event_list_free (core->eventlist);
     n_haptic_free (core->haptic);
     n_dbus_helper_free (core->dbus);
+    n_prewarm_free (core->prewarm);
+    n_metrics_free (core->metrics);
     n_context_free (core->context);
     g_free (core->plugin_path);
     g_free (core->conf_path);
@@ -499,6 +507,10 @@ n_core_initialize (NCore *core)
         }
     }
 
+    /* watch the context for values that predict events. */
+
+    n_prewarm_load (core->prewarm);
+
     /* fire the init done hook. */
 
     n_core_fire_hook (core, N_CORE_HOOK_INIT_DONE, NULL);
@@ -527,8 +539,10 @@ n_core_reload_events (NCore *core)
     for (iter = g_list_first (n_core_get_requests (core)); iter; iter = g_list_next (iter))
         n_core_stop_request (core, iter->data, 0);
 
+    n_prewarm_clear (core->prewarm);
     n_event_list_free (core->eventlist);
     core->eventlist = new_eventlist;
+    n_prewarm_load (core->prewarm);
     N_INFO (LOG_CAT "reloaded events (%d).", n_event_list_size (core->eventlist));
     return TRUE;
 
@@ -555,6 +569,10 @@ n_core_shutdown (NCore *core)
     NSinkInterface  **sink  = NULL;
     GList            *iter  = NULL;
 
+    /* drop prewarmed resources while the sinks are still around */
+
+    n_prewarm_clear (core->prewarm);
+
     /* shutdown all inputs */
 
     if (core->inputs) {
@@ -885,6 +903,15 @@ n_core_get_requests (NCore *core)
     return core->requests;
 }
 
+NRequest*
+n_core_lookup_request (NCore *core, guint id)
+{
+    if (!core || id == 0)
+        return NULL;
+
+    return g_hash_table_lookup (core->request_ids, GUINT_TO_POINTER (id));
+}
+
 NSinkInterface**
 n_core_get_sinks (NCore *core)
 {
@@ -934,6 +961,30 @@ n_core_disconnect (NCore *core, NCoreHook hook, NHookCallback callback,
     n_hook_disconnect (&core->hooks[hook], callback, userdata);
 }
 
+void
+n_core_add_input_key (NCore *core, const char *key)
+{
+    if (!core || !key)
+        return;
+
+    if (!core->input_keys)
+        core->input_keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    g_hash_table_add (core->input_keys, g_strdup (key));
+}
+
+gboolean
+n_core_accepts_input_key (NCore *core, const char *key)
+{
+    if (!core || !key)
+        return FALSE;
+
+    if (!core->input_keys || g_hash_table_contains (core->input_keys, key))
+        return TRUE;
+
+    return n_event_list_has_request_key (core->eventlist, key);
+}
+
 void
 n_core_fire_hook (NCore *core, NCoreHook hook, void *data)
 {
@@ -33,6 +33,9 @@ typedef struct _NEventList
     GHashTable *event_table;
     GList      *event_list;
     GSList     *rule_list;
+    GHashTable *request_keys;   /* keys used in request rules */
+    guint       cache_hits;     /* context rules resolved from cache */
+    guint       cache_misses;   /* context rules evaluated from context */
 } NEventList;
 
 NEventList* n_event_list_new            (NCore *core);
@@ -42,5 +45,6 @@ GList*      n_event_list_get_events     (NEventList *eventlist);
 guint       n_event_list_size           (const NEventList *eventlist);
 
 NEvent*     n_event_list_match_request  (NEventList *eventlist, NRequest *request);
+gboolean    n_event_list_has_request_key (const NEventList *eventlist, const char *key);
 
 #endif
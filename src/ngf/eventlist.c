@@ -51,9 +51,10 @@ static void         unsubscribe_event_rules_cb  (gpointer data, gpointer userdat
 
 typedef struct _NEventMatchResult
 {
-    NRequest *request;
-    NContext *context;
-    gboolean  has_match;
+    NEventList *eventlist;
+    NRequest   *request;
+    NContext   *context;
+    gboolean    has_match;
 } NEventMatchResult;
 
 NEventList*
@@ -64,6 +65,7 @@ n_event_list_new (NCore *core)
     el              = g_new0 (NEventList, 1);
     el->core        = core;
     el->event_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    el->request_keys = g_hash_table_new (g_str_hash, g_str_equal);
 
     return el;
 }
@@ -282,6 +284,7 @@ n_event_list_parse_keyfile (NEventList *eventlist, GKeyFile *keyfile)
     gchar    **group_list = NULL;
     gchar    **group      = NULL;
     NEvent    *event      = NULL;
+    GSList    *rule       = NULL;
     int        parsed     = 0;
 
     group_list = g_key_file_get_groups (keyfile, NULL);
@@ -304,6 +307,13 @@ n_event_list_parse_keyfile (NEventList *eventlist, GKeyFile *keyfile)
         }
     }
 
+    /* rules are shared and live as long as the event list, so the keys
+       can be borrowed. */
+    for (rule = eventlist->rule_list; rule; rule = g_slist_next (rule)) {
+        if (((NEventRule*) rule->data)->target == N_EVENT_RULE_REQUEST)
+            g_hash_table_add (eventlist->request_keys, ((NEventRule*) rule->data)->key);
+    }
+
     if (defines)
         g_hash_table_destroy (defines);
     g_strfreev      (group_list);
@@ -360,6 +370,7 @@ n_event_list_free (NEventList *eventlist)
     g_slist_foreach (eventlist->rule_list, unsubscribe_event_rules_cb,
                      n_core_get_context (eventlist->core));
 
+    g_hash_table_destroy (eventlist->request_keys);
     g_slist_free_full    (eventlist->rule_list, event_rule_free_cb);
     g_list_free          (eventlist->event_list);
     g_hash_table_foreach (eventlist->event_table, event_list_free_cb, NULL);
@@ -414,6 +425,7 @@ match_event_rule_cb (gpointer data, gpointer userdata)
         return;
 
     if (n_event_rule_cached (rule)) {
+        result->eventlist->cache_hits++;
         if (!n_event_rule_cached_value (rule))
             result->has_match = FALSE;
         N_DEBUG (LOG_CAT "-> (cached) " N_EVENT_RULE_CONTEXT_PREFIX "'%s'-> %s",
@@ -422,6 +434,9 @@ match_event_rule_cb (gpointer data, gpointer userdata)
         return;
     }
 
+    if (rule->target == N_EVENT_RULE_CONTEXT)
+        result->eventlist->cache_misses++;
+
     switch (rule->target) {
         case N_EVENT_RULE_CONTEXT:  match_value = n_context_get_value (result->context, rule->key); break;
         case N_EVENT_RULE_REQUEST:  match_value = n_proplist_get (request->properties, rule->key);  break;
@@ -481,6 +496,7 @@ n_event_list_match_request (NEventList *eventlist, NRequest *request)
             break;
         }
 
+        result.eventlist  = eventlist;
         result.request    = request;
         result.context    = n_core_get_context (eventlist->core);
         result.has_match  = TRUE;
@@ -497,6 +513,14 @@ n_event_list_match_request (NEventList *eventlist, NRequest *request)
     return found;
 }
 
+gboolean
+n_event_list_has_request_key (const NEventList *eventlist, const char *key)
+{
+    g_assert (eventlist);
+
+    return g_hash_table_contains (eventlist->request_keys, key);
+}
+
 static void
 subscribe_event_rules_cb (gpointer data, gpointer userdata)
 {
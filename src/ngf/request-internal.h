@@ -61,6 +61,8 @@ struct _NRequest
 
     guint            max_timeout_id;
     guint            timeout_ms;
+
+    gint64           play_time;             /* monotonic time play was requested */
 };
 
 NRequest* n_request_new          ();
@@ -36,6 +36,7 @@ struct _NSinkInterface
     NCore              *core;
     void               *userdata;
     int                 priority;       /* priority */
+    guint               num_failures;   /* failed requests */
 };
 
 #endif /* N_SINK_INTERFACE_INTERNAL_H */
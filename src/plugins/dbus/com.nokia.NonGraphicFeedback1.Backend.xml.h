@@ -1 +1 @@
-const char *dbus_plugin_introspect_string = "<!DOCTYPE node PUBLIC \"-//freedesktop//DTD D-BUS Object Introspection 1.0//EN\" \"http://www.freedesktop.org/standards/dbus/1.0/introspect.dtd\">\n<node>\n    <interface name=\"com.nokia.NonGraphicFeedback1.Backend\">\n        <method name=\"Play\">\n            <arg name=\"event\" type=\"s\" direction=\"in\"/>\n            <arg name=\"properties\" type=\"a(sv)\"/>\n            <arg name=\"\" type=\"u\" direction=\"out\"/>\n        </method>\n        <method name=\"Pause\">\n            <arg name=\"event_id\" type=\"u\" direction=\"in\"/>\n            <arg name=\"pause\" type=\"b\" direction=\"in\"/>\n            <arg name=\"\" type=\"u\" direction=\"out\"/>\n        </method>\n        <method name=\"Stop\">\n            <arg name=\"event_id\" type=\"u\" direction=\"in\"/>\n            <arg name=\"\" type=\"u\" direction=\"out\"/>\n        </method>\n        <signal name=\"Status\">\n            <arg name=\"\" type=\"u\" direction=\"out\"/>\n            <arg name=\"\" type=\"u\" direction=\"out\"/>\n        </signal>\n    </interface>\n</node>\n\n";
+const char *dbus_plugin_introspect_string = "<!DOCTYPE node PUBLIC \"-//freedesktop//DTD D-BUS Object Introspection 1.0//EN\" \"http://www.freedesktop.org/standards/dbus/1.0/introspect.dtd\">\n<node>\n    <interface name=\"com.nokia.NonGraphicFeedback1.Backend\">\n        <method name=\"Play\">\n            <arg name=\"event\" type=\"s\" direction=\"in\"/>\n            <arg name=\"properties\" type=\"a(sv)\"/>\n            <arg name=\"\" type=\"u\" direction=\"out\"/>\n        </method>\n        <method name=\"Pause\">\n            <arg name=\"event_id\" type=\"u\" direction=\"in\"/>\n            <arg name=\"pause\" type=\"b\" direction=\"in\"/>\n            <arg name=\"\" type=\"u\" direction=\"out\"/>\n        </method>\n        <method name=\"Stop\">\n            <arg name=\"event_id\" type=\"u\" direction=\"in\"/>\n            <arg name=\"\" type=\"u\" direction=\"out\"/>\n        </method>\n        <method name=\"Metrics\">\n            <arg name=\"metrics\" type=\"a{sv}\" direction=\"out\"/>\n        </method>\n        <signal name=\"Status\">\n            <arg name=\"\" type=\"u\" direction=\"out\"/>\n            <arg name=\"\" type=\"u\" direction=\"out\"/>\n        </signal>\n    </interface>\n</node>\n\n";
@@ -50,6 +50,7 @@ N_PLUGIN_DESCRIPTION ("D-Bus interface")
 #define NGF_DBUS_METHOD_STOP  "Stop"
 #define NGF_DBUS_METHOD_PAUSE "Pause"
 #define NGF_DBUS_METHOD_DEBUG "internal_debug"
+#define NGF_DBUS_METHOD_METRICS "Metrics"
 
 #define NGF_DBUS_PROPERTY_NAME "dbus.event.client"
 
@@ -73,8 +74,10 @@ static gboolean          msg_parse_variant       (DBusMessageIter *iter,
                                                   NProplist *proplist,
                                                   const char *key);
 static gboolean          msg_parse_dict          (DBusMessageIter *iter,
+                                                  NCore *core,
                                                   NProplist *proplist);
 static gboolean          msg_get_properties      (DBusMessageIter *iter,
+                                                  NCore *core,
                                                   NProplist **properties);
 static DBusHandlerResult dbusif_message_function (DBusConnection *connection,
                                                   DBusMessage *msg,
@@ -95,14 +98,14 @@ typedef struct _DBusInterfaceData
 {
     DBusConnection  *connection;
     NInputInterface *iface;
-    GSList *clients; // Internal cache of all clients currently connected
-    uint32_t client_count;
+    GHashTable *clients; // All clients currently connected, by unique name
 } DBusInterfaceData;
 
 typedef struct _DBusInterfaceClient
 {
     uint32_t    ref;
     uint32_t    active_requests;
+    GSList     *requests;       // ids of active requests
     char        name[1];
 } DBusInterfaceClient;
 
@@ -153,7 +156,7 @@ msg_parse_variant (DBusMessageIter *iter, NProplist *proplist, const char *key)
 }
 
 static gboolean
-msg_parse_dict (DBusMessageIter *iter, NProplist *proplist)
+msg_parse_dict (DBusMessageIter *iter, NCore *core, NProplist *proplist)
 {
     const char      *key = NULL;
     DBusMessageIter  dict;
@@ -171,6 +174,12 @@ msg_parse_dict (DBusMessageIter *iter, NProplist *proplist)
         return FALSE;
 
     dbus_message_iter_get_basic (&dict, &key);
+
+    /* Skip keys that would be dropped later anyway, without copying
+     * anything out of the message. */
+    if (!n_core_accepts_input_key (core, key))
+        return TRUE;
+
     dbus_message_iter_next (&dict);
 
     /* Parse the variant contents */
@@ -181,7 +190,7 @@ msg_parse_dict (DBusMessageIter *iter, NProplist *proplist)
 }
 
 static gboolean
-msg_get_properties (DBusMessageIter *iter, NProplist **properties)
+msg_get_properties (DBusMessageIter *iter, NCore *core, NProplist **properties)
 {
     NProplist       *p = NULL;
     DBusMessageIter  array;
@@ -193,7 +202,7 @@ msg_get_properties (DBusMessageIter *iter, NProplist **properties)
 
     dbus_message_iter_recurse (iter, &array);
     while (dbus_message_iter_get_arg_type (&array) != DBUS_TYPE_INVALID) {
-        (void) msg_parse_dict (&array, p);
+        (void) msg_parse_dict (&array, core, p);
         dbus_message_iter_next (&array);
     }
 
@@ -241,6 +250,7 @@ client_new (const char *client_name)
     c = g_malloc (sizeof (*c) + strlen (client_name));
     c->ref = 1;
     c->active_requests = 0;
+    c->requests = NULL;
     strcpy(c->name, client_name);
     N_DEBUG (LOG_CAT ">> new client (%s)", c->name);
 
@@ -257,6 +267,7 @@ client_ref (DBusInterfaceClient *client)
 static void
 client_free (DBusInterfaceClient *client)
 {
+    g_slist_free (client->requests);
     g_free (client);
 }
 
@@ -270,52 +281,40 @@ client_unref (DBusInterfaceClient *client)
 }
 
 static inline void
-client_request_new (DBusInterfaceClient *client)
+client_request_new (DBusInterfaceClient *client, uint32_t event_id)
 {
+    client->requests = g_slist_prepend (client->requests, GUINT_TO_POINTER (event_id));
     client->active_requests++;
 }
 
 static inline void
-client_request_done (DBusInterfaceClient *client)
+client_request_done (DBusInterfaceClient *client, uint32_t event_id)
 {
     if (client->active_requests == 0)
         N_ERROR (LOG_CAT "client '%s' active requests 0", client->name);
-    else
+    else {
+        client->requests = g_slist_remove (client->requests, GUINT_TO_POINTER (event_id));
         client->active_requests--;
+    }
 }
 
 static DBusInterfaceClient*
 client_list_find (DBusInterfaceData *idata, const char *client_name)
 {
-    GSList              *search;
-    DBusInterfaceClient *c;
-
-    for (search = idata->clients; search; search = g_slist_next(search)) {
-        c = search->data;
-        if (g_str_equal (client_name, c->name))
-            return c;
-    }
-
-    return NULL;
+    return g_hash_table_lookup (idata->clients, client_name);
 }
 
 static void
 client_list_remove (DBusInterfaceData *idata, DBusInterfaceClient *client)
 {
-    GSList *search;
-
-    if ((search = g_slist_find (idata->clients, client))) {
-        idata->clients = g_slist_delete_link (idata->clients, search);
-        idata->client_count--;
-    } else
+    if (!g_hash_table_remove (idata->clients, client->name))
         N_ERROR (LOG_CAT "cannot find client %s from client list.", client->name);
 }
 
 static void
 client_list_add (DBusInterfaceData *idata, DBusInterfaceClient *client)
 {
-    idata->clients = g_slist_append (idata->clients, client);
-    idata->client_count++;
+    g_hash_table_insert (idata->clients, client->name, client);
 }
 
 static DBusHandlerResult
@@ -338,7 +337,7 @@ dbusif_play_handler (DBusConnection *connection, DBusMessage *msg,
         goto fail;
 
     if (!(client = client_list_find(idata, sender))) {
-        if (idata->client_count >= dbusif_max_clients) {
+        if (g_hash_table_size (idata->clients) >= dbusif_max_clients) {
             error = "Too many simultaneous clients.";
             goto limits;
         }
@@ -356,16 +355,17 @@ dbusif_play_handler (DBusConnection *connection, DBusMessage *msg,
     dbus_message_iter_get_basic (&iter, &event);
     dbus_message_iter_next (&iter);
 
-    if (!msg_get_properties (&iter, &properties))
+    if (!msg_get_properties (&iter, n_input_interface_get_core (iface), &properties))
         goto fail;
 
     client_ref (client);
-    client_request_new (client);
 
     n_proplist_set_pointer (properties, NGF_DBUS_PROPERTY_NAME, client);
     request = n_request_new_with_event_and_properties (event, properties);
     n_proplist_free (properties);
 
+    client_request_new (client, n_request_get_id (request));
+
     N_INFO (LOG_CAT ">> play received for event '%s' with id '%u' (client %s : %u active request(s))",
                     event, n_request_get_id (request), client->name, client->active_requests);
 
@@ -390,25 +390,7 @@ dbusif_lookup_request (NInputInterface *iface, uint32_t event_id)
 {
     g_assert (iface != NULL);
 
-    NCore     *core            = NULL;
-    NRequest  *request         = NULL;
-    GList     *active_requests = NULL;
-    GList     *iter            = NULL;
-
-    if (event_id == 0)
-        return NULL;
-
-    core = n_input_interface_get_core (iface);
-    active_requests = n_core_get_requests (core);
-
-    for (iter = g_list_first (active_requests); iter; iter = g_list_next (iter)) {
-        request = (NRequest*) iter->data;
-
-        if (n_request_get_id (request) == event_id)
-            return request;
-    }
-
-    return NULL;
+    return n_core_lookup_request (n_input_interface_get_core (iface), event_id);
 }
 
 static void
@@ -436,27 +418,23 @@ dbusif_stop_by_client (DBusInterfaceData *idata, DBusInterfaceClient *by_client)
     g_assert (idata != NULL);
     g_assert (by_client);
 
-    NCore               *core               = NULL;
     NRequest            *request            = NULL;
-    GList               *active_requests    = NULL;
-    GList               *iter               = NULL;
-    NProplist           *properties         = NULL;
-    DBusInterfaceClient *client             = NULL;
-
-    core = n_input_interface_get_core (idata->iface);
-    active_requests = n_core_get_requests (core);
+    GSList              *requests           = NULL;
+    GSList              *iter               = NULL;
 
-    for (iter = g_list_first (active_requests); iter; iter = g_list_next (iter)) {
-        request = (NRequest*) iter->data;
+    if (!by_client->requests)
+        return;
 
-        properties = (NProplist*) n_request_get_properties (request);
-        if (!properties)
-            continue;
+    // Stopping may complete requests and modify the client's list
+    requests = g_slist_copy (by_client->requests);
 
-        client = n_proplist_get_pointer (properties, NGF_DBUS_PROPERTY_NAME);
-        if (client == by_client)
+    for (iter = requests; iter; iter = g_slist_next (iter)) {
+        request = dbusif_lookup_request (idata->iface, GPOINTER_TO_UINT (iter->data));
+        if (request)
             n_input_interface_stop_request (idata->iface, request, 0);
     }
+
+    g_slist_free (requests);
 }
 
 static DBusHandlerResult
@@ -513,23 +491,134 @@ args:
 }
 
 
+static void
+dbusif_collect_metrics_cb (NHook *hook, void *data, void *userdata)
+{
+    NCoreHookCollectMetricsData *collect        = data;
+    DBusInterfaceData           *idata          = userdata;
+    GHashTableIter               search;
+    DBusInterfaceClient         *client         = NULL;
+    guint                        total_requests = 0;
+
+    (void) hook;
+
+    g_hash_table_iter_init (&search, idata->clients);
+    while (g_hash_table_iter_next (&search, NULL, (gpointer *) &client))
+        total_requests += client->active_requests;
+
+    n_proplist_set_uint (collect->metrics, "dbus.clients", g_hash_table_size (idata->clients));
+    n_proplist_set_uint (collect->metrics, "dbus.requests.active", total_requests);
+}
+
+static void
+dbusif_append_metric_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    DBusMessageIter *dict = userdata;
+    DBusMessageIter  entry;
+    DBusMessageIter  variant;
+    const char      *s;
+    dbus_int32_t     i;
+    dbus_uint32_t    u;
+    dbus_bool_t      b;
+
+    /* pointer values are meaningless outside of the daemon. */
+    if (n_value_type (value) == N_VALUE_TYPE_POINTER)
+        return;
+
+    dbus_message_iter_open_container (dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &key);
+
+    switch (n_value_type (value)) {
+        case N_VALUE_TYPE_STRING:
+            s = n_value_get_string (value);
+            dbus_message_iter_open_container (&entry, DBUS_TYPE_VARIANT, DBUS_TYPE_STRING_AS_STRING, &variant);
+            dbus_message_iter_append_basic (&variant, DBUS_TYPE_STRING, &s);
+            break;
+        case N_VALUE_TYPE_INT:
+            i = n_value_get_int (value);
+            dbus_message_iter_open_container (&entry, DBUS_TYPE_VARIANT, DBUS_TYPE_INT32_AS_STRING, &variant);
+            dbus_message_iter_append_basic (&variant, DBUS_TYPE_INT32, &i);
+            break;
+        case N_VALUE_TYPE_BOOL:
+            b = n_value_get_bool (value);
+            dbus_message_iter_open_container (&entry, DBUS_TYPE_VARIANT, DBUS_TYPE_BOOLEAN_AS_STRING, &variant);
+            dbus_message_iter_append_basic (&variant, DBUS_TYPE_BOOLEAN, &b);
+            break;
+        default:
+            u = n_value_get_uint (value);
+            dbus_message_iter_open_container (&entry, DBUS_TYPE_VARIANT, DBUS_TYPE_UINT32_AS_STRING, &variant);
+            dbus_message_iter_append_basic (&variant, DBUS_TYPE_UINT32, &u);
+            break;
+    }
+
+    dbus_message_iter_close_container (&entry, &variant);
+    dbus_message_iter_close_container (dict, &entry);
+}
+
+static void
+dbusif_dump_metric_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    gchar *value_str;
+
+    (void) userdata;
+
+    value_str = n_value_to_string (value);
+    N_INFO (LOG_CAT "%s = %s", key, value_str);
+    g_free (value_str);
+}
+
+static DBusHandlerResult
+dbusif_metrics_handler (DBusConnection *connection, DBusMessage *msg,
+                        NInputInterface *iface)
+{
+    DBusMessage     *reply   = NULL;
+    NProplist       *metrics = NULL;
+    DBusMessageIter  iter;
+    DBusMessageIter  dict;
+
+    if (dbus_message_get_no_reply (msg))
+        return DBUS_HANDLER_RESULT_HANDLED;
+
+    if (!(reply = dbus_message_new_method_return (msg)))
+        return DBUS_HANDLER_RESULT_HANDLED;
+
+    metrics = n_core_get_metrics (n_input_interface_get_core (iface));
+
+    dbus_message_iter_init_append (reply, &iter);
+    dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+        DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+        DBUS_TYPE_STRING_AS_STRING
+        DBUS_TYPE_VARIANT_AS_STRING
+        DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+        &dict);
+    n_proplist_foreach (metrics, dbusif_append_metric_cb, &dict);
+    dbus_message_iter_close_container (&iter, &dict);
+
+    dbus_connection_send (connection, reply, NULL);
+    dbus_message_unref (reply);
+    n_proplist_free (metrics);
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 static DBusHandlerResult
 dbusif_debug_handler (DBusConnection *connection, DBusMessage *msg,
                       NInputInterface *iface)
 {
     DBusMessage         *reply          = NULL;
     DBusInterfaceData   *idata          = NULL;
-    GSList              *search         = NULL;
+    GHashTableIter       search;
     DBusInterfaceClient *client         = NULL;
     uint32_t             total_clients  = 0;
     uint32_t             total_requests = 0;
+    NProplist           *metrics        = NULL;
 
     idata = n_input_interface_get_userdata (iface);
 
     N_INFO (LOG_CAT "==== DUMP STATS ====");
 
-    for (search = idata->clients; search; search = g_slist_next(search)) {
-        client = (DBusInterfaceClient *) search->data;
+    g_hash_table_iter_init (&search, idata->clients);
+    while (g_hash_table_iter_next (&search, NULL, (gpointer *) &client)) {
         N_INFO (LOG_CAT "client %s  ref %d, active_requests %u/%u",
                         client->name, client->ref,
                         client->active_requests, dbusif_max_requests);
@@ -540,6 +629,11 @@ dbusif_debug_handler (DBusConnection *connection, DBusMessage *msg,
     N_INFO (LOG_CAT "total clients %u/%u, per-client max requests %u , active requests %u",
                     total_clients, dbusif_max_clients,
                     dbusif_max_requests, total_requests);
+
+    metrics = n_core_get_metrics (n_input_interface_get_core (iface));
+    n_proplist_foreach (metrics, dbusif_dump_metric_cb, NULL);
+    n_proplist_free (metrics);
+
     N_INFO (LOG_CAT "====================");
 
     if (!dbus_message_get_no_reply (msg)) {
@@ -704,6 +798,9 @@ dbusif_message_function (DBusConnection *connection, DBusMessage *msg,
     else if (g_str_equal (member, NGF_DBUS_METHOD_PAUSE))
         return dbusif_pause_handler (connection, msg, iface);
 
+    else if (g_str_equal (member, NGF_DBUS_METHOD_METRICS))
+        return dbusif_metrics_handler (connection, msg, iface);
+
     else if (g_str_equal (member, NGF_DBUS_METHOD_DEBUG))
         return dbusif_debug_handler (connection, msg, iface);
 
@@ -723,6 +820,7 @@ dbusif_initialize (NInputInterface *iface)
 
     idata = g_new0 (DBusInterfaceData, 1);
     idata->iface = iface;
+    idata->clients = g_hash_table_new (g_str_hash, g_str_equal);
     n_input_interface_set_userdata (iface, idata);
 
     dbus_error_init (&error);
@@ -751,9 +849,13 @@ dbusif_initialize (NInputInterface *iface)
     dbus_bus_add_match (idata->connection, DBUS_CLIENT_MATCH, NULL);
     dbus_connection_add_filter (idata->connection, dbusif_message_function, iface, NULL);
 
+    (void) n_core_connect (n_input_interface_get_core (iface),
+        N_CORE_HOOK_COLLECT_METRICS, 0, dbusif_collect_metrics_cb, idata);
+
     return TRUE;
 
 error:
+    g_hash_table_destroy (idata->clients);
     g_free (idata);
     if (dbus_error_is_set (&error))
         dbus_error_free (&error);
@@ -767,9 +869,16 @@ dbusif_shutdown (NInputInterface *iface)
 
     idata = n_input_interface_get_userdata (iface);
 
+    if (idata)
+        n_core_disconnect (n_input_interface_get_core (iface),
+            N_CORE_HOOK_COLLECT_METRICS, dbusif_collect_metrics_cb, idata);
+
     if (idata && idata->connection)
         dbus_connection_unref (idata->connection);
 
+    if (idata)
+        g_hash_table_destroy (idata->clients);
+
     g_free (idata);
 }
 
@@ -823,7 +932,7 @@ dbusif_send_reply (NInputInterface *iface, NRequest *request, int code)
 end:
     if (code == N_DBUS_EVENT_FAILED || code == N_DBUS_EVENT_COMPLETED) {
         client = n_proplist_get_pointer (props, NGF_DBUS_PROPERTY_NAME);
-        client_request_done (client);
+        client_request_done (client, event_id);
         client_unref (client);
     }
 }
@@ -0,0 +1,251 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <gst/controller/gsttimedvaluecontrolsource.h>
+
+#include "fade.h"
+
+typedef struct _FadePoint
+{
+    gdouble time;               /* played time in seconds */
+    gdouble value;
+} FadePoint;
+
+struct _FadeTimeline
+{
+    GArray *points;             /* FadePoint sorted by time */
+};
+
+struct _FadeWait
+{
+    gint ref;                   /* owner, clock callback and idle each hold one */
+    gboolean done;              /* fired or cancelled, touched in main loop only */
+    GstClockID id;
+    FadeWaitFunc func;
+    gpointer userdata;
+};
+
+FadeTimeline*
+fade_timeline_new ()
+{
+    FadeTimeline *timeline;
+
+    timeline = g_slice_new0 (FadeTimeline);
+    timeline->points = g_array_new (FALSE, FALSE, sizeof (FadePoint));
+
+    return timeline;
+}
+
+void
+fade_timeline_free (FadeTimeline *timeline)
+{
+    if (!timeline)
+        return;
+
+    g_array_free (timeline->points, TRUE);
+    g_slice_free (FadeTimeline, timeline);
+}
+
+void
+fade_timeline_clear (FadeTimeline *timeline)
+{
+    g_array_set_size (timeline->points, 0);
+}
+
+gboolean
+fade_timeline_is_empty (FadeTimeline *timeline)
+{
+    return !timeline || timeline->points->len == 0;
+}
+
+/* points with the same time keep the order they were added in, so a
+   ramp starting where another ends continues from the end value. */
+static void
+timeline_insert (FadeTimeline *timeline, gdouble time, gdouble value)
+{
+    FadePoint point = { time, value };
+    guint i = timeline->points->len;
+
+    while (i > 0 && g_array_index (timeline->points, FadePoint, i - 1).time > time)
+        i--;
+
+    g_array_insert_val (timeline->points, i, point);
+}
+
+void
+fade_timeline_add (FadeTimeline *timeline, gdouble position, gdouble length,
+                   gdouble start, gdouble end)
+{
+    timeline_insert (timeline, position, start);
+    timeline_insert (timeline, position + MAX (length, 0.0), end);
+}
+
+gdouble
+fade_timeline_value (FadeTimeline *timeline, gdouble time)
+{
+    FadePoint *a, *b;
+    guint i;
+
+    g_assert (!fade_timeline_is_empty (timeline));
+
+    for (i = timeline->points->len; i > 0; i--) {
+        a = &g_array_index (timeline->points, FadePoint, i - 1);
+        if (a->time > time)
+            continue;
+
+        if (i == timeline->points->len)
+            return a->value;
+
+        b = &g_array_index (timeline->points, FadePoint, i);
+        return a->value + (b->value - a->value) * (time - a->time) / (b->time - a->time);
+    }
+
+    return g_array_index (timeline->points, FadePoint, 0).value;
+}
+
+void
+fade_timeline_apply (FadeTimeline *timeline, GstTimedValueControlSource *source,
+                     gdouble elapsed)
+{
+    FadePoint *point;
+    guint i;
+
+    gst_timed_value_control_source_unset_all (source);
+
+    if (fade_timeline_is_empty (timeline))
+        return;
+
+    /* the ramp in progress continues from its current value */
+    gst_timed_value_control_source_set (source, 0,
+        fade_timeline_value (timeline, elapsed));
+
+    for (i = 0; i < timeline->points->len; i++) {
+        point = &g_array_index (timeline->points, FadePoint, i);
+        if (point->time <= elapsed)
+            continue;
+
+        gst_timed_value_control_source_set (source,
+            (GstClockTime) ((point->time - elapsed) * GST_SECOND), point->value);
+    }
+}
+
+static FadeWait*
+fade_wait_ref (FadeWait *wait)
+{
+    g_atomic_int_inc (&wait->ref);
+    return wait;
+}
+
+static void
+fade_wait_unref (gpointer data)
+{
+    FadeWait *wait = data;
+
+    if (g_atomic_int_dec_and_test (&wait->ref))
+        g_slice_free (FadeWait, wait);
+}
+
+static void
+fade_wait_release_id (FadeWait *wait)
+{
+    /* clock entry keeps its own reference until it is done */
+    if (wait->id) {
+        gst_clock_id_unschedule (wait->id);
+        gst_clock_id_unref (wait->id);
+        wait->id = NULL;
+    }
+}
+
+static gboolean
+fade_wait_done_cb (gpointer userdata)
+{
+    FadeWait *wait = userdata;
+
+    if (wait->done)
+        return G_SOURCE_REMOVE;
+
+    wait->done = TRUE;
+    fade_wait_release_id (wait);
+    wait->func (wait->userdata);
+    fade_wait_unref (wait);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* called from the clock thread */
+static gboolean
+fade_wait_clock_cb (GstClock *clock, GstClockTime time, GstClockID id,
+                    gpointer userdata)
+{
+    (void) clock;
+    (void) time;
+    (void) id;
+
+    g_idle_add_full (G_PRIORITY_DEFAULT, fade_wait_done_cb,
+                     fade_wait_ref (userdata), fade_wait_unref);
+
+    return TRUE;
+}
+
+FadeWait*
+fade_wait_new (GstElement *element, gdouble length, FadeWaitFunc func,
+               gpointer userdata)
+{
+    FadeWait *wait;
+    GstClock *clock;
+    GstClockTime target;
+
+    wait = g_slice_new0 (FadeWait);
+    wait->ref = 1;
+    wait->func = func;
+    wait->userdata = userdata;
+
+    if ((clock = gst_element_get_clock (element))) {
+        target = gst_clock_get_time (clock) + (GstClockTime) (MAX (length, 0.0) * GST_SECOND);
+        wait->id = gst_clock_new_single_shot_id (clock, target);
+        gst_object_unref (clock);
+
+        if (gst_clock_id_wait_async (wait->id, fade_wait_clock_cb,
+                                     fade_wait_ref (wait), fade_wait_unref) == GST_CLOCK_OK)
+            return wait;
+
+        /* reference given to the failed wait is left to the clock entry */
+        fade_wait_release_id (wait);
+    }
+
+    g_idle_add_full (G_PRIORITY_DEFAULT, fade_wait_done_cb,
+                     fade_wait_ref (wait), fade_wait_unref);
+
+    return wait;
+}
+
+void
+fade_wait_cancel (FadeWait *wait)
+{
+    if (!wait || wait->done)
+        return;
+
+    wait->done = TRUE;
+    fade_wait_release_id (wait);
+    fade_wait_unref (wait);
+}
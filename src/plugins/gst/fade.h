@@ -0,0 +1,70 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_GST_FADE_H
+#define N_GST_FADE_H
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <gst/controller/gsttimedvaluecontrolsource.h>
+
+/* Volume fades of a stream are kept as one timeline of linear ramps in
+   played time, that is the running time of the stream summed over all
+   loop rounds. Stream time restarts from zero on every round, so the
+   part of the timeline still ahead is projected into the control source
+   when a round starts. Volume element interpolates the values for
+   every sample, and nothing needs to be queried from the pipeline. */
+
+typedef struct _FadeTimeline FadeTimeline;
+
+FadeTimeline*   fade_timeline_new       ();
+void            fade_timeline_free      (FadeTimeline *timeline);
+void            fade_timeline_clear     (FadeTimeline *timeline);
+gboolean        fade_timeline_is_empty  (FadeTimeline *timeline);
+
+/* Ramp from start to end volume, position and length in seconds of
+   played time. */
+void            fade_timeline_add       (FadeTimeline *timeline, gdouble position,
+                                         gdouble length, gdouble start, gdouble end);
+
+/* Volume at the given played time, the first and last values are held
+   before and after the ramps. */
+gdouble         fade_timeline_value     (FadeTimeline *timeline, gdouble time);
+
+/* Replace the control points of the source with the timeline relative
+   to a round that started at elapsed seconds of played time. */
+void            fade_timeline_apply     (FadeTimeline *timeline,
+                                         GstTimedValueControlSource *source,
+                                         gdouble elapsed);
+
+/* Completion of a fade is waited on the pipeline clock. Function is
+   called once from the main loop when the clock has passed length
+   seconds from now, or right away if the element has no clock yet.
+   Wait can not be used after the function is called. */
+
+typedef struct _FadeWait FadeWait;
+typedef void (*FadeWaitFunc) (gpointer userdata);
+
+FadeWait*       fade_wait_new           (GstElement *element, gdouble length,
+                                         FadeWaitFunc func, gpointer userdata);
+void            fade_wait_cancel        (FadeWait *wait);
+
+#endif /* N_GST_FADE_H */
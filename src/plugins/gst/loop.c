@@ -0,0 +1,45 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <glib.h>
+#include <gst/gst.h>
+
+#include "loop.h"
+
+gboolean
+loop_start (GstElement *pipeline)
+{
+    return gst_element_seek (pipeline, 1.0, GST_FORMAT_TIME,
+                             GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_SEGMENT,
+                             GST_SEEK_TYPE_SET, 0,
+                             GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+}
+
+gboolean
+loop_continue (GstElement *pipeline)
+{
+    /* without flush the new segment is accumulated to the running time
+       of the previous one and data already queued is played out. */
+    return gst_element_seek (pipeline, 1.0, GST_FORMAT_TIME,
+                             GST_SEEK_FLAG_SEGMENT,
+                             GST_SEEK_TYPE_SET, 0,
+                             GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+}
@@ -0,0 +1,40 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_GST_LOOP_H
+#define N_GST_LOOP_H
+
+#include <glib.h>
+#include <gst/gst.h>
+
+/* Repeating sounds are played with segment seeks. Pipeline posts
+   SEGMENT_DONE instead of EOS when the sound ends, and the next round
+   is queued right behind the previous one without flushing, so the
+   loop boundary is sample-accurate. */
+
+/* Flushing seek to the beginning with segment done requested, do this
+   once the pipeline is prerolled. */
+gboolean loop_start     (GstElement *pipeline);
+
+/* Queue the next round, call when SEGMENT_DONE is received. */
+gboolean loop_continue  (GstElement *pipeline);
+
+#endif /* N_GST_LOOP_H */
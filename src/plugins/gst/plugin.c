@@ -20,6 +20,7 @@
  */
 
 #include <ngf/plugin.h>
+#include <ngf/event.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -27,67 +28,165 @@
 #include <gst/gst.h>
 #include <gst/controller/gstinterpolationcontrolsource.h>
 #include <gst/controller/gstdirectcontrolbinding.h>
+#include <gst/app/gstappsrc.h>
 #include <gio/gio.h>
 
+#include "sample-cache.h"
+#include "loop.h"
+#include "worker.h"
+#include "sound-info.h"
+#include "fade.h"
+#include "stream-spec.h"
+
 #define GST_KEY               "plugin.gst.data"
+#define GST_PREWARM_KEY       "plugin.gst.prewarm"
 #define LOG_CAT               "gst: "
 #define MAX_TIMEOUT_KEY       "core.max_timeout"
 #define STREAM_PREFIX_KEY     "sound.stream."
 #define SOUND_FILENAME_KEY    "sound.filename"
 #define SOUND_REPEAT_KEY      "sound.repeat"
-#define SOUND_VOLUME_KEY      "sound.volume"
 #define SOUND_ENABLED_KEY     "sound.enabled"
 #define SOUND_OFF             "Off"
-#define FADE_ONLY_CUSTOM_KEY  "sound.fade-only-custom"
-#define FADE_OUT_KEY          "sound.fade-out"
-#define FADE_IN_KEY           "sound.fade-in"
 #define SOUND_DELAY_STARTUP   "sound.delay-startup"
 #define SOUND_DELAY_STOP      "sound.delay-stop"
 #define SOUND_FADE_PAUSE      "sound.fade-pause"
 #define SOUND_FADE_RESUME     "sound.fade-resume"
 #define SOUND_FADE_STOP       "sound.fade-stop"
-#define SYSTEM_SOUND_PATH     "/usr/share/sounds/"
 #define NO_SOUND_DELAY_MS     (20)
+#define POOL_SIZE_KEY         "pipeline_pool_size"
+#define PREROLL_SOUNDS_KEY    "preroll_sounds"
+#define DEFAULT_POOL_SIZE     (2)
+#define CACHE_SIZE_KEY        "pcm_cache_size"
+#define CACHE_MAX_FILE_KEY    "pcm_cache_max_file_size"
+#define PRELOAD_KEY           "sound.preload"
+#define SOUND_INFO_KEY        "sound_info_cache"
+#define TIMEOUT_SLACK_KEY     "sound_timeout_slack"
+#define DEFAULT_TIMEOUT_SLACK (2000)
+#define DEFAULT_CACHE_SIZE    (2 * 1024 * 1024)
+#define DEFAULT_CACHE_MAX_FILE (128 * 1024)
+#define MIXER_KEY             "shared_mixer"
+#define MIXER_LATENCY         (50 * GST_MSECOND)
+#define SINK_ELEMENT_KEY      "sink_element"
+#define SINK_LOCATION_KEY     "sink_location"
+#define DEFAULT_SINK_ELEMENT  "pulsesink"
+#define DEFAULT_SINK_LOCATION "ngfd-gst-%u.wav"
 
 typedef struct _StreamData StreamData;
 typedef void (*stream_fade_completed_cb) (StreamData *stream);
 
-typedef struct _FadeEffect
+typedef struct _Mixer
+{
+    GstElement *pipeline;
+    GstElement *mixer;
+    GstStructure *properties;   /* stream properties of the shared sink */
+    GList *streams;             /* StreamData* with a branch in the mixer */
+    guint jobs;                 /* branch jobs not yet done */
+    guint bus_watch_id;
+    gboolean failed;
+} Mixer;
+
+typedef struct _Prewarm Prewarm;
+
+typedef struct _Pipeline
+{
+    GstElement *pipeline;
+    GstElement *source;
+    GstElement *volume;
+    GstElement *sink;
+    gchar *location;            /* file set to the source */
+    GstStructure *properties;   /* stream properties set to the sink */
+    gboolean raw;               /* appsrc playing from the sample cache */
+    GstBuffer *pcm;             /* cached samples for appsrc */
+    gint rate;
+    gint bpf;                   /* bytes per frame */
+    gsize offset;               /* next byte to push, set from streaming thread */
+    gboolean loop;              /* repeat cached samples instead of eos */
+    GstClockTime loop_base;     /* timestamp of the current round */
+    Mixer *mixer;               /* set when pipeline is a branch of a mixer */
+    GstPad *mixer_pad;
+    gulong block_probe;         /* holds branch data while not playing */
+    GstClockTime start_time;    /* mixer running time of branch start */
+    GstClockTime paused_at;
+    Prewarm *prewarm;           /* set while prewarmed and not yet used */
+} Pipeline;
+
+/* Pipeline set up for a stream in the worker thread. */
+typedef struct _PrepareJob
+{
+    StreamData *stream;         /* NULL if stopped before the job was done */
+    Pipeline *pipe;             /* taken from the pool, or built by the job */
+    gboolean prerolled;
+    gboolean raw;
+    GstBuffer *pcm;
+    GstCaps *caps;
+    gint64 cache_mtime;         /* file time the cached samples are from */
+    gchar *location;
+    StreamSpec *spec;
+    gboolean loop;
+    Prewarm *prewarm;           /* prewarm job, NULL if dropped before done */
+    gboolean paused;            /* results */
+    gboolean prerolling;
+    gboolean failed;
+    SoundFileStat st;           /* stat of the file, unless prerolled */
+    Pipeline *unused;           /* idle pipeline the job did not use after all */
+    Mixer *mixer;               /* set when the job builds a mixer branch */
+} PrepareJob;
+
+/* Stat of a sound file taken in the worker, for the caches that live
+   on the main loop. */
+typedef struct _FileCheck
+{
+    gchar *location;
+    gboolean preload;           /* decode the file to the sample cache */
+    SoundFileStat st;
+} FileCheck;
+
+/* Time to first sample of a stream, shared with the probe on the
+   streaming thread. Whoever flips done removes the probe. */
+typedef struct _FirstSample
+{
+    gint ref;
+    gint done;
+    gint64 prepare_time;
+    guint cached;
+    GstPad *pad;
+    gulong probe;
+} FirstSample;
+
+/* Pipeline prerolled for a request the core predicts is coming. */
+struct _Prewarm
 {
-    gboolean enabled;   /* effect enabled */
-    gdouble elapsed;    /* effect update time */
-    gdouble position;   /* begin position (in s) */
-    gdouble length;     /* length of the fade (in s) */
-    gdouble start;      /* starting volume */
-    gdouble end;        /* ending volume */
-} FadeEffect;
+    PrepareJob *job;            /* set until the job is done */
+    Pipeline *pipe;             /* prerolled pipeline, NULL once used */
+};
 
 struct _StreamData
 {
     NRequest *request;
     NSinkInterface *iface;
+    Pipeline *pooled;
+    PrepareJob *job;
+    gboolean pipeline_failed;
+    gboolean prerolling;
+    gint64 prepare_time;
+    gboolean duration_timeout;  /* request timeout is from the sound duration */
+    FirstSample *first_sample;
     GstElement *pipeline;
     GstState pipeline_state;
     GstElement *volume;
-    gboolean volume_limit;
     guint volume_cap;
-    gboolean volume_fixed;
-    guint volume_min;
-    guint volume_max;
-    guint volume_set;
-    GstStructure *properties;
+    StreamSpec *spec;           /* shared stream properties, volume and fades */
     const gchar *filename;
     gboolean repeat_enabled;
+    gboolean segment_loop;
     GstControlSource *source;
-    gdouble last_volume;
-    gdouble time_spent;
+    FadeTimeline *fades;        /* volume ramps in played time */
+    gdouble time_spent;         /* played time before the current round */
+    GstClockTime round_start;   /* running time the current round started at */
     guint state;
     guint bus_watch_id;
     gboolean sound_enabled;
 
-    FadeEffect *fade_out;
-    FadeEffect *fade_in;
-
     guint delay_startup;
     guint delay_stop;
     guint fade_pause;
@@ -99,8 +198,7 @@ struct _StreamData
     guint fake_play_source;
     guint delay_stop_source;
 
-    FadeEffect *fade;
-    guint fade_source;
+    FadeWait *fade_wait;
     stream_fade_completed_cb fade_completed_cb;
 };
 
@@ -112,35 +210,35 @@ struct _StreamData
 #define GST_VOLUME_SILENT           (0.0)
 #define GST_VOLUME_0DB              (0.1)
 
+/* pause and stop take effect once the sink has rendered the end of the fade */
+#define FADE_COMPLETE_SLACK         (0.1)
+
 N_PLUGIN_NAME        ("gst")
 N_PLUGIN_VERSION     ("0.1")
 N_PLUGIN_DESCRIPTION ("GStreamer plugin")
 
-static gboolean is_custom_sound_filename (const char *filename);
-static gchar* strip_prefix (const gchar *str, const gchar *prefix);
-static gboolean parse_volume_limit (const char *str, guint *min, guint *max);
-static gboolean parse_fixed_volume (const char *str, guint *volume);
 static gdouble get_current_volume (StreamData *stream);
-static gboolean get_current_position (StreamData *stream, gdouble *out_position);
+static gdouble get_current_position (StreamData *stream);
+static gboolean mixer_branch_position (Pipeline *pipe, gdouble *out_position);
 static void set_stream_properties (GstElement *sink, const GstStructure *properties);
-static int set_structure_string (GstStructure *s, const char *key, const char *value);
-static void proplist_to_structure_cb (const char *key, const NValue *value, gpointer userdata);
-static GstStructure* create_stream_properties (NProplist *props);
+static StreamSpec* get_stream_spec (NRequest *request, NProplist *props);
 static void rewind_stream (StreamData *stream);
 static gboolean bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata);
 static void new_decoded_pad_cb (GstElement *element, GstPad *pad, gpointer userdata);
+static Pipeline* pipeline_new (gboolean branch);
+static Pipeline* pipeline_raw_new (gboolean branch);
+static void pipeline_free (Pipeline *pipe);
+static void pipeline_reset_volume (Pipeline *pipe);
+static Pipeline* pool_take (PrepareJob *job);
+static void pool_release (Pipeline *pipe, gboolean reusable);
+static void pool_fill ();
+static void pool_clear ();
 static int make_pipeline (StreamData *stream);
 static void free_pipeline (StreamData *stream);
-static int convert_number (const char *str, gint *result);
-static FadeEffect* fade_effect_new (gdouble position, gdouble length, gdouble start, gdouble end);
-static void fade_effect_free (FadeEffect *effect);
-static FadeEffect* parse_volume_fade (const char *str);
-static void set_fade_effect (GstControlSource *source, FadeEffect *effect);
 static void start_stream_fade (StreamData *stream, gdouble length,
                                gdouble volume_start, gdouble volume_end,
                                stream_fade_completed_cb fade_completed_cb);
 static void stop_stream_fade (StreamData *stream);
-static void update_fade_effect (FadeEffect *effect, gdouble elapsed, gdouble volume);
 static void cleanup (StreamData *stream);
 
 static void stream_list_add (StreamData *stream);
@@ -152,72 +250,41 @@ static guint system_sounds_level = 0;
 
 static GList *active_streams;
 
-static gboolean
-is_custom_sound_filename (const char *filename)
-{
-    if (filename && g_str_has_prefix (filename, SYSTEM_SOUND_PATH))
-        return FALSE;
-
-    return TRUE;
-}
-
-static gchar*
-strip_prefix (const gchar *str, const gchar *prefix)
-{
-    if (!g_str_has_prefix (str, prefix))
-        return NULL;
-
-    size_t prefix_length = strlen (prefix);
-    return g_strdup (str + prefix_length);
-}
-
-static gboolean
-parse_volume_limit (const char *str, guint *min, guint *max)
-{
-    gchar *stripped = NULL;
-
-    if (!str)
-        return FALSE;
-    
-    *min = 0;
-    *max = 0;
-    
-    if (g_str_has_prefix (str, "max:")) {
-        stripped = strip_prefix (str, "max:");
-        *max = atoi (stripped);
-        g_free (stripped);
-        return TRUE;
-    }
-    
-    if (g_str_has_prefix (str, "min:")) {
-        stripped = strip_prefix (str, "min:");
-        *min = atoi (stripped);
-        g_free (stripped);
-        return TRUE;
-    }
-    
-    return FALSE;
-}
-
-static gboolean
-parse_fixed_volume (const char *str, guint *volume)
-{
-    gchar *stripped = NULL;
-
-    if (!str || !g_str_has_prefix (str, "fixed:"))
-        return FALSE;
-
-    stripped = strip_prefix (str, "fixed:");
-    *volume = atoi (stripped);
-    g_free (stripped);
-    return TRUE;
-}
+static guint pool_size = DEFAULT_POOL_SIZE;
+static gsize cache_size = DEFAULT_CACHE_SIZE;
+static gsize cache_max_file_size = DEFAULT_CACHE_MAX_FILE;
+static gchar *sound_info_path;
+static guint timeout_slack = DEFAULT_TIMEOUT_SLACK;
+static guint sounds_rejected;
+static guint prewarm_started;
+static guint prewarm_used;
+static guint prewarm_dropped;
+static NCore *plugin_core;
+static GQueue idle_pipelines = G_QUEUE_INIT;   /* Pipeline* in READY */
+static GList *preroll_pipelines;                /* Pipeline* prerolled in PAUSED */
+static GHashTable *preroll_sounds;              /* files to keep prerolled */
+static gchar **preload_sounds;                  /* files to decode at startup */
+static gboolean mixer_enabled = FALSE;
+static gchar *sink_element;                     /* audio output element */
+static gchar *sink_location;                    /* file written by filesink, %u is the pipeline */
+static gint sink_files;
+static GList *mixers;                           /* Mixer* */
+
+/* time to first sample, index 1 for pipelines playing from cache */
+static GMutex first_sample_lock;
+static gint64 first_sample_total[2];
+static guint first_sample_count[2];
 
 static gdouble
 get_current_volume (StreamData *stream)
 {
     gdouble v;
 
+    /* fading volume is known from the timeline without asking the element */
+    if (!fade_timeline_is_empty (stream->fades))
+        return fade_timeline_value (stream->fades,
+            stream->time_spent + get_current_position (stream));
+
     g_object_get (G_OBJECT (stream->volume),
         "volume", &v, NULL);
 
@@ -228,112 +295,82 @@ get_current_volume (StreamData *stream)
     return v/10.0;
 }
 
-static gboolean
-get_current_position (StreamData *stream, gdouble *out_position)
+/* running time from the pipeline clock, paused pipeline keeps the
+   running time it was paused at as its start time. */
+static GstClockTime
+get_running_time (GstElement *pipeline)
 {
-    gint64 timestamp;
+    GstClock *clock;
+    GstClockTime now, base;
 
-    if (!gst_element_query_position (stream->pipeline, GST_FORMAT_TIME, &timestamp)) {
-        N_WARNING (LOG_CAT "unable to query data position");
-        return FALSE;
+    if (GST_STATE (pipeline) != GST_STATE_PLAYING ||
+        !(clock = gst_element_get_clock (pipeline))) {
+        now = gst_element_get_start_time (pipeline);
+        return GST_CLOCK_TIME_IS_VALID (now) ? now : 0;
     }
 
-    if (!GST_CLOCK_TIME_IS_VALID (timestamp)) {
-        N_WARNING (LOG_CAT "queried position or format is not valid");
-        return FALSE;
-    }
+    now = gst_clock_get_time (clock);
+    base = gst_element_get_base_time (pipeline);
+    gst_object_unref (clock);
 
-    *out_position = (gdouble) timestamp / GST_SECOND;
-    return TRUE;
+    return now > base ? now - base : 0;
 }
 
-static void
-set_stream_properties (GstElement *sink, const GstStructure *properties)
+/* position within the current round, segment loops keep the running
+   time going so the start of the round is subtracted. */
+static gdouble
+get_current_position (StreamData *stream)
 {
-    if (!sink | !properties)
-        return;
+    GstClockTime running;
+    gdouble position = 0.0;
 
-    if (g_object_class_find_property (G_OBJECT_GET_CLASS (sink), "stream-properties") != NULL) {
-        g_object_set (G_OBJECT (sink), "stream-properties", properties, NULL);
+    /* branch bin has no sink of its own */
+    if (stream->pooled && stream->pooled->mixer) {
+        (void) mixer_branch_position (stream->pooled, &position);
+        return position;
     }
-}
 
-static int
-set_structure_string (GstStructure *s, const char *key, const char *value)
-{
-    g_assert (s != NULL);
-    g_assert (key != NULL);
-
-    GValue v = {0,{{0}}};
-
-    if (!value)
-        return FALSE;
-
-    g_value_init (&v, G_TYPE_STRING);
-    g_value_set_string (&v, value);
-    gst_structure_set_value (s, key, &v);
-    g_value_unset (&v);
+    running = get_running_time (stream->pipeline);
+    if (running <= stream->round_start)
+        return 0.0;
 
-    return TRUE;
+    return (gdouble) (running - stream->round_start) / GST_SECOND;
 }
 
 static void
-proplist_to_structure_cb (const char *key, const NValue *value, gpointer userdata)
+set_stream_properties (GstElement *sink, const GstStructure *properties)
 {
-    GstStructure *target     = (GstStructure*) userdata;
-    const char   *prop_key   = NULL;
-    const char   *prop_value = NULL;
-
-    if (!g_str_has_prefix (key, STREAM_PREFIX_KEY))
-        return;
-
-    prop_key = key + strlen (STREAM_PREFIX_KEY);
-    if (*prop_key == '\0')
+    if (!sink | !properties)
         return;
 
-    prop_value = n_value_get_string ((NValue*) value);
-    (void) set_structure_string (target, prop_key, prop_value);
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (sink), "stream-properties") != NULL) {
+        g_object_set (G_OBJECT (sink), "stream-properties", properties, NULL);
+    }
 }
 
-static GstStructure*
-create_stream_properties (NProplist *props)
+/* if system sound level is off and the flag is set, then we need to
+   use different stream restore role. */
+static void
+apply_system_sounds_role (NProplist *props)
 {
-    g_assert (props != NULL);
-
-    GstStructure *s      = gst_structure_new_empty ("props");
-    const char   *source = NULL;
-    const char   *role   = NULL;
-
-    /* set the stream filename based on the sound file we're
-       about to play. */
-
-    source = n_proplist_get_string (props, SOUND_FILENAME_KEY);
-    g_assert (source != NULL);
-
-    set_structure_string (s, "media.filename", source);
-
-    /* set media.role from configuration file if defined. Default to "media" */
-    role = n_proplist_get_string (props, STREAM_PREFIX_KEY "media.role");
-    if (role)
-        set_structure_string (s, "media.role", role);
-    else
-        set_structure_string (s, "media.role", "media");
-
-    /* if system sound level is off and the flag is set, then we need to
-       use different stream restore role. */
+    const char *role = NULL;
 
     role = n_proplist_get_string (props ,"system-sounds-role");
     if (!system_sounds_enabled && role) {
         N_DEBUG (LOG_CAT "system sounds are off and replace role is set, using '%s'", role);
         n_proplist_set_string (props, STREAM_PREFIX_KEY "module-stream-restore.id", role);
     }
+}
 
-    /* convert all properties within the request that begin with
-       "sound.stream." prefix. */
-
-    n_proplist_foreach (props, proplist_to_structure_cb, s);
+/* stream properties and volume settings are parsed once for the
+   event the request resolved to, request properties only pick the
+   variant. */
+static StreamSpec*
+get_stream_spec (NRequest *request, NProplist *props)
+{
+    apply_system_sounds_role (props);
 
-    return s;
+    return stream_spec_get (n_request_get_event (request), props);
 }
 
 static void
@@ -343,36 +380,62 @@ free_stream_properties (GstStructure *s)
         gst_structure_free (s);
 }
 
+static void
+create_control_source (StreamData *stream)
+{
+    if (stream->source)
+        return;
+
+    stream->source = gst_interpolation_control_source_new ();
+    g_object_set (G_OBJECT (stream->source), "mode", GST_INTERPOLATION_MODE_LINEAR, NULL);
+    gst_object_add_control_binding (GST_OBJECT (stream->volume),
+        gst_direct_control_binding_new (GST_OBJECT (stream->volume), "volume",
+            GST_CONTROL_SOURCE (stream->source)));
+
+    stream->fades = fade_timeline_new ();
+}
+
+static void
+apply_fades (StreamData *stream)
+{
+    fade_timeline_apply (stream->fades, GST_TIMED_VALUE_CONTROL_SOURCE (stream->source),
+        stream->time_spent);
+}
+
 static int
 create_volume (StreamData *stream)
 {
-    if (stream->fade_in || stream->fade_out) {
-        stream->source = gst_interpolation_control_source_new ();
-        g_object_set (G_OBJECT (stream->source), "mode", GST_INTERPOLATION_MODE_LINEAR, NULL);
-        gst_object_add_control_binding (GST_OBJECT (stream->volume),
-            gst_direct_control_binding_new (GST_OBJECT (stream->volume), "volume",
-		GST_CONTROL_SOURCE (stream->source)));
+    const StreamSpec *spec = stream->spec;
+
+    if (spec->fade_in || spec->fade_out) {
+        create_control_source (stream);
 
-        set_fade_effect (stream->source, stream->fade_in);
-        set_fade_effect (stream->source, stream->fade_out);
+        if (spec->fade_in)
+            fade_timeline_add (stream->fades, spec->fade_in->position, spec->fade_in->length,
+                spec->fade_in->start, spec->fade_in->end);
+        if (spec->fade_out)
+            fade_timeline_add (stream->fades, spec->fade_out->position, spec->fade_out->length,
+                spec->fade_out->start, spec->fade_out->end);
+
+        apply_fades (stream);
 
         return TRUE;
     }
 
-    if (stream->volume_limit) {
-        if (system_sounds_level < stream->volume_min) {
-            g_object_set (G_OBJECT (stream->volume), "volume", stream->volume_min / 100.0, NULL);
+    if (spec->volume_limit) {
+        if (system_sounds_level < spec->volume_min) {
+            g_object_set (G_OBJECT (stream->volume), "volume", spec->volume_min / 100.0, NULL);
         }
         
-        if (stream->volume_max && system_sounds_level > stream->volume_max) {
-            g_object_set (G_OBJECT (stream->volume), "volume", stream->volume_max / 100.0, NULL);
+        if (spec->volume_max && system_sounds_level > spec->volume_max) {
+            g_object_set (G_OBJECT (stream->volume), "volume", spec->volume_max / 100.0, NULL);
         }
 
         return TRUE;
     }
     
-    if (stream->volume_fixed)
-        g_object_set (G_OBJECT (stream->volume), "volume", stream->volume_set / 100.0, NULL);
+    if (spec->volume_fixed)
+        g_object_set (G_OBJECT (stream->volume), "volume", spec->volume_set / 100.0, NULL);
 
     return FALSE;
 }
@@ -384,29 +447,43 @@ free_volume (StreamData *stream)
         g_object_unref (G_OBJECT (stream->source));
         stream->source = NULL;
     }
+
+    fade_timeline_free (stream->fades);
+    stream->fades = NULL;
 }
 
+/* stream time starts again from zero on every round, project the rest
+   of the fade timeline to the new round. */
 static void
-rewind_stream (StreamData *stream)
+update_loop_fades (StreamData *stream, gdouble position)
 {
-    gdouble position = 0.0;
+    stream->time_spent += position;
 
-    /* query the current position and volume */
-    if (get_current_position (stream, &position)) {
-        stream->time_spent += position;
-        stream->last_volume = get_current_volume (stream);
+    N_DEBUG (LOG_CAT "round done, %.3f seconds played", stream->time_spent);
 
-        /* update the stream effects */
+    if (stream->source)
+        apply_fades (stream);
+}
 
-        N_DEBUG (LOG_CAT "fade effect (last volume=%.2f)", stream->last_volume);
+static void
+stream_start_loop (StreamData *stream)
+{
+    /* cached samples loop in appsrc without any seeking */
+    if (!stream->repeat_enabled || stream->segment_loop || stream->pooled->raw)
+        return;
 
-        update_fade_effect (stream->fade_in, stream->time_spent, stream->last_volume);
-        update_fade_effect (stream->fade_out, stream->time_spent, stream->last_volume);
-        update_fade_effect (stream->fade, stream->time_spent, stream->last_volume);
-        set_fade_effect (stream->source, stream->fade_in);
-        set_fade_effect (stream->source, stream->fade_out);
-        set_fade_effect (stream->source, stream->fade);
-    }
+    stream->segment_loop = loop_start (stream->pipeline);
+    if (!stream->segment_loop)
+        N_DEBUG (LOG_CAT "segment seek failed, rewinding on eos");
+}
+
+static void
+rewind_stream (StreamData *stream)
+{
+    update_loop_fades (stream, get_current_position (stream));
+
+    /* flushing seek starts the running time from zero again */
+    stream->round_start = 0;
 
     N_DEBUG (LOG_CAT "rewinding pipeline.");
     if (!gst_element_seek(stream->pipeline, 1.0, GST_FORMAT_TIME,
@@ -432,24 +509,18 @@ stream_clear_delays (StreamData *stream)
 static void
 stop_stream_fade (StreamData *stream)
 {
-    if (stream->fade_source)
-        g_source_remove (stream->fade_source), stream->fade_source = 0;
-
-    if (stream->fade)
-        fade_effect_free (stream->fade), stream->fade = NULL;
+    if (stream->fade_wait)
+        fade_wait_cancel (stream->fade_wait), stream->fade_wait = NULL;
 }
 
-static gboolean
-stream_fade_event_cb (gpointer userdata)
+static void
+stream_fade_done_cb (gpointer userdata)
 {
     StreamData *stream = userdata;
 
-    stream->fade_source = 0;
-    stop_stream_fade (stream);
+    stream->fade_wait = NULL;
     if (stream->fade_completed_cb)
         stream->fade_completed_cb (stream);
-
-    return G_SOURCE_REMOVE;
 }
 
 static void
@@ -459,49 +530,114 @@ start_stream_fade (StreamData *stream,
                    gdouble volume_end,
                    stream_fade_completed_cb fade_completed_cb)
 {
-    gdouble position = 0.0;
+    gdouble position;
 
     stop_stream_fade (stream);
+    create_control_source (stream);
 
-    if (!get_current_position (stream, &position)) {
-        N_ERROR (LOG_CAT "(%p) failed to start stream fade for '%s'", stream, n_request_get_name (stream->request));
-        stream->fade_completed_cb = fade_completed_cb;
-        stream->fade_source = g_timeout_add (0, stream_fade_event_cb, stream);
-        return;
-    }
+    position = get_current_position (stream);
 
-    if (stream->fade)
-        fade_effect_free (stream->fade);
+    /* pause, resume and stop fades replace the configured ones */
+    fade_timeline_clear (stream->fades);
+    fade_timeline_add (stream->fades, stream->time_spent + position, length,
+        volume_start, volume_end);
+    apply_fades (stream);
 
-    stream->fade = fade_effect_new (position, length, volume_start, volume_end);
+    stream->fade_completed_cb = fade_completed_cb;
+    stream->fade_wait = fade_wait_new (stream->pipeline, length + FADE_COMPLETE_SLACK,
+        stream_fade_done_cb, stream);
 
-    if (stream->source) {
-        gst_timed_value_control_source_unset_all (GST_TIMED_VALUE_CONTROL_SOURCE (stream->source));
-    } else {
-        stream->source = gst_interpolation_control_source_new ();
-        g_object_set (G_OBJECT (stream->source), "mode", GST_INTERPOLATION_MODE_LINEAR, NULL);
+    N_DEBUG (LOG_CAT "start fade at %.4f for %.4f seconds, volume start %.4f end %.4f",
+                     position, length, volume_start, volume_end);
+}
 
-        gst_object_add_control_binding (GST_OBJECT (stream->volume),
-                                        gst_direct_control_binding_new (GST_OBJECT (stream->volume), "volume",
-                                        GST_CONTROL_SOURCE (stream->source)));
+static void
+first_sample_unref (gpointer data)
+{
+    FirstSample *sample = data;
+
+    if (g_atomic_int_dec_and_test (&sample->ref)) {
+        gst_object_unref (sample->pad);
+        g_slice_free (FirstSample, sample);
     }
+}
 
-    if (stream->fade_in)
-        fade_effect_free (stream->fade_in), stream->fade_in = NULL;
-    if (stream->fade_out)
-        fade_effect_free (stream->fade_out), stream->fade_out = NULL;
+static GstPadProbeReturn
+first_sample_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer userdata)
+{
+    FirstSample *sample = userdata;
 
-    gst_timed_value_control_source_set (GST_TIMED_VALUE_CONTROL_SOURCE (stream->source),
-                                        position * GST_SECOND, stream->fade->start);
+    (void) pad;
+    (void) info;
 
-    gst_timed_value_control_source_set (GST_TIMED_VALUE_CONTROL_SOURCE (stream->source),
-                                        (position + stream->fade->length) * GST_SECOND, stream->fade->end);
+    if (!g_atomic_int_compare_and_exchange (&sample->done, FALSE, TRUE))
+        return GST_PAD_PROBE_OK;
 
-    stream->fade_completed_cb = fade_completed_cb;
-    stream->fade_source = g_timeout_add ((length + 0.1) * 1000.0, stream_fade_event_cb, stream);
+    g_mutex_lock (&first_sample_lock);
+    first_sample_total[sample->cached] += g_get_monotonic_time () - sample->prepare_time;
+    first_sample_count[sample->cached]++;
+    g_mutex_unlock (&first_sample_lock);
 
-    N_DEBUG (LOG_CAT "start fade at %.4f for %.4f seconds, volume start %.4f end %.4f",
-                     position, length, volume_start, volume_end);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+/* The sink holds the prerolled buffer until the stream is set playing,
+   so the first buffer it takes after that means the first sample has
+   been handed to the output. Mixer branches are measured at the mixer. */
+static void
+stream_measure_first_sample (StreamData *stream)
+{
+    FirstSample *sample;
+    GstPad *pad;
+
+    if (stream->first_sample || !stream->pooled)
+        return;
+
+    if (stream->pooled->sink)
+        pad = gst_element_get_static_pad (stream->pooled->sink, "sink");
+    else if (stream->pooled->mixer_pad)
+        pad = gst_object_ref (stream->pooled->mixer_pad);
+    else
+        return;
+
+    sample = g_slice_new0 (FirstSample);
+    sample->ref = 2;
+    sample->prepare_time = stream->prepare_time;
+    sample->cached = stream->pooled->raw ? 1 : 0;
+    sample->pad = pad;
+    sample->probe = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        first_sample_probe_cb, sample, first_sample_unref);
+
+    stream->first_sample = sample;
+}
+
+static void
+stream_free_first_sample (StreamData *stream)
+{
+    FirstSample *sample = stream->first_sample;
+
+    if (!sample)
+        return;
+
+    /* probe has not run yet, the pipeline goes back to the pool */
+    if (g_atomic_int_compare_and_exchange (&sample->done, FALSE, TRUE))
+        gst_pad_remove_probe (sample->pad, sample->probe);
+
+    stream->first_sample = NULL;
+    first_sample_unref (sample);
+}
+
+static void
+stream_preroll_done (StreamData *stream)
+{
+    stream->prerolling = FALSE;
+    stream_start_loop (stream);
+
+    if (!stream->delay_startup || stream->synchronization_pending) {
+        N_DEBUG (LOG_CAT "synchronize");
+        stream->synchronization_pending = FALSE;
+        n_sink_interface_synchronize (stream->iface, stream->request);
+    }
 }
 
 static gboolean
@@ -517,7 +653,9 @@ bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata)
             gst_message_parse_error (msg, &error, NULL);
             N_WARNING (LOG_CAT "error: %s", error->message);
             g_error_free (error);
-            n_sink_interface_fail (stream->iface, stream->request);
+            stream->pipeline_failed = TRUE;
+            if (stream->request)
+                n_sink_interface_fail (stream->iface, stream->request);
             stream->bus_watch_id = 0;
             return G_SOURCE_REMOVE;
         }
@@ -533,13 +671,44 @@ bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata)
 
             N_DEBUG (LOG_CAT "state changed: old %d new %d pending %d", old_state, new_state, pending_state);
 
-            if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED &&
-                (!stream->delay_startup || stream->synchronization_pending)) {
-                N_DEBUG (LOG_CAT "synchronize");
-                stream->synchronization_pending = FALSE;
-                n_sink_interface_synchronize (stream->iface, stream->request);
+            if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED)
+                stream_preroll_done (stream);
+
+            break;
+        }
+
+        case GST_MESSAGE_ASYNC_DONE: {
+            /* prerolled pipeline finished rewinding */
+            if (GST_ELEMENT (GST_MESSAGE_SRC (msg)) != stream->pipeline ||
+                !stream->prerolling)
+                break;
+
+            stream->pipeline_state = GST_STATE_PAUSED;
+            stream_preroll_done (stream);
+            break;
+        }
+
+        case GST_MESSAGE_SEGMENT_DONE: {
+            GstFormat format;
+            gint64 position;
+
+            if (GST_ELEMENT (GST_MESSAGE_SRC (msg)) != stream->pipeline)
+                break;
+
+            /* sink is still playing the end of the round, so take the
+               length of the round from the message instead of a query. */
+            gst_message_parse_segment_done (msg, &format, &position);
+            if (format == GST_FORMAT_TIME && position > 0) {
+                stream->round_start += position;
+                update_loop_fades (stream, (gdouble) position / GST_SECOND);
             }
 
+            N_DEBUG (LOG_CAT "segment done, looping");
+            if (!loop_continue (stream->pipeline)) {
+                N_DEBUG (LOG_CAT "failed to loop, rewinding");
+                stream->segment_loop = FALSE;
+                rewind_stream (stream);
+            }
             break;
         }
 
@@ -594,85 +763,1384 @@ new_decoded_pad_cb (GstElement *element, GstPad *pad, gpointer userdata)
     gst_caps_unref (caps);
 }
 
-static int
-make_pipeline (StreamData *stream)
+/* link volume either to the sink, or for a mixer branch to a ghost pad
+   of the branch bin. */
+static gboolean
+pipeline_link_output (GstElement *bin, GstElement *volume, GstElement *sink)
+{
+    GstPad *pad;
+    gboolean ret;
+
+    if (sink)
+        return gst_element_link (volume, sink);
+
+    /* keep preroll of the branch from disturbing the running mixer */
+    g_object_set (G_OBJECT (bin), "async-handling", TRUE, NULL);
+
+    pad = gst_element_get_static_pad (volume, "src");
+    ret = gst_element_add_pad (bin, gst_ghost_pad_new ("src", pad));
+    gst_object_unref (pad);
+
+    return ret;
+}
+
+/* pulsesink normally, fakesink or a wav writing filesink can be
+   configured for running without an audio server. Called from the
+   worker too. */
+static GstElement*
+make_sink ()
+{
+    GstElement *bin = NULL, *encoder = NULL, *sink = NULL;
+    GstPad *pad = NULL;
+    gchar **split = NULL;
+    gchar *number = NULL;
+    gchar *location = NULL;
+
+    if (!g_str_equal (sink_element, "filesink")) {
+        sink = gst_element_factory_make (sink_element, NULL);
+
+        /* consume the samples in real time like the audio server would */
+        if (sink && g_str_equal (sink_element, "fakesink"))
+            g_object_set (G_OBJECT (sink), "sync", TRUE, NULL);
+
+        return sink;
+    }
+
+    bin = gst_bin_new (NULL);
+    encoder = gst_element_factory_make ("wavenc", NULL);
+    sink = gst_element_factory_make ("filesink", NULL);
+
+    if (!bin || !encoder || !sink) {
+        if (sink)
+            gst_object_unref (sink);
+        if (encoder)
+            gst_object_unref (encoder);
+        if (bin)
+            gst_object_unref (bin);
+        return NULL;
+    }
+
+    number = g_strdup_printf ("%d", g_atomic_int_add (&sink_files, 1));
+    split = g_strsplit (sink_location, "%u", -1);
+    location = g_strjoinv (number, split);
+    g_object_set (G_OBJECT (sink), "location", location, "sync", TRUE, NULL);
+    g_strfreev (split);
+    g_free (location);
+    g_free (number);
+
+    gst_bin_add_many (GST_BIN (bin), encoder, sink, NULL);
+    if (!gst_element_link (encoder, sink)) {
+        gst_object_unref (bin);
+        return NULL;
+    }
+
+    pad = gst_element_get_static_pad (encoder, "sink");
+    gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+    gst_object_unref (pad);
+
+    return bin;
+}
+
+static Pipeline*
+pipeline_new (gboolean branch)
 {
+    Pipeline *pipe = NULL;
     GstElement *pipeline = NULL, *source = NULL, *decoder = NULL,
         *audioconv = NULL, *volume = NULL, *sink = NULL;
-    GstBus *bus = NULL;
 
-    pipeline = gst_pipeline_new (NULL);
+    pipeline = branch ? gst_bin_new (NULL) : gst_pipeline_new (NULL);
     source = gst_element_factory_make ("filesrc", NULL);
     decoder = gst_element_factory_make ("decodebin", NULL);
     audioconv = gst_element_factory_make ("audioconvert", NULL);
     volume = gst_element_factory_make ("volume", NULL);
-    sink = gst_element_factory_make ("pulsesink", NULL);
+    if (!branch)
+        sink = make_sink ();
 
-    if (!pipeline || !source || !decoder || !audioconv || !volume || !sink) {
+    if (!pipeline || !source || !decoder || !audioconv || !volume || (!branch && !sink)) {
         N_ERROR (LOG_CAT "failed to create required elements.");
         goto failed;
     }
 
-    gst_bin_add_many (GST_BIN (pipeline), source, decoder, audioconv, volume, sink, NULL);
+    gst_bin_add_many (GST_BIN (pipeline), source, decoder, audioconv, volume, NULL);
+    if (sink)
+        gst_bin_add (GST_BIN (pipeline), sink);
     
     if (!gst_element_link (source, decoder)) {
         N_ERROR (LOG_CAT "failed to link source to decoder");
         goto failed_pipeline;
     }
 
-    if (!gst_element_link_many (audioconv, volume, sink, NULL)) {
-        N_ERROR (LOG_CAT "failed to link converter, volume or sink");
-        goto failed_pipeline;
+    if (!gst_element_link (audioconv, volume) ||
+        !pipeline_link_output (pipeline, volume, sink)) {
+        N_ERROR (LOG_CAT "failed to link converter, volume or sink");
+        goto failed_pipeline;
+    }
+
+    g_signal_connect (G_OBJECT (decoder), "pad-added",
+        G_CALLBACK (new_decoded_pad_cb), audioconv);
+
+    pipe = g_slice_new0 (Pipeline);
+    pipe->pipeline = pipeline;
+    pipe->source = source;
+    pipe->volume = volume;
+    pipe->sink = sink;
+
+    return pipe;
+
+failed:
+    if (sink)
+        gst_object_unref (sink);
+    if (volume)
+        gst_object_unref (volume);
+    if (audioconv)
+        gst_object_unref (audioconv);
+    if (decoder)
+        gst_object_unref (decoder);
+    if (source)
+        gst_object_unref (source);
+
+failed_pipeline:
+    if (pipeline)
+        gst_object_unref (pipeline);
+
+    return NULL;
+}
+
+static void
+raw_need_data_cb (GstAppSrc *src, guint length, gpointer userdata)
+{
+    Pipeline *pipe = userdata;
+    GstBuffer *buffer;
+    gsize size;
+
+    (void) length;
+
+    size = gst_buffer_get_size (pipe->pcm);
+
+    /* when looping start the next round right after the previous one,
+       the timestamps keep running so fades need no adjusting. */
+    if (pipe->loop && pipe->offset >= size) {
+        pipe->loop_base += gst_util_uint64_scale (size / pipe->bpf, GST_SECOND, pipe->rate);
+        pipe->offset = 0;
+    }
+
+    /* push everything left in one go, the memory is shared with the cache. */
+    if (pipe->offset < size) {
+        buffer = gst_buffer_copy_region (pipe->pcm, GST_BUFFER_COPY_MEMORY,
+                                         pipe->offset, size - pipe->offset);
+        GST_BUFFER_PTS (buffer) = pipe->loop_base +
+            gst_util_uint64_scale (pipe->offset / pipe->bpf, GST_SECOND, pipe->rate);
+        GST_BUFFER_DURATION (buffer) = gst_util_uint64_scale ((size - pipe->offset) / pipe->bpf,
+                                                              GST_SECOND, pipe->rate);
+        pipe->offset = size;
+        gst_app_src_push_buffer (src, buffer);
+    }
+
+    if (!pipe->loop || size == 0)
+        gst_app_src_end_of_stream (src);
+}
+
+static gboolean
+raw_seek_data_cb (GstAppSrc *src, guint64 offset, gpointer userdata)
+{
+    Pipeline *pipe = userdata;
+
+    (void) src;
+
+    pipe->offset = gst_util_uint64_scale (offset, pipe->rate, GST_SECOND) * pipe->bpf;
+    pipe->loop_base = 0;
+
+    return TRUE;
+}
+
+static Pipeline*
+pipeline_raw_new (gboolean branch)
+{
+    static GstAppSrcCallbacks callbacks = {
+        .need_data = raw_need_data_cb,
+        .seek_data = raw_seek_data_cb
+    };
+
+    Pipeline *pipe = NULL;
+    GstElement *pipeline = NULL, *source = NULL, *audioconv = NULL,
+        *volume = NULL, *sink = NULL;
+
+    pipeline = branch ? gst_bin_new (NULL) : gst_pipeline_new (NULL);
+    source = gst_element_factory_make ("appsrc", NULL);
+    audioconv = gst_element_factory_make ("audioconvert", NULL);
+    volume = gst_element_factory_make ("volume", NULL);
+    if (!branch)
+        sink = make_sink ();
+
+    if (!pipeline || !source || !audioconv || !volume || (!branch && !sink)) {
+        N_ERROR (LOG_CAT "failed to create required elements.");
+        if (sink)
+            gst_object_unref (sink);
+        if (volume)
+            gst_object_unref (volume);
+        if (audioconv)
+            gst_object_unref (audioconv);
+        if (source)
+            gst_object_unref (source);
+        if (pipeline)
+            gst_object_unref (pipeline);
+        return NULL;
+    }
+
+    gst_bin_add_many (GST_BIN (pipeline), source, audioconv, volume, NULL);
+    if (sink)
+        gst_bin_add (GST_BIN (pipeline), sink);
+
+    if (!gst_element_link_many (source, audioconv, volume, NULL) ||
+        !pipeline_link_output (pipeline, volume, sink)) {
+        N_ERROR (LOG_CAT "failed to link cached sample pipeline");
+        gst_object_unref (pipeline);
+        return NULL;
+    }
+
+    g_object_set (G_OBJECT (source),
+        "format", GST_FORMAT_TIME,
+        "stream-type", GST_APP_STREAM_TYPE_SEEKABLE,
+        NULL);
+
+    pipe = g_slice_new0 (Pipeline);
+    pipe->pipeline = pipeline;
+    pipe->source = source;
+    pipe->volume = volume;
+    pipe->sink = sink;
+    pipe->raw = TRUE;
+
+    gst_app_src_set_callbacks (GST_APP_SRC (source), &callbacks, pipe, NULL);
+
+    return pipe;
+}
+
+static gboolean
+pipeline_set_samples (Pipeline *pipe, GstBuffer *pcm, GstCaps *caps, gboolean loop)
+{
+    GstStructure *s = gst_caps_get_structure (caps, 0);
+    gint channels = 0;
+
+    if (!gst_structure_get_int (s, "rate", &pipe->rate) ||
+        !gst_structure_get_int (s, "channels", &channels) ||
+        pipe->rate <= 0 || channels <= 0) {
+        gst_buffer_unref (pcm);
+        return FALSE;
+    }
+
+    if (pipe->pcm)
+        gst_buffer_unref (pipe->pcm);
+
+    pipe->pcm = pcm;
+    pipe->bpf = channels * 2;   /* SAMPLE_CACHE_FORMAT */
+    pipe->offset = 0;
+    pipe->loop = loop;
+    pipe->loop_base = 0;
+
+    gst_app_src_set_caps (GST_APP_SRC (pipe->source), caps);
+    gst_app_src_set_duration (GST_APP_SRC (pipe->source), loop ? GST_CLOCK_TIME_NONE :
+        gst_util_uint64_scale (gst_buffer_get_size (pcm) / pipe->bpf, GST_SECOND, pipe->rate));
+
+    return TRUE;
+}
+
+static void
+pipeline_free (Pipeline *pipe)
+{
+    if (!pipe)
+        return;
+
+    N_DEBUG (LOG_CAT "freeing pipeline");
+    gst_element_set_state (pipe->pipeline, GST_STATE_NULL);
+    gst_object_unref (pipe->pipeline);
+    if (pipe->pcm)
+        gst_buffer_unref (pipe->pcm);
+    g_free (pipe->location);
+    free_stream_properties (pipe->properties);
+    g_slice_free (Pipeline, pipe);
+}
+
+static void
+pipeline_reset_volume (Pipeline *pipe)
+{
+    GstControlBinding *binding;
+
+    /* drop fades left over from the previous stream */
+    binding = gst_object_get_control_binding (GST_OBJECT (pipe->volume), "volume");
+    if (binding) {
+        gst_object_remove_control_binding (GST_OBJECT (pipe->volume), binding);
+        gst_object_unref (binding);
+    }
+
+    g_object_set (G_OBJECT (pipe->volume), "volume", 1.0, NULL);
+}
+
+static Pipeline*
+pool_pop_idle (gboolean raw)
+{
+    GList *iter;
+    Pipeline *pipe;
+
+    for (iter = idle_pipelines.head; iter; iter = g_list_next (iter)) {
+        pipe = iter->data;
+        if (pipe->raw == raw) {
+            g_queue_delete_link (&idle_pipelines, iter);
+            return pipe;
+        }
+    }
+
+    return NULL;
+}
+
+/* prerolled pipeline can be used only if pulsesink stream was opened
+   with the same properties. Cached samples are already queued with or
+   without eos after them. */
+static GList*
+pool_find_prerolled (const char *location, const GstStructure *properties, gboolean loop)
+{
+    Pipeline *pipe;
+    GList *iter;
+
+    for (iter = g_list_first (preroll_pipelines); iter; iter = g_list_next (iter)) {
+        pipe = iter->data;
+        if (g_str_equal (pipe->location, location) &&
+            gst_structure_is_equal (pipe->properties, properties) &&
+            (!pipe->raw || pipe->loop == loop))
+            return iter;
+    }
+
+    return NULL;
+}
+
+/* pick a pipeline for the stream from the pool, it is set up for the
+   stream later in the worker. */
+static Pipeline*
+pool_take (PrepareJob *job)
+{
+    Pipeline *pipe = NULL;
+    GList *iter;
+
+    if ((iter = pool_find_prerolled (job->location, job->spec->properties, job->loop))) {
+        pipe = iter->data;
+        preroll_pipelines = g_list_delete_link (preroll_pipelines, iter);
+        N_DEBUG (LOG_CAT "using prerolled pipeline for '%s'", pipe->location);
+
+        if (pipe->prewarm) {
+            pipe->prewarm->pipe = NULL;
+            pipe->prewarm = NULL;
+            prewarm_used++;
+        }
+
+        job->prerolled = TRUE;
+        job->raw = pipe->raw;
+        return pipe;
+    }
+
+    job->raw = sample_cache_lookup (job->location, &job->pcm, &job->caps, &job->cache_mtime);
+
+    if ((pipe = pool_pop_idle (job->raw)))
+        N_DEBUG (LOG_CAT "using idle pipeline");
+
+    return pipe;
+}
+
+static gboolean
+pool_has_prerolled (const char *location)
+{
+    GList *iter;
+
+    for (iter = g_list_first (preroll_pipelines); iter; iter = g_list_next (iter)) {
+        if (g_str_equal (((Pipeline*) iter->data)->location, location))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+pipeline_preroll_run (gpointer data)
+{
+    Pipeline *pipe = data;
+
+    pipeline_reset_volume (pipe);
+
+    gst_element_set_state (pipe->pipeline, GST_STATE_PAUSED);
+    if (gst_element_seek_simple (pipe->pipeline, GST_FORMAT_TIME,
+                                 GST_SEEK_FLAG_FLUSH, 0)) {
+        N_DEBUG (LOG_CAT "keeping '%s' prerolled", pipe->location);
+        return;
+    }
+
+    /* prepare job notices the pipeline is not paused and prerolls it */
+    N_DEBUG (LOG_CAT "failed to rewind '%s' for preroll", pipe->location);
+    gst_element_set_state (pipe->pipeline, GST_STATE_READY);
+}
+
+static void
+pipeline_idle_run (gpointer data)
+{
+    Pipeline *pipe = data;
+
+    pipeline_reset_volume (pipe);
+
+    /* failing pipeline fails to pause in the next prepare job */
+    if (gst_element_set_state (pipe->pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
+        N_WARNING (LOG_CAT "failed to set idle pipeline ready");
+
+    /* do not keep cached samples alive from idle pipelines */
+    if (pipe->pcm) {
+        gst_buffer_unref (pipe->pcm);
+        pipe->pcm = NULL;
+    }
+}
+
+/* put back an idle pipeline that a job took but did not touch */
+static void
+pool_put_back (Pipeline *pipe)
+{
+    if (g_queue_get_length (&idle_pipelines) >= pool_size) {
+        worker_push ((WorkerFunc) pipeline_free, NULL, pipe);
+        return;
+    }
+
+    g_queue_push_head (&idle_pipelines, pipe);
+}
+
+/* the pipeline is put to the pool right away, jobs using it from there
+   are run in the worker only after the state change is done. */
+static void
+pool_release (Pipeline *pipe, gboolean reusable)
+{
+    if (!reusable) {
+        worker_push ((WorkerFunc) pipeline_free, NULL, pipe);
+        return;
+    }
+
+    /* keep one pipeline per configured sound rewound in PAUSED, so that
+       next play for it is only a state change. */
+    if (preroll_sounds && g_hash_table_contains (preroll_sounds, pipe->location) &&
+        !pool_has_prerolled (pipe->location)) {
+        preroll_pipelines = g_list_prepend (preroll_pipelines, pipe);
+        worker_push (pipeline_preroll_run, NULL, pipe);
+        return;
+    }
+
+    if (g_queue_get_length (&idle_pipelines) >= pool_size) {
+        worker_push ((WorkerFunc) pipeline_free, NULL, pipe);
+        return;
+    }
+
+    g_queue_push_tail (&idle_pipelines, pipe);
+    worker_push (pipeline_idle_run, NULL, pipe);
+}
+
+static void
+pool_fill_run (gpointer data)
+{
+    Pipeline **pipe = data;
+
+    if (!(*pipe = pipeline_new (FALSE)))
+        return;
+
+    /* READY connects pulsesink to the server already */
+    if (gst_element_set_state ((*pipe)->pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+        N_WARNING (LOG_CAT "failed to set idle pipeline ready");
+        pipeline_free (*pipe);
+        *pipe = NULL;
+    }
+}
+
+static void
+pool_fill_done (gpointer data)
+{
+    Pipeline **pipe = data;
+
+    if (*pipe && g_queue_get_length (&idle_pipelines) < pool_size)
+        g_queue_push_tail (&idle_pipelines, *pipe);
+    else if (*pipe)
+        worker_push ((WorkerFunc) pipeline_free, NULL, *pipe);
+
+    N_DEBUG (LOG_CAT "%u idle pipelines", g_queue_get_length (&idle_pipelines));
+    g_free (pipe);
+}
+
+static void
+pool_fill ()
+{
+    guint i;
+
+    for (i = 0; i < pool_size; i++)
+        worker_push (pool_fill_run, pool_fill_done, g_new0 (Pipeline*, 1));
+}
+
+static void
+pool_clear ()
+{
+    Pipeline *pipe;
+
+    while ((pipe = g_queue_pop_head (&idle_pipelines)))
+        pipeline_free (pipe);
+
+    g_list_free_full (preroll_pipelines, (GDestroyNotify) pipeline_free);
+    preroll_pipelines = NULL;
+}
+
+static void
+mixer_free_run (gpointer data)
+{
+    Mixer *mixer = data;
+
+    if (mixer->pipeline) {
+        gst_element_set_state (mixer->pipeline, GST_STATE_NULL);
+        gst_object_unref (mixer->pipeline);
+    }
+    free_stream_properties (mixer->properties);
+    g_slice_free (Mixer, mixer);
+}
+
+/* stopped in the worker after the jobs still using the mixer */
+static void
+mixer_free (Mixer *mixer)
+{
+    N_DEBUG (LOG_CAT "freeing mixer");
+
+    mixers = g_list_remove (mixers, mixer);
+
+    if (mixer->bus_watch_id) {
+        g_source_remove (mixer->bus_watch_id);
+        mixer->bus_watch_id = 0;
+    }
+
+    worker_push (mixer_free_run, NULL, mixer);
+}
+
+/* mixer runs only while it has streams. State changes go through the
+   worker, so that they are done in order with removing branches. */
+static void
+mixer_play_run (gpointer data)
+{
+    Mixer *mixer = data;
+
+    gst_element_set_state (mixer->pipeline, GST_STATE_PLAYING);
+}
+
+static void
+mixer_pause_run (gpointer data)
+{
+    Mixer *mixer = data;
+
+    gst_element_set_state (mixer->pipeline, GST_STATE_PAUSED);
+}
+
+static gboolean
+mixer_bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata)
+{
+    Mixer *mixer = userdata;
+    GstObject *src = GST_MESSAGE_SRC (msg);
+    StreamData *stream;
+    GList *streams;
+    GList *iter;
+
+    /* route branch messages to the stream owning the branch */
+    for (iter = g_list_first (mixer->streams); iter; iter = g_list_next (iter)) {
+        stream = iter->data;
+        if (src == GST_OBJECT (stream->pipeline) ||
+            gst_object_has_as_ancestor (src, GST_OBJECT (stream->pipeline))) {
+            (void) bus_cb (bus, msg, stream);
+            return G_SOURCE_CONTINUE;
+        }
+    }
+
+    if (GST_MESSAGE_TYPE (msg) != GST_MESSAGE_ERROR)
+        return G_SOURCE_CONTINUE;
+
+    /* shared part failed, fail every stream and create a new mixer for
+       following requests. */
+    N_WARNING (LOG_CAT "mixer failed");
+    mixer->failed = TRUE;
+
+    streams = g_list_copy (mixer->streams);
+    for (iter = g_list_first (streams); iter; iter = g_list_next (iter)) {
+        stream = iter->data;
+        stream->pipeline_failed = TRUE;
+        if (stream->request)
+            n_sink_interface_fail (stream->iface, stream->request);
+    }
+    g_list_free (streams);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Elements of the mixer are made in the worker by the first branch job
+   using it. */
+static gboolean
+mixer_build (Mixer *mixer)
+{
+    GstElement *pipeline = NULL, *silence = NULL, *audiomixer = NULL,
+        *audioconv = NULL, *sink = NULL;
+
+    pipeline = gst_pipeline_new (NULL);
+    silence = gst_element_factory_make ("audiotestsrc", NULL);
+    audiomixer = gst_element_factory_make ("audiomixer", NULL);
+    audioconv = gst_element_factory_make ("audioconvert", NULL);
+    sink = make_sink ();
+
+    if (!pipeline || !silence || !audiomixer || !audioconv || !sink) {
+        N_ERROR (LOG_CAT "failed to create mixer elements.");
+        if (sink)
+            gst_object_unref (sink);
+        if (audioconv)
+            gst_object_unref (audioconv);
+        if (audiomixer)
+            gst_object_unref (audiomixer);
+        if (silence)
+            gst_object_unref (silence);
+        if (pipeline)
+            gst_object_unref (pipeline);
+        return FALSE;
+    }
+
+    gst_bin_add_many (GST_BIN (pipeline), silence, audiomixer, audioconv, sink, NULL);
+
+    if (!gst_element_link_many (silence, audiomixer, audioconv, sink, NULL)) {
+        N_ERROR (LOG_CAT "failed to link mixer");
+        gst_object_unref (pipeline);
+        return FALSE;
+    }
+
+    /* live silence keeps the mixer running on the clock, so that branches
+       without data do not stall the others. */
+    gst_util_set_object_arg (G_OBJECT (silence), "wave", "silence");
+    g_object_set (G_OBJECT (silence), "is-live", TRUE, NULL);
+    g_object_set (G_OBJECT (audiomixer), "latency", (guint64) MIXER_LATENCY, NULL);
+    set_stream_properties (sink, mixer->properties);
+
+    mixer->pipeline = pipeline;
+    mixer->mixer = audiomixer;
+
+    return TRUE;
+}
+
+/* watch the bus once the worker has built the mixer */
+static void
+mixer_watch (Mixer *mixer)
+{
+    GstBus *bus = NULL;
+
+    if (mixer->bus_watch_id || !mixer->pipeline)
+        return;
+
+    bus = gst_element_get_bus (mixer->pipeline);
+    mixer->bus_watch_id = gst_bus_add_watch (bus, mixer_bus_cb, mixer);
+    gst_object_unref (bus);
+}
+
+static Mixer*
+mixer_new (const GstStructure *properties)
+{
+    Mixer *mixer = NULL;
+
+    mixer = g_slice_new0 (Mixer);
+    mixer->properties = gst_structure_copy (properties);
+
+    mixers = g_list_append (mixers, mixer);
+
+    return mixer;
+}
+
+/* pause the mixer once no stream or job uses it, or free it if it has
+   failed meanwhile */
+static void
+mixer_unuse (Mixer *mixer)
+{
+    if (mixer->streams || mixer->jobs)
+        return;
+
+    if (mixer->failed)
+        mixer_free (mixer);
+    else
+        worker_push (mixer_pause_run, NULL, mixer);
+}
+
+static Mixer*
+mixer_get (const GstStructure *properties)
+{
+    GList *iter;
+    Mixer *mixer;
+
+    for (iter = g_list_first (mixers); iter; iter = g_list_next (iter)) {
+        mixer = iter->data;
+        if (!mixer->failed && gst_structure_is_equal (mixer->properties, properties))
+            return mixer;
+    }
+
+    return mixer_new (properties);
+}
+
+static GstClockTime
+mixer_running_time (Mixer *mixer)
+{
+    GstClock *clock;
+    GstClockTime now;
+
+    if (!(clock = gst_element_get_clock (mixer->pipeline)))
+        return 0;
+
+    now = gst_clock_get_time (clock) - gst_element_get_base_time (mixer->pipeline);
+    gst_object_unref (clock);
+
+    return now;
+}
+
+static GstPadProbeReturn
+mixer_branch_eos_cb (GstPad *pad, GstPadProbeInfo *info, gpointer userdata)
+{
+    Pipeline *pipe = userdata;
+    GstBus *bus;
+
+    (void) pad;
+
+    if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) != GST_EVENT_EOS)
+        return GST_PAD_PROBE_OK;
+
+    /* mixer never goes EOS by itself and bins collect EOS only from
+       sinks, so signal end of the branch directly on the pipeline bus. */
+    bus = gst_pipeline_get_bus (GST_PIPELINE (pipe->mixer->pipeline));
+    gst_bus_post (bus, gst_message_new_eos (GST_OBJECT (pipe->pipeline)));
+    gst_object_unref (bus);
+
+    return GST_PAD_PROBE_OK;
+}
+
+/* called from the worker, before the branch is paused */
+static gboolean
+mixer_link_branch (Mixer *mixer, Pipeline *pipe)
+{
+    GstPad *src;
+
+    /* mixer and Pipeline both hold a reference to the branch */
+    gst_bin_add (GST_BIN (mixer->pipeline), gst_object_ref (pipe->pipeline));
+    pipe->mixer = mixer;
+
+    src = gst_element_get_static_pad (pipe->pipeline, "src");
+    pipe->block_probe = gst_pad_add_probe (src, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+                                           NULL, NULL, NULL);
+    gst_pad_add_probe (src, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                       mixer_branch_eos_cb, pipe, NULL);
+
+    pipe->mixer_pad = gst_element_get_request_pad (mixer->mixer, "sink_%u");
+    if (!pipe->mixer_pad || gst_pad_link (src, pipe->mixer_pad) != GST_PAD_LINK_OK) {
+        N_ERROR (LOG_CAT "failed to link branch to mixer");
+        gst_object_unref (src);
+        gst_bin_remove (GST_BIN (mixer->pipeline), pipe->pipeline);
+        if (pipe->mixer_pad) {
+            gst_element_release_request_pad (mixer->mixer, pipe->mixer_pad);
+            gst_object_unref (pipe->mixer_pad);
+            pipe->mixer_pad = NULL;
+        }
+        pipe->mixer = NULL;
+        return FALSE;
+    }
+
+    gst_object_unref (src);
+
+    pipe->start_time = GST_CLOCK_TIME_NONE;
+    pipe->paused_at = GST_CLOCK_TIME_NONE;
+
+    return TRUE;
+}
+
+static void
+mixer_branch_free_run (gpointer data)
+{
+    Pipeline *pipe = data;
+
+    /* branch of a failed job still has its pad */
+    if (pipe->mixer_pad) {
+        gst_element_release_request_pad (pipe->mixer->mixer, pipe->mixer_pad);
+        gst_object_unref (pipe->mixer_pad);
+        pipe->mixer_pad = NULL;
+    }
+
+    gst_element_set_state (pipe->pipeline, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (pipe->mixer->pipeline), pipe->pipeline);
+    pipe->mixer = NULL;
+
+    pipeline_free (pipe);
+}
+
+static void
+mixer_remove_branch (StreamData *stream)
+{
+    Pipeline *pipe = stream->pooled;
+    Mixer *mixer = pipe->mixer;
+
+    /* release the mixer pad first, so that a streaming thread waiting in
+       the mixer does not block stopping the branch. */
+    gst_element_release_request_pad (mixer->mixer, pipe->mixer_pad);
+    gst_object_unref (pipe->mixer_pad);
+    pipe->mixer_pad = NULL;
+
+    mixer->streams = g_list_remove (mixer->streams, stream);
+
+    /* branch is stopped like pooled pipelines, the mixer is kept until
+       the job is done. */
+    worker_push (mixer_branch_free_run, NULL, pipe);
+
+    mixer_unuse (mixer);
+}
+
+/* branches do not follow state of the mixer, data is held with a
+   blocking probe and the pad offset moves the branch to current time. */
+static void
+mixer_branch_set_playing (Pipeline *pipe, gboolean playing)
+{
+    GstClockTime now = mixer_running_time (pipe->mixer);
+    GstPad *src;
+
+    src = gst_element_get_static_pad (pipe->pipeline, "src");
+
+    if (playing && pipe->block_probe) {
+        if (!GST_CLOCK_TIME_IS_VALID (pipe->start_time))
+            pipe->start_time = now;
+        else if (GST_CLOCK_TIME_IS_VALID (pipe->paused_at))
+            pipe->start_time += now - pipe->paused_at;
+
+        pipe->paused_at = GST_CLOCK_TIME_NONE;
+        gst_pad_set_offset (src, pipe->start_time);
+        gst_pad_remove_probe (src, pipe->block_probe);
+        pipe->block_probe = 0;
+    }
+    else if (!playing && !pipe->block_probe) {
+        pipe->paused_at = now;
+        pipe->block_probe = gst_pad_add_probe (src, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+                                               NULL, NULL, NULL);
+    }
+
+    gst_object_unref (src);
+}
+
+static gboolean
+mixer_branch_position (Pipeline *pipe, gdouble *out_position)
+{
+    GstClockTime now;
+
+    if (!GST_CLOCK_TIME_IS_VALID (pipe->start_time)) {
+        *out_position = 0.0;
+        return TRUE;
+    }
+
+    now = GST_CLOCK_TIME_IS_VALID (pipe->paused_at) ? pipe->paused_at
+                                                     : mixer_running_time (pipe->mixer);
+
+    *out_position = now > pipe->start_time ? (gdouble) (now - pipe->start_time) / GST_SECOND : 0.0;
+
+    return TRUE;
+}
+
+static void
+mixer_clear ()
+{
+    while (mixers)
+        mixer_free (mixers->data);
+}
+
+static void
+file_check_run (gpointer data)
+{
+    FileCheck *check = data;
+
+    sound_info_stat (check->location, &check->st);
+}
+
+static void
+file_check_done (gpointer data)
+{
+    FileCheck *check = data;
+    GstClockTime duration;
+
+    if (check->st.exists && check->preload)
+        sample_cache_preload (check->location, check->st.mtime, check->st.size);
+
+    (void) sound_info_update (check->location, &check->st, &duration);
+
+    g_free (check->location);
+    g_slice_free (FileCheck, check);
+}
+
+static FileCheck*
+file_check_new (const char *location)
+{
+    FileCheck *check;
+
+    check = g_slice_new0 (FileCheck);
+    check->location = g_strdup (location);
+
+    return check;
+}
+
+/* Discover the file, and decode it to the sample cache if preload is
+   set, once the worker has looked at it. */
+static void
+file_check (const char *location, gboolean preload)
+{
+    FileCheck *check;
+
+    check = file_check_new (location);
+    check->preload = preload;
+    worker_push (file_check_run, file_check_done, check);
+}
+
+static void
+stream_set_state (StreamData *stream, GstState state)
+{
+    if (stream->pooled && stream->pooled->mixer)
+        mixer_branch_set_playing (stream->pooled, state == GST_STATE_PLAYING);
+
+    gst_element_set_state (stream->pipeline, state);
+}
+
+static void
+pipeline_pause_run (gpointer data)
+{
+    GstElement *pipeline = data;
+
+    gst_element_set_state (pipeline, GST_STATE_PAUSED);
+    gst_object_unref (pipeline);
+}
+
+/* pause of a stopping stream is done in the worker, before the pipeline
+   is released there. Branches are held at once by their probe. */
+static void
+stream_pause_async (StreamData *stream)
+{
+    if (stream->pooled && stream->pooled->mixer)
+        mixer_branch_set_playing (stream->pooled, FALSE);
+
+    worker_push (pipeline_pause_run, NULL, gst_object_ref (stream->pipeline));
+}
+
+static void
+prepare_job_free (PrepareJob *job)
+{
+    if (job->pcm)
+        gst_buffer_unref (job->pcm);
+    if (job->caps)
+        gst_caps_unref (job->caps);
+    if (job->unused)
+        pool_put_back (job->unused);
+    g_free (job->location);
+    stream_spec_unref (job->spec);
+    g_slice_free (PrepareJob, job);
+}
+
+static void
+prepare_job_run (gpointer data)
+{
+    PrepareJob *job = data;
+    Pipeline *pipe = job->pipe;
+    GstBus *bus = NULL;
+    GstState state;
+    GstStateChangeReturn ret;
+    gboolean samples_ok;
+
+    /* the file is looked at here instead of the main loop, prerolled
+       pipelines were checked when they were prepared. */
+    if (!job->prerolled) {
+        sound_info_stat (job->location, &job->st);
+        if (!job->st.exists) {
+            job->unused = pipe;
+            job->pipe = NULL;
+            job->failed = TRUE;
+            return;
+        }
+
+        /* modified since it was cached, decode it instead */
+        if (job->raw && job->st.mtime != job->cache_mtime) {
+            gst_buffer_unref (job->pcm);
+            gst_caps_unref (job->caps);
+            job->pcm = NULL;
+            job->caps = NULL;
+            job->raw = FALSE;
+            job->unused = pipe;
+            pipe = job->pipe = NULL;
+        }
+    }
+
+    if (!pipe && !(pipe = job->pipe = job->raw ? pipeline_raw_new (FALSE) : pipeline_new (FALSE))) {
+        job->failed = TRUE;
+        return;
+    }
+
+    if (!job->prerolled) {
+        if (job->raw) {
+            samples_ok = pipeline_set_samples (pipe, job->pcm, job->caps, job->loop);
+            job->pcm = NULL;
+            if (!samples_ok) {
+                N_WARNING (LOG_CAT "invalid cached samples for '%s'", job->location);
+                job->failed = TRUE;
+                return;
+            }
+        }
+
+        g_free (pipe->location);
+        pipe->location = g_strdup (job->location);
+        if (!pipe->raw)
+            g_object_set (G_OBJECT (pipe->source), "location", pipe->location, NULL);
+
+        /* idle pipelines are often reused for the same event */
+        if (!pipe->properties || !gst_structure_is_equal (pipe->properties, job->spec->properties)) {
+            free_stream_properties (pipe->properties);
+            pipe->properties = gst_structure_copy (job->spec->properties);
+            set_stream_properties (pipe->sink, pipe->properties);
+        }
+    }
+
+    bus = gst_element_get_bus (pipe->pipeline);
+    /* drop messages posted while the pipeline was in the pool */
+    gst_bus_set_flushing (bus, TRUE);
+    gst_bus_set_flushing (bus, FALSE);
+    gst_object_unref (bus);
+
+    if (job->prerolled) {
+        /* rewind may still be in progress, then wait for async done. */
+        ret = gst_element_get_state (pipe->pipeline, &state, NULL, 0);
+        if (ret == GST_STATE_CHANGE_SUCCESS && state == GST_STATE_PAUSED) {
+            job->paused = TRUE;
+            return;
+        } else if (ret == GST_STATE_CHANGE_ASYNC) {
+            job->prerolling = TRUE;
+            return;
+        }
+    }
+
+    N_DEBUG (LOG_CAT "setting pipeline to paused");
+    if (gst_element_set_state (pipe->pipeline, GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE)
+        job->failed = TRUE;
+}
+
+/* stop a single play of a known sound that does not complete in time,
+   unless some other timeout is used already. */
+static void
+stream_set_duration_timeout (StreamData *stream, GstClockTime duration)
+{
+    if (!timeout_slack || stream->repeat_enabled)
+        return;
+
+    if (n_request_get_timeout (stream->request) != 0 && !stream->duration_timeout)
+        return;
+
+    /* duration known before the file was checked is no longer valid */
+    if (!GST_CLOCK_TIME_IS_VALID (duration)) {
+        if (stream->duration_timeout)
+            n_request_set_timeout (stream->request, 0);
+        stream->duration_timeout = FALSE;
+        return;
+    }
+
+    n_request_set_timeout (stream->request, stream->delay_startup +
+        (guint) (duration / GST_MSECOND) + timeout_slack);
+    stream->duration_timeout = TRUE;
+}
+
+/* tell the caches what the job found out about the file */
+static SoundInfoState
+prepare_job_check_file (PrepareJob *job, GstClockTime *duration)
+{
+    *duration = GST_CLOCK_TIME_NONE;
+
+    if (job->prerolled)
+        return SOUND_INFO_UNKNOWN;
+
+    if (job->st.exists)
+        sample_cache_check (job->location, job->raw, job->st.mtime, job->st.size);
+
+    return sound_info_update (job->location, &job->st, duration);
+}
+
+static void
+prepare_job_done (gpointer data)
+{
+    PrepareJob *job = data;
+    StreamData *stream = job->stream;
+    Pipeline *pipe = job->pipe;
+    GstBus *bus = NULL;
+    SoundInfoState state;
+    GstClockTime duration;
+
+    if (stream)
+        stream->job = NULL;
+
+    state = prepare_job_check_file (job, &duration);
+    if (stream && state == SOUND_INFO_INVALID) {
+        N_WARNING (LOG_CAT "'%s' is missing or has no playable audio", job->location);
+        sounds_rejected++;
+        job->failed = TRUE;
+    }
+
+    if (!stream || job->failed) {
+        if (pipe)
+            pool_release (pipe, !job->failed);
+        prepare_job_free (job);
+
+        if (stream) {
+            N_WARNING (LOG_CAT "failed to prepare pipeline for '%s'", stream->filename);
+            n_sink_interface_fail (stream->iface, stream->request);
+        }
+        return;
+    }
+
+    bus = gst_element_get_bus (pipe->pipeline);
+    stream->bus_watch_id = gst_bus_add_watch (bus, bus_cb, stream);
+    gst_object_unref (bus);
+
+    stream->pooled = pipe;
+    stream->pipeline = pipe->pipeline;
+    stream->pipeline_state = GST_STATE_NULL;
+    stream->volume = pipe->volume;
+    stream->prerolling = job->prerolling;
+
+    if (!job->prerolled)
+        stream_set_duration_timeout (stream, duration);
+
+    (void) create_volume (stream);
+
+    /* already prerolled, no state change to wait for. */
+    if (job->paused) {
+        stream->pipeline_state = GST_STATE_PAUSED;
+        stream_preroll_done (stream);
+    }
+
+    prepare_job_free (job);
+}
+
+static void
+prewarm_job_done (gpointer data)
+{
+    PrepareJob *job = data;
+    Prewarm *prewarm = job->prewarm;
+    GstClockTime duration;
+
+    if (prewarm)
+        prewarm->job = NULL;
+
+    if (prepare_job_check_file (job, &duration) == SOUND_INFO_INVALID)
+        job->failed = TRUE;
+
+    if (!prewarm || job->failed) {
+        if (job->pipe)
+            pool_release (job->pipe, !job->failed);
+        prepare_job_free (job);
+        return;
+    }
+
+    /* prepare of the predicted request takes it from the prerolled ones */
+    N_DEBUG (LOG_CAT "prewarmed pipeline for '%s'", job->location);
+    job->pipe->prewarm = prewarm;
+    prewarm->pipe = job->pipe;
+    preroll_pipelines = g_list_prepend (preroll_pipelines, job->pipe);
+    prepare_job_free (job);
+}
+
+/* Branch is built and linked to the mixer in the worker, and the mixer
+   too if it is new. */
+static void
+mixer_branch_job_run (gpointer data)
+{
+    PrepareJob *job = data;
+    Pipeline *pipe = NULL;
+    gboolean samples_ok;
+
+    if (!job->mixer->pipeline && !mixer_build (job->mixer)) {
+        job->failed = TRUE;
+        return;
+    }
+
+    sound_info_stat (job->location, &job->st);
+    if (!job->st.exists) {
+        job->failed = TRUE;
+        return;
+    }
+
+    /* modified since it was cached, decode it instead */
+    if (job->raw && job->st.mtime != job->cache_mtime) {
+        gst_buffer_unref (job->pcm);
+        gst_caps_unref (job->caps);
+        job->pcm = NULL;
+        job->caps = NULL;
+        job->raw = FALSE;
+    }
+
+    if (!(pipe = job->raw ? pipeline_raw_new (TRUE) : pipeline_new (TRUE))) {
+        job->failed = TRUE;
+        return;
+    }
+
+    if (job->raw) {
+        samples_ok = pipeline_set_samples (pipe, job->pcm, job->caps, FALSE);
+        job->pcm = NULL;
+        if (!samples_ok) {
+            N_WARNING (LOG_CAT "invalid cached samples for '%s'", job->location);
+            pipeline_free (pipe);
+            job->failed = TRUE;
+            return;
+        }
+    } else {
+        g_object_set (G_OBJECT (pipe->source), "location", job->location, NULL);
+    }
+
+    pipe->location = g_strdup (job->location);
+
+    if (!mixer_link_branch (job->mixer, pipe)) {
+        pipeline_free (pipe);
+        job->failed = TRUE;
+        return;
+    }
+
+    job->pipe = pipe;
+}
+
+static void
+mixer_branch_pause_run (gpointer data)
+{
+    PrepareJob *job = data;
+
+    N_DEBUG (LOG_CAT "setting branch to paused");
+    if (gst_element_set_state (job->pipe->pipeline, GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE)
+        job->failed = TRUE;
+}
+
+/* preroll of the branch is seen on the mixer bus like for pipelines of
+   their own, only a failed state change is handled here. */
+static void
+mixer_branch_pause_done (gpointer data)
+{
+    PrepareJob *job = data;
+    StreamData *stream = job->stream;
+
+    /* branch belongs to the stream now */
+    job->pipe = NULL;
+
+    if (stream) {
+        stream->job = NULL;
+
+        if (job->failed) {
+            N_WARNING (LOG_CAT "failed to pause branch for '%s'", stream->filename);
+            stream->pipeline_failed = TRUE;
+            n_sink_interface_fail (stream->iface, stream->request);
+        }
+    }
+
+    prepare_job_free (job);
+}
+
+/* Branch goes to the stream and the mixer before the worker pauses it,
+   so that messages of the branch find the stream. */
+static void
+mixer_branch_job_done (gpointer data)
+{
+    PrepareJob *job = data;
+    StreamData *stream = job->stream;
+    Mixer *mixer = job->mixer;
+    Pipeline *pipe = job->pipe;
+    SoundInfoState state;
+    GstClockTime duration;
+
+    mixer->jobs--;
+    mixer_watch (mixer);
+    if (!mixer->pipeline)
+        mixer->failed = TRUE;
+
+    state = prepare_job_check_file (job, &duration);
+    if (stream && state == SOUND_INFO_INVALID) {
+        N_WARNING (LOG_CAT "'%s' is missing or has no playable audio", job->location);
+        sounds_rejected++;
+        job->failed = TRUE;
     }
 
-    g_signal_connect (G_OBJECT (decoder), "pad-added",
-        G_CALLBACK (new_decoded_pad_cb), audioconv);
+    if (!stream || job->failed || mixer->failed) {
+        if (pipe)
+            worker_push (mixer_branch_free_run, NULL, pipe);
+        job->pipe = NULL;
+        mixer_unuse (mixer);
+        prepare_job_free (job);
 
-    g_object_set (G_OBJECT (source), "location", stream->filename, NULL);
+        if (stream) {
+            stream->job = NULL;
+            N_WARNING (LOG_CAT "failed to add '%s' to mixer", stream->filename);
+            n_sink_interface_fail (stream->iface, stream->request);
+        }
+        return;
+    }
 
-    bus = gst_element_get_bus (pipeline);
-    stream->bus_watch_id = gst_bus_add_watch (bus, bus_cb, stream);
-    gst_object_unref (bus);
+    N_DEBUG (LOG_CAT "added '%s' to mixer", stream->filename);
 
-    set_stream_properties (sink, stream->properties);
+    if (!mixer->streams)
+        worker_push (mixer_play_run, NULL, mixer);
+    mixer->streams = g_list_append (mixer->streams, stream);
 
-    stream->pipeline = pipeline;
+    stream->pooled = pipe;
+    stream->pipeline = pipe->pipeline;
     stream->pipeline_state = GST_STATE_NULL;
-    stream->volume = volume;
+    stream->volume = pipe->volume;
+
+    stream_set_duration_timeout (stream, duration);
 
     (void) create_volume (stream);
 
-    return TRUE;
+    worker_push (mixer_branch_pause_run, mixer_branch_pause_done, job);
+}
 
-failed:
-    free_volume (stream);
+static void
+make_mixer_branch (StreamData *stream)
+{
+    PrepareJob *job = NULL;
+
+    job = g_slice_new0 (PrepareJob);
+    job->stream = stream;
+    job->location = g_strdup (stream->filename);
+    job->spec = stream_spec_ref (stream->spec);
+    job->raw = sample_cache_lookup (job->location, &job->pcm, &job->caps, &job->cache_mtime);
+    job->mixer = mixer_get (stream->spec->properties);
+    job->mixer->jobs++;
+
+    stream->job = job;
+    worker_push (mixer_branch_job_run, mixer_branch_job_done, job);
+}
 
-    if (sink)
-        gst_object_unref (sink);
-    if (volume)
-        gst_object_unref (volume);
-    if (audioconv)
-        gst_object_unref (audioconv);
-    if (decoder)
-        gst_object_unref (decoder);
-    if (source)
-        gst_object_unref (source);
+/* Build or set up the pipeline in the worker, stream continues in
+   prepare_job_done, or for branches of the mixer in mixer_branch_job_done. */
+static int
+make_pipeline (StreamData *stream)
+{
+    PrepareJob *job = NULL;
 
-failed_pipeline:
-    if (pipeline)
-        gst_object_unref (pipeline);
+    /* repeating sounds need seeking, which branches do not support */
+    if (mixer_enabled && !stream->repeat_enabled) {
+        make_mixer_branch (stream);
+        return TRUE;
+    }
 
-    return FALSE;
+    job = g_slice_new0 (PrepareJob);
+    job->stream = stream;
+    job->location = g_strdup (stream->filename);
+    job->spec = stream_spec_ref (stream->spec);
+    job->loop = stream->repeat_enabled;
+    job->pipe = pool_take (job);
+
+    stream->job = job;
+    worker_push (prepare_job_run, prepare_job_done, job);
+
+    return TRUE;
 }
 
 static void
 free_pipeline (StreamData *stream)
 {
-    if (stream->pipeline) {
-        N_DEBUG (LOG_CAT "freeing pipeline");
-        gst_element_set_state (stream->pipeline, GST_STATE_NULL);
-        gst_object_unref (stream->pipeline);
-        stream->pipeline = NULL;
+    /* pipeline of the job is released once the job is done */
+    if (stream->job) {
+        stream->job->stream = NULL;
+        stream->job = NULL;
     }
 
     if (stream->bus_watch_id > 0) {
@@ -681,6 +2149,17 @@ free_pipeline (StreamData *stream)
     }
 
     free_volume (stream);
+    stream_free_first_sample (stream);
+
+    if (stream->pooled) {
+        if (stream->pooled->mixer)
+            mixer_remove_branch (stream);
+        else
+            pool_release (stream->pooled, !stream->pipeline_failed);
+        stream->pooled = NULL;
+        stream->pipeline = NULL;
+        stream->volume = NULL;
+    }
 }
 
 static void
@@ -733,6 +2212,63 @@ call_state_changed (NContext *context,
     }
 }
 
+/* sound.filename of an event, or a profile key stored to it, like
+   "ringing.alert.tone@fallback => sound.filename" */
+static void
+discover_event_sound_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    NContext *context = userdata;
+    const NValue *tone = NULL;
+    const char *str = NULL;
+    gchar **tokens = NULL;
+    gchar **source = NULL;
+    gchar *context_key = NULL;
+
+    if (n_value_type (value) != N_VALUE_TYPE_STRING)
+        return;
+
+    str = n_value_get_string (value);
+
+    if (g_str_equal (key, SOUND_FILENAME_KEY)) {
+        file_check (str, FALSE);
+        return;
+    }
+
+    tokens = g_strsplit (str, "=>", 2);
+    if (!tokens[1] || !g_str_equal (g_strstrip (tokens[1]), SOUND_FILENAME_KEY)) {
+        g_strfreev (tokens);
+        return;
+    }
+
+    source = g_strsplit (g_strstrip (tokens[0]), "@", 2);
+    context_key = g_strdup_printf ("profile.%s.%s",
+        source[1] ? g_strstrip (source[1]) : "current", g_strstrip (source[0]));
+
+    tone = n_context_get_value (context, context_key);
+    if (tone && n_value_type (tone) == N_VALUE_TYPE_STRING)
+        file_check (n_value_get_string (tone), FALSE);
+
+    g_free (context_key);
+    g_strfreev (source);
+    g_strfreev (tokens);
+}
+
+static void
+profile_tone_changed (NContext *context,
+                      const char *key,
+                      const NValue *old_value,
+                      const NValue *new_value,
+                      void *userdata)
+{
+    (void) context;
+    (void) old_value;
+    (void) userdata;
+
+    if (new_value && n_value_type (new_value) == N_VALUE_TYPE_STRING &&
+        g_str_has_prefix (key, "profile.") && g_str_has_suffix (key, ".tone"))
+        file_check (n_value_get_string (new_value), FALSE);
+}
+
 static void
 init_done_cb (NHook *hook, void *data, void *userdata)
 {
@@ -756,6 +2292,62 @@ init_done_cb (NHook *hook, void *data, void *userdata)
     }
 
     n_context_subscribe_value_change (context, "call_state.mode", call_state_changed, NULL);
+
+    /* warm the sample cache */
+    for (gchar **file = preload_sounds; file && *file; file++) {
+        if (**file != '\0')
+            file_check (*file, TRUE);
+    }
+
+    /* learn about all the sounds events may play */
+    for (GList *iter = n_core_get_events (plugin_core); iter; iter = g_list_next (iter))
+        n_proplist_foreach (n_event_get_properties (iter->data), discover_event_sound_cb, context);
+
+    n_context_subscribe_value_change (context, NULL, profile_tone_changed, NULL);
+}
+
+static void
+collect_metrics_cb (NHook *hook, void *data, void *userdata)
+{
+    NCoreHookCollectMetricsData *collect = data;
+    guint hits, misses, entries, invalid, pending;
+    gsize bytes;
+
+    (void) hook;
+    (void) userdata;
+
+    sample_cache_get_stats (&hits, &misses, &entries, &bytes);
+
+    n_proplist_set_uint (collect->metrics, "gst.cache.hits", hits);
+    n_proplist_set_uint (collect->metrics, "gst.cache.misses", misses);
+    n_proplist_set_uint (collect->metrics, "gst.cache.hit_rate_percent",
+        hits + misses > 0 ? hits * 100 / (hits + misses) : 0);
+    n_proplist_set_uint (collect->metrics, "gst.cache.entries", entries);
+    n_proplist_set_uint (collect->metrics, "gst.cache.bytes", bytes);
+
+    sound_info_get_stats (&entries, &invalid, &pending);
+
+    n_proplist_set_uint (collect->metrics, "gst.sound_info.entries", entries);
+    n_proplist_set_uint (collect->metrics, "gst.sound_info.invalid", invalid);
+    n_proplist_set_uint (collect->metrics, "gst.sound_info.pending", pending);
+    n_proplist_set_uint (collect->metrics, "gst.sound_info.rejected", sounds_rejected);
+
+    stream_spec_get_stats (&hits, &misses, &entries);
+
+    n_proplist_set_uint (collect->metrics, "gst.stream_spec.hits", hits);
+    n_proplist_set_uint (collect->metrics, "gst.stream_spec.misses", misses);
+    n_proplist_set_uint (collect->metrics, "gst.stream_spec.entries", entries);
+
+    n_proplist_set_uint (collect->metrics, "gst.prewarm.started", prewarm_started);
+    n_proplist_set_uint (collect->metrics, "gst.prewarm.used", prewarm_used);
+    n_proplist_set_uint (collect->metrics, "gst.prewarm.dropped", prewarm_dropped);
+
+    g_mutex_lock (&first_sample_lock);
+    n_proplist_set_uint (collect->metrics, "gst.first_sample.decoded.avg_us",
+        first_sample_count[0] ? first_sample_total[0] / first_sample_count[0] : 0);
+    n_proplist_set_uint (collect->metrics, "gst.first_sample.cached.avg_us",
+        first_sample_count[1] ? first_sample_total[1] / first_sample_count[1] : 0);
+    g_mutex_unlock (&first_sample_lock);
 }
 
 static int
@@ -765,8 +2357,17 @@ gst_sink_initialize (NSinkInterface *iface)
 
     N_DEBUG (LOG_CAT "initializing GStreamer");
 
+    if (!g_str_equal (sink_element, DEFAULT_SINK_ELEMENT))
+        N_INFO (LOG_CAT "using '%s' for audio output", sink_element);
+
     gst_init_check (NULL, NULL, NULL);
 
+    worker_init ();
+    stream_spec_init ();
+    sound_info_init (sound_info_path);
+    sample_cache_init (cache_size, cache_max_file_size);
+    pool_fill ();
+
     return TRUE;
 }
 
@@ -776,6 +2377,12 @@ gst_sink_shutdown (NSinkInterface *iface)
     (void) iface;
 
     stream_list_stop_all ();
+    worker_shutdown ();
+    pool_clear ();
+    mixer_clear ();
+    sample_cache_shutdown ();
+    sound_info_shutdown ();
+    stream_spec_shutdown ();
 }
 
 static int
@@ -794,158 +2401,6 @@ gst_sink_can_handle (NSinkInterface *iface, NRequest *request)
     return FALSE;
 }
 
-static int
-convert_number (const char *str, gint *result)
-{
-    long n;
-    char *end;
-    int errcode;
-
-    errno = 0;
-    n = strtol (str, &end, 10);
-    errcode = errno;
-    
-    if ((n == 0 && str == end)
-        || (n == 0 && errcode == EINVAL)
-        || ((n == LONG_MAX || n == LONG_MIN) && errcode == ERANGE)
-        || (n > G_MAXINT || n < G_MININT))
-    {
-        *result = (gint) 0;
-        return 0;
-    }
-
-    *result = (gint) n;
-
-    return 1;
-}
-
-static FadeEffect*
-fade_effect_new (gdouble position, gdouble length, gdouble start, gdouble end)
-{
-    FadeEffect *effect;
-
-    effect = g_slice_new (FadeEffect);
-    effect->enabled  = TRUE;
-    effect->elapsed  = 0;
-    effect->position = position;
-    effect->length   = length;
-    effect->start    = start;
-    effect->end      = end;
-
-    return effect;
-}
-
-static void
-fade_effect_free (FadeEffect *effect)
-{
-    if (effect)
-        g_slice_free (FadeEffect, effect);
-}
-
-static FadeEffect*
-parse_volume_fade (const char *str)
-{
-#define VALID_NUMBER(in_f) \
-    (valid = (valid == 0) ? 0 : (in_f))
-
-    /* fade key has four values defined: position, length, start value, end value */
-
-    FadeEffect *effect = NULL;
-    gchar **split = NULL;
-    gint position, length, start, end;
-    int valid = 1;
-
-    if (str == NULL)
-        return NULL;
-
-    split = g_strsplit (str, ",", 4);
-
-    if (split[0] && split[1] && split[2] && split[3]) {
-
-        VALID_NUMBER (convert_number (split[0], &position));
-        VALID_NUMBER (convert_number (split[1], &length));
-        VALID_NUMBER (convert_number (split[2], &start));
-        VALID_NUMBER (convert_number (split[3], &end));
-
-        if (valid)
-            effect = fade_effect_new (position, length, start / 1000.0, end / 1000.0);
-    }
-
-    g_strfreev (split);
-
-    if (effect) {
-        N_DEBUG (LOG_CAT "fade effect parsed (enabled=%d elapsed=%.2f position=%.2f "
-                         "length=%.2f start=%.2f stop=%.2f)", effect->enabled ? 1 : 0,
-            effect->elapsed, effect->position, effect->length, effect->start, effect->end);
-    }
-    else {
-        N_DEBUG (LOG_CAT "invalid fade effect, unable to parse: '%s'", str);
-    }
-
-    return effect;
-
-#undef VALID_NUMBER
-}
-
-static void
-set_fade_effect (GstControlSource *source, FadeEffect *effect)
-{
-    gdouble start_time, new_length;
-
-    if (source == NULL || effect == NULL || !effect->enabled)
-        return;
-
-    /* effect not started yet */
-
-    if (effect->elapsed < effect->position) {
-        start_time = effect->position - effect->elapsed;
-        new_length = effect->length;
-    }
-
-    /* effect in progress */
-
-    else if (effect->elapsed >= effect->position
-             && effect->elapsed < (effect->position + effect->length)) {
-        start_time = 0;
-        new_length = effect->length - (effect->elapsed - effect->position);
-    }
-
-    /* done and finished */
-
-    else {
-        N_DEBUG (LOG_CAT "fade effect disabled (elapsed=%.2f position=%.2f "
-                         "length=%.2f start=%.2f stop=%.2f)", effect->elapsed,
-            effect->position, effect->length, effect->start, effect->end);
-        effect->enabled = FALSE;
-        return;
-    }
-
-    gst_timed_value_control_source_set (GST_TIMED_VALUE_CONTROL_SOURCE (source),
-	start_time * GST_SECOND, effect->start);
-
-    gst_timed_value_control_source_set (GST_TIMED_VALUE_CONTROL_SOURCE (source),
-        (start_time + new_length) * GST_SECOND, effect->end);
-
-    N_DEBUG (LOG_CAT "fade effect (%.2f -> %.2f) to start from %.2f and end at %.2f seconds",
-        effect->start, effect->end, start_time, start_time + new_length);
-}
-
-static void
-update_fade_effect (FadeEffect *effect, gdouble elapsed, gdouble volume)
-{
-    if (effect == NULL || !effect->enabled)
-        return;
-
-    effect->elapsed = elapsed;
-    effect->start = volume;
-
-    N_DEBUG (LOG_CAT "fade effect updated (enabled=%d elapsed=%.2f position=%.2f "
-                     "length=%.2f start=%.2f stop=%.2f)", effect->enabled ? 1 : 0,
-        effect->elapsed, effect->position, effect->length, effect->start, effect->end);
-
-    return;
-}
-
 static gboolean
 gst_sink_synchronize_cb (gpointer userdata)
 {
@@ -996,39 +2451,54 @@ stream_list_remove (StreamData *stream)
     active_streams = g_list_remove (active_streams, stream);
 }
 
+static gboolean
+is_sound_enabled (NProplist *props)
+{
+    NValue *enabled = NULL;
+
+    enabled = n_proplist_get (props, SOUND_ENABLED_KEY);
+    if (enabled) {
+        if (n_value_type (enabled) == N_VALUE_TYPE_STRING)
+            return g_str_equal (n_value_get_string (enabled), SOUND_OFF) ? FALSE : TRUE;
+        else if (n_value_type (enabled) == N_VALUE_TYPE_BOOL)
+            return n_value_get_bool (enabled);
+    }
+
+    return TRUE;
+}
+
 static int
 gst_sink_prepare (NSinkInterface *iface, NRequest *request)
 {
     StreamData *stream = NULL;
     NProplist *props = NULL;
     gint timeout_ms;
-    gboolean custom_sound, fade_only_custom;
-    NValue *enabled = NULL;
+    GstClockTime duration = GST_CLOCK_TIME_NONE;
 
     props = (NProplist*) n_request_get_properties (request);
 
     stream = g_slice_new0 (StreamData);
+    stream->prepare_time = g_get_monotonic_time ();
     stream->request = request;
     stream->iface = iface;
     stream->filename = n_proplist_get_string (props, SOUND_FILENAME_KEY);
     stream->repeat_enabled = n_proplist_get_bool (props, SOUND_REPEAT_KEY);
-    stream->properties = create_stream_properties (props);
     stream->state = STREAM_STATE_NOT_STARTED;
 
-    stream->sound_enabled = TRUE;
-    enabled = n_proplist_get (props, SOUND_ENABLED_KEY);
-    if (enabled) {
-        if (n_value_type (enabled) == N_VALUE_TYPE_STRING)
-            stream->sound_enabled = g_str_equal (n_value_get_string (enabled), SOUND_OFF) ? FALSE : TRUE;
-        else if (n_value_type (enabled) == N_VALUE_TYPE_BOOL)
-            stream->sound_enabled = n_value_get_bool (enabled);
+    stream->sound_enabled = is_sound_enabled (props);
+
+    /* known broken sound goes to the fallback right away, the file is
+       checked again in case it has been replaced since. */
+    if (stream->sound_enabled &&
+        sound_info_lookup (stream->filename, &duration) == SOUND_INFO_INVALID) {
+        N_WARNING (LOG_CAT "'%s' is missing or has no playable audio", stream->filename);
+        sounds_rejected++;
+        file_check (stream->filename, FALSE);
+        g_slice_free (StreamData, stream);
+        return FALSE;
     }
 
-    stream->volume_limit = parse_volume_limit (n_proplist_get_string (props, SOUND_VOLUME_KEY),
-        &stream->volume_min, &stream->volume_max);
-    
-    stream->volume_fixed = parse_fixed_volume (n_proplist_get_string (props, SOUND_VOLUME_KEY),
-        &stream->volume_set);
+    stream->spec = get_stream_spec (request, props);
 
     stream->delay_startup = n_proplist_get_int (props, SOUND_DELAY_STARTUP);
     stream->delay_stop = n_proplist_get_int (props, SOUND_DELAY_STOP);
@@ -1036,24 +2506,16 @@ gst_sink_prepare (NSinkInterface *iface, NRequest *request)
     stream->fade_resume = n_proplist_get_int (props, SOUND_FADE_RESUME);
     stream->fade_stop = n_proplist_get_int (props, SOUND_FADE_STOP);
 
-    fade_only_custom = n_proplist_get_bool (props, FADE_ONLY_CUSTOM_KEY);
-    custom_sound = is_custom_sound_filename (stream->filename);
-
-    if (!fade_only_custom || (fade_only_custom && custom_sound)) {
-        /* parse the volume fading keys and setup fades for the stream
-           if available */
-
-        stream->fade_out = parse_volume_fade (
-            n_proplist_get_string (props, FADE_OUT_KEY));
-        stream->fade_in = parse_volume_fade (
-            n_proplist_get_string (props, FADE_IN_KEY));
-
+    if (stream->spec->fade_enabled) {
         timeout_ms = n_proplist_get_int (props, MAX_TIMEOUT_KEY);
         timeout_ms = timeout_ms < 0 ? 0 : timeout_ms;
 
         n_request_set_timeout (request, (guint) timeout_ms);
     }
 
+    /* checked again once the worker has looked at the file */
+    stream_set_duration_timeout (stream, duration);
+
     /* store data ... */
 
     n_request_store_data (request, GST_KEY, stream);
@@ -1072,9 +2534,6 @@ gst_sink_prepare (NSinkInterface *iface, NRequest *request)
     if (!make_pipeline (stream))
         return FALSE;
 
-    N_DEBUG (LOG_CAT "setting pipeline to paused");
-    gst_element_set_state (stream->pipeline, GST_STATE_PAUSED);
-
     if (stream->delay_startup) {
         /* synchronize after startup delay so that vibra etc effects
          * start at the same time with delayed gst events as well. */
@@ -1086,6 +2545,85 @@ gst_sink_prepare (NSinkInterface *iface, NRequest *request)
     return TRUE;
 }
 
+/* Preroll a pipeline for the request the core predicts, prepare of the
+   real request then finds it among the prerolled pipelines. */
+static int
+gst_sink_prewarm (NSinkInterface *iface, NRequest *request)
+{
+    NProplist *props = NULL;
+    PrepareJob *job = NULL;
+    Prewarm *prewarm = NULL;
+    const gchar *filename;
+    gboolean repeat;
+    GstClockTime duration;
+
+    (void) iface;
+
+    props = (NProplist*) n_request_get_properties (request);
+    filename = n_proplist_get_string (props, SOUND_FILENAME_KEY);
+    repeat = n_proplist_get_bool (props, SOUND_REPEAT_KEY);
+
+    if (!filename || !is_sound_enabled (props))
+        return FALSE;
+
+    /* mixer branches are not prerolled */
+    if (mixer_enabled && !repeat)
+        return FALSE;
+
+    if (sound_info_lookup (filename, &duration) == SOUND_INFO_INVALID)
+        return FALSE;
+
+    job = g_slice_new0 (PrepareJob);
+    job->location = g_strdup (filename);
+    job->spec = get_stream_spec (request, props);
+    job->loop = repeat;
+
+    if (pool_find_prerolled (job->location, job->spec->properties, job->loop)) {
+        N_DEBUG (LOG_CAT "'%s' is prerolled already", filename);
+        prepare_job_free (job);
+        return FALSE;
+    }
+
+    job->pipe = pool_take (job);
+
+    prewarm = g_slice_new0 (Prewarm);
+    prewarm->job = job;
+    job->prewarm = prewarm;
+    n_request_store_data (request, GST_PREWARM_KEY, prewarm);
+
+    N_DEBUG (LOG_CAT "prewarming pipeline for '%s'", filename);
+    prewarm_started++;
+    worker_push (prepare_job_run, prewarm_job_done, job);
+
+    return TRUE;
+}
+
+static void
+gst_sink_drop_prewarm (NSinkInterface *iface, NRequest *request)
+{
+    Prewarm *prewarm = NULL;
+
+    (void) iface;
+
+    if (!(prewarm = n_request_get_data (request, GST_PREWARM_KEY)))
+        return;
+
+    if (prewarm->job) {
+        /* pipeline is released when the job is done */
+        prewarm->job->prewarm = NULL;
+        prewarm_dropped++;
+    } else if (prewarm->pipe) {
+        N_DEBUG (LOG_CAT "dropping unused prewarmed pipeline for '%s'", prewarm->pipe->location);
+        preroll_pipelines = g_list_remove (preroll_pipelines, prewarm->pipe);
+        prewarm->pipe->prewarm = NULL;
+        pool_release (prewarm->pipe, TRUE);
+        prewarm_dropped++;
+    }
+
+    n_request_store_data (request, GST_PREWARM_KEY, NULL);
+    g_slice_free (Prewarm, prewarm);
+}
+
 static int
 gst_sink_play (NSinkInterface *iface, NRequest *request)
 {
@@ -1109,10 +2647,11 @@ gst_sink_play (NSinkInterface *iface, NRequest *request)
 
         if (stream->state == STREAM_STATE_NOT_STARTED) {
             N_DEBUG (LOG_CAT "first time setting pipeline to playing");
-            gst_element_set_state (stream->pipeline, GST_STATE_PLAYING);
+            stream_measure_first_sample (stream);
+            stream_set_state (stream, GST_STATE_PLAYING);
         } else if (stream->state == STREAM_STATE_PAUSED) {
             N_DEBUG (LOG_CAT "resuming by setting pipeline to playing");
-            gst_element_set_state (stream->pipeline, GST_STATE_PLAYING);
+            stream_set_state (stream, GST_STATE_PLAYING);
             if (stream->fade_resume)
                 start_stream_fade (stream, (gdouble) stream->fade_resume / 1000.0,
                                    GST_VOLUME_SILENT, GST_VOLUME_0DB, NULL);
@@ -1128,7 +2667,7 @@ static void
 stream_pause (StreamData *stream)
 {
     N_DEBUG (LOG_CAT "pause");
-    gst_element_set_state (stream->pipeline, GST_STATE_PAUSED);
+    stream_set_state (stream, GST_STATE_PAUSED);
 }
 
 static int
@@ -1160,14 +2699,8 @@ static void
 cleanup (StreamData *stream)
 {
     free_pipeline (stream);
-    free_stream_properties (stream->properties);
-    stream->properties = NULL;
-
-    fade_effect_free (stream->fade_out);
-    stream->fade_out = NULL;
-
-    fade_effect_free (stream->fade_in);
-    stream->fade_in = NULL;
+    stream_spec_unref (stream->spec);
+    stream->spec = NULL;
 }
 
 static void
@@ -1178,7 +2711,7 @@ stream_stop (StreamData *stream)
     stream_clear_delays (stream);
 
     if (stream->pipeline)
-        gst_element_set_state (stream->pipeline, GST_STATE_PAUSED);
+        stream_pause_async (stream);
 
     stream_list_remove (stream);
     stop_stream_fade (stream);
@@ -1195,7 +2728,7 @@ gst_sink_stop_all_cb (gpointer userdata)
     stream_clear_delays (stream);
 
     if (stream->pipeline)
-        gst_element_set_state (stream->pipeline, GST_STATE_PAUSED);
+        stream_pause_async (stream);
 
     stop_stream_fade (stream);
     cleanup (stream);
@@ -1249,7 +2782,7 @@ gst_sink_stop (NSinkInterface *iface, NRequest *request)
             stream->delay_stop_source = g_timeout_add (stream->delay_stop,
                                                        gst_sink_delayed_stop_cb,
                                                        stream);
-            gst_element_set_state (stream->pipeline, GST_STATE_PAUSED);
+            stream_pause_async (stream);
         } else {
             N_DEBUG (LOG_CAT "setup faded stop");
             start_stream_fade (stream, (gdouble) stream->fade_stop / 1000.0,
@@ -1273,6 +2806,65 @@ stream_list_stop_all ()
     active_streams = NULL;
 }
 
+static void
+parse_params (const NProplist *params)
+{
+    const char *value;
+    gchar **files;
+    gchar **file;
+
+    if ((value = n_proplist_get_string (params, POOL_SIZE_KEY)))
+        pool_size = atoi (value);
+
+    if ((value = n_proplist_get_string (params, MIXER_KEY)))
+        mixer_enabled = g_str_equal (value, "true");
+
+    if ((value = n_proplist_get_string (params, CACHE_SIZE_KEY)))
+        cache_size = g_ascii_strtoull (value, NULL, 10);
+
+    if ((value = n_proplist_get_string (params, CACHE_MAX_FILE_KEY)))
+        cache_max_file_size = g_ascii_strtoull (value, NULL, 10);
+
+    if ((value = n_proplist_get_string (params, TIMEOUT_SLACK_KEY)))
+        timeout_slack = atoi (value);
+
+    /* empty value keeps the sound info in memory only */
+    if ((value = n_proplist_get_string (params, SOUND_INFO_KEY)))
+        sound_info_path = *value ? g_strdup (value) : NULL;
+    else
+        sound_info_path = g_build_filename (g_get_user_cache_dir (), "ngfd", "sound-info", NULL);
+
+    sink_element = g_strdup (n_proplist_get_string (params, SINK_ELEMENT_KEY));
+    if (!sink_element || *sink_element == '\0') {
+        g_free (sink_element);
+        sink_element = g_strdup (DEFAULT_SINK_ELEMENT);
+    }
+
+    if ((value = n_proplist_get_string (params, SINK_LOCATION_KEY)) && *value)
+        sink_location = g_strdup (value);
+    else
+        sink_location = g_build_filename (g_get_tmp_dir (), DEFAULT_SINK_LOCATION, NULL);
+
+    if ((value = n_proplist_get_string (params, PRELOAD_KEY))) {
+        preload_sounds = g_strsplit (value, ";", -1);
+        for (file = preload_sounds; *file; file++)
+            g_strstrip (*file);
+    }
+
+    if (!(value = n_proplist_get_string (params, PREROLL_SOUNDS_KEY)))
+        return;
+
+    preroll_sounds = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    files = g_strsplit (value, ";", -1);
+    for (file = files; *file; file++) {
+        g_strstrip (*file);
+        if (**file != '\0')
+            g_hash_table_add (preroll_sounds, g_strdup (*file));
+    }
+    g_strfreev (files);
+}
+
 N_PLUGIN_LOAD (plugin)
 {
     NCore    *core    = NULL;
@@ -1287,9 +2879,13 @@ N_PLUGIN_LOAD (plugin)
         .prepare    = gst_sink_prepare,
         .play       = gst_sink_play,
         .pause      = gst_sink_pause,
-        .stop       = gst_sink_stop
+        .stop       = gst_sink_stop,
+        .prewarm    = gst_sink_prewarm,
+        .drop_prewarm = gst_sink_drop_prewarm
     };
 
+    parse_params (n_plugin_get_params (plugin));
+
     n_plugin_register_sink (plugin, &decl);
 
     core = n_plugin_get_core (plugin);
@@ -1301,6 +2897,10 @@ N_PLUGIN_LOAD (plugin)
         N_ERROR (LOG_CAT "failed to setup init done hook.");
     }
 
+    n_core_connect (core, N_CORE_HOOK_COLLECT_METRICS, 0, collect_metrics_cb, NULL);
+
+    plugin_core = core;
+
     return TRUE;
 }
 
@@ -1318,4 +2918,26 @@ N_PLUGIN_UNLOAD (plugin)
 
     n_core_disconnect (core, N_CORE_HOOK_INIT_DONE,
         init_done_cb, context);
+    n_core_disconnect (core, N_CORE_HOOK_COLLECT_METRICS,
+        collect_metrics_cb, NULL);
+
+    n_context_unsubscribe_value_change (context, NULL, profile_tone_changed);
+    plugin_core = NULL;
+
+    g_free (sound_info_path);
+    sound_info_path = NULL;
+
+    g_free (sink_element);
+    sink_element = NULL;
+
+    g_free (sink_location);
+    sink_location = NULL;
+
+    g_strfreev (preload_sounds);
+    preload_sounds = NULL;
+
+    if (preroll_sounds) {
+        g_hash_table_destroy (preroll_sounds);
+        preroll_sounds = NULL;
+    }
 }
@@ -0,0 +1,456 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <ngf/log.h>
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+
+#include "sample-cache.h"
+#include "worker.h"
+
+#define LOG_CAT "gst-cache: "
+
+typedef struct _CacheEntry
+{
+    gchar      *filename;
+    gint64      mtime;
+    GstBuffer  *pcm;
+    GstCaps    *caps;
+    gsize       size;
+} CacheEntry;
+
+/* Decode pipeline is built, started and stopped in the worker, the
+   main loop only watches its bus. */
+typedef struct _Decode
+{
+    gchar      *filename;
+    gint64      mtime;
+    GstElement *pipeline;
+    guint       bus_watch_id;
+    gboolean    eos;
+    /* written from the streaming thread until the pipeline is stopped */
+    GByteArray *data;
+    GstCaps    *caps;
+} Decode;
+
+static GHashTable *cache_entries;   /* filename -> GList link in cache_lru */
+static GQueue      cache_lru = G_QUEUE_INIT;    /* CacheEntry*, most recent first */
+static GHashTable *cache_decodes;   /* filename -> Decode* */
+static gsize       cache_budget;
+static gsize       cache_max_file_size;
+static gsize       cache_used;
+static guint       cache_hits;
+static guint       cache_misses;
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+    g_free (entry->filename);
+    gst_buffer_unref (entry->pcm);
+    gst_caps_unref (entry->caps);
+    g_slice_free (CacheEntry, entry);
+}
+
+static void
+cache_remove (GList *link)
+{
+    CacheEntry *entry = link->data;
+
+    N_DEBUG (LOG_CAT "dropping '%s' (%" G_GSIZE_FORMAT " bytes)", entry->filename, entry->size);
+
+    g_hash_table_remove (cache_entries, entry->filename);
+    g_queue_delete_link (&cache_lru, link);
+    cache_used -= entry->size;
+    cache_entry_free (entry);
+}
+
+static void
+cache_insert (CacheEntry *entry)
+{
+    GList *link;
+
+    if (entry->size > cache_budget) {
+        N_DEBUG (LOG_CAT "'%s' does not fit in cache", entry->filename);
+        cache_entry_free (entry);
+        return;
+    }
+
+    if ((link = g_hash_table_lookup (cache_entries, entry->filename)))
+        cache_remove (link);
+
+    while (cache_used + entry->size > cache_budget)
+        cache_remove (g_queue_peek_tail_link (&cache_lru));
+
+    g_queue_push_head (&cache_lru, entry);
+    g_hash_table_insert (cache_entries, entry->filename, g_queue_peek_head_link (&cache_lru));
+    cache_used += entry->size;
+
+    N_DEBUG (LOG_CAT "cached '%s' (%" G_GSIZE_FORMAT " bytes, %" G_GSIZE_FORMAT "/%" G_GSIZE_FORMAT " used)",
+        entry->filename, entry->size, cache_used, cache_budget);
+}
+
+static void
+decode_free (Decode *decode)
+{
+    if (decode->bus_watch_id)
+        g_source_remove (decode->bus_watch_id);
+
+    if (decode->pipeline) {
+        gst_element_set_state (decode->pipeline, GST_STATE_NULL);
+        gst_object_unref (decode->pipeline);
+    }
+
+    if (decode->data)
+        g_byte_array_free (decode->data, TRUE);
+    if (decode->caps)
+        gst_caps_unref (decode->caps);
+
+    g_free (decode->filename);
+    g_slice_free (Decode, decode);
+}
+
+/* streaming threads are stopped before touching the data */
+static void
+decode_finish (Decode *decode)
+{
+    CacheEntry *entry;
+    gsize size;
+
+    if (!decode->caps || decode->data->len == 0) {
+        N_DEBUG (LOG_CAT "nothing decoded from '%s'", decode->filename);
+        return;
+    }
+
+    size = decode->data->len;
+
+    entry = g_slice_new0 (CacheEntry);
+    entry->filename = g_strdup (decode->filename);
+    entry->mtime = decode->mtime;
+    entry->pcm = gst_buffer_new_wrapped (g_byte_array_free (decode->data, FALSE), size);
+    entry->caps = decode->caps;
+    entry->size = size;
+
+    decode->data = NULL;
+    decode->caps = NULL;
+
+    cache_insert (entry);
+}
+
+static void
+decode_stop_run (gpointer data)
+{
+    Decode *decode = data;
+
+    gst_element_set_state (decode->pipeline, GST_STATE_NULL);
+}
+
+static void
+decode_stop_done (gpointer data)
+{
+    Decode *decode = data;
+
+    if (decode->eos)
+        decode_finish (decode);
+
+    g_hash_table_remove (cache_decodes, decode->filename);
+}
+
+static gboolean
+decode_bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata)
+{
+    Decode *decode = userdata;
+
+    (void) bus;
+
+    switch (GST_MESSAGE_TYPE (msg)) {
+        case GST_MESSAGE_ERROR: {
+            GError *error = NULL;
+            gst_message_parse_error (msg, &error, NULL);
+            N_DEBUG (LOG_CAT "failed to decode '%s': %s", decode->filename, error->message);
+            g_error_free (error);
+            break;
+        }
+
+        case GST_MESSAGE_EOS:
+            decode->eos = TRUE;
+            break;
+
+        default:
+            return G_SOURCE_CONTINUE;
+    }
+
+    decode->bus_watch_id = 0;
+    worker_push (decode_stop_run, decode_stop_done, decode);
+
+    return G_SOURCE_REMOVE;
+}
+
+static GstFlowReturn
+decode_new_sample_cb (GstAppSink *sink, gpointer userdata)
+{
+    Decode     *decode = userdata;
+    GstSample  *sample;
+    GstBuffer  *buffer;
+    GstMapInfo  map;
+
+    if (!(sample = gst_app_sink_pull_sample (sink)))
+        return GST_FLOW_EOS;
+
+    if (!decode->caps)
+        decode->caps = gst_caps_ref (gst_sample_get_caps (sample));
+
+    buffer = gst_sample_get_buffer (sample);
+    if (gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+        g_byte_array_append (decode->data, map.data, map.size);
+        gst_buffer_unmap (buffer, &map);
+    }
+
+    gst_sample_unref (sample);
+
+    /* decoded sound is larger than the whole cache, give up. */
+    if (decode->data->len > cache_budget)
+        return GST_FLOW_ERROR;
+
+    return GST_FLOW_OK;
+}
+
+static void
+decode_pad_added_cb (GstElement *element, GstPad *pad, gpointer userdata)
+{
+    GstElement *convert  = userdata;
+    GstPad     *sink_pad = NULL;
+
+    (void) element;
+
+    sink_pad = gst_element_get_static_pad (convert, "sink");
+    if (!gst_pad_is_linked (sink_pad))
+        gst_pad_link (pad, sink_pad);
+    gst_object_unref (sink_pad);
+}
+
+static void
+decode_start_run (gpointer data)
+{
+    static GstAppSinkCallbacks callbacks = {
+        .new_sample = decode_new_sample_cb
+    };
+
+    Decode     *decode = data;
+    GstElement *pipeline, *source, *decoder, *convert, *sink;
+    GstCaps    *caps;
+
+    pipeline = gst_pipeline_new (NULL);
+    source = gst_element_factory_make ("filesrc", NULL);
+    decoder = gst_element_factory_make ("decodebin", NULL);
+    convert = gst_element_factory_make ("audioconvert", NULL);
+    sink = gst_element_factory_make ("appsink", NULL);
+
+    if (!source || !decoder || !convert || !sink) {
+        N_WARNING (LOG_CAT "failed to create decode elements");
+        if (source)
+            gst_object_unref (source);
+        if (decoder)
+            gst_object_unref (decoder);
+        if (convert)
+            gst_object_unref (convert);
+        if (sink)
+            gst_object_unref (sink);
+        gst_object_unref (pipeline);
+        return;
+    }
+
+    gst_bin_add_many (GST_BIN (pipeline), source, decoder, convert, sink, NULL);
+
+    caps = gst_caps_new_simple ("audio/x-raw",
+        "format", G_TYPE_STRING, SAMPLE_CACHE_FORMAT,
+        "layout", G_TYPE_STRING, "interleaved",
+        NULL);
+
+    if (!gst_element_link (source, decoder) ||
+        !gst_element_link_filtered (convert, sink, caps)) {
+        N_WARNING (LOG_CAT "failed to link decode pipeline");
+        gst_caps_unref (caps);
+        gst_object_unref (pipeline);
+        return;
+    }
+
+    gst_caps_unref (caps);
+
+    g_signal_connect (G_OBJECT (decoder), "pad-added",
+        G_CALLBACK (decode_pad_added_cb), convert);
+
+    g_object_set (G_OBJECT (source), "location", decode->filename, NULL);
+    g_object_set (G_OBJECT (sink), "sync", FALSE, NULL);
+    gst_app_sink_set_callbacks (GST_APP_SINK (sink), &callbacks, decode, NULL);
+
+    /* messages wait in the bus until the main loop watches it */
+    decode->pipeline = pipeline;
+    if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+        N_DEBUG (LOG_CAT "failed to start decoding '%s'", decode->filename);
+}
+
+static void
+decode_start_done (gpointer data)
+{
+    Decode *decode = data;
+    GstBus *bus;
+
+    if (!decode->pipeline) {
+        g_hash_table_remove (cache_decodes, decode->filename);
+        return;
+    }
+
+    bus = gst_element_get_bus (decode->pipeline);
+    decode->bus_watch_id = gst_bus_add_watch (bus, decode_bus_cb, decode);
+    gst_object_unref (bus);
+}
+
+static void
+decode_start (const char *filename, gint64 mtime)
+{
+    Decode *decode;
+
+    decode = g_slice_new0 (Decode);
+    decode->filename = g_strdup (filename);
+    decode->mtime = mtime;
+    decode->data = g_byte_array_new ();
+
+    g_hash_table_insert (cache_decodes, decode->filename, decode);
+
+    N_DEBUG (LOG_CAT "decoding '%s'", filename);
+    worker_push (decode_start_run, decode_start_done, decode);
+}
+
+static void
+cache_decode_if_small (const char *filename, gint64 mtime, gsize size)
+{
+    if (size > cache_max_file_size) {
+        N_DEBUG (LOG_CAT "not caching '%s', file too large (%" G_GSIZE_FORMAT " bytes)",
+            filename, size);
+        return;
+    }
+
+    if (!g_hash_table_contains (cache_decodes, filename))
+        decode_start (filename, mtime);
+}
+
+void
+sample_cache_init (gsize budget, gsize max_file_size)
+{
+    cache_budget = budget;
+    cache_max_file_size = max_file_size;
+    cache_entries = g_hash_table_new (g_str_hash, g_str_equal);
+    cache_decodes = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+        (GDestroyNotify) decode_free);
+}
+
+void
+sample_cache_shutdown ()
+{
+    CacheEntry *entry;
+
+    if (cache_decodes) {
+        g_hash_table_destroy (cache_decodes);
+        cache_decodes = NULL;
+    }
+
+    if (cache_entries) {
+        g_hash_table_destroy (cache_entries);
+        cache_entries = NULL;
+    }
+
+    while ((entry = g_queue_pop_head (&cache_lru)))
+        cache_entry_free (entry);
+
+    cache_used = 0;
+}
+
+gboolean
+sample_cache_lookup (const char *filename, GstBuffer **pcm, GstCaps **caps, gint64 *mtime)
+{
+    CacheEntry *entry = NULL;
+    GList      *link  = NULL;
+
+    if (!cache_entries || cache_budget == 0 || !filename)
+        return FALSE;
+
+    if (!(link = g_hash_table_lookup (cache_entries, filename)))
+        return FALSE;
+
+    entry = link->data;
+    g_queue_unlink (&cache_lru, link);
+    g_queue_push_head_link (&cache_lru, link);
+
+    *pcm = gst_buffer_ref (entry->pcm);
+    *caps = gst_caps_ref (entry->caps);
+    *mtime = entry->mtime;
+
+    return TRUE;
+}
+
+void
+sample_cache_check (const char *filename, gboolean hit, gint64 mtime, gsize size)
+{
+    GList *link;
+
+    if (!cache_entries || cache_budget == 0 || !filename)
+        return;
+
+    if (hit) {
+        cache_hits++;
+        return;
+    }
+
+    cache_misses++;
+
+    if ((link = g_hash_table_lookup (cache_entries, filename))) {
+        if (((CacheEntry*) link->data)->mtime == mtime)
+            return;
+
+        N_DEBUG (LOG_CAT "'%s' has been modified", filename);
+        cache_remove (link);
+    }
+
+    cache_decode_if_small (filename, mtime, size);
+}
+
+void
+sample_cache_preload (const char *filename, gint64 mtime, gsize size)
+{
+    if (!cache_entries || cache_budget == 0)
+        return;
+
+    if (g_hash_table_contains (cache_entries, filename))
+        return;
+
+    cache_decode_if_small (filename, mtime, size);
+}
+
+void
+sample_cache_get_stats (guint *hits, guint *misses, guint *entries, gsize *bytes)
+{
+    *hits = cache_hits;
+    *misses = cache_misses;
+    *entries = g_queue_get_length (&cache_lru);
+    *bytes = cache_used;
+}
@@ -0,0 +1,51 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_GST_SAMPLE_CACHE_H
+#define N_GST_SAMPLE_CACHE_H
+
+#include <glib.h>
+#include <gst/gst.h>
+
+/* Decoded sounds are kept as interleaved S16LE PCM. */
+#define SAMPLE_CACHE_FORMAT "S16LE"
+
+void     sample_cache_init      (gsize budget, gsize max_file_size);
+void     sample_cache_shutdown  ();
+
+/* Return new references to the decoded data and its caps, and the
+   modification time of the file they were decoded from, if the file is
+   cached. The file is not looked at, callers stat it off the main loop
+   and tell the result with sample_cache_check. */
+gboolean sample_cache_lookup    (const char *filename, GstBuffer **pcm, GstCaps **caps,
+                                 gint64 *mtime);
+
+/* Count a hit if the cached data was used for the file as it is now.
+   Otherwise count a miss, drop the entry if the file has been modified
+   and decode the file in the background if it is small enough. */
+void     sample_cache_check     (const char *filename, gboolean hit, gint64 mtime, gsize size);
+
+/* Decode the file in the background without counting a miss. */
+void     sample_cache_preload   (const char *filename, gint64 mtime, gsize size);
+
+void     sample_cache_get_stats (guint *hits, guint *misses, guint *entries, gsize *bytes);
+
+#endif /* N_GST_SAMPLE_CACHE_H */
@@ -0,0 +1,495 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <ngf/log.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <gst/pbutils/pbutils.h>
+
+#include "sound-info.h"
+
+#define LOG_CAT             "gst-info: "
+#define DISCOVER_TIMEOUT    (10 * GST_SECOND)
+#define SAVE_DELAY_MS       (2000)
+
+typedef struct _InfoEntry
+{
+    gint64        mtime;
+    gint64        size;
+    gboolean      valid;
+    GstClockTime  duration;
+    gchar        *caps;
+    gchar        *codec;
+} InfoEntry;
+
+typedef struct _Pending
+{
+    gint64 mtime;
+    gint64 size;
+} Pending;
+
+static GHashTable    *info_entries;     /* filename -> InfoEntry* */
+static GHashTable    *info_pending;     /* filename -> Pending* */
+static GstDiscoverer *info_discoverer;
+static gchar         *info_path;
+static gboolean       info_dirty;
+static guint          info_save_source;
+static GThread       *info_save_thread;
+static gint           info_save_running;
+
+/* File contents written by the save thread. */
+typedef struct _SaveData
+{
+    gchar *path;
+    gchar *data;
+    gsize  length;
+} SaveData;
+
+static void
+info_entry_free (InfoEntry *entry)
+{
+    g_free (entry->caps);
+    g_free (entry->codec);
+    g_slice_free (InfoEntry, entry);
+}
+
+static void
+pending_free (Pending *pending)
+{
+    g_slice_free (Pending, pending);
+}
+
+static void
+info_load ()
+{
+    GKeyFile *keyfile;
+    InfoEntry *entry;
+    gchar **groups, **group;
+
+    keyfile = g_key_file_new ();
+    if (!g_key_file_load_from_file (keyfile, info_path, G_KEY_FILE_NONE, NULL)) {
+        g_key_file_free (keyfile);
+        return;
+    }
+
+    /* one group per sound file */
+    groups = g_key_file_get_groups (keyfile, NULL);
+    for (group = groups; *group; group++) {
+        entry = g_slice_new0 (InfoEntry);
+        entry->mtime = g_key_file_get_int64 (keyfile, *group, "mtime", NULL);
+        entry->size = g_key_file_get_int64 (keyfile, *group, "size", NULL);
+        entry->valid = g_key_file_get_boolean (keyfile, *group, "valid", NULL);
+        entry->duration = GST_CLOCK_TIME_NONE;
+        if (g_key_file_has_key (keyfile, *group, "duration", NULL))
+            entry->duration = g_key_file_get_uint64 (keyfile, *group, "duration", NULL);
+        entry->caps = g_key_file_get_string (keyfile, *group, "caps", NULL);
+        entry->codec = g_key_file_get_string (keyfile, *group, "codec", NULL);
+        g_hash_table_replace (info_entries, g_strdup (*group), entry);
+    }
+
+    N_DEBUG (LOG_CAT "loaded %u entries from '%s'", g_strv_length (groups), info_path);
+
+    g_strfreev (groups);
+    g_key_file_free (keyfile);
+}
+
+static gchar*
+info_to_data (gsize *length)
+{
+    GKeyFile *keyfile;
+    GHashTableIter iter;
+    const char *filename;
+    InfoEntry *entry;
+    gchar *data;
+
+    keyfile = g_key_file_new ();
+
+    g_hash_table_iter_init (&iter, info_entries);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &filename, (gpointer*) &entry)) {
+        g_key_file_set_int64 (keyfile, filename, "mtime", entry->mtime);
+        g_key_file_set_int64 (keyfile, filename, "size", entry->size);
+        g_key_file_set_boolean (keyfile, filename, "valid", entry->valid);
+        if (GST_CLOCK_TIME_IS_VALID (entry->duration))
+            g_key_file_set_uint64 (keyfile, filename, "duration", entry->duration);
+        if (entry->caps)
+            g_key_file_set_string (keyfile, filename, "caps", entry->caps);
+        if (entry->codec)
+            g_key_file_set_string (keyfile, filename, "codec", entry->codec);
+    }
+
+    data = g_key_file_to_data (keyfile, length, NULL);
+    g_key_file_free (keyfile);
+
+    return data;
+}
+
+static gboolean
+info_write (const char *path, const gchar *data, gsize length)
+{
+    gchar *dir;
+    GError *error = NULL;
+
+    dir = g_path_get_dirname (path);
+    g_mkdir_with_parents (dir, 0700);
+    g_free (dir);
+
+    if (!g_file_set_contents (path, data, length, &error)) {
+        N_WARNING (LOG_CAT "failed to save '%s': %s", path, error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gpointer
+info_save_thread_cb (gpointer userdata)
+{
+    SaveData *save = userdata;
+    gboolean ok;
+
+    ok = info_write (save->path, save->data, save->length);
+
+    g_free (save->path);
+    g_free (save->data);
+    g_slice_free (SaveData, save);
+
+    g_atomic_int_set (&info_save_running, 0);
+
+    return GINT_TO_POINTER (ok);
+}
+
+/* failed save is tried again the next time entries change */
+static void
+info_save_join ()
+{
+    if (!info_save_thread)
+        return;
+
+    if (!GPOINTER_TO_INT (g_thread_join (info_save_thread)))
+        info_dirty = TRUE;
+    info_save_thread = NULL;
+}
+
+static gboolean
+info_save_cb (gpointer userdata)
+{
+    SaveData *save;
+
+    (void) userdata;
+
+    /* previous save is still writing, come back later */
+    if (g_atomic_int_get (&info_save_running))
+        return G_SOURCE_CONTINUE;
+
+    info_save_source = 0;
+    info_save_join ();
+
+    if (!info_dirty)
+        return G_SOURCE_REMOVE;
+
+    save = g_slice_new (SaveData);
+    save->path = g_strdup (info_path);
+    save->data = info_to_data (&save->length);
+    info_dirty = FALSE;
+
+    g_atomic_int_set (&info_save_running, 1);
+    info_save_thread = g_thread_new ("ngfd-sound-info", info_save_thread_cb, save);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Discoveries are saved together a while after the last one, and the
+   file is written in a thread of its own. */
+static void
+info_save_later ()
+{
+    if (!info_path || !info_dirty || info_save_source)
+        return;
+
+    info_save_source = g_timeout_add (SAVE_DELAY_MS, info_save_cb, NULL);
+}
+
+static void
+info_save ()
+{
+    gchar *data;
+    gsize length;
+
+    if (!info_path || !info_dirty)
+        return;
+
+    data = info_to_data (&length);
+    if (info_write (info_path, data, length))
+        info_dirty = FALSE;
+    g_free (data);
+}
+
+static InfoEntry*
+info_entry_from_result (GstDiscovererInfo *info)
+{
+    InfoEntry *entry;
+    GList *streams;
+    GstCaps *caps;
+
+    entry = g_slice_new0 (InfoEntry);
+    entry->duration = GST_CLOCK_TIME_NONE;
+
+    if (gst_discoverer_info_get_result (info) != GST_DISCOVERER_OK)
+        return entry;
+
+    streams = gst_discoverer_info_get_audio_streams (info);
+    if (!streams)
+        return entry;
+
+    entry->valid = TRUE;
+    entry->duration = gst_discoverer_info_get_duration (info);
+    if (entry->duration == 0)
+        entry->duration = GST_CLOCK_TIME_NONE;
+
+    if ((caps = gst_discoverer_stream_info_get_caps (streams->data))) {
+        entry->caps = gst_caps_to_string (caps);
+        entry->codec = gst_pb_utils_get_codec_description (caps);
+        gst_caps_unref (caps);
+    }
+
+    gst_discoverer_stream_info_list_free (streams);
+
+    return entry;
+}
+
+static void
+discovered_cb (GstDiscoverer *discoverer, GstDiscovererInfo *info,
+               GError *error, gpointer userdata)
+{
+    GstDiscovererResult result;
+    InfoEntry *entry;
+    Pending *pending;
+    gchar *filename;
+
+    (void) discoverer;
+    (void) userdata;
+
+    if (!(filename = g_filename_from_uri (gst_discoverer_info_get_uri (info), NULL, NULL)))
+        return;
+
+    if (!(pending = g_hash_table_lookup (info_pending, filename))) {
+        g_free (filename);
+        return;
+    }
+
+    /* try again next time the sound is used */
+    result = gst_discoverer_info_get_result (info);
+    if (result == GST_DISCOVERER_TIMEOUT || result == GST_DISCOVERER_BUSY) {
+        N_DEBUG (LOG_CAT "discovering '%s' did not finish", filename);
+        g_hash_table_remove (info_pending, filename);
+        g_free (filename);
+        return;
+    }
+
+    entry = info_entry_from_result (info);
+    entry->mtime = pending->mtime;
+    entry->size = pending->size;
+
+    if (entry->valid)
+        N_DEBUG (LOG_CAT "'%s': %s, %" GST_TIME_FORMAT, filename,
+            entry->codec ? entry->codec : "unknown codec", GST_TIME_ARGS (entry->duration));
+    else
+        N_WARNING (LOG_CAT "'%s' has no playable audio%s%s", filename,
+            error ? ": " : "", error ? error->message : "");
+
+    g_hash_table_remove (info_pending, filename);
+    g_hash_table_replace (info_entries, filename, entry);
+    info_dirty = TRUE;
+}
+
+static void
+finished_cb (GstDiscoverer *discoverer, gpointer userdata)
+{
+    (void) discoverer;
+    (void) userdata;
+
+    info_save_later ();
+}
+
+static void
+discover_start (const char *filename, gint64 mtime, gint64 size)
+{
+    Pending *pending;
+    gchar *uri;
+
+    if (!info_discoverer || g_hash_table_contains (info_pending, filename))
+        return;
+
+    if (!(uri = gst_filename_to_uri (filename, NULL)))
+        return;
+
+    if (gst_discoverer_discover_uri_async (info_discoverer, uri)) {
+        pending = g_slice_new (Pending);
+        pending->mtime = mtime;
+        pending->size = size;
+        g_hash_table_insert (info_pending, g_strdup (filename), pending);
+        N_DEBUG (LOG_CAT "discovering '%s'", filename);
+    }
+
+    g_free (uri);
+}
+
+void
+sound_info_init (const char *path)
+{
+    GError *error = NULL;
+
+    info_entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        (GDestroyNotify) info_entry_free);
+    info_pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        (GDestroyNotify) pending_free);
+    info_path = g_strdup (path);
+
+    if (info_path)
+        info_load ();
+
+    gst_pb_utils_init ();
+
+    if (!(info_discoverer = gst_discoverer_new (DISCOVER_TIMEOUT, &error))) {
+        N_WARNING (LOG_CAT "failed to create discoverer: %s", error->message);
+        g_error_free (error);
+        return;
+    }
+
+    g_signal_connect (info_discoverer, "discovered", G_CALLBACK (discovered_cb), NULL);
+    g_signal_connect (info_discoverer, "finished", G_CALLBACK (finished_cb), NULL);
+    gst_discoverer_start (info_discoverer);
+}
+
+void
+sound_info_shutdown ()
+{
+    if (info_discoverer) {
+        gst_discoverer_stop (info_discoverer);
+        g_object_unref (info_discoverer);
+        info_discoverer = NULL;
+    }
+
+    if (info_save_source) {
+        g_source_remove (info_save_source);
+        info_save_source = 0;
+    }
+
+    /* whatever is left is written right away */
+    info_save_join ();
+    if (info_entries)
+        info_save ();
+
+    if (info_pending) {
+        g_hash_table_destroy (info_pending);
+        info_pending = NULL;
+    }
+
+    if (info_entries) {
+        g_hash_table_destroy (info_entries);
+        info_entries = NULL;
+    }
+
+    g_free (info_path);
+    info_path = NULL;
+}
+
+void
+sound_info_stat (const char *filename, SoundFileStat *st)
+{
+    GStatBuf buf;
+
+    st->exists = filename && g_stat (filename, &buf) == 0;
+    st->mtime = st->exists ? buf.st_mtime : 0;
+    st->size = st->exists ? buf.st_size : 0;
+}
+
+SoundInfoState
+sound_info_lookup (const char *filename, GstClockTime *duration)
+{
+    InfoEntry *entry;
+
+    *duration = GST_CLOCK_TIME_NONE;
+
+    if (!info_entries || !filename)
+        return SOUND_INFO_UNKNOWN;
+
+    if (!(entry = g_hash_table_lookup (info_entries, filename)))
+        return SOUND_INFO_UNKNOWN;
+
+    *duration = entry->duration;
+    return entry->valid ? SOUND_INFO_VALID : SOUND_INFO_INVALID;
+}
+
+SoundInfoState
+sound_info_update (const char *filename, const SoundFileStat *st, GstClockTime *duration)
+{
+    InfoEntry *entry;
+
+    *duration = GST_CLOCK_TIME_NONE;
+
+    if (!info_entries || !filename)
+        return SOUND_INFO_UNKNOWN;
+
+    if (!st->exists)
+        return SOUND_INFO_INVALID;
+
+    if ((entry = g_hash_table_lookup (info_entries, filename))) {
+        if (entry->mtime == st->mtime && entry->size == st->size) {
+            *duration = entry->duration;
+            return entry->valid ? SOUND_INFO_VALID : SOUND_INFO_INVALID;
+        }
+
+        N_DEBUG (LOG_CAT "'%s' has been modified", filename);
+        g_hash_table_remove (info_entries, filename);
+        info_dirty = TRUE;
+    }
+
+    discover_start (filename, st->mtime, st->size);
+
+    return SOUND_INFO_UNKNOWN;
+}
+
+void
+sound_info_get_stats (guint *entries, guint *invalid, guint *pending)
+{
+    GHashTableIter iter;
+    InfoEntry *entry;
+
+    *entries = 0;
+    *invalid = 0;
+    *pending = 0;
+
+    if (!info_entries)
+        return;
+
+    *entries = g_hash_table_size (info_entries);
+    *pending = g_hash_table_size (info_pending);
+
+    g_hash_table_iter_init (&iter, info_entries);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &entry)) {
+        if (!entry->valid)
+            (*invalid)++;
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_GST_SOUND_INFO_H
+#define N_GST_SOUND_INFO_H
+
+#include <glib.h>
+#include <gst/gst.h>
+
+/* Duration, caps and codec of sound files, discovered in the background
+   and kept in a file over restarts. Entries are dropped when the file
+   size or modification time changes. */
+
+typedef enum _SoundInfoState
+{
+    SOUND_INFO_UNKNOWN,     /* not discovered yet */
+    SOUND_INFO_VALID,
+    SOUND_INFO_INVALID      /* missing, or no decodable audio */
+} SoundInfoState;
+
+/* Cache is loaded from and saved to path, NULL keeps it in memory. */
+void           sound_info_init      (const char *path);
+void           sound_info_shutdown  ();
+
+typedef struct _SoundFileStat
+{
+    gboolean exists;
+    gint64   mtime;
+    gint64   size;
+} SoundFileStat;
+
+/* Stat the file. This may block on slow storage, so it is safe to call
+   from any thread and the sink calls it in the worker. */
+void           sound_info_stat      (const char *filename, SoundFileStat *st);
+
+/* Return what is known about the file without looking at the file
+   itself, duration is GST_CLOCK_TIME_NONE when not known. */
+SoundInfoState sound_info_lookup    (const char *filename, GstClockTime *duration);
+
+/* Like sound_info_lookup, but checked against a stat of the file.
+   Unknown and changed files are discovered in the background. */
+SoundInfoState sound_info_update    (const char *filename, const SoundFileStat *st,
+                                     GstClockTime *duration);
+
+void           sound_info_get_stats (guint *entries, guint *invalid, guint *pending);
+
+#endif /* N_GST_SOUND_INFO_H */
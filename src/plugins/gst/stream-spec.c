@@ -0,0 +1,497 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <ngf/log.h>
+#include <ngf/value.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <glib.h>
+#include <gst/gst.h>
+
+#include "stream-spec.h"
+
+#define LOG_CAT               "gst-spec: "
+#define STREAM_PREFIX_KEY     "sound.stream."
+#define SOUND_FILENAME_KEY    "sound.filename"
+#define SOUND_VOLUME_KEY      "sound.volume"
+#define FADE_ONLY_CUSTOM_KEY  "sound.fade-only-custom"
+#define FADE_OUT_KEY          "sound.fade-out"
+#define FADE_IN_KEY           "sound.fade-in"
+#define SYSTEM_SOUND_PATH     "/usr/share/sounds/"
+#define MAX_VARIANTS          (4)       /* specs kept per event */
+#define MAX_OWNERS            (64)      /* events with specs, all dropped when exceeded */
+
+/* Spec with the values of the keys it was made of. */
+typedef struct _SpecEntry
+{
+    StreamSpec spec;
+    gint       refcount;
+    NProplist *source;
+} SpecEntry;
+
+typedef struct _SpecMatch
+{
+    const NProplist *source;
+    gint             matched;
+    gboolean         differs;
+} SpecMatch;
+
+static GHashTable *spec_cache = NULL;  /* owner -> GList of SpecEntry, most recent first */
+static guint spec_hits = 0;
+static guint spec_misses = 0;
+static guint spec_entries = 0;
+
+static gboolean
+is_spec_key (const char *key)
+{
+    return g_str_has_prefix (key, STREAM_PREFIX_KEY) ||
+           g_str_equal (key, SOUND_FILENAME_KEY) ||
+           g_str_equal (key, SOUND_VOLUME_KEY) ||
+           g_str_equal (key, FADE_IN_KEY) ||
+           g_str_equal (key, FADE_OUT_KEY) ||
+           g_str_equal (key, FADE_ONLY_CUSTOM_KEY);
+}
+
+static gboolean
+is_custom_sound_filename (const char *filename)
+{
+    if (filename && g_str_has_prefix (filename, SYSTEM_SOUND_PATH))
+        return FALSE;
+
+    return TRUE;
+}
+
+static gchar*
+strip_prefix (const gchar *str, const gchar *prefix)
+{
+    if (!g_str_has_prefix (str, prefix))
+        return NULL;
+
+    size_t prefix_length = strlen (prefix);
+    return g_strdup (str + prefix_length);
+}
+
+static gboolean
+parse_volume_limit (const char *str, guint *min, guint *max)
+{
+    gchar *stripped = NULL;
+
+    if (!str)
+        return FALSE;
+    
+    *min = 0;
+    *max = 0;
+    
+    if (g_str_has_prefix (str, "max:")) {
+        stripped = strip_prefix (str, "max:");
+        *max = atoi (stripped);
+        g_free (stripped);
+        return TRUE;
+    }
+    
+    if (g_str_has_prefix (str, "min:")) {
+        stripped = strip_prefix (str, "min:");
+        *min = atoi (stripped);
+        g_free (stripped);
+        return TRUE;
+    }
+    
+    return FALSE;
+}
+
+static gboolean
+parse_fixed_volume (const char *str, guint *volume)
+{
+    gchar *stripped = NULL;
+
+    if (!str || !g_str_has_prefix (str, "fixed:"))
+        return FALSE;
+
+    stripped = strip_prefix (str, "fixed:");
+    *volume = atoi (stripped);
+    g_free (stripped);
+    return TRUE;
+}
+
+static int
+set_structure_string (GstStructure *s, const char *key, const char *value)
+{
+    g_assert (s != NULL);
+    g_assert (key != NULL);
+
+    GValue v = {0,{{0}}};
+
+    if (!value)
+        return FALSE;
+
+    g_value_init (&v, G_TYPE_STRING);
+    g_value_set_string (&v, value);
+    gst_structure_set_value (s, key, &v);
+    g_value_unset (&v);
+
+    return TRUE;
+}
+
+static void
+proplist_to_structure_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    GstStructure *target     = (GstStructure*) userdata;
+    const char   *prop_key   = NULL;
+    const char   *prop_value = NULL;
+
+    if (!g_str_has_prefix (key, STREAM_PREFIX_KEY))
+        return;
+
+    prop_key = key + strlen (STREAM_PREFIX_KEY);
+    if (*prop_key == '\0')
+        return;
+
+    prop_value = n_value_get_string ((NValue*) value);
+    (void) set_structure_string (target, prop_key, prop_value);
+}
+
+static GstStructure*
+create_stream_properties (const NProplist *props)
+{
+    GstStructure *s      = gst_structure_new_empty ("props");
+    const char   *source = NULL;
+    const char   *role   = NULL;
+
+    /* set the stream filename based on the sound file we're
+       about to play. */
+
+    source = n_proplist_get_string (props, SOUND_FILENAME_KEY);
+    g_assert (source != NULL);
+
+    set_structure_string (s, "media.filename", source);
+
+    /* set media.role from configuration file if defined. Default to "media" */
+    role = n_proplist_get_string (props, STREAM_PREFIX_KEY "media.role");
+    if (role)
+        set_structure_string (s, "media.role", role);
+    else
+        set_structure_string (s, "media.role", "media");
+
+    /* convert all properties within the request that begin with
+       "sound.stream." prefix. */
+
+    n_proplist_foreach (props, proplist_to_structure_cb, s);
+
+    return s;
+}
+
+static int
+convert_number (const char *str, gint *result)
+{
+    long n;
+    char *end;
+    int errcode;
+
+    errno = 0;
+    n = strtol (str, &end, 10);
+    errcode = errno;
+    
+    if ((n == 0 && str == end)
+        || (n == 0 && errcode == EINVAL)
+        || ((n == LONG_MAX || n == LONG_MIN) && errcode == ERANGE)
+        || (n > G_MAXINT || n < G_MININT))
+    {
+        *result = (gint) 0;
+        return 0;
+    }
+
+    *result = (gint) n;
+
+    return 1;
+}
+
+static FadeEffect*
+fade_effect_new (gdouble position, gdouble length, gdouble start, gdouble end)
+{
+    FadeEffect *effect;
+
+    effect = g_slice_new (FadeEffect);
+    effect->position = position;
+    effect->length   = length;
+    effect->start    = start;
+    effect->end      = end;
+
+    return effect;
+}
+
+static void
+fade_effect_free (FadeEffect *effect)
+{
+    if (effect)
+        g_slice_free (FadeEffect, effect);
+}
+
+static FadeEffect*
+parse_volume_fade (const char *str)
+{
+#define VALID_NUMBER(in_f) \
+    (valid = (valid == 0) ? 0 : (in_f))
+
+    /* fade key has four values defined: position, length, start value, end value */
+
+    FadeEffect *effect = NULL;
+    gchar **split = NULL;
+    gint position, length, start, end;
+    int valid = 1;
+
+    if (str == NULL)
+        return NULL;
+
+    split = g_strsplit (str, ",", 4);
+
+    if (split[0] && split[1] && split[2] && split[3]) {
+
+        VALID_NUMBER (convert_number (split[0], &position));
+        VALID_NUMBER (convert_number (split[1], &length));
+        VALID_NUMBER (convert_number (split[2], &start));
+        VALID_NUMBER (convert_number (split[3], &end));
+
+        if (valid)
+            effect = fade_effect_new (position, length, start / 1000.0, end / 1000.0);
+    }
+
+    g_strfreev (split);
+
+    if (effect) {
+        N_DEBUG (LOG_CAT "fade effect parsed (position=%.2f length=%.2f start=%.2f stop=%.2f)",
+            effect->position, effect->length, effect->start, effect->end);
+    }
+    else {
+        N_DEBUG (LOG_CAT "invalid fade effect, unable to parse: '%s'", str);
+    }
+
+    return effect;
+
+#undef VALID_NUMBER
+}
+
+static void
+copy_spec_key_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    NProplist *target = userdata;
+
+    if (is_spec_key (key))
+        n_proplist_set (target, key, n_value_copy (value));
+}
+
+static SpecEntry*
+spec_entry_new (const NProplist *props)
+{
+    SpecEntry *entry;
+    StreamSpec *spec;
+    gboolean fade_only_custom;
+
+    entry = g_slice_new0 (SpecEntry);
+    entry->refcount = 1;
+    entry->source = n_proplist_new ();
+    n_proplist_foreach (props, copy_spec_key_cb, entry->source);
+
+    spec = &entry->spec;
+    spec->properties = create_stream_properties (props);
+
+    spec->volume_limit = parse_volume_limit (n_proplist_get_string (props, SOUND_VOLUME_KEY),
+        &spec->volume_min, &spec->volume_max);
+    spec->volume_fixed = parse_fixed_volume (n_proplist_get_string (props, SOUND_VOLUME_KEY),
+        &spec->volume_set);
+
+    fade_only_custom = n_proplist_get_bool (props, FADE_ONLY_CUSTOM_KEY);
+    spec->fade_enabled = !fade_only_custom ||
+        is_custom_sound_filename (n_proplist_get_string (props, SOUND_FILENAME_KEY));
+
+    if (spec->fade_enabled) {
+        /* parse the volume fading keys and setup fades for the stream
+           if available */
+
+        spec->fade_out = parse_volume_fade (
+            n_proplist_get_string (props, FADE_OUT_KEY));
+        spec->fade_in = parse_volume_fade (
+            n_proplist_get_string (props, FADE_IN_KEY));
+    }
+
+    return entry;
+}
+
+static void
+spec_entry_free (SpecEntry *entry)
+{
+    gst_structure_free (entry->spec.properties);
+    fade_effect_free (entry->spec.fade_in);
+    fade_effect_free (entry->spec.fade_out);
+    n_proplist_free (entry->source);
+    g_slice_free (SpecEntry, entry);
+}
+
+static void
+match_spec_key_cb (const char *key, const NValue *value, gpointer userdata)
+{
+    SpecMatch *match = userdata;
+    NValue *cached = NULL;
+
+    if (match->differs || !is_spec_key (key))
+        return;
+
+    cached = n_proplist_get (match->source, key);
+    if (!cached || !n_value_equals (cached, value))
+        match->differs = TRUE;
+    else
+        match->matched++;
+}
+
+/* spec can be used if props have the same spec keys with the same
+   values, and no others. */
+static gboolean
+spec_entry_matches (SpecEntry *entry, const NProplist *props)
+{
+    SpecMatch match;
+
+    match.source = entry->source;
+    match.matched = 0;
+    match.differs = FALSE;
+
+    n_proplist_foreach (props, match_spec_key_cb, &match);
+
+    return !match.differs && match.matched == n_proplist_size (entry->source);
+}
+
+static void
+spec_list_free (gpointer data)
+{
+    GList *list = data;
+
+    spec_entries -= g_list_length (list);
+    g_list_free_full (list, (GDestroyNotify) stream_spec_unref);
+}
+
+void
+stream_spec_init ()
+{
+    if (spec_cache)
+        return;
+
+    spec_cache = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, spec_list_free);
+}
+
+void
+stream_spec_shutdown ()
+{
+    if (!spec_cache)
+        return;
+
+    g_hash_table_destroy (spec_cache);
+    spec_cache = NULL;
+}
+
+StreamSpec*
+stream_spec_get (gconstpointer owner, const NProplist *props)
+{
+    SpecEntry *entry = NULL;
+    GList *list = NULL;
+    GList *iter = NULL;
+    GList *last = NULL;
+
+    g_assert (props != NULL);
+
+    stream_spec_init ();
+
+    list = g_hash_table_lookup (spec_cache, owner);
+    for (iter = list; iter; iter = g_list_next (iter)) {
+        if (spec_entry_matches (iter->data, props))
+            break;
+    }
+
+    if (iter) {
+        spec_hits++;
+        entry = iter->data;
+
+        /* keep the most recently used first */
+        if (iter != list) {
+            list = g_list_remove_link (list, iter);
+            list = g_list_concat (iter, list);
+            g_hash_table_steal (spec_cache, owner);
+            g_hash_table_insert (spec_cache, (gpointer) owner, list);
+        }
+
+        return stream_spec_ref (&entry->spec);
+    }
+
+    spec_misses++;
+    entry = spec_entry_new (props);
+
+    /* stale owners of events that have been reloaded are dropped
+       with the rest once there are too many. */
+    if (!list && g_hash_table_size (spec_cache) >= MAX_OWNERS) {
+        N_DEBUG (LOG_CAT "too many events with stream specs, clearing");
+        g_hash_table_remove_all (spec_cache);
+    }
+
+    g_hash_table_steal (spec_cache, owner);
+    list = g_list_prepend (list, stream_spec_ref (&entry->spec));
+    spec_entries++;
+
+    if (g_list_length (list) > MAX_VARIANTS) {
+        last = g_list_last (list);
+        list = g_list_remove_link (list, last);
+        spec_list_free (last);
+    }
+
+    g_hash_table_insert (spec_cache, (gpointer) owner, list);
+
+    N_DEBUG (LOG_CAT "new stream spec for '%s'",
+        n_proplist_get_string (props, SOUND_FILENAME_KEY));
+
+    return &entry->spec;
+}
+
+StreamSpec*
+stream_spec_ref (StreamSpec *spec)
+{
+    SpecEntry *entry = (SpecEntry*) spec;
+
+    if (entry)
+        g_atomic_int_inc (&entry->refcount);
+
+    return spec;
+}
+
+void
+stream_spec_unref (StreamSpec *spec)
+{
+    SpecEntry *entry = (SpecEntry*) spec;
+
+    if (entry && g_atomic_int_dec_and_test (&entry->refcount))
+        spec_entry_free (entry);
+}
+
+void
+stream_spec_get_stats (guint *hits, guint *misses, guint *entries)
+{
+    *hits = spec_hits;
+    *misses = spec_misses;
+    *entries = spec_entries;
+}
@@ -0,0 +1,69 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_GST_STREAM_SPEC_H
+#define N_GST_STREAM_SPEC_H
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <ngf/proplist.h>
+
+/* Stream properties, volume limits and fades parsed from the properties
+   of a request. Specs are cached per resolved event and shared by all
+   the requests of the event that have the same values for the keys the
+   spec is made of, so nothing is parsed or built again for them. A spec
+   is read only once returned. */
+
+typedef struct _FadeEffect
+{
+    gdouble position;   /* begin position (in s) */
+    gdouble length;     /* length of the fade (in s) */
+    gdouble start;      /* starting volume */
+    gdouble end;        /* ending volume */
+} FadeEffect;
+
+typedef struct _StreamSpec
+{
+    GstStructure *properties;   /* stream properties for the sink */
+    gboolean      volume_limit;
+    guint         volume_min;
+    guint         volume_max;
+    gboolean      volume_fixed;
+    guint         volume_set;
+    gboolean      fade_enabled; /* fades are not set for system sounds with fade-only-custom */
+    FadeEffect   *fade_in;
+    FadeEffect   *fade_out;
+} StreamSpec;
+
+void         stream_spec_init      ();
+void         stream_spec_shutdown  ();
+
+/* Return a reference to the spec of props, owner is the event the
+   request was resolved to. Request must have sound.filename set. */
+StreamSpec*  stream_spec_get       (gconstpointer owner, const NProplist *props);
+
+/* References can be taken and dropped from any thread. */
+StreamSpec*  stream_spec_ref       (StreamSpec *spec);
+void         stream_spec_unref     (StreamSpec *spec);
+
+void         stream_spec_get_stats (guint *hits, guint *misses, guint *entries);
+
+#endif /* N_GST_STREAM_SPEC_H */
@@ -0,0 +1,157 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <ngf/log.h>
+
+#include <glib.h>
+
+#include "worker.h"
+
+#define LOG_CAT "gst-worker: "
+
+typedef struct _WorkerJob
+{
+    WorkerFunc  func;
+    WorkerFunc  done;
+    gpointer    data;
+} WorkerJob;
+
+static GThreadPool *worker_pool;
+static gboolean     worker_stopping;
+static GMutex       worker_lock;
+static GQueue       worker_done = G_QUEUE_INIT;  /* WorkerJob* waiting for done */
+static guint        worker_done_source;
+
+static WorkerJob*
+worker_pop_done ()
+{
+    WorkerJob *job;
+
+    g_mutex_lock (&worker_lock);
+    job = g_queue_pop_head (&worker_done);
+    g_mutex_unlock (&worker_lock);
+
+    return job;
+}
+
+static void
+worker_run_done ()
+{
+    WorkerJob *job;
+
+    while ((job = worker_pop_done ())) {
+        job->done (job->data);
+        g_slice_free (WorkerJob, job);
+    }
+}
+
+static gboolean
+worker_done_cb (gpointer userdata)
+{
+    (void) userdata;
+
+    g_mutex_lock (&worker_lock);
+    worker_done_source = 0;
+    g_mutex_unlock (&worker_lock);
+
+    worker_run_done ();
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+worker_finish (WorkerJob *job)
+{
+    if (!job->done) {
+        g_slice_free (WorkerJob, job);
+        return;
+    }
+
+    g_mutex_lock (&worker_lock);
+    g_queue_push_tail (&worker_done, job);
+    if (!worker_done_source && !worker_stopping)
+        worker_done_source = g_idle_add_full (G_PRIORITY_DEFAULT, worker_done_cb, NULL, NULL);
+    g_mutex_unlock (&worker_lock);
+}
+
+static void
+worker_thread_cb (gpointer data, gpointer userdata)
+{
+    WorkerJob *job = data;
+
+    (void) userdata;
+
+    job->func (job->data);
+    worker_finish (job);
+}
+
+void
+worker_init ()
+{
+    GError *error = NULL;
+
+    worker_stopping = FALSE;
+    worker_pool = g_thread_pool_new (worker_thread_cb, NULL, 1, FALSE, &error);
+    if (!worker_pool) {
+        N_WARNING (LOG_CAT "failed to start worker thread: %s", error->message);
+        g_error_free (error);
+    }
+}
+
+void
+worker_shutdown ()
+{
+    g_mutex_lock (&worker_lock);
+    worker_stopping = TRUE;
+    g_mutex_unlock (&worker_lock);
+
+    if (worker_pool) {
+        g_thread_pool_free (worker_pool, FALSE, TRUE);
+        worker_pool = NULL;
+    }
+
+    if (worker_done_source) {
+        g_source_remove (worker_done_source);
+        worker_done_source = 0;
+    }
+
+    worker_run_done ();
+}
+
+void
+worker_push (WorkerFunc func, WorkerFunc done, gpointer data)
+{
+    WorkerJob *job;
+
+    job = g_slice_new (WorkerJob);
+    job->func = func;
+    job->done = done;
+    job->data = data;
+
+    if (worker_pool) {
+        g_thread_pool_push (worker_pool, job, NULL);
+        return;
+    }
+
+    /* while stopping, done is picked up by the loop in worker_shutdown */
+    func (data);
+    worker_finish (job);
+}
@@ -0,0 +1,44 @@
+/*
+ * ngfd - Non-graphic feedback daemon
+ *
+ * Copyright (C) 2017 Jolla Ltd
+ * Contact: Juho Hämäläinen <juho.hamalainen@jolla.com>
+ *
+ * This work is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this work; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef N_GST_WORKER_H
+#define N_GST_WORKER_H
+
+#include <glib.h>
+
+/* Single worker thread for pipeline construction and state changes that
+   may block, like opening files or connecting to the sound server. Jobs
+   are run in the order they were pushed, so a job may rely on all the
+   previous jobs being done with the same pipeline. */
+
+typedef void (*WorkerFunc) (gpointer data);
+
+void     worker_init      ();
+
+/* Wait for the queued jobs and run their done callbacks. Jobs pushed from
+   the done callbacks are run right away. */
+void     worker_shutdown  ();
+
+/* Run func in the worker thread, and then done (if any) in the main
+   loop. Without a worker thread func is run right away. */
+void     worker_push      (WorkerFunc func, WorkerFunc done, gpointer data);
+
+#endif /* N_GST_WORKER_H */
@@ -583,7 +583,7 @@ N_PLUGIN_LOAD (plugin)
     stream_restore_role_map = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                      role_map_key_free, entry_list_free);
 
-    volume_controller_initialize ();
+    volume_controller_initialize (core);
 
     /* load the stream restore roles we are interested in. */
 
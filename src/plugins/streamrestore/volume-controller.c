@@ -26,6 +26,7 @@
 #include "volume-controller.h"
 
 #include <ngf/log.h>
+#include <ngf/core-dbus.h>
 
 #define LOG_CAT                 "stream-restore: "
 
@@ -81,6 +82,7 @@ typedef struct _SubscribeItem
     void *data;
 } SubscribeItem;
 
+static NCore          *volume_core     = NULL;
 static GQueue         *volume_queue    = NULL;
 static DBusConnection *volume_bus      = NULL;
 static guint           volume_retry_id = 0;
@@ -102,6 +104,10 @@ static gboolean        object_map_complete               = FALSE;
 static void           *subscribe_userdata                = NULL;
 static volume_controller_subscribe_cb subscribe_callback = NULL;
 static gboolean        queue_subscribe                   = FALSE;
+// object_map_updating is TRUE while object path lookups are in flight, further
+// updates requested meanwhile are run once the lookups are done.
+static gboolean        object_map_updating               = FALSE;
+static gboolean        object_map_update_queued          = FALSE;
 
 static media_state_subscribe_cb media_state_callback     = NULL;
 static void           *media_state_userdata              = NULL;
@@ -109,8 +115,8 @@ static void           *media_state_userdata              = NULL;
 static gboolean          retry_timeout_cb           (gpointer userdata);
 static DBusHandlerResult filter_cb                  (DBusConnection *connection, DBusMessage *msg, void *data);
 static void              append_volume              (DBusMessageIter *iter, guint volume);
-static gboolean          add_entry                  (const char *role, guint volume);
-static void              get_entry_volume           (const char *role);
+static gboolean          add_entry                  (NDBusBatch *batch, const char *role, guint volume);
+static void              get_entry_volume           (NDBusBatch *batch, const char *role);
 static void              process_queued_ops         ();
 static void              connect_to_pulseaudio      ();
 static void              disconnect_from_pulseaudio ();
@@ -118,7 +124,9 @@ static void              retry_connect              ();
 static void              get_address_reply_cb       (DBusPendingCall *pending, void *data);
 
 static gchar*            get_object_name            (const char *obj_path);
-static gchar*            get_object_path            (const char *obj_path);
+static gchar*            get_object_path_from_reply (DBusMessage *reply, const char *stream_name);
+static gboolean          get_object_path            (NDBusBatch *batch, const char *stream_name,
+                                                     NDBusReplyFunc cb);
 static void              listen_for_signal          (const char *signal, const char **objects);
 static void              stop_listen_for_signal     (const char *signal);
 static void              update_object_map_listen   ();
@@ -375,18 +383,36 @@ append_volume (DBusMessageIter *iter, guint volume)
     dbus_message_iter_close_container (iter, &array);
 }
 
+static void
+add_entry_reply_cb (NCore *core, DBusMessage *msg, void *userdata)
+{
+    gchar     *role = userdata;
+    DBusError  error;
+
+    (void) core;
+
+    dbus_error_init (&error);
+
+    if (dbus_set_error_from_message (&error, msg)) {
+        N_WARNING (LOG_CAT "failed to update volume role '%s': %s",
+            role, error.message);
+        dbus_error_free (&error);
+    }
+
+    g_free (role);
+}
+
 static gboolean
-add_entry (const char *role, guint volume)
+add_entry (NDBusBatch *batch, const char *role, guint volume)
 {
     DBusMessage     *msg     = NULL;
-    DBusMessage     *reply   = NULL;
     const char      *empty   = "";
+    gchar           *data    = NULL;
     gboolean         success = FALSE;
     dbus_bool_t      muted   = FALSE;
     dbus_bool_t      apply   = TRUE;
     dbus_uint32_t    vol     = 0;
     DBusMessageIter  iter;
-    DBusError        error;
 
     if (!volume_bus || !role)
         return FALSE;
@@ -394,7 +420,6 @@ add_entry (const char *role, guint volume)
     /* convert the volume from 0-100 to PA_VOLUME_NORM range */
     vol = TO_PA_VOL(volume);
 
-    dbus_error_init (&error);
     msg = dbus_message_new_method_call (0, STREAM_RESTORE_PATH,
         STREAM_RESTORE_IF, ADD_ENTRY_METHOD);
 
@@ -408,15 +433,10 @@ add_entry (const char *role, guint volume)
     dbus_message_iter_append_basic (&iter, DBUS_TYPE_BOOLEAN, &muted);
     dbus_message_iter_append_basic (&iter, DBUS_TYPE_BOOLEAN, &apply);
 
-    reply = dbus_connection_send_with_reply_and_block (volume_bus,
-        msg, -1, &error);
-
-    if (!reply) {
-        if (dbus_error_is_set (&error)) {
-            N_WARNING (LOG_CAT "failed to update volume role '%s': %s",
-                role, error.message);
-        }
-
+    data = g_strdup (role);
+    if (!n_dbus_batch_add_connection (batch, add_entry_reply_cb, data,
+                                      volume_bus, msg, -1)) {
+        g_free (data);
         goto done;
     }
 
@@ -424,23 +444,16 @@ add_entry (const char *role, guint volume)
     success = TRUE;
 
 done:
-    dbus_error_free (&error);
-
-    if (reply) dbus_message_unref (reply);
-    if (msg)   dbus_message_unref (msg);
+    if (msg) dbus_message_unref (msg);
 
     return success;
 }
 
 static void
-get_entry_volume (const char *role)
+entry_volume_reply_cb (NCore *core, DBusMessage *msg, void *userdata)
 {
+    gchar           *role           = userdata;
     SubscribeItem   *item           = NULL;
-    gchar           *obj_path       = NULL;
-    DBusMessage     *msg            = NULL;
-    DBusMessage     *reply          = NULL;
-    const gchar     *iface          = STREAM_ENTRY_IF;
-    const gchar     *addr           = "Volume";
     int              current_type;
     int              channel_count  = 0;
     uint32_t         volume_max     = 0;
@@ -450,41 +463,17 @@ get_entry_volume (const char *role)
     DBusMessageIter  iter_struct;
     DBusError        error;
 
-    if (!volume_bus || !role)
-        return;
+    (void) core;
 
     dbus_error_init (&error);
 
-    if (!(obj_path = get_object_path (role)))
-        goto done;
-
-    msg = dbus_message_new_method_call(STREAM_ENTRY_IF,
-                                       obj_path,
-                                       DBUS_PROPERTIES_IF,
-                                       "Get");
-
-    if (msg == NULL)
-        goto done;
-
-    if (!dbus_message_append_args(msg,
-                                  DBUS_TYPE_STRING, &iface,
-                                  DBUS_TYPE_STRING, &addr,
-                                  DBUS_TYPE_INVALID))
-        goto done;
-
-    reply = dbus_connection_send_with_reply_and_block (volume_bus,
-                                                       msg, -1, &error);
-
-    if (!reply) {
-        if (dbus_error_is_set (&error)) {
-            N_WARNING (LOG_CAT "couldn't get volume for %s: %s",
-                               obj_path, error.message);
-        }
-
+    if (dbus_set_error_from_message (&error, msg)) {
+        N_WARNING (LOG_CAT "couldn't get volume for %s: %s",
+                           role, error.message);
         goto done;
     }
 
-    dbus_message_iter_init(reply, &iter);
+    dbus_message_iter_init(msg, &iter);
 
     /* Volumes are in variant containing an array of structs of
      * uint32 pair, a[(channel_position,channel_volume)] */
@@ -516,10 +505,12 @@ get_entry_volume (const char *role)
         dbus_message_iter_next(&iter);
     }
 
-    if (channel_count > 0) {
+    // Look the stream up by name, the object map may still be waiting for
+    // its own lookups to finish.
+    if (channel_count > 0 && subscribe_map && subscribe_callback) {
         if (volume_max > VOLUME_SCALE_VALUE)
             volume_max = VOLUME_SCALE_VALUE;
-        if ((item = g_hash_table_lookup (object_map, obj_path))) {
+        if ((item = g_hash_table_lookup (subscribe_map, role))) {
             N_DEBUG (LOG_CAT "post volume get for stream %s (%s) : %u",
                              item->stream_name, item->object_path, volume_max);
             subscribe_callback (item->stream_name, FROM_PA_VOL(volume_max), item->data, subscribe_userdata);
@@ -528,10 +519,56 @@ get_entry_volume (const char *role)
 
 done:
     dbus_error_free (&error);
+    g_free (role);
+}
+
+static void
+entry_path_reply_cb (NCore *core, DBusMessage *msg, void *userdata)
+{
+    gchar           *role     = userdata;
+    gchar           *obj_path = NULL;
+    DBusMessage     *get      = NULL;
+    NDBusBatch      *batch    = NULL;
+    const gchar     *iface    = STREAM_ENTRY_IF;
+    const gchar     *addr     = "Volume";
+
+    // Connection may have gone away while the lookup was in flight.
+    if (!volume_bus || !(obj_path = get_object_path_from_reply (msg, role)))
+        goto done;
+
+    get = dbus_message_new_method_call(STREAM_ENTRY_IF,
+                                       obj_path,
+                                       DBUS_PROPERTIES_IF,
+                                       "Get");
+
+    if (get == NULL)
+        goto done;
 
+    if (!dbus_message_append_args(get,
+                                  DBUS_TYPE_STRING, &iface,
+                                  DBUS_TYPE_STRING, &addr,
+                                  DBUS_TYPE_INVALID))
+        goto done;
+
+    batch = n_dbus_batch_new (core, NULL, NULL);
+    if (n_dbus_batch_add_connection (batch, entry_volume_reply_cb, role,
+                                     volume_bus, get, -1))
+        role = NULL;
+    n_dbus_batch_commit (batch);
+
+done:
     g_free (obj_path);
-    if (reply) dbus_message_unref (reply);
-    if (msg)   dbus_message_unref (msg);
+    g_free (role);
+    if (get) dbus_message_unref (get);
+}
+
+static void
+get_entry_volume (NDBusBatch *batch, const char *role)
+{
+    if (!volume_bus || !role)
+        return;
+
+    get_object_path (batch, role, entry_path_reply_cb);
 }
 
 static void
@@ -681,38 +718,47 @@ done:
     return ret;
 }
 
-static gchar*
-get_object_path (const char *stream_name)
+static gboolean
+get_object_path (NDBusBatch *batch, const char *stream_name, NDBusReplyFunc cb)
 {
     DBusMessage     *msg     = NULL;
-    DBusMessage     *reply   = NULL;
-    const gchar     *obj_path= NULL;
-    gchar           *ret     = NULL;
-    DBusError        error;
+    gchar           *data    = NULL;
+    gboolean         success = FALSE;
 
     g_assert (volume_bus);
     g_assert (stream_name);
 
-    dbus_error_init (&error);
     msg = dbus_message_new_method_call (NULL,
                                         STREAM_RESTORE_PATH,
                                         STREAM_RESTORE_IF,
                                         "GetEntryByName");
 
     if (msg == NULL)
-        goto done;
+        return FALSE;
 
     dbus_message_append_args (msg, DBUS_TYPE_STRING, &stream_name, DBUS_TYPE_INVALID);
 
-    reply = dbus_connection_send_with_reply_and_block (volume_bus,
-                                                       msg, -1, &error);
+    data = g_strdup (stream_name);
+    if (!(success = n_dbus_batch_add_connection (batch, cb, data, volume_bus, msg, -1)))
+        g_free (data);
 
-    if (!reply) {
-        if (dbus_error_is_set (&error)) {
-            N_DEBUG (LOG_CAT "couldn't get object path for %s: %s",
-                     stream_name, error.message);
-        }
+    dbus_message_unref (msg);
+
+    return success;
+}
+
+static gchar*
+get_object_path_from_reply (DBusMessage *reply, const char *stream_name)
+{
+    const gchar     *obj_path= NULL;
+    gchar           *ret     = NULL;
+    DBusError        error;
+
+    dbus_error_init (&error);
 
+    if (dbus_set_error_from_message (&error, reply)) {
+        N_DEBUG (LOG_CAT "couldn't get object path for %s: %s",
+                 stream_name, error.message);
         goto done;
     }
 
@@ -726,19 +772,37 @@ get_object_path (const char *stream_name)
 done:
     dbus_error_free (&error);
 
-    if (reply) dbus_message_unref (reply);
-    if (msg)   dbus_message_unref (msg);
-
     return ret;
 }
 
-// Tries to update all items from subscribe_map to object_map, and after this
-// listens for stream restore entry signals coming from entries with object paths
-// in object_map.
+static void
+object_path_reply_cb (NCore *core, DBusMessage *msg, void *userdata)
+{
+    gchar         *stream_name = userdata;
+    gchar         *obj_path;
+    SubscribeItem *item;
+
+    (void) core;
+
+    // The subscription may have been removed while the lookup was in flight.
+    if ((obj_path = get_object_path_from_reply (msg, stream_name))) {
+        if (subscribe_map &&
+            (item = g_hash_table_lookup (subscribe_map, stream_name)) &&
+            !item->object_path)
+            item->object_path = obj_path;
+        else
+            g_free (obj_path);
+    }
+
+    g_free (stream_name);
+}
+
+// Listens for stream restore entry signals coming from entries with object
+// paths in object_map.
 // If object_map is incomplete (doesn't contain all items from subscribe_map), then
 // object_map_complete is FALSE.
 static void
-update_object_map_listen ()
+object_map_listen ()
 {
     const char **obj_paths;
     GList *subscription_items, *i;
@@ -753,8 +817,6 @@ update_object_map_listen ()
 
     for (i = g_list_first (subscription_items); i; i = g_list_next (i)) {
         SubscribeItem *item = (SubscribeItem*) i->data;
-        if (!item->object_path)
-            item->object_path = get_object_path (item->stream_name);
         if (item->object_path) {
             g_hash_table_insert (object_map, item->object_path, item);
             obj_paths[j++] = item->object_path;
@@ -774,10 +836,63 @@ update_object_map_listen ()
     g_free (obj_paths);
 }
 
+static void
+object_map_done_cb (NCore *core, void *userdata)
+{
+    (void) core;
+    (void) userdata;
+
+    object_map_updating = FALSE;
+
+    if (object_map_update_queued) {
+        object_map_update_queued = FALSE;
+        update_object_map_listen ();
+        return;
+    }
+
+    object_map_listen ();
+}
+
+// Tries to update all items from subscribe_map to object_map, and after this
+// listens for stream restore entry signals coming from entries with object paths
+// in object_map.
+// All missing object paths are looked up in one batch, so that the lookups
+// cost a single round trip, and the signals are listened for once all the
+// replies have arrived.
+static void
+update_object_map_listen ()
+{
+    NDBusBatch *batch;
+    GList *subscription_items, *i;
+
+    if (!volume_bus || !subscribe_map || !object_map)
+        return;
+
+    if (object_map_updating) {
+        object_map_update_queued = TRUE;
+        return;
+    }
+
+    object_map_updating = TRUE;
+    batch = n_dbus_batch_new (volume_core, object_map_done_cb, NULL);
+    subscription_items = g_hash_table_get_values (subscribe_map);
+
+    for (i = g_list_first (subscription_items); i; i = g_list_next (i)) {
+        SubscribeItem *item = (SubscribeItem*) i->data;
+        if (!item->object_path)
+            get_object_path (batch, item->stream_name, object_path_reply_cb);
+    }
+
+    g_list_free (subscription_items);
+
+    n_dbus_batch_commit (batch);
+}
+
 static void
 process_queued_ops ()
 {
-    QueueItem *op = NULL;
+    QueueItem  *op    = NULL;
+    NDBusBatch *batch = NULL;
 
     /* listen for objects here */
     if (queue_subscribe) {
@@ -788,16 +903,19 @@ process_queued_ops ()
         queue_subscribe = FALSE;
     }
 
+    /* send all queued ops without waiting for the replies in between */
+    batch = n_dbus_batch_new (volume_core, NULL, NULL);
+
     while ((op = g_queue_pop_head (volume_queue)) != NULL) {
         N_DEBUG (LOG_CAT "processing queued volume for role:%s type:%u volume:%d ",
                          op->role, op->type, op->volume);
 
         switch (op->type) {
             case QUEUE_ITEM_TYPE_SET:
-                add_entry (op->role, op->volume);
+                add_entry (batch, op->role, op->volume);
                 break;
             case QUEUE_ITEM_TYPE_GET:
-                get_entry_volume (op->role);
+                get_entry_volume (batch, op->role);
                 break;
             default:
                 g_assert (0);
@@ -807,6 +925,8 @@ process_queued_ops ()
         g_free (op->role);
         g_slice_free (QueueItem, op);
     }
+
+    n_dbus_batch_commit (batch);
 }
 
 static gboolean
@@ -935,8 +1055,10 @@ disconnect_from_pulseaudio ()
 }
 
 int
-volume_controller_initialize ()
+volume_controller_initialize (NCore *core)
 {
+    volume_core = core;
+
     if ((volume_queue = g_queue_new ()) == NULL)
         return FALSE;
 
@@ -966,6 +1088,8 @@ volume_controller_shutdown ()
         g_free(volume_pulse_address);
         volume_pulse_address = NULL;
     }
+
+    volume_core = NULL;
 }
 
 static void
@@ -990,6 +1114,9 @@ queue_op (const char *role, guint type, int volume)
 int
 volume_controller_update (const char *role, int volume)
 {
+    NDBusBatch *batch;
+    gboolean    success;
+
     if (!role)
         return FALSE;
 
@@ -998,12 +1125,18 @@ volume_controller_update (const char *role, int volume)
         return TRUE;
     }
 
-    return add_entry (role, volume);
+    batch = n_dbus_batch_new (volume_core, NULL, NULL);
+    success = add_entry (batch, role, volume);
+    n_dbus_batch_commit (batch);
+
+    return success;
 }
 
 void
 volume_controller_get_volume (const char *role)
 {
+    NDBusBatch *batch;
+
     if (!role)
         return;
 
@@ -1012,7 +1145,9 @@ volume_controller_get_volume (const char *role)
         return;
     }
 
-    get_entry_volume (role);
+    batch = n_dbus_batch_new (volume_core, NULL, NULL);
+    get_entry_volume (batch, role);
+    n_dbus_batch_commit (batch);
 }
 
 void
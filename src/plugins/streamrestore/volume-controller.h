@@ -22,6 +22,8 @@
 #ifndef VOLUME_CONTROLLER_H
 #define VOLUME_CONTROLLER_H
 
+#include <ngf/core.h>
+
 // Called when volume entry with stream name changes.
 // stream_name      name of the stream
 // volume           new volume in range 0..100
@@ -32,7 +34,7 @@ typedef void (*volume_controller_subscribe_cb) (const char *stream_name, int vol
 // Called when media state changes
 typedef void (*media_state_subscribe_cb) (const char *media_state, void *userdata);
 
-int  volume_controller_initialize ();
+int  volume_controller_initialize (NCore *core);
 void volume_controller_shutdown   ();
 int  volume_controller_update     (const char *role, int volume);
 void volume_controller_get_volume (const char *role);
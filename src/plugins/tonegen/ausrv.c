@@ -30,6 +30,7 @@ USA.
 
 #include "stream.h"
 #include "ausrv.h"
+#include "dtmf.h"
 
 #if PA_API_VERSION < 9
 #error Invalid PulseAudio API version
@@ -44,6 +45,7 @@ static void set_connection_status(struct ausrv *ausrv, bool connected);
 static void context_callback(pa_context *, void *);
 static void event_callback(pa_context *, pa_subscription_event_type_t,
                            uint32_t, void *);
+static void query_default_sink(struct ausrv *);
 static void connect_server(struct ausrv *);
 static void restart_timer(struct ausrv *, int);
 static void cancel_timer(struct ausrv *);
@@ -86,6 +88,7 @@ struct ausrv *ausrv_create(struct tonegend *tonegend, const char *server)
     ausrv->tonegend = tonegend;
     ausrv->server   = strdup(server ?: DEFAULT_SERVER);
     ausrv->mainloop = mainloop;
+    ausrv->sink_index = PA_INVALID_INDEX;
 
     connect_server(ausrv);
 
@@ -123,6 +126,8 @@ static void set_connection_status(struct ausrv *ausrv, bool connected)
 {
     if (ausrv->connected != connected) {
         ausrv->connected = connected;
+        ausrv->sink_index = PA_INVALID_INDEX;
+        ausrv->sink_rate = 0;
         TRACE("%s '%s' server", ausrv->connected ? "Connected to" : "Disconnected from", ausrv->server);
     }
 }
@@ -132,6 +137,7 @@ static void context_callback(pa_context *context, void *userdata)
     struct ausrv *ausrv = (struct ausrv *)userdata;
     int           err   = 0;
     const char   *strerr;
+    pa_operation *op;
 
     if (context == NULL) {
         N_ERROR(LOG_CAT "%s() called with zero context", __FUNCTION__);
@@ -165,6 +171,16 @@ static void context_callback(pa_context *context, void *userdata)
         set_connection_status(ausrv, true);
         cancel_timer(ausrv);
         N_DEBUG(LOG_CAT "PulseAudio OK");
+
+        /* follow the default sink for its sample rate */
+        op = pa_context_subscribe(context,
+                                  PA_SUBSCRIPTION_MASK_SERVER |
+                                  PA_SUBSCRIPTION_MASK_SINK,
+                                  NULL, NULL);
+        if (op != NULL)
+            pa_operation_unref(op);
+
+        query_default_sink(ausrv);
         break;
 
     case PA_CONTEXT_TERMINATED:
@@ -194,15 +210,21 @@ static void event_callback(pa_context                   *context,
 {
     struct ausrv *ausrv = (struct ausrv *)userdata;
 
-    (void)idx;
-
     if (ausrv == NULL || ausrv->context != context)
         N_ERROR(LOG_CAT "%s(): Confused with data structures", __FUNCTION__);
     else {
-        switch (type) {
+        switch (type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+
+        case PA_SUBSCRIPTION_EVENT_SERVER:
+            TRACE("Event server");
+            /* the default sink may have changed */
+            query_default_sink(ausrv);
+            break;
 
         case PA_SUBSCRIPTION_EVENT_SINK:
             TRACE("Event sink");
+            if (idx == ausrv->sink_index)
+                query_default_sink(ausrv);
             break;
 
         case PA_SUBSCRIPTION_EVENT_SOURCE:
@@ -225,6 +247,58 @@ static void event_callback(pa_context                   *context,
 }
 
 
+static void sink_info_callback(pa_context        *context,
+                               const pa_sink_info *info,
+                               int                 eol,
+                               void               *userdata)
+{
+    struct ausrv *ausrv = (struct ausrv *)userdata;
+
+    (void)context;
+
+    if (eol || info == NULL || !ausrv->connected)
+        return;
+
+    ausrv->sink_index = info->index;
+
+    if (ausrv->sink_rate != info->sample_spec.rate) {
+        N_DEBUG(LOG_CAT "default sink '%s' plays at %u Hz",
+                info->name, info->sample_spec.rate);
+        ausrv->sink_rate = info->sample_spec.rate;
+        dtmf_update_rate(ausrv);
+    }
+}
+
+static void server_info_callback(pa_context           *context,
+                                 const pa_server_info *info,
+                                 void                 *userdata)
+{
+    struct ausrv *ausrv = (struct ausrv *)userdata;
+    pa_operation *op;
+
+    if (info == NULL || info->default_sink_name == NULL || !ausrv->connected)
+        return;
+
+    op = pa_context_get_sink_info_by_name(context, info->default_sink_name,
+                                          sink_info_callback, ausrv);
+    if (op != NULL)
+        pa_operation_unref(op);
+}
+
+/*
+ * Looks up the sample rate of the default sink, where the streams
+ * are played, when connected and whenever the default sink changes.
+ */
+static void query_default_sink(struct ausrv *ausrv)
+{
+    pa_operation *op;
+
+    op = pa_context_get_server_info(ausrv->context, server_info_callback, ausrv);
+    if (op != NULL)
+        pa_operation_unref(op);
+}
+
+
 static void retry_connect(pa_mainloop_api *api, pa_time_event *event,
                           const struct timeval *tv, void *data)
 {
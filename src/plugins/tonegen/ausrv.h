@@ -40,6 +40,8 @@ struct ausrv {
     pa_context        *context;
     pa_time_event     *timer;
     int                nextid;
+    uint32_t           sink_index; /* default sink */
+    uint32_t           sink_rate;  /* its sample rate, 0 if not known */
     struct stream     *streams;
 };
 
@@ -69,12 +69,17 @@ static void   *dtmf_props  = NULL;
 static int     vol_scale   = 100;
 static bool    mute        = false;
 static guint   tmute_id;
+static bool    warm_enabled = false;
+static int     warm_reasons = 0;
+static char   *warm_props   = NULL;
 
 
 static void destroy_callback(void *);
 static void set_mute_timeout(struct ausrv *, guint);
 static gboolean mute_timeout_callback(gpointer);
 static void request_muting(struct ausrv *ausrv, bool new_mute);
+static struct stream *create_stream(struct ausrv *, const char *);
+static struct stream *find_or_create_stream(struct ausrv *, const char *);
 
 
 
@@ -85,14 +90,13 @@ int dtmf_init(void)
 
 void dtmf_play(struct ausrv *ausrv, dtmf_tone tone, uint32_t volume, int duration, const char *extra_properties)
 {
-    struct stream *stream = stream_find(ausrv, dtmf_stream);
+    struct stream *stream;
     struct dtmf   *dtmf   = dtmf_defs + tone;
     uint32_t       per    = duration;
     uint32_t       play   = duration > 60000 ? duration - 20000 : duration;
     int            type_l = TONE_DTMF_L;
     int            type_h = TONE_DTMF_H;
     uint32_t       timeout;
-    void          *properties = dtmf_props;
 
     if (tone >= DTMF_MAX || (duration != 0 && duration < 10000))
         return;
@@ -108,39 +112,74 @@ void dtmf_play(struct ausrv *ausrv, dtmf_tone tone, uint32_t volume, int duratio
         per = play = 1000000;
     }
 
-    if (stream != NULL) {
+    dtmf_update_rate(ausrv);
+
+    if ((stream = stream_find(ausrv, dtmf_stream)) != NULL) {
         if (!duration) {
             indicator_stop(ausrv, true);
             dtmf_stop(ausrv);
         }
     }
-    else {
-        if (extra_properties)
-            properties = stream_merge_properties(dtmf_props, extra_properties);
+    else if ((stream = find_or_create_stream(ausrv, extra_properties)) == NULL)
+        return;
+
+    volume = (vol_scale * volume) / 100;
 
-        stream = stream_create(ausrv, dtmf_stream, NULL, 0,
-                               tone_write_callback,
-                               destroy_callback,
-                               properties,
-                               NULL);
+    tone_create(stream, type_l, dtmf->low_freq , volume/2, per, play, 0, duration);
+    tone_create(stream, type_h, dtmf->high_freq, volume/2, per, play, 0, duration);
 
-        if (extra_properties)
-            stream_free_properties(properties);
+    timeout = duration ? duration + (30 * 1000000) : (1 * 60 * 1000000);
 
-        if (stream == NULL) {
-            N_ERROR(LOG_CAT "%s(): Can't create stream", __FUNCTION__);
+    stream_set_timeout(stream, timeout);
+    stream_set_corked(stream, false);
+
+    request_muting(ausrv, true);
+    set_mute_timeout(ausrv, 0);
+}
+
+/*
+ * Queues a sequence of digits, eg. of an auto-dial, on the DTMF stream
+ * in one go. Each digit plays for its on usecs followed by its off usecs
+ * of silence. The digits are chained like keypresses, after those still
+ * playing, so that the renderer starts each one at the sample where the
+ * previous one ends regardless of how the main loop is scheduled.
+ */
+void dtmf_play_sequence(struct ausrv *ausrv, const struct dtmf_digit *digits,
+                        int count, uint32_t volume, const char *extra_properties)
+{
+    struct stream *stream;
+    struct dtmf   *dtmf;
+    uint32_t       per;
+    uint32_t       end;
+    int            i;
+
+    for (i = 0;  i < count;  i++) {
+        if (digits[i].tone >= DTMF_MAX || digits[i].on < 10000) {
+            N_ERROR(LOG_CAT "%s(): invalid digit %d of the sequence",
+                    __FUNCTION__, i);
             return;
         }
     }
 
+    dtmf_update_rate(ausrv);
+
+    if (count <= 0 || (stream = find_or_create_stream(ausrv, extra_properties)) == NULL)
+        return;
+
     volume = (vol_scale * volume) / 100;
 
-    tone_create(stream, type_l, dtmf->low_freq , volume/2, per, play, 0, duration);
-    tone_create(stream, type_h, dtmf->high_freq, volume/2, per, play, 0, duration);
+    for (i = 0;  i < count;  i++) {
+        dtmf = dtmf_defs + digits[i].tone;
+        per  = digits[i].on + digits[i].off;
 
-    timeout = duration ? duration + (30 * 1000000) : (1 * 60 * 1000000);
+        tone_create(stream, TONE_DTMF_L, dtmf->low_freq , volume/2, per, digits[i].on, 0, per);
+        tone_create(stream, TONE_DTMF_H, dtmf->high_freq, volume/2, per, digits[i].on, 0, per);
+    }
 
-    stream_set_timeout(stream, timeout);
+    end = tone_chain_end(stream, TONE_DTMF_L);
+
+    stream_set_timeout(stream, (end > stream->time ? end - stream->time : 0) + (30 * 1000000));
+    stream_set_corked(stream, false);
 
     request_muting(ausrv, true);
     set_mute_timeout(ausrv, 0);
@@ -163,8 +202,7 @@ void dtmf_stop(struct ausrv *ausrv)
 
             case TONE_DTMF_IND_L:
             case TONE_DTMF_IND_H:
-                /* in the future a linear ramp-down enevlop can be set */
-                tone_destroy(tone, true);
+                (void)tone_ramp_down(tone, TONE_STOP_RAMP);
                 break;
 
             default:
@@ -183,6 +221,41 @@ void dtmf_stop(struct ausrv *ausrv)
 }
 
 
+/* fades out the tone playing and drops the digits queued after it */
+void dtmf_stop_sequence(struct ausrv *ausrv)
+{
+    struct stream *stream = stream_find(ausrv, dtmf_stream);
+    struct tone   *tone;
+    struct tone   *next;
+
+    if (stream != NULL) {
+        for (tone = (struct tone *)stream->data;  tone;  tone = next) {
+            next = tone->next;
+
+            if (tone->type == TONE_DTMF_L || tone->type == TONE_DTMF_H)
+                (void)tone_ramp_down(tone, TONE_STOP_RAMP);
+        }
+    }
+
+    dtmf_stop(ausrv);
+}
+
+/* returns the tone of a digit, eg. '*' or 'a', or -1 */
+int dtmf_parse_digit(char symbol)
+{
+    int i;
+
+    if (symbol >= 'a' && symbol <= 'd')
+        symbol -= 'a' - 'A';
+
+    for (i = 0;  i < DTMF_MAX;  i++) {
+        if (dtmf_defs[i].symbol == symbol)
+            return i;
+    }
+
+    return -1;
+}
+
 void dtmf_set_properties(char *propstring)
 {
     dtmf_props = stream_parse_properties(propstring);
@@ -194,6 +267,137 @@ void dtmf_set_volume(uint32_t volume)
     vol_scale = volume;
 }
 
+void dtmf_enable_warm_stream(bool enable)
+{
+    warm_enabled = enable;
+
+    if (!enable) {
+        g_free(warm_props);
+        warm_props = NULL;
+    }
+}
+
+/*
+ * While there is a reason to expect keypresses the DTMF stream is kept
+ * connected but corked, with silence already queued, instead of being
+ * destroyed after the tones. The first keypress of a burst then only
+ * needs to uncork it instead of setting up and pre-buffering a stream.
+ */
+void dtmf_set_warm(struct ausrv *ausrv, dtmf_warm_reason reason, bool warm,
+                   const char *extra_properties)
+{
+    struct stream *stream;
+    int            reasons;
+
+    if (extra_properties) {
+        g_free(warm_props);
+        warm_props = g_strdup(extra_properties);
+    }
+
+    reasons = warm ? (warm_reasons | reason) : (warm_reasons & ~reason);
+
+    if (!warm_enabled || !reasons == !warm_reasons) {
+        warm_reasons = reasons;
+        return;
+    }
+
+    warm_reasons = reasons;
+
+    TRACE("%s(): %s warm dtmf stream", __FUNCTION__, reasons ? "start" : "stop");
+
+    if (ausrv == NULL || !ausrv->connected)
+        return;
+
+    stream = stream_find(ausrv, dtmf_stream);
+
+    if (reasons) {
+        if (stream == NULL) {
+            if ((stream = create_stream(ausrv, warm_props)) != NULL)
+                stream_set_corked(stream, true);
+        }
+        else
+            stream->warm = true;
+    }
+    else if (stream != NULL) {
+        stream->warm = false;
+
+        /* a playing stream is destroyed by its timeout */
+        if (stream->corked)
+            stream_destroy(stream);
+    }
+}
+
+/*
+ * Streams keep the rate they were created at. When the sink rate has
+ * changed, a corked warm stream is made again at the new rate and an
+ * idle one is dropped, to be created at the new rate with the next
+ * digit. A playing stream is left alone and checked again next time.
+ */
+void dtmf_update_rate(struct ausrv *ausrv)
+{
+    struct stream *stream;
+
+    if (ausrv == NULL || (stream = stream_find(ausrv, dtmf_stream)) == NULL)
+        return;
+
+    if (stream->rate == stream_default_rate(ausrv))
+        return;
+
+    if (stream->corked) {
+        TRACE("%s(): recreating warm dtmf stream at %u Hz", __FUNCTION__,
+              stream_default_rate(ausrv));
+
+        stream_destroy(stream);
+
+        if ((stream = create_stream(ausrv, warm_props)) != NULL)
+            stream_set_corked(stream, true);
+    }
+    else if (stream->data == NULL)
+        stream_destroy(stream);
+}
+
+static struct stream *create_stream(struct ausrv *ausrv,
+                                    const char *extra_properties)
+{
+    struct stream *stream;
+    void          *properties = dtmf_props;
+
+    if (extra_properties)
+        properties = stream_merge_properties(dtmf_props, extra_properties);
+
+    stream = stream_create(ausrv, dtmf_stream, NULL, 0,
+                           tone_write_callback,
+                           destroy_callback,
+                           properties,
+                           NULL);
+
+    if (extra_properties)
+        stream_free_properties(properties);
+
+    if (stream == NULL)
+        N_ERROR(LOG_CAT "%s(): Can't create stream", __FUNCTION__);
+    else
+        stream->warm = warm_enabled && warm_reasons;
+
+    return stream;
+}
+
+static struct stream *find_or_create_stream(struct ausrv *ausrv,
+                                            const char *extra_properties)
+{
+    struct stream *stream = stream_find(ausrv, dtmf_stream);
+
+    if (stream == NULL) {
+        /* a warm stream is created alike, e.g. with the role of the call */
+        g_free(warm_props);
+        warm_props = g_strdup(extra_properties);
+
+        stream = create_stream(ausrv, extra_properties);
+    }
+
+    return stream;
+}
+
 static void destroy_callback(void *data)
 {
     struct tone   *tone = (struct tone *)data;
@@ -24,6 +24,7 @@ USA.
 #define __TONEGEND_DTMF_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef enum _dtmf_tone {
     DTMF_0        = 0,
@@ -45,12 +46,31 @@ typedef enum _dtmf_tone {
     DTMF_MAX      = 16
 } dtmf_tone;
 
+struct dtmf_digit {
+    dtmf_tone      tone;
+    uint32_t       on;       /* usecs of tone */
+    uint32_t       off;      /* usecs of silence after it */
+};
+
+typedef enum _dtmf_warm_reason {
+    DTMF_WARM_CALL = 1 << 0,    /* there is an active call */
+    DTMF_WARM_HINT = 1 << 1     /* requested by a client */
+} dtmf_warm_reason;
+
 int  dtmf_init(void);
 void dtmf_play(struct ausrv *ausrv, dtmf_tone tone,
                uint32_t volume, int duration, const char *extra_properties);
+void dtmf_play_sequence(struct ausrv *ausrv, const struct dtmf_digit *digits,
+                        int count, uint32_t volume, const char *extra_properties);
 void dtmf_stop(struct ausrv *ausrv);
+void dtmf_stop_sequence(struct ausrv *ausrv);
+int  dtmf_parse_digit(char symbol);
 void dtmf_set_properties(char *propstring);
 void dtmf_set_volume(uint32_t volume);
 void dtmf_enable_mute_signal(gboolean enable);
+void dtmf_enable_warm_stream(bool enable);
+void dtmf_set_warm(struct ausrv *ausrv, dtmf_warm_reason reason, bool warm,
+                   const char *extra_properties);
+void dtmf_update_rate(struct ausrv *ausrv);
 
 #endif /* __TONEGEND_DTMF_H__ */
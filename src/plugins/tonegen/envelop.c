@@ -49,20 +49,14 @@ static inline union envelop *ramp_create(int type, uint32_t length,
         memset(ramp, 0, sizeof(*ramp));
         ramp->type   = type;
 
-        up->k1    = 100;
-        up->k2    = length / up->k1;
         up->start = start;
         up->end   = start + length;
 
         if (end < start + (length * 2)) {
-            down->k1    = 1;
-            down->k2    = 1;
             down->start = -1;
             down->end   = -1;
         }
         else {
-            down->k1    = 100;
-            down->k2    = length / down->k1;
             down->start = end - length;
             down->end   = end;
         }
@@ -76,8 +70,6 @@ static inline void ramp_update(union envelop *envelop, uint32_t length,
 {
     struct envelop_ramp_def *down = &envelop->ramp.down;
 
-    down->k1    = 100;
-    down->k2    = length / down->k1;
     down->start = end - length;
     down->end   = end;
 }
@@ -88,23 +80,38 @@ static inline void ramp_destroy(union envelop *envelop)
     (void) envelop;
 }
 
-static inline int32_t ramp_apply(union envelop *envelop, int32_t in,uint32_t t)
+/*
+ * ramp-up includes its start and ramp-down its end so that
+ * the first and last sample of a ramp are silent
+ */
+static inline uint32_t ramp_span(union envelop *envelop, uint32_t t,
+                                 float *gain, float *slope)
 {
     struct envelop_ramp_def *up   = &envelop->ramp.up;
     struct envelop_ramp_def *down = &envelop->ramp.down;
-    int32_t                  k3;
 
-    if (t > up->start && t < up->end) {
-        k3 = (int32_t)(t - up->start) / up->k1;
-        return (in * k3) / up->k2;
+    if (t >= up->start && t < up->end) {
+        *slope = 1.0f / (float)(up->end - up->start);
+        *gain  = (float)(t - up->start) * *slope;
+        return up->end - t;
     }
 
-    if (t > down->start && t < down->end) {
-        k3 = (int32_t)(down->end -t) / down->k1;
-        return (in * k3) / down->k2;
+    if (down->start != UINT32_MAX && t >= down->start && t <= down->end) {
+        *slope = -1.0f / (float)(down->end - down->start);
+        *gain  = (float)(down->end - t) * -*slope;
+        return down->end - t + 1;
     }
 
-    return in;
+    *gain  = 1.0f;
+    *slope = 0.0f;
+
+    if (t < up->start)
+        return up->start - t;
+
+    if (t < down->start)
+        return down->start - t;
+
+    return UINT32_MAX;
 }
 
 
@@ -160,16 +167,22 @@ void envelop_destroy(union envelop *envelop)
     }
 }
 
-int32_t envelop_apply(union envelop *envelop, int32_t in, uint32_t t)
+/*
+ * Returns for how many microseconds from t the envelop stays linear.
+ * Over that span the gain at t + x is *gain + x * *slope.
+ */
+uint32_t envelop_linear_span(union envelop *envelop, uint32_t t,
+                             float *gain, float *slope)
 {
-    uint32_t out = in;
-
     if (envelop != NULL) {
         switch (envelop->type) {
-        case ENVELOP_RAMP_LINEAR:   out = ramp_apply(envelop, in, t);    break;
-        default:                    out = in;                            break;
+        case ENVELOP_RAMP_LINEAR:   return ramp_span(envelop, t, gain, slope);
+        default:                                                          break;
         }
     }
 
-    return out;
+    *gain  = 1.0f;
+    *slope = 0.0f;
+
+    return UINT32_MAX;
 }
@@ -29,8 +29,6 @@ USA.
 #define ENVELOP_RAMP_LINEAR  1
 
 struct envelop_ramp_def {
-    int32_t       k1;
-    int32_t       k2;
     uint32_t      start;
     uint32_t      end;
 };
@@ -51,6 +49,7 @@ int envelop_init(void);
 union envelop *envelop_create(int type, uint32_t length, uint32_t start, uint32_t end);
 void envelop_update(union envelop *envelop, uint32_t length, uint32_t end);
 void envelop_destroy(union envelop *envelop);
-int32_t envelop_apply(union envelop *envelop, int32_t in, uint32_t t);
+uint32_t envelop_linear_span(union envelop *envelop, uint32_t t,
+                             float *gain, float *slope);
 
 #endif /* __TONEGEND_ENVELOP_H__ */
@@ -30,6 +30,7 @@ USA.
 #include "ausrv.h"
 #include "stream.h"
 #include "tone.h"
+#include "pattern.h"
 #include "indicator.h"
 #include "dtmf.h"
 
@@ -39,24 +40,318 @@ USA.
  * stream around for a long time after playing the actual tone. */
 #define MAX_SHORT_TONE_LENGTH (1 * 5 * 1000000)
 
+/* Endless periodic tones are rendered once into a loop and played
+ * from there. Loops are kept up to this many bytes. */
+#define DEFAULT_LOOP_CACHE (1024 * 1024)
+
+#define NUM_STANDARDS   (STD_ATNT + 1)
+#define NUM_TONES       (TONE_RING + 1)
+
+#define ERROR_PATTERN   "900 2000/333.333 ramp 3, 1400 2000/332.857 at 333.333 ramp 3, " \
+                        "1800 2000/300 at 666.19 ramp 3"
+
 #define LOG_CAT "tonegen-indicator: "
 
+struct loop_entry {
+    struct loop_entry  *next;
+    int                 type;
+    indicator_standard  standard;
+    uint32_t            rate;
+    uint32_t            volume;
+    struct tone_loop   *loop;
+};
+
 static char                *ind_stream = STREAM_INDICATOR;
 static indicator_standard   standard   = STD_CEPT;
 static void                *ind_props  = NULL;
 static uint32_t             vol_scale  = 100;
 
+static struct loop_entry   *loops       = NULL;   /* most recently used first */
+static size_t               loop_limit  = DEFAULT_LOOP_CACHE;
+static size_t               loop_size   = 0;
+static uint32_t             loop_count  = 0;
+static uint32_t             loop_hits   = 0;
+static uint32_t             loop_misses = 0;
+
+static void evict_loops(size_t limit);
+
+static const char *standard_names[NUM_STANDARDS] = {
+    [STD_CEPT]  = "cept",
+    [STD_ANSI]  = "ansi",
+    [STD_JAPAN] = "japan",
+    [STD_ATNT]  = "atnt",
+};
+
+static const char *tone_names[NUM_TONES] = {
+    [TONE_DIAL]      = "dial",
+    [TONE_BUSY]      = "busy",
+    [TONE_CONGEST]   = "congest",
+    [TONE_RADIO_ACK] = "radio-ack",
+    [TONE_RADIO_NA]  = "radio-na",
+    [TONE_ERROR]     = "error",
+    [TONE_WAIT]      = "wait",
+    [TONE_RING]      = "ring",
+};
+
+/* the tones of each standard, see pattern.h for the format */
+static const char *default_patterns[NUM_STANDARDS][NUM_TONES] = {
+    [STD_CEPT] = {
+        [TONE_DIAL]      = "425 1000/1000 forever; long",
+        [TONE_BUSY]      = "425 1000/500",
+        [TONE_CONGEST]   = "425 400/200",
+        [TONE_RADIO_ACK] = "425 200/200 for 200; short",
+        [TONE_RADIO_NA]  = "425 400/200 for 1200; short",
+        [TONE_ERROR]     = ERROR_PATTERN,
+        [TONE_WAIT]      = "425 800/200 for 1000, 425 800/200 at 4000 for 1000; long",
+        [TONE_RING]      = "425 5000/1000 forever; long",
+    },
+    [STD_ANSI] = {
+        [TONE_DIAL]      = "350+440 1000/1000 forever; long",
+        [TONE_BUSY]      = "480+620 1000/500",
+        [TONE_CONGEST]   = "480+620 500/250",
+        [TONE_RADIO_ACK] = "425 200/200 for 200; short",
+        [TONE_RADIO_NA]  = "425 400/200 for 1200; short",
+        [TONE_ERROR]     = ERROR_PATTERN,
+        [TONE_WAIT]      = "440 300/300 for 300, 440 10000/100 at 10000 forever, "
+                           "440 10000/100 at 10200 forever; long",
+        [TONE_RING]      = "440+480 6000/2000 forever; long",
+    },
+    [STD_JAPAN] = {
+        [TONE_DIAL]      = "400 1000/1000 forever; long",
+        [TONE_BUSY]      = "400 1000/500",
+        /* non-standard, busy tone is played instead of being silent */
+        [TONE_CONGEST]   = "400 1000/500",
+        /* the Japan standard tone is repeating */
+        [TONE_RADIO_ACK] = "400 3000/1000 forever; long",
+        [TONE_RADIO_NA]  = "silent; short",
+        /* non-standard, busy tone is played instead of being silent */
+        [TONE_ERROR]     = "400 1000/500",
+        [TONE_WAIT]      = "silent; long",
+        [TONE_RING]      = "silent; long",
+    },
+    [STD_ATNT] = {
+        [TONE_DIAL]      = "350+440 1000/1000 forever; long",
+        [TONE_BUSY]      = "480+620 1000/500",
+        [TONE_CONGEST]   = "480+620 500/250",
+        [TONE_RADIO_ACK] = "425 200/200 for 200; short",
+        [TONE_RADIO_NA]  = "425 400/200 for 1200; short",
+        [TONE_ERROR]     = ERROR_PATTERN,
+        [TONE_WAIT]      = "440 4000/200 forever, 440 4000/200 at 500 forever; long",
+        [TONE_RING]      = "440+480 6000/2000 forever; long",
+    },
+};
+
+static struct tone_pattern *patterns[NUM_STANDARDS][NUM_TONES];
+
 int indicator_init(void)
 {
+    int std, type;
+
+    for (std = 0;  std < NUM_STANDARDS;  std++) {
+        for (type = TONE_DIAL;  type < NUM_TONES;  type++) {
+            if (patterns[std][type] == NULL)
+                patterns[std][type] = pattern_compile(default_patterns[std][type]);
+        }
+    }
+
     return 0;
 }
 
+void indicator_exit(void)
+{
+    int std, type;
+
+    evict_loops(0);
+
+    for (std = 0;  std < NUM_STANDARDS;  std++) {
+        for (type = 0;  type < NUM_TONES;  type++) {
+            pattern_free(patterns[std][type]);
+            patterns[std][type] = NULL;
+        }
+    }
+}
+
+/*
+ * Replaces the tone of a standard with a pattern, eg. from the
+ * pattern.<standard>.<tone> option. Returns false if the standard or
+ * the tone is not known or the pattern is invalid.
+ */
+bool indicator_set_pattern(const char *std_name, const char *tone_name,
+                           const char *spec)
+{
+    struct tone_pattern *pattern;
+    int                  std, type;
+
+    for (std = 0;  std < NUM_STANDARDS;  std++) {
+        if (!strcmp(std_name, standard_names[std]))
+            break;
+    }
+
+    for (type = TONE_DIAL;  type < NUM_TONES;  type++) {
+        if (!strcmp(tone_name, tone_names[type]))
+            break;
+    }
+
+    if (std >= NUM_STANDARDS || type >= NUM_TONES) {
+        N_ERROR(LOG_CAT "Unknown tone '%s' of standard '%s'", tone_name, std_name);
+        return false;
+    }
+
+    if ((pattern = pattern_compile(spec)) == NULL)
+        return false;
+
+    pattern_free(patterns[std][type]);
+    patterns[std][type] = pattern;
+
+    /* the loops of the old pattern are gone with the cache */
+    evict_loops(0);
+
+    N_DEBUG(LOG_CAT "%s %s tone is '%s'", std_name, tone_name, spec);
+
+    return true;
+}
+
+/* returns the timeout for the stream */
+static uint32_t create_tones(struct stream *stream, int type, uint32_t volume,
+                             int duration)
+{
+    struct tone_pattern *pattern;
+
+    if (type < TONE_DIAL || type >= NUM_TONES) {
+        N_ERROR(LOG_CAT "%s(): invalid type %d", __FUNCTION__, type);
+        return duration ?: MAX_TONE_LENGTH;
+    }
+
+    if ((pattern = patterns[standard][type]) == NULL)
+        return duration ?: MAX_TONE_LENGTH;
+
+    pattern_play(stream, type, pattern, volume, duration);
+
+    switch (pattern->timeout) {
+    case PATTERN_TIMEOUT_SHORT:
+        return MAX_SHORT_TONE_LENGTH;
+    case PATTERN_TIMEOUT_LONG:
+        return MAX_TONE_LENGTH;
+    default:
+        return duration ?: MAX_TONE_LENGTH;
+    }
+}
+
+static void evict_loops(size_t limit)
+{
+    struct loop_entry **iter;
+    struct loop_entry  *entry;
+
+    while (loop_size > limit) {
+        for (iter = &loops; (*iter)->next; iter = &(*iter)->next)
+            ;
+
+        entry = *iter;
+        *iter = NULL;
+
+        loop_size -= entry->loop->length * sizeof(int16_t);
+        loop_count--;
+
+        N_DEBUG(LOG_CAT "evicted loop of tone %d, cache %zu bytes in %u loops",
+                entry->type, loop_size, loop_count);
+
+        tone_loop_unref(entry->loop);
+        free(entry);
+    }
+}
+
+static struct tone_loop *find_loop(int type, uint32_t rate, uint32_t volume)
+{
+    struct loop_entry **iter;
+    struct loop_entry  *entry;
+
+    for (iter = &loops; (entry = *iter); iter = &entry->next) {
+        if (entry->type == type && entry->standard == standard &&
+            entry->rate == rate && entry->volume == volume) {
+            *iter       = entry->next;
+            entry->next = loops;
+            loops       = entry;
+
+            return entry->loop;
+        }
+    }
+
+    return NULL;
+}
+
+static struct tone_loop *render_loop(int type, uint32_t rate, uint32_t volume)
+{
+    struct stream      scratch;
+    struct tone_loop  *loop;
+    struct loop_entry *entry;
+
+    memset(&scratch, 0, sizeof(scratch));
+    scratch.rate = rate;
+
+    create_tones(&scratch, type, volume, 0);
+    loop = tone_loop_render(&scratch, loop_limit);
+
+    if (scratch.data != NULL)
+        tone_destroy_callback(scratch.data);
+
+    if (loop == NULL)
+        return NULL;
+
+    if ((entry = calloc(1, sizeof(*entry))) == NULL) {
+        N_ERROR(LOG_CAT "%s(): Can't allocate memory", __FUNCTION__);
+        tone_loop_unref(loop);
+        return NULL;
+    }
+
+    entry->type     = type;
+    entry->standard = standard;
+    entry->rate     = rate;
+    entry->volume   = volume;
+    entry->loop     = loop;
+    entry->next     = loops;
+    loops           = entry;
+
+    loop_size += loop->length * sizeof(int16_t);
+    loop_count++;
+
+    N_DEBUG(LOG_CAT "rendered %u ms loop of tone %d, cache %zu bytes in %u loops",
+            loop->period / 1000, type, loop_size, loop_count);
+
+    evict_loops(loop_limit);
+
+    return loop;
+}
+
+static bool play_loop(struct stream *stream, int type, uint32_t volume)
+{
+    struct tone_loop *loop;
+
+    if (!loop_limit)
+        return false;
+
+    if ((loop = find_loop(type, stream->rate, volume)) != NULL)
+        loop_hits++;
+    else if ((loop = render_loop(type, stream->rate, volume)) != NULL)
+        loop_misses++;
+    else
+        return false;
+
+    return tone_create_loop(stream, type, loop) != NULL;
+}
 
 void indicator_play(struct ausrv *ausrv, int type, uint32_t volume, int duration)
 {
     struct stream *stream  = stream_find(ausrv, ind_stream);
     uint32_t       timeout = duration ?: MAX_TONE_LENGTH;
 
+    /* a stopping stream finishes its ramp on its own, and the new
+       tone gets a stream of its own at the current sink rate */
+    if (stream != NULL &&
+        (stream->stopping || stream->rate != stream_default_rate(ausrv))) {
+        stream_destroy(stream);
+        stream = NULL;
+    }
+
     if (stream != NULL) {
         dtmf_stop(ausrv);
         indicator_stop(ausrv, false);
@@ -76,152 +371,38 @@ void indicator_play(struct ausrv *ausrv, int type, uint32_t volume, int duration
 
     volume = (vol_scale * volume) / 100;
 
-    switch (type) {
+    if (duration || !play_loop(stream, type, volume))
+        timeout = create_tones(stream, type, volume, duration);
 
-    case TONE_DIAL:
-        switch (standard) {
-        case STD_CEPT:
-            tone_create(stream, type, 425, volume, 1000000, 1000000, 0,0);
-            break;
-        case STD_ANSI:
-        case STD_ATNT:
-            tone_create(stream, type, 350, (volume*7)/10, 1000000, 1000000, 0,0);
-            tone_create(stream, type, 440, (volume*7)/10, 1000000, 1000000, 0,0);
-            break;
-        case STD_JAPAN:
-            tone_create(stream, type, 400, volume, 1000000, 1000000, 0,0);
-            break;
-        }
-        timeout = MAX_TONE_LENGTH;
-        break;
+    stream_set_timeout(stream, timeout);
+}
 
-    case TONE_BUSY:
-        switch (standard) {
-        case STD_CEPT:
-            tone_create(stream, type, 425, volume, 1000000, 500000, 0, duration);
-            break;
-        case STD_ANSI:
-        case STD_ATNT:
-            tone_create(stream, type, 480, (volume*7)/10, 1000000, 500000, 0, duration);
-            tone_create(stream, type, 620, (volume*7)/10, 1000000, 500000, 0, duration);
-            break;
-        case STD_JAPAN:
-            tone_create(stream, type, 400, volume, 1000000, 500000, 0, duration);
-            break;
-        }
-        break;
+/* ramps the tones down and lets the stream go once they have ended */
+static void stop_stream(struct stream *stream)
+{
+    struct tone *tone;
+    struct tone *next;
+    uint32_t     end = 0;
+    uint32_t     tone_end;
 
-    case TONE_CONGEST:
-        switch (standard) {
-        case STD_CEPT:
-            tone_create(stream, type, 425, volume, 400000, 200000, 0, duration);
-            break;
-        case STD_ANSI:
-        case STD_ATNT:
-            tone_create(stream, type, 480, (volume*7)/10, 500000, 250000, 0, duration);
-            tone_create(stream, type, 620, (volume*7)/10, 500000, 250000, 0, duration);
-            break;
-        case STD_JAPAN:
-            /*
-             * this is non-standard, but
-             * we play busy tone instead of being silent
-             */
-            tone_create(stream, type, 400, volume, 1000000, 500000, 0, duration);
-            break;
-        }
-        break;
-
-    case TONE_RADIO_ACK:
-        switch (standard) {
-        case STD_CEPT:
-        case STD_ANSI:
-        case STD_ATNT:
-            tone_create(stream, type, 425, volume, 200000, 200000, 0,200000);
-            timeout = MAX_SHORT_TONE_LENGTH;
-            break;
-        case STD_JAPAN:
-            tone_create(stream, type, 400, volume, 3000000, 1000000, 0,0);
-            /* The Japan standard tone is repeating, so I guess we need to wait 60s anyway. */
-            timeout = MAX_TONE_LENGTH;
-            break;
-        }
-        break;
-
-    case TONE_RADIO_NA:
-        switch (standard) {
-        case STD_CEPT:
-        case STD_ANSI:
-        case STD_ATNT:
-            tone_create(stream, type, 425, volume, 400000, 200000, 0,1200000);
-            break;
-        case STD_JAPAN:
-            break;
-        }
-        timeout = MAX_SHORT_TONE_LENGTH;
-        break;
-
-    case TONE_ERROR:
-        switch (standard) {
-        case STD_CEPT:
-        case STD_ANSI:
-        case STD_ATNT:
-            tone_create(stream, type,  900, volume, 2000000, 333333, 0, duration);
-            tone_create(stream, type, 1400, volume, 2000000, 332857, 333333, duration);
-            tone_create(stream, type, 1800, volume, 2000000, 300000, 666190, duration);
-            break;
-        case STD_JAPAN:
-            /*
-             * this is non-standard, but
-             * we play busy tone instead of being silent
-             */
-            tone_create(stream, type, 400, volume, 1000000, 500000, 0, duration);
-            break;
-        }
-        break;
+    if (stream->stopping)
+        return;
 
-    case TONE_WAIT:
-        switch (standard) {
-        case STD_CEPT:
-            tone_create(stream,type, 425, volume, 800000,200000, 0,1000000);
-            tone_create(stream,type, 425, volume, 800000,200000, 4000000,1000000);
-            break;
-        case STD_ANSI:
-            tone_create(stream,type, 440, volume, 300000,300000, 0,300000);
-            tone_create(stream,type, 440, volume, 10000000,100000, 10000000,0);
-            tone_create(stream,type, 440, volume, 10000000,100000, 10200000,0);
-            break;
-        case STD_ATNT:
-            tone_create(stream, type, 440, volume, 4000000, 200000, 0, 0);
-            tone_create(stream, type, 440, volume, 4000000, 200000, 500000, 0);
-            break;
-        case STD_JAPAN:
-            break;
-        }
-        timeout = MAX_TONE_LENGTH;
-        break;
+    for (tone = (struct tone *)stream->data;  tone;  tone = next) {
+        next = tone->next;
 
-    case TONE_RING:
-        switch (standard) {
-        case STD_CEPT:
-            tone_create(stream, type, 425, volume, 5000000, 1000000, 0,0);
-            break;
-        case STD_ANSI:
-        case STD_ATNT:
-            tone_create(stream, type, 440, (volume*7)/10, 6000000, 2000000, 0,0);
-            tone_create(stream, type, 480, (volume*7)/10, 6000000, 2000000, 0,0);
-            break;
-        case STD_JAPAN:
-            break;
-        }
-        timeout = MAX_TONE_LENGTH;
-        break;
+        if ((tone_end = tone_ramp_down(tone, TONE_STOP_RAMP)) > end)
+            end = tone_end;
+    }
 
-    default:
-        N_ERROR(LOG_CAT "%s(): invalid type %d", __FUNCTION__, type);
-        break;
+    if (end <= stream->time) {
+        stream_destroy(stream);
+        return;
     }
 
-    stream_set_timeout(stream, timeout);
+    stream->stopping = true;
+    stream->flush    = false;
+    stream_set_timeout(stream, end - stream->time);
 }
 
 void indicator_stop(struct ausrv *ausrv, bool kill_stream)
@@ -235,7 +416,7 @@ void indicator_stop(struct ausrv *ausrv, bool kill_stream)
 
     if (stream != NULL) {
         if (kill_stream)
-            stream_destroy(stream);
+            stop_stream(stream);
         else {
             /* destroy all but DTMF tones */
             for (hd = (struct tone *)&stream->data;  hd;  hd = hd->next) {
@@ -260,3 +441,18 @@ void indicator_set_volume(uint32_t volume)
 {
     vol_scale = volume;
 }
+
+void indicator_set_loop_cache(size_t size)
+{
+    loop_limit = size;
+    evict_loops(loop_limit);
+}
+
+void indicator_get_loop_stats(uint32_t *count, size_t *size,
+                              uint32_t *hits, uint32_t *misses)
+{
+    *count  = loop_count;
+    *size   = loop_size;
+    *hits   = loop_hits;
+    *misses = loop_misses;
+}
@@ -25,6 +25,7 @@ USA.
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef enum _indicator_standard {
     STD_CEPT          = 0,
@@ -35,10 +36,16 @@ typedef enum _indicator_standard {
 
 
 int  indicator_init(void);
+void indicator_exit(void);
 void indicator_play(struct ausrv *ausrv, int type, uint32_t volume, int duration);
 void indicator_stop(struct ausrv *ausrv, bool kill_stream);
 void indicator_set_standard(indicator_standard std);
 void indicator_set_properties(char *propstring);
 void indicator_set_volume(uint32_t volume);
+void indicator_set_loop_cache(size_t size);
+bool indicator_set_pattern(const char *standard, const char *tone,
+                           const char *spec);
+void indicator_get_loop_stats(uint32_t *count, size_t *size,
+                              uint32_t *hits, uint32_t *misses);
 
 #endif /* __TONEGEND_INDICATOR_H__ */
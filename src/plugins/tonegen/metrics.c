@@ -0,0 +1,231 @@
+/*************************************************************************
+This file is part of ngfd / tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+              2015 Jolla Ltd.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include <ngf/log.h>
+#include <trace/trace.h>
+
+#include "metrics.h"
+
+#define LOG_CAT "tonegen-metrics: "
+
+#define METRICS_NAMES       8       /* stream names tracked */
+#define METRICS_SAMPLES     128     /* latest samples kept per ring */
+#define METRICS_ALL         "all"
+
+struct metrics_ring {
+    uint32_t           samples[METRICS_SAMPLES];
+    uint32_t           count;
+    uint32_t           next;
+};
+
+struct metrics {
+    char              *name;
+    uint32_t           streams;      /* streams created */
+    uint32_t           writes;       /* writes after pre-buffering */
+    uint32_t           late;         /* writes later than minreq */
+    uint32_t           underflows;
+    struct metrics_ring render;      /* cpu usecs to render a write */
+    struct metrics_ring latency;     /* server latency usecs at writes */
+    struct metrics_ring startup;     /* usecs from start to first write */
+};
+
+static struct metrics table[METRICS_NAMES];
+
+static void ring_add(struct metrics_ring *ring, uint32_t sample)
+{
+    ring->samples[ring->next] = sample;
+    ring->next = (ring->next + 1) % METRICS_SAMPLES;
+
+    if (ring->count < METRICS_SAMPLES)
+        ring->count++;
+}
+
+struct metrics *metrics_stream_created(const char *name)
+{
+    struct metrics *metrics;
+    int             i;
+
+    if (name == NULL)
+        return NULL;
+
+    for (i = 0;  i < METRICS_NAMES;  i++) {
+        metrics = table + i;
+
+        if (metrics->name == NULL) {
+            metrics->name = strdup(name);
+            break;
+        }
+
+        if (!strcmp(name, metrics->name))
+            break;
+    }
+
+    if (i >= METRICS_NAMES || metrics->name == NULL) {
+        N_DEBUG(LOG_CAT "no room for the metrics of stream '%s'", name);
+        return NULL;
+    }
+
+    metrics->streams++;
+
+    return metrics;
+}
+
+/* recording a sample is just a store, the percentiles are calculated
+ * when the metrics are collected */
+void metrics_add_write(struct metrics *metrics, uint32_t render, bool late)
+{
+    if (metrics != NULL) {
+        metrics->writes++;
+
+        if (late)
+            metrics->late++;
+
+        ring_add(&metrics->render, render);
+    }
+}
+
+void metrics_add_underflow(struct metrics *metrics)
+{
+    if (metrics != NULL)
+        metrics->underflows++;
+}
+
+void metrics_add_latency(struct metrics *metrics, uint32_t latency)
+{
+    if (metrics != NULL)
+        ring_add(&metrics->latency, latency);
+}
+
+void metrics_add_startup(struct metrics *metrics, uint32_t startup)
+{
+    if (metrics != NULL)
+        ring_add(&metrics->startup, startup);
+}
+
+static int sample_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void set_counter(NProplist *target, const char *name,
+                        const char *key, uint32_t value)
+{
+    char *full = g_strdup_printf("tonegen.%s.%s", name, key);
+
+    n_proplist_set_uint(target, full, value);
+    g_free(full);
+}
+
+/* rings are the samples of one or, for the sum, all the stream names */
+static void collect_percentiles(NProplist *target, const char *name,
+                                const char *key, struct metrics_ring **rings,
+                                int nring)
+{
+    static const uint32_t percentiles[] = { 50, 90, 99 };
+    uint32_t  sorted[METRICS_SAMPLES * METRICS_NAMES];
+    uint32_t  count;
+    char     *full;
+    int       i;
+
+    for (i = 0, count = 0;  i < nring;  i++) {
+        memcpy(sorted + count, rings[i]->samples,
+               rings[i]->count * sizeof(uint32_t));
+        count += rings[i]->count;
+    }
+
+    full = g_strdup_printf("%s.samples", key);
+    set_counter(target, name, full, count);
+    g_free(full);
+
+    if (count == 0)
+        return;
+
+    qsort(sorted, count, sizeof(uint32_t), sample_cmp);
+
+    for (i = 0;  i < (int)G_N_ELEMENTS(percentiles);  i++) {
+        full = g_strdup_printf("%s.p%u_us", key, percentiles[i]);
+        set_counter(target, name, full,
+                    sorted[(count - 1) * percentiles[i] / 100]);
+        g_free(full);
+    }
+}
+
+static void collect_counters(NProplist *target, const char *name,
+                             struct metrics *metrics, int nmetrics)
+{
+    struct metrics_ring *render[METRICS_NAMES];
+    struct metrics_ring *latency[METRICS_NAMES];
+    struct metrics_ring *startup[METRICS_NAMES];
+    uint32_t             streams = 0;
+    uint32_t             writes = 0;
+    uint32_t             late = 0;
+    uint32_t             underflows = 0;
+    int                  i;
+
+    for (i = 0;  i < nmetrics;  i++) {
+        streams    += metrics[i].streams;
+        writes     += metrics[i].writes;
+        late       += metrics[i].late;
+        underflows += metrics[i].underflows;
+
+        render[i]  = &metrics[i].render;
+        latency[i] = &metrics[i].latency;
+        startup[i] = &metrics[i].startup;
+    }
+
+    set_counter(target, name, "streams", streams);
+    set_counter(target, name, "writes", writes);
+    set_counter(target, name, "late", late);
+    set_counter(target, name, "late_percent", writes ? (uint32_t)((uint64_t)late * 100 / writes) : 0);
+    set_counter(target, name, "underflows", underflows);
+
+    collect_percentiles(target, name, "render", render, nmetrics);
+    collect_percentiles(target, name, "latency", latency, nmetrics);
+    collect_percentiles(target, name, "startup", startup, nmetrics);
+}
+
+void metrics_collect(NProplist *target)
+{
+    int i;
+
+    for (i = 0;  i < METRICS_NAMES && table[i].name != NULL;  i++)
+        collect_counters(target, table[i].name, table + i, 1);
+
+    collect_counters(target, METRICS_ALL, table, i);
+}
+
+void metrics_reset(void)
+{
+    int i;
+
+    for (i = 0;  i < METRICS_NAMES;  i++)
+        free(table[i].name);
+
+    memset(table, 0, sizeof(table));
+}
@@ -0,0 +1,48 @@
+/*************************************************************************
+This file is part of ngfd / tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+              2015 Jolla Ltd.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_METRICS_H__
+#define __TONEGEND_METRICS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <ngf/proplist.h>
+
+/*
+ * Stream metrics kept per stream name for the lifetime of the plugin,
+ * whether or not the statistics option is on. They are exported with
+ * the core metrics as tonegen.<stream name>.* and, summed over all the
+ * streams, as tonegen.all.*.
+ */
+
+struct metrics;
+
+struct metrics *metrics_stream_created(const char *name);
+void metrics_add_write(struct metrics *metrics, uint32_t render, bool late);
+void metrics_add_underflow(struct metrics *metrics);
+void metrics_add_latency(struct metrics *metrics, uint32_t latency);
+void metrics_add_startup(struct metrics *metrics, uint32_t startup);
+void metrics_collect(NProplist *target);
+void metrics_reset(void);
+
+#endif /* __TONEGEND_METRICS_H__ */
@@ -0,0 +1,355 @@
+/*************************************************************************
+This file is part of ngfd / tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+              2015 Jolla Ltd.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <ngf/log.h>
+#include <trace/trace.h>
+
+#include "ausrv.h"
+#include "stream.h"
+#include "dtmf.h"
+#include "offline.h"
+#include "metrics.h"
+
+#define LOG_CAT "tonegen-offline: "
+
+#define WAV_HEADER   44
+#define WAV_CHUNK    1024       /* samples rendered at a time */
+
+static uint32_t default_rate  = 48000;
+static bool     use_sink_rate = false;
+
+
+int stream_init(void)
+{
+    return 0;
+}
+
+void stream_set_default_samplerate(uint32_t rate)
+{
+    default_rate = rate;
+}
+
+void stream_use_sink_rate(bool use)
+{
+    use_sink_rate = use;
+}
+
+/* rate of the streams created with sample rate 0 */
+uint32_t stream_default_rate(struct ausrv *ausrv)
+{
+    return use_sink_rate && ausrv->sink_rate ? ausrv->sink_rate : default_rate;
+}
+
+void stream_print_statistics(bool print)
+{
+    (void)print;
+}
+
+void stream_buffering_parameters(int tlen, int minreq)
+{
+    (void)tlen;
+    (void)minreq;
+}
+
+struct stream *stream_create(struct ausrv *ausrv,
+                             const char   *name,
+                             const char   *sink,
+                             uint32_t      sample_rate,
+                             uint32_t    (*write)(struct stream *s, int16_t *samples, int length),
+                             void        (*destroy)(void*),
+                             void         *proplist,
+                             void         *data)
+{
+    struct stream *stream;
+
+    (void)sink;
+    (void)proplist;
+
+    if (!ausrv->connected) {
+        N_ERROR(LOG_CAT "Can't create stream '%s': no server connected", name);
+        return NULL;
+    }
+
+    if (name == NULL)
+        name = "generated tone";
+
+    if (sample_rate == 0)
+        sample_rate = stream_default_rate(ausrv);
+
+    if ((stream = (struct stream *) calloc(1, sizeof(struct stream))) == NULL) {
+        N_ERROR(LOG_CAT "%s(): Can't allocate memory", __FUNCTION__);
+        return NULL;
+    }
+
+    stream->next    = ausrv->streams;
+    stream->ausrv   = ausrv;
+    stream->id      = ausrv->nextid++;
+    stream->name    = strdup(name);
+    stream->rate    = sample_rate;
+    stream->flush   = true;
+    stream->bufsize = (uint32_t)-1;
+    stream->write   = write;
+    stream->destroy = destroy;
+    stream->data    = data;
+    stream->metrics = metrics_stream_created(name);
+
+    ausrv->streams = stream;
+
+    TRACE("%s(): stream '%s' created", __FUNCTION__, stream->name);
+
+    return stream;
+}
+
+void stream_destroy(struct stream *stream)
+{
+    struct ausrv  *ausrv = stream->ausrv;
+    struct stream *prev;
+
+    TRACE("%s(): destroying stream '%s'", __FUNCTION__, stream->name);
+
+    for (prev=(struct stream *)&ausrv->streams;  prev->next;  prev=prev->next) {
+        if (prev->next == stream) {
+            prev->next   = stream->next;
+            stream->next = NULL;
+
+            if (stream->destroy != NULL)
+                stream->destroy(stream->data);
+
+            free(stream->name);
+            free(stream);
+            break;
+        }
+    }
+}
+
+void stream_set_timeout(struct stream *stream, uint32_t timeout)
+{
+    if (timeout == 0)
+        stream->end = 0;
+    else
+        stream->end = stream->time + timeout;
+}
+
+void stream_set_corked(struct stream *stream, bool corked)
+{
+    stream->corked = corked;
+}
+
+void stream_kill_all(struct ausrv *ausrv)
+{
+    while (ausrv->streams != NULL)
+        stream_destroy(ausrv->streams);
+}
+
+void stream_clean_buffer(struct stream *stream)
+{
+    /* nothing is rendered ahead */
+    (void)stream;
+}
+
+struct stream *stream_find(struct ausrv *ausrv, char *name)
+{
+    struct stream *stream;
+
+    for (stream = ausrv->streams;   stream != NULL;   stream = stream->next) {
+        if (!strcmp(name, stream->name))
+            break;
+    }
+
+    return stream;
+}
+
+void *stream_parse_properties(const char *propstring)
+{
+    (void)propstring;
+    return NULL;
+}
+
+void *stream_merge_properties(void *proplist, const char *extra_properties)
+{
+    (void)extra_properties;
+    return proplist;
+}
+
+void stream_free_properties(void *proplist)
+{
+    (void)proplist;
+}
+
+
+struct ausrv *offline_create(void)
+{
+    struct ausrv *ausrv;
+
+    if ((ausrv = (struct ausrv *) calloc(1, sizeof(struct ausrv))) == NULL) {
+        N_ERROR(LOG_CAT "%s(): Can't allocate memory", __FUNCTION__);
+        return NULL;
+    }
+
+    ausrv->server    = strdup("offline");
+    ausrv->connected = true;
+
+    return ausrv;
+}
+
+/*
+ * Sets the rate of the simulated default sink, as if it was queried
+ * from the server or the route changed. 0 makes it unknown.
+ */
+void offline_set_sink_rate(struct ausrv *ausrv, uint32_t rate)
+{
+    if (ausrv->sink_rate != rate) {
+        ausrv->sink_rate = rate;
+        dtmf_update_rate(ausrv);
+    }
+}
+
+void offline_destroy(struct ausrv *ausrv)
+{
+    if (ausrv != NULL) {
+        stream_kill_all(ausrv);
+
+        free(ausrv->server);
+        free(ausrv);
+    }
+}
+
+/*
+ * Renders the next length samples of the named stream, like the server
+ * would request them. Streams time out as with stream.c. Returns the
+ * number of samples rendered, 0 when the stream does not exist (any
+ * more) or is corked.
+ */
+int offline_render(struct ausrv *ausrv, const char *name,
+                   int16_t *samples, int length)
+{
+    struct stream *stream = stream_find(ausrv, (char *)name);
+    clock_t        cpu;
+
+    if (stream == NULL || stream->corked || length <= 0)
+        return 0;
+
+    cpu = clock();
+
+    stream->time  = stream->write(stream, samples, length);
+    stream->bcnt += length * sizeof(*samples);
+
+    /* nothing is played late offline */
+    metrics_add_write(stream->metrics, clock() - cpu, false);
+
+    if (stream->end && stream->time >= stream->end) {
+        if (stream->warm) {
+            stream->end = 0;
+            stream_set_corked(stream, true);
+        }
+        else
+            stream_destroy(stream);
+    }
+
+    return length;
+}
+
+static void put_le(uint8_t *buf, uint32_t value, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; i++)
+        buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+/*
+ * Renders duration usecs of the named stream to a mono 16 bit WAV file,
+ * or less if the stream ends before. Returns the number of samples
+ * written or -1 on error.
+ */
+int offline_render_wav(struct ausrv *ausrv, const char *name,
+                       const char *path, uint32_t duration)
+{
+    struct stream *stream = stream_find(ausrv, (char *)name);
+    uint8_t        header[WAV_HEADER];
+    uint8_t        data[WAV_CHUNK * 2];
+    int16_t        samples[WAV_CHUNK];
+    uint32_t       rate;
+    uint32_t       length;
+    uint32_t       total;
+    int            n, i;
+    FILE          *file;
+
+    if (stream == NULL) {
+        N_ERROR(LOG_CAT "%s(): no stream '%s'", __FUNCTION__, name);
+        return -1;
+    }
+
+    if ((file = fopen(path, "wb")) == NULL) {
+        N_ERROR(LOG_CAT "%s(): Can't open '%s'", __FUNCTION__, path);
+        return -1;
+    }
+
+    rate   = stream->rate;
+    length = (uint32_t)(((uint64_t)duration * rate) / 1000000ULL);
+
+    /* header is rewritten with the sizes when done */
+    memset(header, 0, sizeof(header));
+    fwrite(header, 1, sizeof(header), file);
+
+    for (total = 0;  total < length;  total += n) {
+        n = length - total < WAV_CHUNK ? length - total : WAV_CHUNK;
+
+        if ((n = offline_render(ausrv, name, samples, n)) == 0)
+            break;
+
+        for (i = 0; i < n; i++)
+            put_le(data + i * 2, (uint16_t)samples[i], 2);
+
+        fwrite(data, 2, n, file);
+    }
+
+    memcpy(header, "RIFF", 4);
+    put_le(header + 4, 36 + total * 2, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le(header + 16, 16, 4);            /* fmt chunk size */
+    put_le(header + 20, 1, 2);             /* PCM */
+    put_le(header + 22, 1, 2);             /* mono */
+    put_le(header + 24, rate, 4);
+    put_le(header + 28, rate * 2, 4);      /* bytes per second */
+    put_le(header + 32, 2, 2);             /* block align */
+    put_le(header + 34, 16, 2);            /* bits per sample */
+    memcpy(header + 36, "data", 4);
+    put_le(header + 40, total * 2, 4);
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file);
+
+    if (ferror(file) | fclose(file)) {
+        N_ERROR(LOG_CAT "%s(): Can't write '%s'", __FUNCTION__, path);
+        return -1;
+    }
+
+    return (int)total;
+}
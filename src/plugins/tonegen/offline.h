@@ -0,0 +1,47 @@
+/*************************************************************************
+This file is part of ngfd / tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+              2015 Jolla Ltd.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+
+#ifndef __TONEGEND_OFFLINE_H__
+#define __TONEGEND_OFFLINE_H__
+
+#include <stdint.h>
+
+/*
+ * Offline implementation of the stream interface of stream.h. Linked in
+ * place of stream.c it renders the streams to memory or to a WAV file
+ * instead of playing them on a PulseAudio server. The sample rate of the
+ * streams is set with stream_set_default_samplerate(), or with
+ * offline_set_sink_rate() when stream_use_sink_rate() is on.
+ */
+
+struct ausrv;
+
+struct ausrv *offline_create(void);
+void offline_destroy(struct ausrv *ausrv);
+void offline_set_sink_rate(struct ausrv *ausrv, uint32_t rate);
+int offline_render(struct ausrv *ausrv, const char *name,
+                   int16_t *samples, int length);
+int offline_render_wav(struct ausrv *ausrv, const char *name,
+                       const char *path, uint32_t duration);
+
+#endif /* __TONEGEND_OFFLINE_H__ */
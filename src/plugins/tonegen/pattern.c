@@ -0,0 +1,276 @@
+/*************************************************************************
+This file is part of ngfd / tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+              2015 Jolla Ltd.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#include <ngf/log.h>
+#include <trace/trace.h>
+
+#include "stream.h"
+#include "tone.h"
+#include "pattern.h"
+
+#define LOG_CAT "tonegen-pattern: "
+
+#define MAX_SEGMENTS    32
+#define MAX_FREQ        20000       /* Hz */
+#define MAX_TIME        3600000     /* msecs */
+#define DEFAULT_RAMP    10000       /* usecs */
+
+struct parser {
+    const char *spec;
+    const char *pos;
+};
+
+static void skip_space(struct parser *p)
+{
+    while (isspace((unsigned char)*p->pos))
+        p->pos++;
+}
+
+/* consumes word if it is next, as a whole */
+static bool accept(struct parser *p, const char *word)
+{
+    size_t len = strlen(word);
+
+    skip_space(p);
+
+    if (strncmp(p->pos, word, len) || isalnum((unsigned char)p->pos[len]))
+        return false;
+
+    p->pos += len;
+
+    return true;
+}
+
+static bool parse_freq(struct parser *p, uint32_t *freq)
+{
+    char          *end;
+    unsigned long  value;
+
+    skip_space(p);
+
+    value = strtoul(p->pos, &end, 10);
+
+    if (end == p->pos || value == 0 || value > MAX_FREQ)
+        return false;
+
+    p->pos = end;
+    *freq  = value;
+
+    return true;
+}
+
+/* milliseconds, possibly with a fraction, to usecs */
+static bool parse_time(struct parser *p, uint32_t *usecs)
+{
+    char   *end;
+    double  value;
+
+    skip_space(p);
+
+    if (!isdigit((unsigned char)*p->pos))
+        return false;
+
+    value = strtod(p->pos, &end);
+
+    if (end == p->pos || value > MAX_TIME)
+        return false;
+
+    p->pos = end;
+    *usecs = (uint32_t)(value * 1000.0 + 0.5);
+
+    return true;
+}
+
+static bool parse_part(struct parser *p, struct pattern_segment *segments,
+                       int *length)
+{
+    uint32_t freqs[MAX_SEGMENTS];
+    uint32_t nfreq = 0;
+    uint32_t period, play;
+    uint32_t start  = 0;
+    uint32_t plen   = PATTERN_REQUESTED;
+    uint32_t ramp   = DEFAULT_RAMP;
+    uint32_t i;
+
+    for (;;) {
+        if (nfreq >= MAX_SEGMENTS || !parse_freq(p, &freqs[nfreq]))
+            return false;
+
+        nfreq++;
+        skip_space(p);
+
+        if (*p->pos != '+')
+            break;
+
+        p->pos++;
+    }
+
+    if (!parse_time(p, &period))
+        return false;
+
+    skip_space(p);
+
+    if (*p->pos != '/')
+        return false;
+
+    p->pos++;
+
+    if (!parse_time(p, &play))
+        return false;
+
+    if (!period || !play || play > period)
+        return false;
+
+    if (accept(p, "at") && !parse_time(p, &start))
+        return false;
+
+    if (accept(p, "forever"))
+        plen = 0;
+    else if (accept(p, "for") && (!parse_time(p, &plen) || !plen))
+        return false;
+
+    if (accept(p, "ramp") && !parse_time(p, &ramp))
+        return false;
+
+    if (*length + (int)nfreq > MAX_SEGMENTS)
+        return false;
+
+    for (i = 0;  i < nfreq;  i++) {
+        segments[*length].freq   = freqs[i];
+        segments[*length].parts  = nfreq;
+        segments[*length].period = period;
+        segments[*length].play   = play;
+        segments[*length].start  = start;
+        segments[*length].length = plen;
+        segments[*length].ramp   = ramp;
+        (*length)++;
+    }
+
+    return true;
+}
+
+struct tone_pattern *pattern_compile(const char *spec)
+{
+    struct pattern_segment  segments[MAX_SEGMENTS];
+    struct tone_pattern    *pattern;
+    struct parser           p;
+    int                     length  = 0;
+    int                     timeout = PATTERN_TIMEOUT_REQUESTED;
+
+    if (spec == NULL)
+        return NULL;
+
+    p.spec = p.pos = spec;
+
+    if (!accept(&p, "silent")) {
+        for (;;) {
+            if (!parse_part(&p, segments, &length))
+                goto error;
+
+            skip_space(&p);
+
+            if (*p.pos != ',')
+                break;
+
+            p.pos++;
+        }
+    }
+
+    skip_space(&p);
+
+    if (*p.pos == ';') {
+        p.pos++;
+
+        if (accept(&p, "short"))
+            timeout = PATTERN_TIMEOUT_SHORT;
+        else if (accept(&p, "long"))
+            timeout = PATTERN_TIMEOUT_LONG;
+        else
+            goto error;
+
+        skip_space(&p);
+    }
+
+    if (*p.pos != '\0')
+        goto error;
+
+    pattern = malloc(sizeof(*pattern) + length * sizeof(segments[0]));
+
+    if (pattern == NULL) {
+        N_ERROR(LOG_CAT "%s(): Can't allocate memory", __FUNCTION__);
+        return NULL;
+    }
+
+    pattern->timeout = timeout;
+    pattern->length  = length;
+    memcpy(pattern->segments, segments, length * sizeof(segments[0]));
+
+    return pattern;
+
+ error:
+    N_ERROR(LOG_CAT "Invalid tone pattern '%s' at '%s'", spec, p.pos);
+    return NULL;
+}
+
+void pattern_free(struct tone_pattern *pattern)
+{
+    free(pattern);
+}
+
+/*
+ * Frequencies played together get 70% each, to sound about as loud as
+ * a single one, but never more than their share of the range, so that
+ * the sum does not clip at high volumes.
+ */
+static inline uint32_t part_volume(uint32_t volume, uint32_t parts)
+{
+    if (parts <= 1)
+        return volume;
+
+    volume = (volume * 7) / 10;
+
+    return volume > 100 / parts ? 100 / parts : volume;
+}
+
+void pattern_play(struct stream *stream, tone_type type,
+                  const struct tone_pattern *pattern,
+                  uint32_t volume, uint32_t duration)
+{
+    const struct pattern_segment *seg;
+    uint32_t                      length;
+    int                           i;
+
+    for (i = 0;  i < pattern->length;  i++) {
+        seg    = pattern->segments + i;
+        length = seg->length == PATTERN_REQUESTED ? duration : seg->length;
+
+        tone_create_shaped(stream, type, seg->freq,
+                           part_volume(volume, seg->parts),
+                           seg->period, seg->play, seg->start, length,
+                           seg->ramp, seg->play < seg->period);
+    }
+}
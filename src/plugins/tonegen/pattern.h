@@ -0,0 +1,89 @@
+/*************************************************************************
+This file is part of ngfd / tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+              2015 Jolla Ltd.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_PATTERN_H__
+#define __TONEGEND_PATTERN_H__
+
+#include <stdint.h>
+
+#include "tone.h"
+
+/*
+ * Tone patterns describe a tone as text, eg.
+ *
+ *   480+620 1000/500
+ *   900 2000/333.333 ramp 3, 1400 2000/332.857 at 333.333 ramp 3
+ *   425 200/200 for 200; short
+ *
+ * A pattern is a comma separated list of parts, or 'silent' for none,
+ * optionally followed by '; short' or '; long'. Each part is
+ *
+ *   <hz>[+<hz>...] <period>/<play> [at <start>] [for <length>|forever]
+ *                  [ramp <ramp>]
+ *
+ * with the times in milliseconds. A part plays its frequencies for play
+ * of every period, from start. It plays for the duration of the request
+ * unless it has a length of its own or plays forever. It ramps up and
+ * down in 10 ms or the given ramp, at every burst or, if it plays the
+ * whole period, only at its start and end. Frequencies played together
+ * share the volume.
+ *
+ * The stream of a pattern times out after the duration of the request,
+ * or if there is none, or the pattern is long, after a minute, or if the
+ * pattern is short, after 5 seconds.
+ *
+ * Patterns are compiled into a flat array of segments, one for each
+ * frequency of each part, that is played without looking at the type
+ * of the tone.
+ */
+
+#define PATTERN_REQUESTED   ((uint32_t)-1)    /* length of the request */
+
+enum pattern_timeout {
+    PATTERN_TIMEOUT_REQUESTED = 0,
+    PATTERN_TIMEOUT_SHORT,
+    PATTERN_TIMEOUT_LONG
+};
+
+struct pattern_segment {
+    uint32_t           freq;         /* Hz */
+    uint32_t           parts;        /* frequencies played together */
+    uint32_t           period;       /* usecs */
+    uint32_t           play;         /* usecs */
+    uint32_t           start;        /* usecs */
+    uint32_t           length;       /* usecs, 0 forever or PATTERN_REQUESTED */
+    uint32_t           ramp;         /* usecs */
+};
+
+struct tone_pattern {
+    int                    timeout;  /* enum pattern_timeout */
+    int                    length;   /* number of segments */
+    struct pattern_segment segments[];
+};
+
+struct tone_pattern *pattern_compile(const char *spec);
+void pattern_free(struct tone_pattern *pattern);
+void pattern_play(struct stream *stream, tone_type type,
+                  const struct tone_pattern *pattern,
+                  uint32_t volume, uint32_t duration);
+
+#endif /* __TONEGEND_PATTERN_H__ */
@@ -38,9 +38,11 @@
 #include "indicator.h"
 #include "dtmf.h"
 #include "rfc4733.h"
+#include "metrics.h"
 #include "ngfif.h"
 
 #define LOG_CAT        "tonegen: "
+#define CALL_STATE_KEY "call_state.mode"
 
 N_PLUGIN_NAME        ("tonegen")
 N_PLUGIN_VERSION     ("0.2")
@@ -48,7 +50,9 @@ N_PLUGIN_DESCRIPTION ("Tone generator plugin")
 
 struct properties {
     indicator_standard  standard;
+    int                 oscillator;
     int                 sample_rate;
+    bool                native_rate;
     bool                statistics;
     int                 buflen;
     int                 minreq;
@@ -56,6 +60,8 @@ struct properties {
     char               *ind_tags;
     int                 dtmf_volume;
     int                 ind_volume;
+    int                 ind_cache;
+    bool                dtmf_warm;
 };
 
 struct userdata {
@@ -78,13 +84,16 @@ static struct userdata u;
 
 static bool prop_8khz_parser(const NValue *val, struct options_parse *opt);
 static bool prop_standard_parser(const NValue *val, struct options_parse *opt);
+static bool prop_oscillator_parser(const NValue *val, struct options_parse *opt);
 static bool prop_string_parser(const NValue *val, struct options_parse *opt);
 static bool prop_int_parser(const NValue *val, struct options_parse *opt);
 static bool prop_bool_parser(const NValue *val, struct options_parse *opt);
 
 static struct options_parse options[] = {
     { "8kHz"            , prop_8khz_parser      , &u.properties.sample_rate, NULL },
+    { "native-rate"     , prop_bool_parser      , &u.properties.native_rate, NULL },
     { "standard"        , prop_standard_parser  , &u.properties.standard, NULL    },
+    { "oscillator"      , prop_oscillator_parser, &u.properties.oscillator, NULL  },
     { "buflen"          , prop_int_parser       , &u.properties.buflen, NULL      },
     { "minreq"          , prop_int_parser       , &u.properties.minreq, NULL      },
     { "statistics"      , prop_bool_parser      , &u.properties.statistics, NULL  },
@@ -92,6 +101,8 @@ static struct options_parse options[] = {
     { "tag-indicator"   , prop_string_parser    , NULL, &u.properties.ind_tags    },
     { "volume-dtmf"     , prop_int_parser       , &u.properties.dtmf_volume, NULL },
     { "volume-indicator", prop_int_parser       , &u.properties.ind_volume, NULL  },
+    { "indicator-cache" , prop_int_parser       , &u.properties.ind_cache, NULL   },
+    { "dtmf-warm"       , prop_bool_parser      , &u.properties.dtmf_warm, NULL   },
     { NULL              , NULL                  , NULL, NULL                      }
 };
 
@@ -106,7 +117,7 @@ prop_8khz_parser (const NValue *val, struct options_parse *opt)
     b.arg_value = (void *) &use_8khz;
 
     if (prop_bool_parser (val, &b)) {
-        if (*(bool *) opt->arg_value)
+        if (use_8khz)
             *(int *) opt->arg_value = 8000;
         return true;
     } else
@@ -155,6 +166,24 @@ prop_standard_parser (const NValue *val, struct options_parse *opt)
     return true;
 }
 
+static bool
+prop_oscillator_parser (const NValue *val, struct options_parse *opt)
+{
+    const gchar *osc;
+
+    osc = n_value_get_string(val);
+    if (g_strcmp0 (osc, "recurrence") == 0)
+        *(int *) opt->arg_value = OSCILLATOR_RECURRENCE;
+    else if (g_strcmp0 (osc, "wavetable") == 0)
+        *(int *) opt->arg_value = OSCILLATOR_WAVETABLE;
+    else {
+        N_ERROR (LOG_CAT "Invalid oscillator '%s'", osc);
+        return false;
+    }
+
+    return true;
+}
+
 static bool
 prop_string_parser (const NValue *val, struct options_parse *opt)
 {
@@ -204,14 +233,69 @@ parse_options (NProplist *params)
     n_proplist_foreach (params, parse_opt, NULL);
 }
 
+static void
+parse_pattern (const char *key, const NValue *value, gpointer userdata)
+{
+    gchar **fields;
+
+    (void) userdata;
+
+    if (!g_str_has_prefix (key, "pattern."))
+        return;
+
+    /* pattern.<standard>.<tone> */
+    fields = g_strsplit (key + strlen ("pattern."), ".", 2);
+
+    if (!fields[0] || !fields[1] || n_value_type (value) != N_VALUE_TYPE_STRING ||
+        !indicator_set_pattern (fields[0], fields[1], n_value_get_string (value)))
+        N_ERROR (LOG_CAT "Failed to parse plugin property with key '%s'", key);
+
+    g_strfreev (fields);
+}
+
+static void
+call_state_changed (NContext *context,
+                    const char *key,
+                    const NValue *old_value,
+                    const NValue *new_value,
+                    void *userdata)
+{
+    const char *state;
+
+    (void) context;
+    (void) key;
+    (void) old_value;
+    (void) userdata;
+
+    state = new_value ? n_value_get_string (new_value) : NULL;
+
+    dtmf_set_warm (u.tonegend.ausrv_ctx, DTMF_WARM_CALL,
+                   state && !strcmp (state, "active"), NULL);
+}
+
+static void
+collect_metrics_cb (NHook *hook, void *data, void *userdata)
+{
+    NCoreHookCollectMetricsData *collect = data;
+
+    (void) hook;
+    (void) userdata;
+
+    metrics_collect (collect->metrics);
+}
+
 static int
 tonegen_sink_initialize (NSinkInterface *iface)
 {
+    NContext *context;
+
     (void) iface;
 
     /* Set default properties */
     u.properties.standard = STD_CEPT;
+    u.properties.oscillator = OSCILLATOR_RECURRENCE;
     u.properties.sample_rate = 48000;
+    u.properties.native_rate = true;
     u.properties.statistics = false;
     u.properties.buflen = 0;
     u.properties.minreq = 0;
@@ -219,6 +303,8 @@ tonegen_sink_initialize (NSinkInterface *iface)
     u.properties.ind_tags = NULL;
     u.properties.dtmf_volume = 100;
     u.properties.ind_volume = 100;
+    u.properties.ind_cache = -1;
+    u.properties.dtmf_warm = false;
 
     NProplist *params = (NProplist*) n_plugin_get_params (u.plugin);
     N_DEBUG (LOG_CAT "starting sink");
@@ -227,12 +313,16 @@ tonegen_sink_initialize (NSinkInterface *iface)
     ausrv_init ();
     stream_init ();
     tone_init ();
+    tone_set_oscillator (u.properties.oscillator);
     envelop_init ();
     indicator_init ();
+    n_proplist_foreach (params, parse_pattern, NULL);
     dtmf_init ();
     rfc4733_init ();
 
     stream_set_default_samplerate (u.properties.sample_rate);
+    /* an explicit 8kHz is kept whatever the sink plays at */
+    stream_use_sink_rate (u.properties.native_rate && u.properties.sample_rate != 8000);
     stream_print_statistics (u.properties.statistics);
     stream_buffering_parameters (u.properties.buflen, u.properties.minreq);
 
@@ -242,6 +332,9 @@ tonegen_sink_initialize (NSinkInterface *iface)
     dtmf_set_volume (u.properties.dtmf_volume);
     indicator_set_volume (u.properties.ind_volume);
 
+    if (u.properties.ind_cache >= 0)
+        indicator_set_loop_cache ((size_t) u.properties.ind_cache * 1024);
+
     u.tonegend.ngfd_ctx = ngfif_create (&u.tonegend);
 
     if ((u.tonegend.dbus_ctx = dbusif_create (&u.tonegend)) == NULL) {
@@ -261,6 +354,19 @@ tonegen_sink_initialize (NSinkInterface *iface)
 
     indicator_set_standard (u.properties.standard);
 
+    n_core_connect (n_plugin_get_core (u.plugin), N_CORE_HOOK_COLLECT_METRICS, 0,
+                    collect_metrics_cb, NULL);
+
+    if (u.properties.dtmf_warm) {
+        context = n_core_get_context (n_plugin_get_core (u.plugin));
+
+        dtmf_enable_warm_stream (true);
+        n_context_subscribe_value_change (context, CALL_STATE_KEY,
+                                          call_state_changed, NULL);
+        call_state_changed (context, CALL_STATE_KEY, NULL,
+                            n_context_get_value (context, CALL_STATE_KEY), NULL);
+    }
+
     return TRUE;
 }
 
@@ -268,6 +374,18 @@ static void
 tonegen_sink_shutdown (NSinkInterface *iface)
 {
     (void) iface;
+
+    if (u.properties.dtmf_warm) {
+        n_context_unsubscribe_value_change (n_core_get_context (n_plugin_get_core (u.plugin)),
+                                            CALL_STATE_KEY, call_state_changed);
+        dtmf_enable_warm_stream (false);
+    }
+
+    n_core_disconnect (n_plugin_get_core (u.plugin), N_CORE_HOOK_COLLECT_METRICS,
+                       collect_metrics_cb, NULL);
+
+    indicator_exit ();
+    metrics_reset ();
 }
 
 static int
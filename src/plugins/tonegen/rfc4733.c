@@ -42,6 +42,10 @@ USA.
 
 #define LOG_CAT "tonegen-rfc4733: "
 
+#define SEQUENCE_MAX_DIGITS 64
+#define SEQUENCE_ON         100     /* msecs */
+#define SEQUENCE_OFF        100     /* msecs */
+
 struct method_ngfd {
     char  *name;                                        /* tone type */
     int  (*func_start)(NRequest *, struct tonegend *);  /* implementing function */
@@ -52,12 +56,18 @@ static int start_dtmf_tone(NRequest *request, struct tonegend *);
 static int start_indicator_tone(NRequest *request, struct tonegend *);
 static int stop_dtmf_tone(NRequest *request, struct tonegend *);
 static int stop_indicator_tone(NRequest *request, struct tonegend *);
+static int start_dtmf_sequence(NRequest *request, struct tonegend *);
+static int stop_dtmf_sequence(NRequest *request, struct tonegend *);
+static int start_dtmf_warm(NRequest *request, struct tonegend *);
+static int stop_dtmf_warm(NRequest *request, struct tonegend *);
 static uint32_t linear_volume(int);
 
 static struct method_ngfd  method_ngfd_defs[] = {
-    {"dtmf",        start_dtmf_tone,        stop_dtmf_tone      },
-    {"indicator",   start_indicator_tone,   stop_indicator_tone },
-    {NULL,          NULL,                   NULL                }
+    {"dtmf",            start_dtmf_tone,        stop_dtmf_tone      },
+    {"indicator",       start_indicator_tone,   stop_indicator_tone },
+    {"dtmf-sequence",   start_dtmf_sequence,    stop_dtmf_sequence  },
+    {"dtmf-warm",       start_dtmf_warm,        stop_dtmf_warm      },
+    {NULL,              NULL,                   NULL                }
 };
 
 static GHashTable *indicator_hash = NULL;
@@ -233,6 +243,115 @@ static int stop_indicator_tone(NRequest *request, struct tonegend *tonegend)
     return TRUE;
 }
 
+/*
+ * Plays the digits of tonegen.digits, eg. "0401234567#", each for
+ * tonegen.on msecs followed by tonegen.off msecs of silence.
+ */
+static int start_dtmf_sequence(NRequest *request, struct tonegend *tonegend)
+{
+    struct ausrv     *ausrv = tonegend->ausrv_ctx;
+    struct dtmf_digit digits[SEQUENCE_MAX_DIGITS];
+    const char       *string;
+    int32_t           dbm0 = 0;
+    uint32_t          on   = SEQUENCE_ON;
+    uint32_t          off  = SEQUENCE_OFF;
+    uint32_t          volume;
+    const char       *extra_props = NULL;
+    const NProplist  *proplist;
+    int               count;
+    int               tone;
+
+    proplist = n_request_get_properties(request);
+
+    if (!(string = n_proplist_get_string(proplist, "tonegen.digits"))) {
+        N_WARNING(LOG_CAT "request doesn't have digits.");
+        return FALSE;
+    }
+
+    if (n_proplist_has_key(proplist, "tonegen.on"))
+        on = n_proplist_get_uint(proplist, "tonegen.on");
+    if (n_proplist_has_key(proplist, "tonegen.off"))
+        off = n_proplist_get_uint(proplist, "tonegen.off");
+
+    if (on < 10 || on > 10000 || off > 10000) {
+        N_WARNING(LOG_CAT "Invalid DTMF sequence timing %u/%u msec.", on, off);
+        return FALSE;
+    }
+
+    for (count = 0;  string[count];  count++) {
+        if (count >= SEQUENCE_MAX_DIGITS || (tone = dtmf_parse_digit(string[count])) < 0) {
+            N_WARNING(LOG_CAT "Invalid DTMF sequence '%s'.", string);
+            return FALSE;
+        }
+
+        digits[count].tone = tone;
+        digits[count].on   = on * 1000;
+        digits[count].off  = off * 1000;
+    }
+
+    if (!count) {
+        N_WARNING(LOG_CAT "request doesn't have digits.");
+        return FALSE;
+    }
+
+    if (n_proplist_has_key(proplist, "tonegen.dbm0"))
+        dbm0 = n_proplist_get_int(proplist, "tonegen.dbm0");
+
+    if (n_proplist_has_key(proplist, "tonegen.properties"))
+        extra_props = n_proplist_get_string(proplist, "tonegen.properties");
+
+    volume = linear_volume(dbm0);
+
+    N_DEBUG(LOG_CAT "%s(): digits '%s' %u/%u msec volume %d dbm0 (%u)",
+            __FUNCTION__, string, on, off, dbm0, volume);
+
+    dtmf_play_sequence(ausrv, digits, count, volume, extra_props);
+
+    return TRUE;
+}
+
+static int stop_dtmf_sequence(NRequest *request, struct tonegend *tonegend)
+{
+    struct ausrv *ausrv = tonegend->ausrv_ctx;
+    (void) request;
+
+    N_DEBUG(LOG_CAT "%s(): stop dtmf sequence", __FUNCTION__);
+
+    dtmf_stop_sequence(ausrv);
+
+    return TRUE;
+}
+
+static int start_dtmf_warm(NRequest *request, struct tonegend *tonegend)
+{
+    struct ausrv *ausrv = tonegend->ausrv_ctx;
+    const char   *extra_props = NULL;
+    const NProplist *proplist;
+
+    proplist = n_request_get_properties(request);
+
+    if (n_proplist_has_key(proplist, "tonegen.properties"))
+        extra_props = n_proplist_get_string(proplist, "tonegen.properties");
+
+    N_DEBUG(LOG_CAT "%s(): keep dtmf stream warm", __FUNCTION__);
+
+    dtmf_set_warm(ausrv, DTMF_WARM_HINT, true, extra_props);
+
+    return TRUE;
+}
+
+static int stop_dtmf_warm(NRequest *request, struct tonegend *tonegend)
+{
+    struct ausrv *ausrv = tonegend->ausrv_ctx;
+    (void) request;
+
+    N_DEBUG(LOG_CAT "%s(): release warm dtmf stream", __FUNCTION__);
+
+    dtmf_set_warm(ausrv, DTMF_WARM_HINT, false, NULL);
+
+    return TRUE;
+}
+
 /*
  * This function maps the RFC4733 defined
  * power level of 0dbm0 - -63dbm0
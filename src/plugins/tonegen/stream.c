@@ -34,6 +34,7 @@ USA.
 
 #include "ausrv.h"
 #include "stream.h"
+#include "metrics.h"
 
 #define LOG_CAT "tonegen-stream: "
 
@@ -46,6 +47,7 @@ static void drain_callback(pa_stream *, int, void *);
 static void write_samples(struct stream *, int16_t *,size_t, uint32_t *);
 
 static uint32_t default_rate     = 48000;
+static bool     use_sink_rate    = false;
 static bool     print_statistics = false;
 static int      target_buflen    = 1000; /* 1000msec ie. 1sec */
 static int      min_bufreq       = 200;  /* 200msec */
@@ -61,6 +63,22 @@ void stream_set_default_samplerate(uint32_t rate)
     default_rate = rate;
 }
 
+/*
+ * Streams created without an explicit rate play at the rate of the
+ * default sink when it is known, so that the server does not need to
+ * resample them. The default rate is used otherwise.
+ */
+void stream_use_sink_rate(bool use)
+{
+    use_sink_rate = use;
+}
+
+/* rate of the streams created with sample rate 0 */
+uint32_t stream_default_rate(struct ausrv *ausrv)
+{
+    return use_sink_rate && ausrv->sink_rate ? ausrv->sink_rate : default_rate;
+}
+
 void stream_print_statistics(bool print)
 {
     print_statistics = print;
@@ -114,7 +132,7 @@ struct stream *stream_create(struct ausrv *ausrv,
         name = "generated tone";
 
     if (sample_rate == 0)
-        sample_rate = default_rate;
+        sample_rate = stream_default_rate(ausrv);
 
     memset(&spec, 0, sizeof(spec));
     spec.format   = PA_SAMPLE_S16LE;
@@ -149,18 +167,23 @@ struct stream *stream_create(struct ausrv *ausrv,
                                                   &spec, NULL,
                                                   (pa_proplist *)proplist);
     stream->start   = start;
+    stream->reqtime = start;
     stream->flush   = true;
     stream->bufsize = bufsize;
     stream->write   = write;
     stream->destroy = destroy;
     stream->data    = data;
+    stream->metrics = metrics_stream_created(name);
+
+    stat = &stream->stat;
+    stat->wrtime = start;
 
     if (print_statistics) {
-        stat = &stream->stat;
-        stat->wrtime  = start;
         stat->minbuf  = -1;
         stat->mingap  = -1;
         stat->mincalc = -1;
+        stat->minrender = -1;
+        stat->minlat  = -1;
     }
 
 
@@ -181,7 +204,9 @@ struct stream *stream_create(struct ausrv *ausrv,
     battr.prebuf    = -1;                /* default (tlength) */
     battr.fragsize  = -1;                /* default (tlength) */
 
-    flags = PA_STREAM_ADJUST_LATENCY;
+    /* timing updates for the latency metrics */
+    flags = PA_STREAM_ADJUST_LATENCY | PA_STREAM_AUTO_TIMING_UPDATE |
+            PA_STREAM_INTERPOLATE_TIMING;
 
     pa_stream_set_state_callback(stream->pastr, state_callback,(void*)stream);
     pa_stream_set_underflow_callback(stream->pastr, underflow_callback,
@@ -310,14 +335,21 @@ void stream_destroy(struct stream *stream)
                       "   bufsize %u - %u - %u\n"
                       "   calc.time %u - %u - %u msec\n"
                       "   avarage cpu / buffer %u msec\n"
+                      "   render cpu / buffer %u - %u - %u usec\n"
                       "   cpu load for all buffer calculation %.2lf%%\n"
+                      "   write-ahead-buffer allocations %u\n"
+                      "   first write %u - %u usec after start\n"
                       "   gaps %u - %u - %u msec\n"
                       "   underflows %u\n"
                       "   %u buffer was late out of %u (%u%%)",
                       stream->name, upt, strt, flow, freq, 1000.0/freq,
                       stat->minbuf, avbuf, stat->maxbuf,
                       stat->mincalc / 1000, avcalc, stat->maxcalc / 1000,
-                      avcpu, ((double)avcpu * freq) / 10.0,
+                      avcpu,
+                      stat->minrender, stat->cpucalc / stat->wrcnt, stat->maxrender,
+                      ((double)avcpu * freq) / 10.0,
+                      stat->allocs,
+                      stat->minlat, stat->maxlat,
                       stat->mingap / 1000, avgap, stat->maxgap / 1000,
                       stat->underflows, stat->late, stat->wrcnt,
                       (stat->late * 100) / stat->wrcnt);
@@ -339,6 +371,51 @@ void stream_set_timeout(struct stream *stream, uint32_t timeout)
         stream->end = stream->time + timeout;
 }
 
+void stream_set_corked(struct stream *stream, bool corked)
+{
+    struct timeval  tv;
+    pa_operation   *oper;
+
+    if (stream->corked == corked)
+        return;
+
+    stream->corked  = corked;
+    stream->reqtime = 0;
+
+    TRACE("%s(): %scorking stream '%s'", __FUNCTION__,
+          corked ? "" : "un", stream->name);
+
+    if (!corked) {
+        /*
+         * Whatever was rendered while the stream was corked is
+         * silence. It is dropped so that the tones added since
+         * are the first samples to play.
+         */
+        gettimeofday(&tv, NULL);
+        stream->reqtime = (uint64_t)tv.tv_sec * (uint64_t)1000000 +
+                          (uint64_t)tv.tv_usec;
+        stream->buf.buflen = 0;
+
+        /* time spent corked does not make the next write late */
+        stream->stat.wrtime = stream->reqtime;
+    }
+
+    /* streams still connecting are corked once ready */
+    if (pa_stream_get_state(stream->pastr) != PA_STREAM_READY)
+        return;
+
+    if (!corked && (oper = pa_stream_flush(stream->pastr, NULL, NULL)))
+        pa_operation_unref(oper);
+
+    if ((oper = pa_stream_cork(stream->pastr, corked, NULL, NULL)) != NULL)
+        pa_operation_unref(oper);
+    else {
+        N_ERROR(LOG_CAT "%s(): Can't %scork stream '%s': %s", __FUNCTION__,
+                corked ? "" : "un", stream->name,
+                pa_strerror(pa_context_errno(pa_stream_get_context(stream->pastr))));
+    }
+}
+
 void stream_kill_all(struct ausrv *ausrv)
 {
     struct stream *stream;
@@ -359,6 +436,7 @@ void stream_kill_all(struct ausrv *ausrv)
         pa_stream_set_suspended_callback(stream->pastr, NULL,NULL);
         pa_stream_set_write_callback(stream->pastr, NULL,NULL);
 
+        free(stream->buf.samples);
         free(stream->name);
         free(stream);
     }
@@ -510,6 +588,7 @@ void stream_free_properties(void *proplist)
 static void state_callback(pa_stream *pastr, void *userdata)
 {
     struct stream *stream = (struct stream *)userdata;
+    pa_operation  *oper;
 
     if (!stream || stream->pastr != pastr) {
         N_ERROR(LOG_CAT "%s(): confused with data structures", __FUNCTION__);
@@ -527,6 +606,9 @@ static void state_callback(pa_stream *pastr, void *userdata)
 
         case PA_STREAM_READY:
             TRACE("%s(): stream '%s' ready", __FUNCTION__, stream->name);
+
+            if (stream->corked && (oper = pa_stream_cork(pastr, 1, NULL, NULL)))
+                pa_operation_unref(oper);
             break;
 
         case PA_STREAM_TERMINATED:
@@ -556,6 +638,7 @@ static void underflow_callback(pa_stream *pastr, void *userdata)
         N_ERROR(LOG_CAT "Stream '%s' underflow", stream->name);
 
         stream->stat.underflows++;
+        metrics_add_underflow(stream->metrics);
 
         stream_destroy(stream);
     }
@@ -580,10 +663,11 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
     struct stream        *stream = (struct stream *)userdata;
     struct stream_stat   *stat   = &stream->stat;
     const pa_buffer_attr *battr;
-    int16_t              *samples;
+    void                 *data;
     size_t                buflen;
-    int16_t              *extra;
-    size_t                extlen;
+    size_t                ahead;
+    size_t                done;
+    size_t                len;
     struct timeval        tv;
     uint32_t              start = 0;
     uint32_t              gap = 0;
@@ -591,6 +675,10 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
     uint32_t              calc;
     uint32_t              period;
     uint32_t              cpu;
+    uint32_t              render;
+    uint32_t              latency;
+    pa_usec_t             usec;
+    int                   negative;
 
 
     if (!stream || stream->pastr != pastr) {
@@ -601,68 +689,101 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
     if (stream->killed)
         return;
 
-    if (print_statistics) {
-        gettimeofday(&tv, NULL);
-        start = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec;
-        gap   = start - stat->wrtime;
-    }
+    gettimeofday(&tv, NULL);
+    start = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec;
+    gap   = start - stat->wrtime;
 
 #ifdef ENABLE_VERBOSE_TRACE
     TRACE("%s(): %d bytes", __FUNCTION__, bytes);
 #endif
 
-    if (stream->buf.samples == NULL) {
-        buflen  = (bytes + 1) & (~1U);
-        samples = (int16_t *)malloc(buflen);
+    /*
+     * The samples rendered ahead are copied and anything more is
+     * rendered straight to the memory of the server. Nothing is
+     * allocated here once the write-ahead-buffer exists.
+     */
+    ahead  = stream->buf.samples != NULL ? stream->buf.buflen : 0;
+    buflen = (bytes + 1) & (~1U);
+    cpu    = stream->buf.cpu;
+
+    if (buflen < ahead)
+        buflen = ahead;
+    else if (buflen > ahead && ahead > 0) {
+        TRACE("%s(): extending write-ahead-buffer %u bytes (%u -> %u)",
+              __FUNCTION__, buflen - ahead, ahead, buflen);
+    }
 
-        if (samples != NULL)
-            write_samples(stream, samples,buflen, &cpu);
-        else {
-            N_ERROR(LOG_CAT "%s(): failed to allocate memory", __FUNCTION__);
-            return;
+    for (done = 0;  done < buflen;  done += len) {
+        data = NULL;
+        len  = buflen - done;
+
+        if (pa_stream_begin_write(pastr, &data, &len) < 0 || data == NULL) {
+            N_ERROR(LOG_CAT "%s(): Can't get write buffer: %s", __FUNCTION__,
+                    pa_strerror(pa_context_errno(pa_stream_get_context(pastr))));
+            break;
         }
-    }
-    else {
-        if (bytes <= stream->buf.buflen) {
-            buflen  = stream->buf.buflen;
-            samples = stream->buf.samples;
-            cpu     = stream->buf.cpu;
+
+        if ((len &= ~(size_t)1) == 0) {
+            pa_stream_cancel_write(pastr);
+            break;
         }
-        else {
-            buflen  = (bytes + 1) & (~1U);
-            samples = (int16_t *)realloc(stream->buf.samples, buflen);
 
-            extra  = samples + (stream->buf.buflen / 2);
-            extlen = buflen - stream->buf.buflen;
+        if (done < ahead) {
+            if (len > ahead - done)
+                len = ahead - done;
 
-            if (samples != NULL) {
-                TRACE("%s(): extending write-ahead-buffer %u butes (%u -> %u)",
-                      __FUNCTION__, extlen, stream->buf.buflen, buflen);
-                write_samples(stream, extra,extlen, &cpu);
-                cpu += stream->buf.cpu;
-            }
-            else {
-                N_ERROR(LOG_CAT "%s(): failed to allocate memory", __FUNCTION__);
-                return;
-            }
+            memcpy(data, (char *)stream->buf.samples + done, len);
+        }
+        else {
+            write_samples(stream, (int16_t *)data,len, &render);
+            cpu += render;
         }
 
-        stream->buf.samples = NULL;
-        stream->buf.cpu = 0;
+        pa_stream_write(pastr, data,len, NULL, 0,PA_SEEK_RELATIVE);
     }
 
+    stream->buf.buflen = 0;
+    stream->buf.cpu    = 0;
 
-    if (samples != NULL) {
+    buflen = done;
 
-        if (print_statistics) {
+    if (buflen > 0) {
+
+        if (stream->reqtime && !stream->corked) {
             gettimeofday(&tv, NULL);
-            calcend = (uint64_t)tv.tv_sec * (uint64_t)1000000 +
-                      (uint64_t)tv.tv_usec;
-            calc    = calcend - start;
-            period  = (calcend - stat->wrtime) / 1000;
+            latency = (uint64_t)tv.tv_sec * (uint64_t)1000000 +
+                      (uint64_t)tv.tv_usec - stream->reqtime;
 
-            stat->wrtime = calcend;
+            N_DEBUG(LOG_CAT "stream '%s' (%s) first write %u usec after start",
+                    stream->name, stream->warm ? "warm" : "cold", latency);
 
+            metrics_add_startup(stream->metrics, latency);
+
+            if (print_statistics) {
+                if (latency < stat->minlat) stat->minlat = latency;
+                if (latency > stat->maxlat) stat->maxlat = latency;
+            }
+
+            stream->reqtime = 0;
+        }
+
+        gettimeofday(&tv, NULL);
+        calcend = (uint64_t)tv.tv_sec * (uint64_t)1000000 +
+                  (uint64_t)tv.tv_usec;
+        calc    = calcend - start;
+        period  = (calcend - stat->wrtime) / 1000;
+
+        stat->wrtime = calcend;
+
+        if (stream->bcnt > 0) {
+            metrics_add_write(stream->metrics, cpu,
+                              min_bufreq > 0 && period > (uint32_t)min_bufreq);
+
+            if (pa_stream_get_latency(pastr, &usec, &negative) == 0)
+                metrics_add_latency(stream->metrics, negative ? 0 : (uint32_t)usec);
+        }
+
+        if (print_statistics) {
             if (stream->bcnt == 0 /* && buflen > stream->bufsize */) {
                 TRACE("Stream '%s' pre-buffers of %u bytes",
                       stream->name, buflen);
@@ -683,6 +804,9 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
                 if (calc < stat->mincalc) stat->mincalc = calc;
                 if (calc > stat->maxcalc) stat->maxcalc = calc;
 
+                if (cpu < stat->minrender) stat->minrender = cpu;
+                if (cpu > stat->maxrender) stat->maxrender = cpu;
+
 #ifdef ENABLE_VERBOSE_TRACE
                 TRACE("Buffer writting period %umsec", period);
 #endif
@@ -698,8 +822,6 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
             }
         }
 
-        pa_stream_write(stream->pastr, (void*)samples,buflen, free,
-                        0,PA_SEEK_RELATIVE);
         stream->bcnt += buflen;
 
 
@@ -708,6 +830,13 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
               stream->time / 1000, stream->end / 1000);
 #endif
 
+        if (stream->end && stream->time >= stream->end && stream->warm) {
+            TRACE("%s(): keeping timed out stream '%s' corked",
+                  __FUNCTION__, stream->name);
+            stream->end = 0;
+            stream_set_corked(stream, true);
+        }
+
         if (stream->end && stream->time >= stream->end)
             stream_destroy(stream);
         else {
@@ -717,14 +846,21 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
             }
 
             if (stream->bufsize != (uint32_t)-1) {
-                stream->buf.samples = (int16_t *)malloc(stream->bufsize);
-                stream->buf.buflen  = stream->bufsize;
+                if (stream->buf.size < stream->bufsize) {
+                    free(stream->buf.samples);
+
+                    stream->buf.samples = (int16_t *)malloc(stream->bufsize);
+                    stream->buf.size    = stream->buf.samples ? stream->bufsize : 0;
+
+                    stat->allocs++;
+                }
 
                 if (stream->buf.samples == NULL)
                     N_ERROR(LOG_CAT "%s(): failed to allocate memory", __FUNCTION__);
                 else {
                     write_samples(stream, stream->buf.samples,stream->bufsize,
                                   &stream->buf.cpu);
+                    stream->buf.buflen = stream->bufsize;
                 }
             }
         }
@@ -779,11 +915,11 @@ static void write_samples(struct stream *stream, int16_t *samples,
 
     length = bytes/2;
 
-    cpubeg = print_statistics ? clock() : 0;
+    cpubeg = clock();
 
     stream->time = stream->write(stream, samples, length);
 
-    cpuend = print_statistics ? clock() : 0;
+    cpuend = clock();
 
     *cpu = cpuend - cpubeg;
 
@@ -38,6 +38,7 @@ USA.
 #define INPUT_BY_ROLE       "sink-input-by-media-role"
 
 struct ausrv;
+struct metrics;
 
 struct stream_stat {
     uint64_t           firstwr;      /* first writting time */
@@ -52,6 +53,11 @@ struct stream_stat {
     uint32_t           maxcalc;
     uint64_t           sumcalc;
     uint32_t           cpucalc;
+    uint32_t           minrender;    /* cpu usecs to render a period */
+    uint32_t           maxrender;
+    uint32_t           allocs;       /* write-ahead-buffer allocations */
+    uint32_t           minlat;       /* usecs from start to the first write */
+    uint32_t           maxlat;
     uint32_t           underflows;
     uint32_t           late;
 };
@@ -68,21 +74,29 @@ struct stream {
     uint32_t           end;      /* buffer timeout for the stream in usec */
     bool               flush;    /* flush on destroy */
     bool               killed;
+    bool               corked;
+    bool               warm;     /* cork on timeout instead of destroying */
+    bool               stopping; /* tones ramp down until the timeout */
+    uint64_t           reqtime;  /* wall clock time of the last start */
     uint32_t           bufsize;  /* write-ahead-buffer size (ie. minreq) */
     uint32_t           bcnt;     /* byte count */
     uint32_t         (*write)(struct stream *s, int16_t *samples, int length);
     void             (*destroy)(void *);
     void              *data;     /* extension */
     struct stream_stat stat;     /* statistics */
+    struct metrics    *metrics;  /* exported metrics of the stream name */
     struct {
         int16_t  *samples;
-        size_t    buflen;
+        size_t    size;      /* allocated bytes */
+        size_t    buflen;    /* bytes rendered ahead */
         uint32_t  cpu;
     }                  buf;
 };
 
 int stream_init(void);
 void stream_set_default_samplerate(uint32_t rate);
+void stream_use_sink_rate(bool use);
+uint32_t stream_default_rate(struct ausrv *ausrv);
 void stream_print_statistics(bool print);
 void stream_buffering_parameters(int tlen, int minreq);
 struct stream *stream_create(struct ausrv *ausrv, const char *name, const char *sink, uint32_t sample_rate,
@@ -92,6 +106,7 @@ struct stream *stream_create(struct ausrv *ausrv, const char *name, const char *
                              void *data);
 void stream_destroy(struct stream *stream);
 void stream_set_timeout(struct stream *stream, uint32_t timeout);
+void stream_set_corked(struct stream *stream, bool corked);
 void stream_kill_all(struct ausrv *ausrv);
 void stream_clean_buffer(struct stream *stream);
 struct stream *stream_find(struct ausrv *stream, char *name);
@@ -38,41 +38,253 @@ USA.
 #define LOG_CAT "tonegen-tone: "
 
 #define AMPLITUDE SHRT_MAX /* 32767 */
-#define OFFSET    8192
 #define SCALE     1024ULL
+#define BLOCK     256       /* samples mixed at a time */
 
+#define LOOP_MAX_PERIOD 10000000 /* usecs */
+
+#define WAVETABLE_BITS  10
+#define WAVETABLE_SIZE  (1 << WAVETABLE_BITS)
+#define WAVETABLE_FRAC  (32 - WAVETABLE_BITS)  /* phase bits between entries */
+
+/* a sine cycle with the difference to the next entry for interpolation */
+static struct {
+    float y;
+    float dy;
+}   sine_table[WAVETABLE_SIZE];
+
+static int oscillator = OSCILLATOR_RECURRENCE;
+
+/*
+ * The sine is generated with the recurrence
+ *   y(k + N) = 2cos(Nw) * y(k) - y(k - N)
+ * running N = SINGEN_LANES independent lanes, so that a block of
+ * N samples is produced with N multiply-adds the compiler can vectorize.
+ */
 static inline void singen_init(struct singen *singen, uint32_t freq,
                                uint32_t rate, uint32_t volume)
 {
     double w = 2.0 * M_PI * ((double)freq / (double)rate);
+    double a;
+    int    j;
+
+    if (volume > 100) volume = 100;
+
+    a = (double)AMPLITUDE * (double)volume / 100.0;
+
+    singen->m = 2.0 * cos(w * SINGEN_LANES);
+
+    for (j = 0; j < SINGEN_LANES; j++) {
+        singen->s[j] = a * sin(w * j);
+        singen->p[j] = a * sin(w * (j - SINGEN_LANES));
+    }
+}
+
+static inline void singen_step(struct singen *singen)
+{
+    double s = singen->s[0];
+    double y = singen->m * s - singen->p[0];
+    int    j;
+
+    for (j = 0; j < SINGEN_LANES - 1; j++) {
+        singen->s[j] = singen->s[j + 1];
+        singen->p[j] = singen->p[j + 1];
+    }
+
+    singen->s[SINGEN_LANES - 1] = y;
+    singen->p[SINGEN_LANES - 1] = s;
+}
+
+/* adds n samples to mix, scaled by a gain changing linearly by step */
+static inline void singen_mix(struct singen *singen, float *mix, int n,
+                              float gain, float step)
+{
+    double y[SINGEN_LANES];
+    int    i, j;
+
+    for (i = 0; i + SINGEN_LANES <= n; i += SINGEN_LANES) {
+        for (j = 0; j < SINGEN_LANES; j++) {
+            mix[i + j] += (float)singen->s[j] * (gain + step * (float)j);
+
+            y[j] = singen->m * singen->s[j] - singen->p[j];
+            singen->p[j] = singen->s[j];
+            singen->s[j] = y[j];
+        }
+
+        gain += step * (float)SINGEN_LANES;
+    }
+
+    for ( ; i < n; i++) {
+        mix[i] += (float)singen->s[0] * gain;
+        gain   += step;
+
+        singen_step(singen);
+    }
+}
+
+/*
+ * The wavetable oscillator interpolates linearly between the entries
+ * of sine_table. Its phase is an integer advancing by freq * 2^32 / rate
+ * per sample, with the remainder of the division carried over, so that
+ * it stays exact however long the tone plays and does not drift in
+ * amplitude, phase or frequency.
+ */
+static inline void wavetable_init(struct wavetable *wavetable, uint32_t freq,
+                                  uint32_t rate, uint32_t volume)
+{
+    uint64_t step = ((uint64_t)freq << 32);
 
     if (volume > 100) volume = 100;
 
-    singen->m = 2.0 * cos(w) * (AMPLITUDE * OFFSET);
+    wavetable->phase     = 0;
+    wavetable->step      = (uint32_t)(step / rate);
+    wavetable->error     = 0;
+    wavetable->rem       = (uint32_t)(step % rate);
+    wavetable->rate      = rate;
+    wavetable->amplitude = (float)AMPLITUDE * (float)volume / 100.0f;
+}
+
+/* adds n samples to mix, scaled like in singen_mix() */
+static inline void wavetable_mix(struct wavetable *wavetable, float *mix, int n,
+                                 float gain, float step)
+{
+    const float scale = 1.0f / (float)(1 << WAVETABLE_FRAC);
+    uint32_t    phase = wavetable->phase;
+    uint32_t    error = wavetable->error;
+    uint32_t    idx;
+    float       frac;
+    int         i;
+
+    gain *= wavetable->amplitude;
+    step *= wavetable->amplitude;
+
+    for (i = 0; i < n; i++) {
+        idx  = phase >> WAVETABLE_FRAC;
+        frac = (float)(int32_t)(phase & ((1 << WAVETABLE_FRAC) - 1)) * scale;
+
+        mix[i] += (sine_table[idx].y + sine_table[idx].dy * frac) *
+                  (gain + step * (float)i);
+
+        phase += wavetable->step;
+
+        if ((error += wavetable->rem) >= wavetable->rate) {
+            error -= wavetable->rate;
+            phase++;
+        }
+    }
+
+    wavetable->phase = phase;
+    wavetable->error = error;
+}
+
+/* adds n samples of the loop to mix, scaled like in singen_mix() */
+static inline void looper_mix(struct looper *looper, float *mix, int n,
+                              float gain, float step)
+{
+    struct tone_loop *loop = looper->loop;
+    const int16_t    *samples;
+    int               i, k;
+
+    while (n > 0) {
+        samples = loop->samples + looper->pos;
+        k       = loop->length - looper->pos;
+
+        if (k > n)
+            k = n;
+
+        for (i = 0; i < k; i++)
+            mix[i] += (float)samples[i] * (gain + step * (float)i);
+
+        gain += step * (float)k;
+        mix  += k;
+        n    -= k;
+
+        if ((looper->pos += k) >= loop->length)
+            looper->pos = 0;
+    }
+}
+
+static inline void looper_copy(struct looper *looper, int16_t *buf, int n)
+{
+    struct tone_loop *loop = looper->loop;
+    int               k;
+
+    while (n > 0) {
+        k = loop->length - looper->pos;
 
-    singen->n0 = -sin(w) * (AMPLITUDE * OFFSET);
-    singen->n1 = 0;
+        if (k > n)
+            k = n;
 
-    singen->offs = volume ? (OFFSET * 100) / volume : LONG_MAX;
+        memcpy(buf, loop->samples + looper->pos, k*sizeof(*buf));
+
+        buf += k;
+        n   -= k;
+
+        if ((looper->pos += k) >= loop->length)
+            looper->pos = 0;
+    }
 }
 
-static inline int32_t singen_write(struct singen *singen)
+static void release_tone(struct tone *tone)
 {
-    uint64_t n2 = (singen->m * singen->n1) / (AMPLITUDE * OFFSET) - singen->n0;
+    if (tone->backend == BACKEND_LOOP) {
+        tone_loop_unref(tone->looper.loop);
+        tone->looper.loop = NULL;
+    }
 
-    singen->n0 = singen->n1;
-    singen->n1 = n2;
+    envelop_destroy(tone->envelop);
+    tone->envelop = NULL;
+}
+
+static void release_chain(struct tone *tone)
+{
+    struct tone *head;
 
-    return (int32_t)(singen->n0 / singen->offs);
+    while ((head = tone->chain)) {
+        tone->chain = head->chain;
+        head->chain = NULL;
+        release_tone(head);
+        free(head);
+    }
 }
 
-static void setup_envelop_for_tone(struct tone *tone, tone_type type, uint32_t play, uint32_t duration);
+/*
+ * How the tones of tone_create() are shaped and chained. Indicator
+ * tones come from patterns, which carry their own shape.
+ */
+static const struct {
+    uint32_t  ramp;         /* usecs of linear ramp up and down */
+    bool      reltime;      /* ramp every burst, not the whole tone */
+    bool      chainable;
+} tone_types[TONE_MAX] = {
+    [TONE_DTMF_IND_L] = { 10000, false, false },
+    [TONE_DTMF_IND_H] = { 10000, false, false },
+    [TONE_DTMF_L]     = { 10000, true,  true  },
+    [TONE_DTMF_H]     = { 10000, true,  true  },
+    [TONE_NOTE_0]     = { 0,     false, true  },
+};
 
 int tone_init(void)
 {
+    double y, next;
+    int    k;
+
+    for (k = 0, y = 0.0; k < WAVETABLE_SIZE; k++, y = next) {
+        next = sin(2.0 * M_PI * (double)(k + 1) / (double)WAVETABLE_SIZE);
+
+        sine_table[k].y  = (float)y;
+        sine_table[k].dy = (float)(next - y);
+    }
+
     return 0;
 }
 
+/* selects the oscillator of the tones created from now on */
+void tone_set_oscillator(int osc)
+{
+    oscillator = osc;
+}
+
 
 struct tone *tone_create(struct stream *stream,
                          tone_type      type,
@@ -83,7 +295,32 @@ struct tone *tone_create(struct stream *stream,
                          uint32_t       start,
                          uint32_t       duration)
 {
-    if (!volume || !period || !play)
+    if (type >= TONE_MAX)
+        return NULL;
+
+    return tone_create_shaped(stream, type, freq, volume, period, play,
+                              start, duration, tone_types[type].ramp,
+                              tone_types[type].reltime);
+}
+
+/*
+ * Creates a tone that plays for play usecs of every period, from start
+ * for duration usecs or endlessly. The tone is ramped linearly up and
+ * down in ramp usecs, at every burst with reltime or else only at its
+ * start and end.
+ */
+struct tone *tone_create_shaped(struct stream *stream,
+                                tone_type      type,
+                                uint32_t       freq,
+                                uint32_t       volume,
+                                uint32_t       period,
+                                uint32_t       play,
+                                uint32_t       start,
+                                uint32_t       duration,
+                                uint32_t       ramp,
+                                bool           reltime)
+{
+    if (!volume || !period || !play || type >= TONE_MAX)
         return NULL;
 
     struct tone *link = NULL;
@@ -117,16 +354,25 @@ struct tone *tone_create(struct stream *stream,
     tone->next    = next;
     tone->stream  = stream;
     tone->type    = type;
+    tone->freq    = freq;
     tone->period  = period;
     tone->play    = play;
     tone->start   = (uint64_t)(time + start) * SCALE;
     tone->end     = duration ? tone->start + (uint64_t)(duration * SCALE) : 0;
 
-    setup_envelop_for_tone(tone, type, play, duration);
+    if (ramp) {
+        tone->reltime = reltime;
+        tone->envelop = envelop_create(ENVELOP_RAMP_LINEAR, ramp, 0,
+                                       reltime ? play : duration);
+    }
 
     if (!freq) {
         tone->backend = BACKEND_UNKNOWN;
     }
+    else if (oscillator == OSCILLATOR_WAVETABLE) {
+        tone->backend = BACKEND_WAVETABLE;
+        wavetable_init(&tone->wavetable, freq, stream->rate, volume);
+    }
     else {
         tone->backend = BACKEND_SINGEN;
         singen_init(&tone->singen, freq, stream->rate, volume);
@@ -144,6 +390,41 @@ struct tone *tone_create(struct stream *stream,
     return tone;
 }
 
+/*
+ * Creates an endless tone playing a prerendered loop. Only the ramp-up
+ * is applied on top, the cadence is part of the loop.
+ */
+struct tone *tone_create_loop(struct stream *stream, tone_type type,
+                              struct tone_loop *loop)
+{
+    struct tone *tone;
+
+    if (!loop || !loop->length)
+        return NULL;
+
+    if (!(tone = calloc(1, sizeof *tone))) {
+        N_ERROR(LOG_CAT "%s(): Can't allocate memory", __FUNCTION__);
+        return NULL;
+    }
+
+    tone->next    = stream->data;
+    tone->stream  = stream;
+    tone->type    = type;
+    tone->period  = loop->period;
+    tone->play    = loop->period;
+    tone->start   = (uint64_t)stream->time * SCALE;
+    tone->end     = 0;
+    tone->reltime = false;
+    tone->envelop = envelop_create(ENVELOP_RAMP_LINEAR, 10000, 0, 0);
+    tone->backend = BACKEND_LOOP;
+    tone->looper.loop = tone_loop_ref(loop);
+    tone->looper.pos  = 0;
+
+    stream->data = tone;
+
+    return tone;
+}
+
 void tone_destroy(struct tone *tone, bool kill_chain)
 {
     if (!tone)
@@ -168,16 +449,8 @@ void tone_destroy(struct tone *tone, bool kill_chain)
         }
 
         // optionally flush chained items
-        if (kill_chain) {
-            struct tone *head;
-            while ((head = tone->chain)) {
-                tone->chain = head->chain;
-                head->chain = NULL;
-                envelop_destroy(head->envelop);
-                head->envelop = NULL;
-                free(head);
-            }
-        }
+        if (kill_chain)
+            release_chain(tone);
 
         // pull in chained tone if one (still) exists,
         // otherwise continue from the next tone
@@ -191,8 +464,7 @@ void tone_destroy(struct tone *tone, bool kill_chain)
         }
 
         // clear and release tone object
-        envelop_destroy(tone->envelop);
-        tone->envelop = NULL;
+        release_tone(tone);
         tone->next    = NULL;
         tone->chain   = NULL;
         tone->stream  = NULL;
@@ -202,28 +474,203 @@ void tone_destroy(struct tone *tone, bool kill_chain)
     }
 }
 
+/*
+ * Ends the tone with a linear ramp-down of ramp usecs from the current
+ * stream time instead of cutting it, dropping the tones chained after
+ * it. The tone is destroyed once the ramp has been rendered, or right
+ * away if it has not started yet. Returns the stream time in usecs the
+ * tone ends at, 0 if it was destroyed.
+ */
+uint32_t tone_ramp_down(struct tone *tone, uint32_t ramp)
+{
+    struct stream *stream = tone->stream;
+    uint64_t       now    = (uint64_t)stream->time * SCALE;
+    uint32_t       end;
+
+    release_chain(tone);
+
+    if (now <= tone->start) {
+        tone_destroy(tone, true);
+        return 0;
+    }
+
+    end = (uint32_t)((now - tone->start) / SCALE) + ramp;
+
+    if (tone->end && tone->end <= tone->start + (uint64_t)end * SCALE)
+        return (uint32_t)(tone->end / SCALE);
+
+    // the ramp may span bursts, so it follows the time of the whole tone
+    if (tone->reltime || !tone->envelop) {
+        envelop_destroy(tone->envelop);
+        tone->reltime = false;
+        tone->envelop = envelop_create(ENVELOP_RAMP_LINEAR, ramp, 0, 0);
+    }
+
+    envelop_update(tone->envelop, ramp, end);
+    tone->end = tone->start + (uint64_t)end * SCALE;
+
+    return (uint32_t)(tone->end / SCALE);
+}
+
 
 bool tone_chainable(tone_type type)
 {
-    switch (type) {
-    case TONE_DTMF_L:
-    case TONE_DTMF_H:
-    case TONE_NOTE_0:
+    return type < TONE_MAX && tone_types[type].chainable;
+}
+
+/* stream time in usecs when the chain of tones of type ends, 0 if none */
+uint32_t tone_chain_end(struct stream *stream, tone_type type)
+{
+    struct tone *tone;
+
+    for (tone = stream->data; tone; tone = tone->next) {
+        if (tone->type == type) {
+            while (tone->chain)
+                tone = tone->chain;
+
+            return (uint32_t)(tone->end / SCALE);
+        }
+    }
+
+    return 0;
+}
+
+/* number of samples, at most max, from t until limit */
+static inline int samples_until(uint64_t limit, uint64_t t, uint64_t dt, int max)
+{
+    uint64_t n = (limit - t + dt - 1) / dt;
+
+    if (n < 1)
         return 1;
-    default:
-        return 0;
+
+    return n < (uint64_t)max ? (int)n : max;
+}
+
+/*
+ * Adds tone to mix[i..len). The tone is rendered in runs of samples
+ * where the cadence and the envelop do not change. Returns the index
+ * of the first sample past the end of the tone, or len.
+ */
+static int tone_mix(struct tone *tone, float *mix, int i, int len,
+                    uint64_t t0, uint64_t dt)
+{
+    float     dtus = (float)dt / (float)SCALE;
+    uint64_t  t, abst, relt, limit, envlimit;
+    uint32_t  span;
+    float     gain, slope;
+    int       n;
+
+    while (i < len) {
+        t = t0 + dt * (uint64_t)i;
+
+        if (tone->end && tone->end < t)
+            return i;
+
+        if (t <= tone->start) {
+            i += samples_until(tone->start + 1, t, dt, len - i);
+            continue;
+        }
+
+        abst = (t - tone->start) / SCALE;
+        relt = abst % tone->period;
+
+        if (relt >= tone->play) {
+            limit = tone->start + (abst - relt + tone->period) * SCALE;
+            i += samples_until(limit, t, dt, len - i);
+            continue;
+        }
+
+        limit = tone->start + (abst - relt + tone->play) * SCALE;
+
+        if (tone->end && tone->end < limit)
+            limit = tone->end + 1;
+
+        span = envelop_linear_span(tone->envelop,
+                                   (uint32_t)(tone->reltime ? relt : abst),
+                                   &gain, &slope);
+        envlimit = tone->start + (abst + span) * SCALE;
+
+        if (envlimit < limit)
+            limit = envlimit;
+
+        n = samples_until(limit, t, dt, len - i);
+
+        switch (tone->backend) {
+
+        case BACKEND_SINGEN:
+            singen_mix(&tone->singen, mix + i, n, gain, slope * dtus);
+            break;
+
+        case BACKEND_WAVETABLE:
+            wavetable_mix(&tone->wavetable, mix + i, n, gain, slope * dtus);
+            break;
+
+        case BACKEND_LOOP:
+            looper_mix(&tone->looper, mix + i, n, gain, slope * dtus);
+            break;
+        }
+
+        i += n;
     }
+
+    return len;
+}
+
+static inline void mix_clip(const float *mix, int16_t *buf, int len)
+{
+    float sample;
+    int   i;
+
+    for (i = 0; i < len; i++) {
+        sample = mix[i];
+
+#ifdef ENABLE_VERBOSE_TRACE
+        if (sample < SHRT_MIN || sample > SHRT_MAX) {
+            TRACE("sample %f is out of range (%d - %d)",
+                  sample, SHRT_MIN, SHRT_MAX);
+        }
+#endif
+
+        sample = sample > SHRT_MAX ? SHRT_MAX : sample;
+        sample = sample < SHRT_MIN ? SHRT_MIN : sample;
+
+        buf[i] = (int16_t)sample;
+    }
+}
+
+/* a lone loop past its ramp-up is copied as such to the buffer */
+static bool loop_copy(struct tone *tone, int16_t *buf, int len,
+                      uint64_t t, uint64_t dt)
+{
+    uint32_t span;
+    float    gain, slope;
+
+    if (tone->next || tone->chain || tone->backend != BACKEND_LOOP ||
+        tone->end || t <= tone->start)
+        return false;
+
+    span = envelop_linear_span(tone->envelop,
+                               (uint32_t)((t - tone->start) / SCALE),
+                               &gain, &slope);
+
+    if (gain != 1.0f || slope != 0.0f || (uint64_t)span * SCALE <= dt * (uint64_t)len)
+        return false;
+
+    looper_copy(&tone->looper, buf, len);
+
+    return true;
 }
 
 uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int len)
 {
+    float          mix[BLOCK];
+    struct tone  **iter;
     struct tone   *tone;
-    struct tone   *next;
+    struct tone   *head;
     uint64_t       t, dt;
-    uint32_t       abst;
-    uint32_t       relt;
-    int32_t        sine;
-    int32_t        sample;
+    int            from;
+    int            end;
+    int            n;
     int            i;
 
     t  = (uint64_t)stream->time * SCALE;
@@ -233,49 +680,34 @@ uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int len)
         memset(buf, 0, len*sizeof(*buf));
         t += dt * (uint64_t)len;
     }
+    else if (loop_copy(stream->data, buf, len, t, dt)) {
+        t += dt * (uint64_t)len;
+    }
     else {
-        for (i = 0; i < len; i++) {
-            sample = 0;
+        for (i = 0; i < len; i += n) {
+            n = len - i < BLOCK ? len - i : BLOCK;
 
-            for (tone=(struct tone *)stream->data;  tone!=NULL;  tone=next) {
-                next = tone->next;
-
-                if (tone->end && tone->end < t)
-                    tone_destroy(tone, false);
-                else if (t > tone->start) {
-                    abst = (uint32_t)((t - tone->start) / SCALE);
-                    relt = abst % tone->period;
+            memset(mix, 0, n*sizeof(*mix));
 
-                    if (relt < tone->play) {
-                        switch (tone->backend) {
+            for (iter = (struct tone **)&stream->data, from = 0; (tone = *iter); ) {
+                end = tone_mix(tone, mix, from, n, t, dt);
 
-                        case BACKEND_SINGEN:
-                            sine    = singen_write(&tone->singen);
-                            sample += envelop_apply(tone->envelop, sine,
-                                                    tone->reltime ? relt:abst);
-                            break;
-                        }
-
-                    }
+                if (end < n) {
+                    // a chained tone takes the place of the
+                    // ended one and continues from where it ended
+                    head = tone->chain;
+                    tone_destroy(tone, false);
+                    from = head ? end : 0;
+                }
+                else {
+                    iter = &tone->next;
+                    from = 0;
                 }
-            } /* for */
-
-
-#ifdef ENABLE_VERBOSE_TRACE
-            if (sample < SHRT_MIN || sample > SHRT_MAX) {
-                TRACE("sample %d is out of range (%d - %d)",
-                      sample, SHRT_MIN, SHRT_MAX);
             }
-#endif
 
-            if (sample > SHRT_MAX)
-                buf[i] = SHRT_MAX;
-            else if (sample < SHRT_MIN)
-                buf[i] = SHRT_MIN;
-            else
-                buf[i] = sample;
+            mix_clip(mix, buf + i, n);
 
-            t += dt;
+            t += dt * (uint64_t)n;
         }
     }
 
@@ -297,36 +729,102 @@ void tone_destroy_callback(void *data)
     }
 }
 
-static void setup_envelop_for_tone(struct tone *tone, tone_type type,
-                                   uint32_t play, uint32_t duration)
+static uint64_t gcd(uint64_t a, uint64_t b)
 {
-    switch (type) {
+    uint64_t r;
 
-    case TONE_DIAL:
-    case TONE_DTMF_IND_L:
-    case TONE_DTMF_IND_H:
-        tone->reltime = false;
-        tone->envelop = envelop_create(ENVELOP_RAMP_LINEAR, 10000, 0, duration);
-        break;
-
-    case TONE_BUSY:
-    case TONE_CONGEST:
-    case TONE_RADIO_ACK:
-    case TONE_RADIO_NA:
-    case TONE_WAIT:
-    case TONE_RING:
-    case TONE_DTMF_L:
-    case TONE_DTMF_H:
-        tone->reltime = true;
-        tone->envelop = envelop_create(ENVELOP_RAMP_LINEAR, 10000, 0, play);
-        break;
-
-    case TONE_ERROR:
-        tone->reltime = true;
-        tone->envelop = envelop_create(ENVELOP_RAMP_LINEAR, 3000, 0, play);
-        break;
-
-    default:
-        break;
+    while (b) {
+        r = a % b;
+        a = b;
+        b = r;
+    }
+
+    return a;
+}
+
+/*
+ * Renders one cycle of the endless tones of the stream into a loop,
+ * starting from a cycle boundary after the ramp-ups and start offsets.
+ * Returns NULL if the tones do not repeat within LOOP_MAX_PERIOD, the
+ * cycle is not a whole number of samples or the loop would take more
+ * than max_size bytes. The tones are left on the stream.
+ */
+struct tone_loop *tone_loop_render(struct stream *stream, size_t max_size)
+{
+    struct tone_loop *loop;
+    struct tone      *tone;
+    uint64_t          period = 1;
+    uint64_t          offset = 0;
+    uint64_t          length;
+    uint64_t          skip;
+    int               n;
+
+    if (!stream->data || !stream->rate)
+        return NULL;
+
+    for (tone = stream->data; tone; tone = tone->next) {
+        if (tone->end || tone->chain ||
+            (tone->backend != BACKEND_SINGEN && tone->backend != BACKEND_WAVETABLE))
+            return NULL;
+
+        period = period / gcd(period, tone->period) * tone->period;
+
+        if (period > LOOP_MAX_PERIOD)
+            return NULL;
+
+        if (tone->start / SCALE - stream->time > offset)
+            offset = tone->start / SCALE - stream->time;
+    }
+
+    if ((period * stream->rate) % 1000000)
+        return NULL;
+
+    // the loop must end where it started, ie. in whole cycles of all tones
+    for (tone = stream->data; tone; tone = tone->next) {
+        if ((period * tone->freq) % 1000000)
+            return NULL;
+    }
+
+    length = (period * stream->rate) / 1000000;
+
+    if (length * sizeof(int16_t) > max_size)
+        return NULL;
+
+    if (!(loop = calloc(1, sizeof *loop)) ||
+        !(loop->samples = malloc(length * sizeof(int16_t)))) {
+        N_ERROR(LOG_CAT "%s(): Can't allocate memory", __FUNCTION__);
+        free(loop);
+        return NULL;
+    }
+
+    loop->length   = length;
+    loop->period   = period;
+    loop->refcount = 1;
+
+    skip = ((offset + period - 1) / period + 1) * length;
+
+    for ( ; skip > 0; skip -= n) {
+        n = skip < length ? (int)skip : (int)length;
+        stream->time = tone_write_callback(stream, loop->samples, n);
+    }
+
+    stream->time = tone_write_callback(stream, loop->samples, loop->length);
+
+    return loop;
+}
+
+struct tone_loop *tone_loop_ref(struct tone_loop *loop)
+{
+    if (loop)
+        loop->refcount++;
+
+    return loop;
+}
+
+void tone_loop_unref(struct tone_loop *loop)
+{
+    if (loop && --loop->refcount == 0) {
+        free(loop->samples);
+        free(loop);
     }
 }
@@ -25,6 +25,7 @@ USA.
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /*
  * predefined tone types
@@ -50,16 +51,47 @@ typedef enum _tone_type {
 
 #define BACKEND_UNKNOWN      0
 #define BACKEND_SINGEN       1
+#define BACKEND_LOOP         2
+#define BACKEND_WAVETABLE    3
+
+#define OSCILLATOR_RECURRENCE 0
+#define OSCILLATOR_WAVETABLE  1
+
+/* usecs to ramp down a stopped tone, cutting it would click */
+#define TONE_STOP_RAMP       10000
 
 
 struct stream;
 union  envelop;
 
+#define SINGEN_LANES         4
+
 struct singen {
-    int64_t        m;
-    int64_t        n0;
-    int64_t        n1;
-    int64_t        offs;
+    double         m;                   /* 2cos(w * SINGEN_LANES) */
+    double         s[SINGEN_LANES];     /* next samples to output */
+    double         p[SINGEN_LANES];     /* SINGEN_LANES samples before s[] */
+};
+
+struct wavetable {
+    uint32_t       phase;               /* 2^32 is a full cycle */
+    uint32_t       step;                /* phase increment per sample */
+    uint32_t       error;               /* phase left over, in 1/rate */
+    uint32_t       rem;                 /* error added per sample */
+    uint32_t       rate;
+    float          amplitude;
+};
+
+
+struct tone_loop {
+    int16_t       *samples;
+    uint32_t       length;   /* in samples */
+    uint32_t       period;   /* length in usecs */
+    int            refcount;
+};
+
+struct looper {
+    struct tone_loop  *loop;
+    uint32_t           pos;
 };
 
 
@@ -68,13 +100,16 @@ struct tone {
     struct stream     *stream;
     struct tone       *chain;
     tone_type          type;
+    uint32_t           freq;
     uint32_t           period;   /* period (ie. play+pause) length */
     uint32_t           play;     /* how long to play the sine */
     uint64_t           start;
     uint64_t           end;
     int                backend;
     union {
-        struct singen  singen;
+        struct singen     singen;
+        struct wavetable  wavetable;
+        struct looper     looper;
     };
     bool               reltime; /* relative time to be passed to env. func's */
     union envelop     *envelop;
@@ -82,12 +117,23 @@ struct tone {
 
 
 int tone_init(void);
+void tone_set_oscillator(int oscillator);
 struct tone *tone_create(struct stream *stream, tone_type type, uint32_t freq, uint32_t volume,
                          uint32_t period,uint32_t play, uint32_t start, uint32_t duration);
+struct tone *tone_create_shaped(struct stream *stream, tone_type type, uint32_t freq,
+                                uint32_t volume, uint32_t period, uint32_t play,
+                                uint32_t start, uint32_t duration,
+                                uint32_t ramp, bool reltime);
+struct tone *tone_create_loop(struct stream *stream, tone_type type, struct tone_loop *loop);
 void tone_destroy(struct tone *tone, bool kill_chain);
+uint32_t tone_ramp_down(struct tone *tone, uint32_t ramp);
 bool tone_chainable(tone_type type);
+uint32_t tone_chain_end(struct stream *stream, tone_type type);
 uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int length);
 void tone_destroy_callback(void *data);
+struct tone_loop *tone_loop_render(struct stream *stream, size_t max_size);
+struct tone_loop *tone_loop_ref(struct tone_loop *loop);
+void tone_loop_unref(struct tone_loop *loop);
 
 
 #endif /* __TONEGEND_TONE_H__ */
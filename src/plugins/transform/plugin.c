@@ -204,6 +204,31 @@ parse_transform_map (NProplist *params)
     return TRUE;
 }
 
+static void
+register_input_keys (NCore *core)
+{
+    GHashTableIter  iter;
+    gpointer        target;
+    GList          *i;
+
+    /* Let input interfaces drop keys we would drop anyway before they
+       bother to copy them. Custom filename keys and key map targets are
+       inspected as well, so keep them. */
+
+    if (transform_allow_all)
+        return;
+
+    for (i = g_list_first (transform_allowed_keys); i; i = g_list_next (i))
+        n_core_add_input_key (core, (const char*) i->data);
+
+    g_hash_table_iter_init (&iter, transform_key_map);
+    while (g_hash_table_iter_next (&iter, NULL, &target))
+        n_core_add_input_key (core, (const char*) target);
+
+    n_core_add_input_key (core, SOUND_FILENAME);
+    n_core_add_input_key (core, SOUND_ENABLED);
+}
+
 N_PLUGIN_LOAD (plugin)
 {
     NCore     *core   = NULL;
@@ -225,6 +250,8 @@ N_PLUGIN_LOAD (plugin)
     if (!parse_transform_map (params))
         return FALSE;
 
+    register_input_keys (core);
+
     /* connect to the new request hook. */
 
     (void) n_core_connect (core, N_CORE_HOOK_NEW_REQUEST,
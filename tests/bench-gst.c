@@ -0,0 +1,400 @@
+/*
+ * Drives prepare, play and stop cycles through the gst sink plugin
+ * with fakesink or filesink output, so that it runs without an audio
+ * server. Reports prepare latency, time to the first sample, peak
+ * RSS and RSS growth after the warm-up iterations.
+ *
+ *   bench-gst [-n iterations] [-p play-ms] [-s fakesink|filesink]
+ *             [-f sound-file] [--no-cache] [--mixer]
+ *
+ * The plugin is loaded from NGF_PLUGIN_PATH, or from the build tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "ngf/core.h"
+#include "ngf/inputinterface.h"
+#include "src/ngf/core-internal.h"
+#include "src/ngf/core-player.h"
+
+#define BENCH_EVENT         "bench"
+#define SOUND_RATE          (8000)
+#define SOUND_MS            (300)
+
+typedef struct _Bench
+{
+    NCore           *core;
+    NInputInterface *input;
+    GMainLoop       *loop;
+    NRequest        *request;       /* request of the current iteration */
+    guint            stop_source;
+    gint             iteration;
+    gint             failed;
+    gint64           start_time;
+    glong            warm_rss_kb;
+} Bench;
+
+static gint iterations = 1000;
+static gint warmup = 50;
+static gint play_ms = 50;
+static gchar *sink = NULL;
+static gchar *sound = NULL;
+static gboolean no_cache = FALSE;
+static gboolean mixer = FALSE;
+
+static GOptionEntry entries[] = {
+    { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Play cycles to run", "N" },
+    { "warmup", 'w', 0, G_OPTION_ARG_INT, &warmup, "Cycles before RSS growth is measured", "N" },
+    { "play-ms", 'p', 0, G_OPTION_ARG_INT, &play_ms, "Milliseconds to play before stop", "MS" },
+    { "sink", 's', 0, G_OPTION_ARG_STRING, &sink, "Output element, fakesink or filesink", "ELEMENT" },
+    { "file", 'f', 0, G_OPTION_ARG_FILENAME, &sound, "Sound file to play", "FILE" },
+    { "no-cache", 0, 0, G_OPTION_ARG_NONE, &no_cache, "Decode the file on every play", NULL },
+    { "mixer", 0, 0, G_OPTION_ARG_NONE, &mixer, "Play through the shared mixer", NULL },
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static void start_iteration (Bench *bench);
+
+static glong
+current_rss_kb ()
+{
+    glong size = 0, resident = 0;
+    FILE *fp;
+
+    if (!(fp = fopen ("/proc/self/statm", "r")))
+        return 0;
+
+    if (fscanf (fp, "%ld %ld", &size, &resident) != 2)
+        resident = 0;
+    fclose (fp);
+
+    return resident * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+static glong
+peak_rss_kb ()
+{
+    struct rusage usage;
+
+    if (getrusage (RUSAGE_SELF, &usage) < 0)
+        return 0;
+
+    return usage.ru_maxrss;
+}
+
+static gboolean
+write_sound (const char *path)
+{
+    guint32 frames = SOUND_RATE * SOUND_MS / 1000;
+    guint32 data_size = frames * 2;
+    guint32 header[11];
+    gchar *contents;
+    gboolean ret;
+
+    memcpy (&header[0], "RIFF", 4);
+    header[1] = GUINT32_TO_LE (36 + data_size);
+    memcpy (&header[2], "WAVEfmt ", 8);
+    header[4] = GUINT32_TO_LE (16);
+    header[5] = GUINT32_TO_LE (1 | (1 << 16));      /* PCM, mono */
+    header[6] = GUINT32_TO_LE (SOUND_RATE);
+    header[7] = GUINT32_TO_LE (SOUND_RATE * 2);     /* byte rate */
+    header[8] = GUINT32_TO_LE (2 | (16 << 16));     /* block align, bits */
+    memcpy (&header[9], "data", 4);
+    header[10] = GUINT32_TO_LE (data_size);
+
+    contents = g_malloc0 (sizeof (header) + data_size);
+    memcpy (contents, header, sizeof (header));
+    ret = g_file_set_contents (path, contents, sizeof (header) + data_size, NULL);
+    g_free (contents);
+
+    return ret;
+}
+
+static gboolean
+write_config (const char *dir, const char *filename)
+{
+    gchar *path, *contents;
+    gboolean ret;
+
+    path = g_build_filename (dir, "ngfd.ini", NULL);
+    ret = g_file_set_contents (path,
+        "[general]\n"
+        "plugins = gst\n"
+        "sink-order = gst\n", -1, NULL);
+    g_free (path);
+
+    path = g_build_filename (dir, "plugins.d", NULL);
+    g_mkdir (path, 0700);
+    g_free (path);
+
+    path = g_build_filename (dir, "plugins.d", "50-gst.ini", NULL);
+    contents = g_strdup_printf (
+        "[gst]\n"
+        "sink_element = %s\n"
+        "sink_location = %s/out-%%u.wav\n"
+        "sound_info_cache =\n"
+        "pcm_cache_size = %s\n"
+        "shared_mixer = %s\n",
+        sink, dir, no_cache ? "0" : "2097152", mixer ? "true" : "false");
+    ret = ret && g_file_set_contents (path, contents, -1, NULL);
+    g_free (contents);
+    g_free (path);
+
+    path = g_build_filename (dir, "events.d", NULL);
+    g_mkdir (path, 0700);
+    g_free (path);
+
+    path = g_build_filename (dir, "events.d", "bench.ini", NULL);
+    contents = g_strdup_printf (
+        "[" BENCH_EVENT "]\n"
+        "sound.filename = %s\n", filename);
+    ret = ret && g_file_set_contents (path, contents, -1, NULL);
+    g_free (contents);
+    g_free (path);
+
+    return ret;
+}
+
+static void
+remove_dir (const char *path)
+{
+    const gchar *name;
+    gchar *child;
+    GDir *dir;
+
+    if ((dir = g_dir_open (path, 0, NULL))) {
+        while ((name = g_dir_read_name (dir))) {
+            child = g_build_filename (path, name, NULL);
+            if (g_file_test (child, G_FILE_TEST_IS_DIR))
+                remove_dir (child);
+            else
+                g_unlink (child);
+            g_free (child);
+        }
+        g_dir_close (dir);
+    }
+
+    g_rmdir (path);
+}
+
+static gboolean
+next_iteration_cb (gpointer userdata)
+{
+    Bench *bench = userdata;
+
+    if (bench->iteration == warmup)
+        bench->warm_rss_kb = current_rss_kb ();
+
+    if (bench->iteration >= iterations)
+        g_main_loop_quit (bench->loop);
+    else
+        start_iteration (bench);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+iteration_done (Bench *bench, gboolean failed)
+{
+    if (bench->stop_source) {
+        g_source_remove (bench->stop_source);
+        bench->stop_source = 0;
+    }
+
+    if (failed)
+        bench->failed++;
+
+    bench->request = NULL;
+    bench->iteration++;
+    g_idle_add (next_iteration_cb, bench);
+}
+
+static gboolean
+stop_cb (gpointer userdata)
+{
+    Bench *bench = userdata;
+
+    bench->stop_source = 0;
+    n_input_interface_stop_request (bench->input, bench->request, 0);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+bench_send_reply (NInputInterface *iface, NRequest *request, int ret_code)
+{
+    Bench *bench = n_input_interface_get_userdata (iface);
+
+    if (request != bench->request)
+        return;
+
+    switch (ret_code) {
+        case N_CORE_EVENT_PLAYING:
+            if (!bench->stop_source)
+                bench->stop_source = g_timeout_add (play_ms, stop_cb, bench);
+            break;
+
+        case N_CORE_EVENT_COMPLETED:
+            iteration_done (bench, FALSE);
+            break;
+
+        case N_CORE_EVENT_FAILED:
+            iteration_done (bench, TRUE);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void
+bench_send_error (NInputInterface *iface, NRequest *request, const char *err_msg)
+{
+    Bench *bench = n_input_interface_get_userdata (iface);
+
+    if (request != bench->request)
+        return;
+
+    if (bench->failed == 0)
+        fprintf (stderr, "request failed: %s\n", err_msg);
+
+    iteration_done (bench, TRUE);
+}
+
+static void
+start_iteration (Bench *bench)
+{
+    bench->request = n_request_new_with_event (BENCH_EVENT);
+    n_input_interface_play_request (bench->input, bench->request);
+}
+
+static void
+print_metrics (NCore *core)
+{
+    static const char *keys[] = {
+        "core.latency.prepare.p50_us",
+        "core.latency.prepare.p90_us",
+        "core.latency.prepare.p99_us",
+        "core.latency.total.p50_us",
+        "gst.first_sample.decoded.avg_us",
+        "gst.first_sample.cached.avg_us",
+        "gst.cache.hits",
+        "gst.cache.misses",
+        "gst.stream_spec.hits",
+        "gst.stream_spec.misses",
+        "core.objects.requests",
+        NULL
+    };
+
+    NProplist *metrics;
+    const char **key;
+
+    metrics = n_core_get_metrics (core);
+    for (key = keys; *key; key++) {
+        if (n_proplist_has_key (metrics, *key))
+            printf ("%-34s %u\n", *key, n_proplist_get_uint (metrics, *key));
+    }
+    n_proplist_free (metrics);
+}
+
+int
+main (int argc, char *argv[])
+{
+    static const NInputInterfaceDecl decl = {
+        .name       = "bench",
+        .send_error = bench_send_error,
+        .send_reply = bench_send_reply
+    };
+
+    GOptionContext *context;
+    GError *error = NULL;
+    Bench bench;
+    gchar *dir, *user_dir, *filename;
+    gint64 elapsed;
+    glong end_rss_kb;
+    int ret = EXIT_FAILURE;
+
+    context = g_option_context_new ("- benchmark the gst sink");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        fprintf (stderr, "%s\n", error->message);
+        g_error_free (error);
+        g_option_context_free (context);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free (context);
+
+    if (!sink)
+        sink = g_strdup ("fakesink");
+    if (warmup >= iterations)
+        warmup = 0;
+
+    dir = g_dir_make_tmp ("ngfd-bench-XXXXXX", NULL);
+    user_dir = g_build_filename (dir, "user", NULL);
+    g_mkdir (user_dir, 0700);
+    filename = sound ? g_strdup (sound) : g_build_filename (dir, "sound.wav", NULL);
+
+    if ((!sound && !write_sound (filename)) || !write_config (dir, filename)) {
+        fprintf (stderr, "failed to write configuration to '%s'\n", dir);
+        goto done;
+    }
+
+    g_setenv ("NGF_CONF_PATH", dir, TRUE);
+    g_setenv ("NGF_USER_CONF_PATH", user_dir, TRUE);
+    g_setenv ("NGF_PLUGIN_PATH", G_STRINGIFY (BENCH_PLUGIN_PATH), FALSE);
+
+    memset (&bench, 0, sizeof (bench));
+    bench.loop = g_main_loop_new (NULL, FALSE);
+    bench.core = n_core_new (&argc, argv);
+
+    if (!n_core_initialize (bench.core)) {
+        fprintf (stderr, "failed to load the gst plugin from '%s'\n", g_getenv ("NGF_PLUGIN_PATH"));
+        n_core_free (bench.core);
+        g_main_loop_unref (bench.loop);
+        goto done;
+    }
+
+    n_core_register_input (bench.core, &decl);
+    bench.input = bench.core->inputs[bench.core->num_inputs - 1];
+    n_input_interface_set_userdata (bench.input, &bench);
+
+    printf ("%d cycles of %d ms through %s, %s\n", iterations, play_ms, sink,
+        mixer ? "shared mixer" : (no_cache ? "decoding" : "sample cache"));
+
+    bench.warm_rss_kb = current_rss_kb ();
+    bench.start_time = g_get_monotonic_time ();
+    start_iteration (&bench);
+    g_main_loop_run (bench.loop);
+    elapsed = g_get_monotonic_time () - bench.start_time;
+    end_rss_kb = current_rss_kb ();
+
+    printf ("%-34s %.2f\n", "cycles per second", iterations / (elapsed / (gdouble) G_USEC_PER_SEC));
+    printf ("%-34s %d\n", "failed", bench.failed);
+    print_metrics (bench.core);
+    printf ("%-34s %ld\n", "rss.peak_kb", peak_rss_kb ());
+    printf ("%-34s %ld\n", "rss.growth_kb", end_rss_kb - bench.warm_rss_kb);
+    printf ("%-34s %.2f\n", "rss.growth_per_1000_cycles_kb", iterations > warmup ?
+        (end_rss_kb - bench.warm_rss_kb) * 1000.0 / (iterations - warmup) : 0.0);
+
+    n_core_shutdown (bench.core);
+    n_core_free (bench.core);
+    g_main_loop_unref (bench.loop);
+
+    ret = bench.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+
+done:
+    remove_dir (dir);
+    g_free (filename);
+    g_free (user_dir);
+    g_free (dir);
+    g_free (sink);
+    g_free (sound);
+
+    return ret;
+}
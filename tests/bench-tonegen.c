@@ -0,0 +1,501 @@
+/*
+ * Renders every indicator tone of every standard and every DTMF tone
+ * through the tonegen tone renderer without an audio server, and reports
+ * the CPU time spent per second of generated audio. The time to start an
+ * indicator tone, including rendering its loop, is counted in.
+ *
+ *   bench-tonegen [-d seconds] [-r rate] [-b buffer-samples] [-c cache-kb]
+ *                 [-s sink-rate]
+ *
+ * The streams are rendered with the offline stream backend. With a sink
+ * rate other than the rate, the tones are rendered once at the rate and
+ * resampled to the sink rate, as the server would do, and once directly
+ * at the sink rate, and the CPU time of the two is compared.
+ *
+ * Finally full scale sines are rendered with each oscillator kernel, and
+ * their CPU time, THD+N and how much they drift in amplitude and phase
+ * from the first to the last second are reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <glib.h>
+
+#include "src/plugins/tonegen/ausrv.h"
+#include "src/plugins/tonegen/stream.h"
+#include "src/plugins/tonegen/tone.h"
+#include "src/plugins/tonegen/indicator.h"
+#include "src/plugins/tonegen/dtmf.h"
+#include "src/plugins/tonegen/offline.h"
+
+#define KEYPRESS_LENGTH     (100000)
+#define RESAMPLER_TAPS      (16)
+#define RESAMPLER_PHASES    (1024)
+#define OSCILLATOR_STREAM   "oscillator"
+
+typedef struct _BenchResult
+{
+    guint64  samples;
+    gint     rate;
+    gint64   cpu_us;
+    gint     peak;
+} BenchResult;
+
+/* windowed sinc polyphase resampler of about the cost of the
+ * speex-float-1 method PulseAudio uses by default */
+typedef struct _Resampler
+{
+    gint     up;        /* output rate / gcd of the rates */
+    gint     down;      /* input rate / gcd of the rates */
+    gint     pos;       /* next output in 1/up input samples */
+    gfloat  *filter;    /* RESAMPLER_TAPS coefficients for each phase */
+    gfloat  *input;     /* RESAMPLER_TAPS - 1 samples of history + input */
+    int16_t *output;
+} Resampler;
+
+static gint duration = 60;
+static gint rate = 48000;
+static gint buffer = 1024;
+static gint cache_kb = -1;
+static gint sink_rate = 0;
+
+static GOptionEntry entries[] = {
+    { "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds of audio to render per tone", "S" },
+    { "rate", 'r', 0, G_OPTION_ARG_INT, &rate, "Sample rate", "HZ" },
+    { "buffer", 'b', 0, G_OPTION_ARG_INT, &buffer, "Samples rendered per write", "N" },
+    { "cache", 'c', 0, G_OPTION_ARG_INT, &cache_kb, "Indicator loop cache size in kB, 0 disables", "KB" },
+    { "sink-rate", 's', 0, G_OPTION_ARG_INT, &sink_rate, "Compare resampling to the sink rate with rendering at it", "HZ" },
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static struct ausrv *ausrv = NULL;
+static Resampler *resampler = NULL;
+
+int
+dbusif_send_signal (struct tonegend *tonegend, const char *intf, const char *name, int type, ...)
+{
+    (void) tonegend;
+    (void) intf;
+    (void) name;
+    (void) type;
+    return 0;
+}
+
+static gint64
+cpu_time_us ()
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static Resampler*
+resampler_new (gint from, gint to)
+{
+    Resampler *r;
+    gint a = from, b = to, t;
+    gint p, k;
+    gdouble cutoff, d, w, sum;
+
+    while (b) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+
+    if (to / a > RESAMPLER_PHASES) {
+        fprintf (stderr, "can't resample from %d Hz to %d Hz\n", from, to);
+        return NULL;
+    }
+
+    r = g_new0 (Resampler, 1);
+    r->up = to / a;
+    r->down = from / a;
+    r->filter = g_new (gfloat, r->up * RESAMPLER_TAPS);
+    r->input = g_new0 (gfloat, RESAMPLER_TAPS - 1 + buffer);
+    r->output = g_new (int16_t, (gint64) buffer * r->up / r->down + 2);
+
+    /* low pass at the lower of the two nyquist frequencies */
+    cutoff = MIN (1.0, (gdouble) r->up / r->down);
+
+    for (p = 0; p < r->up; p++) {
+        for (k = 0, sum = 0.0; k < RESAMPLER_TAPS; k++) {
+            d = k - RESAMPLER_TAPS / 2 + 1 - (gdouble) p / r->up;
+            w = 0.5 + 0.5 * cos (M_PI * d / (RESAMPLER_TAPS / 2));
+            w *= d == 0.0 ? 1.0 : sin (M_PI * cutoff * d) / (M_PI * cutoff * d);
+            r->filter[p * RESAMPLER_TAPS + k] = w;
+            sum += w;
+        }
+
+        for (k = 0; k < RESAMPLER_TAPS; k++)
+            r->filter[p * RESAMPLER_TAPS + k] /= sum;
+    }
+
+    return r;
+}
+
+static void
+resampler_reset (Resampler *r)
+{
+    r->pos = 0;
+    memset (r->input, 0, (RESAMPLER_TAPS - 1) * sizeof (gfloat));
+}
+
+static void
+resampler_free (Resampler *r)
+{
+    g_free (r->filter);
+    g_free (r->input);
+    g_free (r->output);
+    g_free (r);
+}
+
+/* resamples length samples to r->output, returns the number of samples
+ * there */
+static gint
+resample (Resampler *r, const int16_t *samples, gint length)
+{
+    gint avail = RESAMPLER_TAPS - 1 + length;
+    const gfloat *h;
+    gfloat acc;
+    gint n, m, k;
+
+    for (k = 0; k < length; k++)
+        r->input[RESAMPLER_TAPS - 1 + k] = samples[k];
+
+    for (n = 0; (m = r->pos / r->up) + RESAMPLER_TAPS <= avail; r->pos += r->down) {
+        h = r->filter + (r->pos % r->up) * RESAMPLER_TAPS;
+
+        for (k = 0, acc = 0.0f; k < RESAMPLER_TAPS; k++)
+            acc += h[k] * r->input[m + k];
+
+        r->output[n++] = CLAMP (lrintf (acc), -32768, 32767);
+    }
+
+    memmove (r->input, r->input + length, (RESAMPLER_TAPS - 1) * sizeof (gfloat));
+    r->pos -= length * r->up;
+
+    return n;
+}
+
+/* keypress_digits queues a new set of digits whenever the previous ones
+ * have been played, otherwise the tones already on the stream are played */
+static void
+render (const char *name, gboolean keypress_digits, BenchResult *result)
+{
+    struct stream *stream = stream_find (ausrv, (char *) name);
+    int16_t *samples = g_new (int16_t, buffer);
+    uint32_t end = (uint32_t) duration * G_USEC_PER_SEC;
+    int16_t *output = samples;
+    gint64 started;
+    gint i, n, rendered, digit;
+
+    memset (result, 0, sizeof (*result));
+
+    if (!stream)
+        goto done;
+
+    result->rate = stream->rate;
+
+    if (resampler) {
+        resampler_reset (resampler);
+        result->rate = sink_rate;
+        output = resampler->output;
+    }
+
+    /* streams are not timed out during the benchmark */
+    stream_set_timeout (stream, 0);
+
+    while (stream->time < end) {
+        if (keypress_digits && !stream->data) {
+            for (digit = 0; digit < DTMF_MAX; digit++)
+                dtmf_play (ausrv, digit, 100, KEYPRESS_LENGTH, NULL);
+            stream_set_timeout (stream, 0);
+        }
+
+        started = cpu_time_us ();
+        rendered = offline_render (ausrv, name, samples, buffer);
+        n = rendered && resampler ? resample (resampler, samples, rendered) : rendered;
+        result->cpu_us += cpu_time_us () - started;
+        result->samples += n;
+
+        if (rendered == 0)
+            break;
+
+        for (i = 0; i < n; i++) {
+            if (ABS (output[i]) > result->peak)
+                result->peak = ABS (output[i]);
+        }
+    }
+
+done:
+    g_free (samples);
+}
+
+static void
+report (const char *name, BenchResult *result, BenchResult *total)
+{
+    gdouble seconds = (gdouble) result->samples / MAX (result->rate, 1);
+
+    if (result->samples == 0) {
+        printf ("%-24s silent\n", name);
+        return;
+    }
+
+    printf ("%-24s %8.1f us/s  %8.0fx realtime  peak %5d\n", name,
+            result->cpu_us / seconds,
+            result->cpu_us > 0 ? seconds * G_USEC_PER_SEC / result->cpu_us : 0.0,
+            result->peak);
+
+    if (total) {
+        total->rate = result->rate;
+        total->samples += result->samples;
+        total->cpu_us += result->cpu_us;
+        total->peak = MAX (total->peak, result->peak);
+    }
+}
+
+/* fits a sine of freq Hz to one second of samples, returns the power of
+ * the rest relative to the sine in dB */
+static gdouble
+fit_sine (const int16_t *samples, gint freq, gdouble *amplitude, gdouble *phase)
+{
+    gdouble c = 0.0, s = 0.0, power = 0.0, w;
+    gint k;
+
+    for (k = 0; k < rate; k++) {
+        w = 2.0 * M_PI * freq * k / rate;
+        c += samples[k] * cos (w);
+        s += samples[k] * sin (w);
+        power += (gdouble) samples[k] * samples[k];
+    }
+
+    *amplitude = 2.0 * sqrt (c * c + s * s) / rate;
+    *phase = atan2 (c, s);
+
+    power = power / rate - *amplitude * *amplitude / 2.0;
+
+    return 10.0 * log10 (MAX (power, 1e-12) / (*amplitude * *amplitude / 2.0));
+}
+
+static void
+oscillator (gint osc, gint freq, BenchResult *total)
+{
+    static const char *names[] = { "recurrence", "wavetable" };
+    struct stream *stream;
+    int16_t *samples = g_new (int16_t, rate);
+    guint64 length = (guint64) duration * rate;
+    guint64 pos;
+    gdouble thd, amplitude[2], phase[2], drift;
+    gint64 started, cpu_us = 0;
+    gint n, i, k, rendered;
+    gchar *name;
+
+    tone_set_oscillator (osc);
+    stream = stream_create (ausrv, OSCILLATOR_STREAM, NULL, rate,
+                            tone_write_callback, tone_destroy_callback,
+                            NULL, NULL);
+    stream_set_timeout (stream, 0);
+    tone_create_shaped (stream, TONE_NOTE_0, freq, 100, G_USEC_PER_SEC,
+                        G_USEC_PER_SEC, 0, 0, 0, false);
+
+    /* the first and the last second go to samples for the fit */
+    for (pos = 0; pos < length; pos += n) {
+        if (pos < (guint64) rate) {
+            i = pos;
+            n = MIN ((guint64) buffer, rate - pos);
+        }
+        else if (pos + rate < length) {
+            i = 0;
+            n = MIN ((guint64) buffer, length - rate - pos);
+        }
+        else {
+            i = pos + rate - length;
+            n = MIN ((guint64) buffer, length - pos);
+        }
+
+        started = cpu_time_us ();
+        rendered = offline_render (ausrv, OSCILLATOR_STREAM, samples + i, n);
+        cpu_us += cpu_time_us () - started;
+
+        if (rendered < n)
+            break;
+
+        for (k = i; k < i + n; k++)
+            total->peak = MAX (total->peak, ABS (samples[k]));
+
+        if (pos + n == (guint64) rate)
+            fit_sine (samples, freq, &amplitude[0], &phase[0]);
+    }
+
+    thd = fit_sine (samples, freq, &amplitude[1], &phase[1]);
+    drift = fmod (phase[1] - phase[0] + 3.0 * M_PI, 2.0 * M_PI) - M_PI;
+
+    name = g_strdup_printf ("%s %d Hz", names[osc], freq);
+    printf ("%-24s %8.1f us/s  THD+N %6.1f dB  drift %+.5f dB %+.4f deg\n", name,
+            (gdouble) cpu_us / duration, thd,
+            20.0 * log10 (amplitude[1] / amplitude[0]), drift * 180.0 / M_PI);
+    g_free (name);
+
+    total->rate = rate;
+    total->samples += pos;
+    total->cpu_us += cpu_us;
+
+    stream_destroy (stream);
+    g_free (samples);
+}
+
+/* renders all the tones once, the totals are added to total */
+static void
+run (BenchResult *total)
+{
+    static const char *standards[] = { "cept", "ansi", "japan", "atnt" };
+    static const char *indicators[] = { "dial", "busy", "congest", "radio-ack",
+                                        "radio-na", "error", "wait", "ring" };
+    static const char digits[] = "0123456789*#ABCD";
+    BenchResult result;
+    gchar *name;
+    gint std, type, digit;
+    gint64 started, play_us;
+    guint32 loops, loop_hits, loop_misses;
+    gsize loop_size;
+
+    memset (total, 0, sizeof (*total));
+
+    for (std = STD_CEPT; std <= STD_ATNT; std++) {
+        indicator_set_standard (std);
+
+        for (type = TONE_DIAL; type <= TONE_RING; type++) {
+            started = cpu_time_us ();
+            indicator_play (ausrv, type, 100, 0);
+            play_us = cpu_time_us () - started;
+
+            render (STREAM_INDICATOR, FALSE, &result);
+            result.cpu_us += play_us;
+            indicator_stop (ausrv, true);
+
+            name = g_strdup_printf ("%s %s", standards[std], indicators[type - TONE_DIAL]);
+            report (name, &result, total);
+            g_free (name);
+        }
+    }
+
+    indicator_get_loop_stats (&loops, &loop_size, &loop_hits, &loop_misses);
+    printf ("\nindicator loops: %u rendered, %u played from cache, %u kept in %" G_GSIZE_FORMAT " bytes\n\n",
+            loop_misses, loop_hits, loops, loop_size);
+
+    for (digit = 0; digit < DTMF_MAX; digit++) {
+        dtmf_play (ausrv, digit, 100, 0, NULL);
+        render (STREAM_DTMF, FALSE, &result);
+        stream_destroy (stream_find (ausrv, STREAM_DTMF));
+
+        name = g_strdup_printf ("dtmf %c", digits[digit]);
+        report (name, &result, total);
+        g_free (name);
+    }
+
+    dtmf_play (ausrv, 0, 100, KEYPRESS_LENGTH, NULL);
+    render (STREAM_DTMF, TRUE, &result);
+    stream_destroy (stream_find (ausrv, STREAM_DTMF));
+    report ("dtmf keypresses", &result, total);
+
+    printf ("\n");
+    report ("total", total, NULL);
+}
+
+int
+main (int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    static const gint frequencies[] = { 425, 697, 1209, 1633, 3400 };
+    BenchResult total, native;
+    gint osc, i;
+
+    context = g_option_context_new ("- tone generator rendering benchmark");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        fprintf (stderr, "%s\n", error->message);
+        g_error_free (error);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free (context);
+
+    if (duration <= 0 || rate <= 0 || buffer <= 0) {
+        fprintf (stderr, "duration, rate and buffer must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    if (sink_rate < 0) {
+        fprintf (stderr, "sink rate can't be negative\n");
+        return EXIT_FAILURE;
+    }
+
+    if (sink_rate == rate)
+        sink_rate = 0;
+
+    if (sink_rate && (resampler = resampler_new (rate, sink_rate)) == NULL)
+        return EXIT_FAILURE;
+
+    tone_init ();
+    indicator_init ();
+
+    if (cache_kb >= 0)
+        indicator_set_loop_cache ((gsize) cache_kb * 1024);
+
+    stream_set_default_samplerate (rate);
+    ausrv = offline_create ();
+
+    if (sink_rate)
+        printf ("rendering %d s per tone at %d Hz resampled to %d Hz in writes of %d samples\n\n",
+                duration, rate, sink_rate, buffer);
+    else
+        printf ("rendering %d s per tone at %d Hz in writes of %d samples\n\n",
+                duration, rate, buffer);
+
+    run (&total);
+
+    if (sink_rate) {
+        resampler_free (resampler);
+        resampler = NULL;
+
+        /* the streams follow the sink rate as with native-rate */
+        stream_use_sink_rate (TRUE);
+        offline_set_sink_rate (ausrv, sink_rate);
+
+        printf ("\nrendering %d s per tone at the sink rate of %d Hz in writes of %d samples\n\n",
+                duration, sink_rate, buffer);
+
+        run (&native);
+
+        printf ("\n");
+        report ("resampled total", &total, NULL);
+        report ("native total", &native, NULL);
+        if (native.cpu_us > 0)
+            printf ("\nrendering at the sink rate takes %.0f%% of the CPU time of resampling\n",
+                    100.0 * native.cpu_us / MAX (total.cpu_us, 1));
+    }
+
+    printf ("\nrendering %d s of a full scale sine with each oscillator at %d Hz\n\n",
+            duration, rate);
+
+    for (osc = OSCILLATOR_RECURRENCE; osc <= OSCILLATOR_WAVETABLE; osc++) {
+        memset (&total, 0, sizeof (total));
+
+        for (i = 0; i < (gint) G_N_ELEMENTS (frequencies); i++)
+            oscillator (osc, frequencies[i], &total);
+
+        report (osc == OSCILLATOR_RECURRENCE ? "recurrence total" : "wavetable total",
+                &total, NULL);
+        printf ("\n");
+    }
+
+    offline_destroy (ausrv);
+    indicator_exit ();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,529 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+/* Signal dispatch is internal to core-dbus, include it directly. */
+#include "src/ngf/core-dbus.c"
+
+#define BENCH_ROUNDS 20000
+
+#define SERVICE_NAME        "org.example.StandIn"
+#define SERVICE_PATH        "/org/example/StandIn"
+#define SERVICE_IF          "org.example.StandIn"
+#define SERVICE_DELAY_MS    20
+#define SERVICE_HANG        "Hang"
+
+typedef struct _TrafficEntry
+{
+    const char *iface;
+    const char *path;
+    const char *member;
+} TrafficEntry;
+
+/* Signals recorded from the system bus of an idle device, in the order
+ * they were seen. Only call state and led pattern signals are of
+ * interest to the plugins registering matches below. */
+static const TrafficEntry traffic[] = {
+    { "org.freedesktop.DBus",               "/org/freedesktop/DBus",            "NameOwnerChanged" },
+    { "org.freedesktop.DBus.Properties",    "/org/freedesktop/systemd1/unit/ofono_2eservice", "PropertiesChanged" },
+    { "com.nokia.mce.signal",               "/com/nokia/mce/signal",            "display_status_ind" },
+    { "com.nokia.mce.signal",               "/com/nokia/mce/signal",            "sig_call_state_ind" },
+    { "org.ofono.NetworkRegistration",      "/ril_0",                           "PropertyChanged" },
+    { "net.connman.Manager",                "/",                                "PropertyChanged" },
+    { "com.nokia.mce.signal",               "/com/nokia/mce/signal",            "led_pattern_deactivated_ind" },
+    { "org.freedesktop.DBus",               "/org/freedesktop/DBus",            "NameAcquired" },
+    { "com.nokia.mce.signal",               "/com/nokia/mce/signal",            "tklock_mode_ind" },
+    { "org.freedesktop.DBus.Properties",    "/org/freedesktop/UPower/devices/battery_battery", "PropertiesChanged" },
+    { "com.nokia.mce.signal",               "/com/nokia/mce/signal",            "sig_call_state_ind" },
+    { "org.ofono.VoiceCallManager",         "/ril_0",                           "CallAdded" },
+};
+
+static int call_state_hits = 0;
+static int led_pattern_hits = 0;
+
+static DBusHandlerResult
+call_state_cb (NCore *core, DBusConnection *connection, DBusMessage *msg, void *userdata)
+{
+    (void) core;
+    (void) connection;
+    (void) msg;
+    (void) userdata;
+
+    call_state_hits++;
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static DBusHandlerResult
+led_pattern_cb (NCore *core, DBusConnection *connection, DBusMessage *msg, void *userdata)
+{
+    (void) core;
+    (void) connection;
+    (void) msg;
+    (void) userdata;
+
+    led_pattern_hits++;
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+add_filter (NDBusHelper *dbus, guint id, NDBusFilterFunc cb, const char *member)
+{
+    n_dbus_match *match;
+    gboolean created;
+
+    match = match_get (dbus, DBUS_BUS_SYSTEM, "com.nokia.mce.signal",
+                       "/com/nokia/mce/signal", member, &created);
+    match_add_callback (match, id, cb, NULL);
+}
+
+/* the filters of add_filter() hold no bus references, they are dropped
+ * before the helper would remove them from the bus */
+static void
+drop_filters (NDBusHelper *dbus)
+{
+    g_hash_table_remove_all (dbus->matches);
+}
+
+static DBusMessage**
+record_traffic ()
+{
+    DBusMessage **msgs;
+    guint i;
+
+    msgs = g_new0 (DBusMessage*, G_N_ELEMENTS (traffic));
+    for (i = 0; i < G_N_ELEMENTS (traffic); i++)
+        msgs[i] = dbus_message_new_signal (traffic[i].path, traffic[i].iface, traffic[i].member);
+
+    return msgs;
+}
+
+static void
+free_traffic (DBusMessage **msgs)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (traffic); i++)
+        dbus_message_unref (msgs[i]);
+    g_free (msgs);
+}
+
+START_TEST (test_dispatch)
+{
+    NDBusHelper *dbus = n_dbus_helper_new (NULL);
+    DBusMessage **msgs = record_traffic ();
+    guint i;
+
+    call_state_hits = 0;
+    led_pattern_hits = 0;
+
+    add_filter (dbus, 1, call_state_cb, "sig_call_state_ind");
+    add_filter (dbus, 2, led_pattern_cb, "led_pattern_deactivated_ind");
+    add_filter (dbus, 3, call_state_cb, "sig_call_state_ind");
+    ck_assert_int_eq (g_hash_table_size (dbus->matches), 2);
+
+    for (i = 0; i < G_N_ELEMENTS (traffic); i++)
+        dispatch_signal (dbus, DBUS_BUS_SYSTEM, NULL, msgs[i]);
+
+    /* two signals, two callbacks each */
+    ck_assert_int_eq (call_state_hits, 4);
+    ck_assert_int_eq (led_pattern_hits, 1);
+
+    /* same signals on the session bus are not ours */
+    for (i = 0; i < G_N_ELEMENTS (traffic); i++)
+        dispatch_signal (dbus, DBUS_BUS_SESSION, NULL, msgs[i]);
+
+    ck_assert_int_eq (call_state_hits, 4);
+    ck_assert_int_eq (led_pattern_hits, 1);
+
+    free_traffic (msgs);
+    drop_filters (dbus);
+    n_dbus_helper_free (dbus);
+}
+END_TEST
+
+START_TEST (test_dispatch_benchmark)
+{
+    NDBusHelper *dbus = n_dbus_helper_new (NULL);
+    DBusMessage **msgs = record_traffic ();
+    GHashTable *legacy;
+    gint64 start, tuple_time, string_time;
+    int legacy_hits = 0;
+    guint round, i;
+
+    call_state_hits = 0;
+    led_pattern_hits = 0;
+
+    add_filter (dbus, 1, call_state_cb, "sig_call_state_ind");
+    add_filter (dbus, 2, led_pattern_cb, "led_pattern_deactivated_ind");
+
+    start = g_get_monotonic_time ();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+        for (i = 0; i < G_N_ELEMENTS (traffic); i++)
+            dispatch_signal (dbus, DBUS_BUS_SYSTEM, NULL, msgs[i]);
+    tuple_time = g_get_monotonic_time () - start;
+
+    ck_assert_int_eq (call_state_hits, 2 * BENCH_ROUNDS);
+    ck_assert_int_eq (led_pattern_hits, BENCH_ROUNDS);
+
+    /* Previous implementation: build match string for every signal and
+     * look it up from string keyed table. */
+    legacy = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_hash_table_insert (legacy, build_match_string ("com.nokia.mce.signal",
+                         "/com/nokia/mce/signal", "sig_call_state_ind"), GINT_TO_POINTER (1));
+    g_hash_table_insert (legacy, build_match_string ("com.nokia.mce.signal",
+                         "/com/nokia/mce/signal", "led_pattern_deactivated_ind"), GINT_TO_POINTER (1));
+
+    start = g_get_monotonic_time ();
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        for (i = 0; i < G_N_ELEMENTS (traffic); i++) {
+            char *match_str = build_match_string (dbus_message_get_interface (msgs[i]),
+                                                  dbus_message_get_path (msgs[i]),
+                                                  dbus_message_get_member (msgs[i]));
+            if (g_hash_table_lookup (legacy, match_str))
+                legacy_hits++;
+            g_free (match_str);
+        }
+    }
+    string_time = g_get_monotonic_time () - start;
+
+    ck_assert_int_eq (legacy_hits, 3 * BENCH_ROUNDS);
+
+    printf ("dispatch of %d signals: tuple lookup %" G_GINT64_FORMAT " us, "
+            "match string lookup %" G_GINT64_FORMAT " us\n",
+            BENCH_ROUNDS * (int) G_N_ELEMENTS (traffic), tuple_time, string_time);
+
+    g_hash_table_destroy (legacy);
+    free_traffic (msgs);
+    drop_filters (dbus);
+    n_dbus_helper_free (dbus);
+}
+END_TEST
+
+/* Local stand-in for the services queried at startup. Every method call
+ * is answered after SERVICE_DELAY_MS, except SERVICE_HANG which is never
+ * answered. */
+typedef struct _StandIn
+{
+    DBusServer     *server;
+    DBusConnection *service;
+    NCore          *core;
+    GMainLoop      *loop;
+    int             received;
+    int             replies;
+    int             errors;
+    int             in_flight;  /* calls received before the first reply */
+} StandIn;
+
+static StandIn stand_in;
+
+static gboolean
+stand_in_reply_cb (gpointer userdata)
+{
+    DBusMessage *msg = userdata;
+    DBusMessage *reply;
+
+    reply = dbus_message_new_method_return (msg);
+    dbus_connection_send (stand_in.service, reply, NULL);
+    dbus_message_unref (reply);
+    dbus_message_unref (msg);
+
+    return FALSE;
+}
+
+static DBusHandlerResult
+stand_in_filter_cb (DBusConnection *connection, DBusMessage *msg, void *userdata)
+{
+    (void) connection;
+    (void) userdata;
+
+    if (dbus_message_get_type (msg) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    stand_in.received++;
+
+    if (!dbus_message_has_member (msg, SERVICE_HANG))
+        g_timeout_add (SERVICE_DELAY_MS, stand_in_reply_cb, dbus_message_ref (msg));
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void
+stand_in_new_connection_cb (DBusServer *server, DBusConnection *connection, void *userdata)
+{
+    (void) server;
+    (void) userdata;
+
+    stand_in.service = dbus_connection_ref (connection);
+    dbus_gmain_set_up_connection (connection, NULL);
+    dbus_connection_add_filter (connection, stand_in_filter_cb, NULL, NULL);
+}
+
+static void
+stand_in_setup ()
+{
+    DBusConnection *client;
+    char *address;
+
+    memset (&stand_in, 0, sizeof (stand_in));
+
+    stand_in.server = dbus_server_listen ("unix:tmpdir=/tmp", NULL);
+    ck_assert (stand_in.server != NULL);
+    dbus_server_set_new_connection_function (stand_in.server,
+                                             stand_in_new_connection_cb, NULL, NULL);
+    dbus_gmain_set_up_server (stand_in.server, NULL);
+
+    address = dbus_server_get_address (stand_in.server);
+    client = dbus_connection_open_private (address, NULL);
+    dbus_free (address);
+    ck_assert (client != NULL);
+    dbus_gmain_set_up_connection (client, NULL);
+
+    stand_in.loop = g_main_loop_new (NULL, FALSE);
+    while (!stand_in.service)
+        g_main_context_iteration (NULL, TRUE);
+
+    /* Pretend the client connection is the system bus. */
+    stand_in.core = g_new0 (NCore, 1);
+    stand_in.core->dbus = n_dbus_helper_new (stand_in.core);
+    stand_in.core->dbus->bus[DBUS_BUS_SYSTEM].connection = client;
+    stand_in.core->dbus->bus[DBUS_BUS_SYSTEM].ref = 1;
+}
+
+static void
+stand_in_teardown ()
+{
+    NDBusHelper *dbus = stand_in.core->dbus;
+
+    dbus_connection_close (dbus->bus[DBUS_BUS_SYSTEM].connection);
+    connection_unref (dbus, DBUS_BUS_SYSTEM);
+    n_dbus_helper_free (dbus);
+    g_free (stand_in.core);
+
+    dbus_connection_close (stand_in.service);
+    dbus_connection_unref (stand_in.service);
+    dbus_server_disconnect (stand_in.server);
+    dbus_server_unref (stand_in.server);
+    g_main_loop_unref (stand_in.loop);
+}
+
+static DBusMessage*
+stand_in_query (const char *method)
+{
+    return dbus_message_new_method_call (SERVICE_NAME, SERVICE_PATH, SERVICE_IF, method);
+}
+
+static void
+stand_in_reply_received_cb (NCore *core, DBusMessage *msg, void *userdata)
+{
+    (void) core;
+    (void) userdata;
+
+    if (stand_in.replies + stand_in.errors == 0)
+        stand_in.in_flight = stand_in.received;
+
+    if (dbus_message_get_type (msg) == DBUS_MESSAGE_TYPE_ERROR)
+        stand_in.errors++;
+    else
+        stand_in.replies++;
+
+    g_main_loop_quit (stand_in.loop);
+}
+
+static void
+stand_in_batch_done_cb (NCore *core, void *userdata)
+{
+    (void) core;
+
+    *(gboolean*) userdata = TRUE;
+    g_main_loop_quit (stand_in.loop);
+}
+
+/* Queries done by plugins at startup: mce, profiled, route, devicelock */
+static const char *startup_queries[] = {
+    "get_call_state",
+    "get_profile",
+    "GetActiveRoutes",
+    "getState"
+};
+
+START_TEST (test_batch_startup_timing)
+{
+    NDBusBatch *batch;
+    DBusMessage *msg;
+    gboolean done = FALSE;
+    gint64 start, serial_time, batch_time;
+    guint i;
+
+    stand_in_setup ();
+
+    /* One query after another, each waiting for the previous reply. */
+    start = g_get_monotonic_time ();
+    for (i = 0; i < G_N_ELEMENTS (startup_queries); i++) {
+        msg = stand_in_query (startup_queries[i]);
+        ck_assert (n_dbus_async_call_full (stand_in.core, stand_in_reply_received_cb, NULL,
+                                           DBUS_BUS_SYSTEM, msg));
+        dbus_message_unref (msg);
+        g_main_loop_run (stand_in.loop);
+    }
+    serial_time = g_get_monotonic_time () - start;
+    ck_assert_int_eq (stand_in.replies, G_N_ELEMENTS (startup_queries));
+    ck_assert_int_eq (stand_in.in_flight, 1);
+
+    /* All queries in one batch. */
+    stand_in.replies = 0;
+    stand_in.received = 0;
+    start = g_get_monotonic_time ();
+    batch = n_dbus_batch_new (stand_in.core, stand_in_batch_done_cb, &done);
+    for (i = 0; i < G_N_ELEMENTS (startup_queries); i++) {
+        msg = stand_in_query (startup_queries[i]);
+        ck_assert (n_dbus_batch_add (batch, stand_in_reply_received_cb, NULL,
+                                     DBUS_BUS_SYSTEM, msg, -1));
+        dbus_message_unref (msg);
+    }
+    n_dbus_batch_commit (batch);
+    while (!done)
+        g_main_loop_run (stand_in.loop);
+    batch_time = g_get_monotonic_time () - start;
+    ck_assert_int_eq (stand_in.replies, G_N_ELEMENTS (startup_queries));
+
+    /* the service had all the queries before answering any, ie. the
+     * batch took one round trip instead of one per query */
+    ck_assert_int_eq (stand_in.in_flight, G_N_ELEMENTS (startup_queries));
+
+    printf ("startup queries with %d ms service latency: serial %" G_GINT64_FORMAT " us, "
+            "batched %" G_GINT64_FORMAT " us\n",
+            SERVICE_DELAY_MS, serial_time, batch_time);
+
+    stand_in_teardown ();
+}
+END_TEST
+
+START_TEST (test_batch_dedup_timeout)
+{
+    NDBusBatch *batch;
+    DBusMessage *msg;
+    gboolean done = FALSE;
+
+    stand_in_setup ();
+
+    batch = n_dbus_batch_new (stand_in.core, stand_in_batch_done_cb, &done);
+
+    /* identical calls share one request */
+    msg = stand_in_query ("get_call_state");
+    ck_assert (n_dbus_batch_add (batch, stand_in_reply_received_cb, NULL,
+                                 DBUS_BUS_SYSTEM, msg, -1));
+    ck_assert (n_dbus_batch_add (batch, stand_in_reply_received_cb, NULL,
+                                 DBUS_BUS_SYSTEM, msg, -1));
+
+    /* but not with a caller waiting for less */
+    ck_assert (n_dbus_batch_add (batch, stand_in_reply_received_cb, NULL,
+                                 DBUS_BUS_SYSTEM, msg, 5 * SERVICE_DELAY_MS));
+    dbus_message_unref (msg);
+
+    /* unanswered call times out with error reply */
+    msg = stand_in_query (SERVICE_HANG);
+    ck_assert (n_dbus_batch_add (batch, stand_in_reply_received_cb, NULL,
+                                 DBUS_BUS_SYSTEM, msg, 2 * SERVICE_DELAY_MS));
+    dbus_message_unref (msg);
+
+    n_dbus_batch_commit (batch);
+    while (!done)
+        g_main_loop_run (stand_in.loop);
+
+    ck_assert_int_eq (stand_in.received, 3);
+    ck_assert_int_eq (stand_in.replies, 3);
+    ck_assert_int_eq (stand_in.errors, 1);
+
+    stand_in_teardown ();
+}
+END_TEST
+
+START_TEST (test_batch_peer_connection)
+{
+    NDBusHelper *dbus;
+    NDBusBatch *batch;
+    DBusMessage *msg;
+    gboolean done = FALSE;
+
+    stand_in_setup ();
+    dbus = stand_in.core->dbus;
+
+    /* calls on a private connection, like the stream restore peer to
+     * peer connection, are sent on it as they are and never shared */
+    batch = n_dbus_batch_new (stand_in.core, stand_in_batch_done_cb, &done);
+    msg = stand_in_query ("get_call_state");
+    ck_assert (n_dbus_batch_add_connection (batch, stand_in_reply_received_cb, NULL,
+                                            dbus->bus[DBUS_BUS_SYSTEM].connection, msg, -1));
+    ck_assert (n_dbus_batch_add_connection (batch, stand_in_reply_received_cb, NULL,
+                                            dbus->bus[DBUS_BUS_SYSTEM].connection, msg, -1));
+    dbus_message_unref (msg);
+
+    n_dbus_batch_commit (batch);
+    while (!done)
+        g_main_loop_run (stand_in.loop);
+
+    ck_assert_int_eq (stand_in.received, 2);
+    ck_assert_int_eq (stand_in.replies, 2);
+    ck_assert_int_eq (stand_in.in_flight, 2);
+
+    /* the helper's own bus references are left alone */
+    ck_assert_int_eq (dbus->bus[DBUS_BUS_SYSTEM].ref, 1);
+
+    stand_in_teardown ();
+}
+END_TEST
+
+START_TEST (test_leaked_match)
+{
+    NDBusHelper *dbus;
+
+    stand_in_setup ();
+    dbus = stand_in.core->dbus;
+
+    /* a plugin forgetting its match, the helper removes it from the bus
+     * and the teardown asserts that the bus references are dropped */
+    ck_assert (n_dbus_add_match (stand_in.core, call_state_cb, NULL, DBUS_BUS_SYSTEM,
+                                 "com.nokia.mce.signal", "/com/nokia/mce/signal",
+                                 "sig_call_state_ind") > 0);
+    ck_assert_int_eq (dbus->bus[DBUS_BUS_SYSTEM].ref, 3);
+
+    stand_in_teardown ();
+}
+END_TEST
+
+int
+main ()
+{
+    Suite *s = NULL;
+    SRunner *sr = NULL;
+    TCase *tc = NULL;
+    int num_failed = 0;
+
+    s = suite_create ("\tCore DBus tests");
+
+    tc = tcase_create ("signal dispatch");
+    tcase_add_test (tc, test_dispatch);
+    tcase_add_test (tc, test_leaked_match);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("signal dispatch benchmark");
+    tcase_add_test (tc, test_dispatch_benchmark);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("batched startup calls");
+    tcase_add_test (tc, test_batch_startup_timing);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("shared and timed out calls");
+    tcase_add_test (tc, test_batch_dedup_timeout);
+    tcase_add_test (tc, test_batch_peer_connection);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -166,6 +166,207 @@ START_TEST (test_connect)
 }
 END_TEST
 
+START_TEST (test_input_keys)
+{
+    NCore *core = n_core_new (NULL, NULL);
+    ck_assert (core != NULL);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "sms => play.mode=short", "sink.null", "true");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    /* no restrictions */
+    ck_assert (n_core_accepts_input_key (NULL, "audio") == FALSE);
+    ck_assert (n_core_accepts_input_key (core, "audio") == TRUE);
+    ck_assert (n_core_accepts_input_key (core, "unknown.key") == TRUE);
+
+    n_core_add_input_key (core, "audio");
+    ck_assert (n_core_accepts_input_key (core, "audio") == TRUE);
+    ck_assert (n_core_accepts_input_key (core, "unknown.key") == FALSE);
+
+    /* keys used in request rules are always accepted */
+    ck_assert (n_core_accepts_input_key (core, "play.mode") == TRUE);
+
+    n_core_free (core);
+}
+END_TEST
+
+static void
+collect_metrics_cb (NHook *hook, void *data, void *userdata)
+{
+    NCoreHookCollectMetricsData *collect = data;
+
+    (void) hook;
+    (void) userdata;
+
+    n_proplist_set_uint (collect->metrics, "test.value", 42);
+}
+
+START_TEST (test_metrics)
+{
+    NCore *core = n_core_new (NULL, NULL);
+    ck_assert (core != NULL);
+
+    NProplist *metrics = n_core_get_metrics (core);
+    ck_assert (metrics != NULL);
+    ck_assert (n_proplist_get_uint (metrics, "core.requests.active") == 0);
+    ck_assert (n_proplist_get_uint (metrics, "core.requests.total") == 0);
+    ck_assert (n_proplist_get_uint (metrics, "core.latency.total.samples") == 0);
+    ck_assert (!n_proplist_has_key (metrics, "core.latency.total.p50_us"));
+    ck_assert (!n_proplist_has_key (metrics, "test.value"));
+    n_proplist_free (metrics);
+
+    n_metrics_request_new (core->metrics);
+    n_metrics_request_new (core->metrics);
+
+    /* more samples than the ring holds, oldest ones are dropped */
+    for (gint64 i = 1; i <= 200; i++)
+        n_metrics_add_latency (core->metrics, N_METRICS_PHASE_TOTAL, i);
+
+    n_core_connect (core, N_CORE_HOOK_COLLECT_METRICS, 0, collect_metrics_cb, NULL);
+
+    metrics = n_core_get_metrics (core);
+    ck_assert (n_proplist_get_uint (metrics, "core.requests.total") == 2);
+    ck_assert (n_proplist_get_uint (metrics, "core.requests.last_minute") == 2);
+    ck_assert (n_proplist_get_uint (metrics, "core.latency.total.samples") == 128);
+    ck_assert (n_proplist_get_uint (metrics, "core.latency.total.p50_us") == 136);
+    ck_assert (n_proplist_get_uint (metrics, "core.latency.total.p99_us") == 198);
+    ck_assert (n_proplist_get_uint (metrics, "core.latency.prepare.samples") == 0);
+    ck_assert (n_proplist_get_uint (metrics, "test.value") == 42);
+    n_proplist_free (metrics);
+
+    n_core_disconnect (core, N_CORE_HOOK_COLLECT_METRICS, collect_metrics_cb, NULL);
+    n_core_free (core);
+}
+END_TEST
+
+static int num_prewarmed;
+static int num_dropped;
+
+static int
+prewarm_sink_play (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    (void) request;
+
+    return TRUE;
+}
+
+static void
+prewarm_sink_stop (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    (void) request;
+}
+
+static int
+prewarm_sink_prewarm (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+
+    ck_assert (g_strcmp0 (n_request_get_name (request), "ringtone") == 0);
+    ck_assert (n_proplist_has_key (n_request_get_properties (request), "sound.filename"));
+    num_prewarmed++;
+
+    return TRUE;
+}
+
+static void
+prewarm_sink_drop (NSinkInterface *iface, NRequest *request)
+{
+    (void) iface;
+    (void) request;
+
+    num_dropped++;
+}
+
+static void
+set_call_state (NCore *core, const char *mode)
+{
+    NValue *value = n_value_new ();
+
+    n_value_set_string (value, mode);
+    n_context_set_value (core->context, "call_state.mode", value);
+}
+
+START_TEST (test_prewarm)
+{
+    static const NSinkInterfaceDecl decl = {
+        .name         = "prewarm",
+        .play         = prewarm_sink_play,
+        .stop         = prewarm_sink_stop,
+        .prewarm      = prewarm_sink_prewarm,
+        .drop_prewarm = prewarm_sink_drop
+    };
+
+    NCore *core = n_core_new (NULL, NULL);
+    ck_assert (core != NULL);
+
+    n_core_register_sink (core, &decl);
+
+    GKeyFile *keyfile = g_key_file_new ();
+    g_key_file_set_value (keyfile, "ringtone", "sound.filename", "ring.wav");
+    g_key_file_set_value (keyfile, "ringtone", "core.prewarm", "call_state.mode = ringing, alarm.state=due");
+    g_key_file_set_value (keyfile, "sms", "sound.filename", "sms.wav");
+    n_event_list_parse_keyfile (core->eventlist, keyfile);
+    g_key_file_free (keyfile);
+
+    n_prewarm_load (core->prewarm);
+
+    /* unrelated value does not trigger */
+    set_call_state (core, "active");
+    ck_assert_int_eq (num_prewarmed, 0);
+
+    set_call_state (core, "ringing");
+    ck_assert_int_eq (num_prewarmed, 1);
+
+    /* repeated prediction keeps the same resources */
+    set_call_state (core, "ringing");
+    ck_assert_int_eq (num_prewarmed, 1);
+
+    NProplist *metrics = n_core_get_metrics (core);
+    ck_assert (n_proplist_get_uint (metrics, "core.prewarm.declared") == 1);
+    ck_assert (n_proplist_get_uint (metrics, "core.prewarm.active") == 1);
+    ck_assert (n_proplist_get_uint (metrics, "core.prewarm.triggers") == 1);
+    ck_assert (!n_proplist_has_key (metrics, "core.prewarm.hit_rate_percent"));
+    n_proplist_free (metrics);
+
+    /* other requests do not consume it */
+    NRequest *request = n_request_new_with_event ("sms");
+    n_prewarm_request_new (core->prewarm, request);
+    ck_assert_int_eq (num_dropped, 0);
+    n_request_free (request);
+
+    /* the predicted request arrives */
+    request = n_request_new_with_event ("ringtone");
+    n_prewarm_request_new (core->prewarm, request);
+    ck_assert_int_eq (num_dropped, 1);
+    n_request_free (request);
+
+    /* prediction goes away without a request */
+    set_call_state (core, "none");
+    set_call_state (core, "ringing");
+    ck_assert_int_eq (num_prewarmed, 2);
+    set_call_state (core, "active");
+    ck_assert_int_eq (num_dropped, 2);
+
+    metrics = n_core_get_metrics (core);
+    ck_assert (n_proplist_get_uint (metrics, "core.prewarm.active") == 0);
+    ck_assert (n_proplist_get_uint (metrics, "core.prewarm.triggers") == 2);
+    ck_assert (n_proplist_get_uint (metrics, "core.prewarm.hits") == 1);
+    ck_assert (n_proplist_get_uint (metrics, "core.prewarm.wasted") == 1);
+    ck_assert (n_proplist_get_uint (metrics, "core.prewarm.hit_rate_percent") == 50);
+    n_proplist_free (metrics);
+
+    /* active prewarm is dropped on shutdown */
+    set_call_state (core, "ringing");
+    ck_assert_int_eq (num_prewarmed, 3);
+    n_core_free (core);
+    ck_assert_int_eq (num_dropped, 3);
+}
+END_TEST
+
 int
 main (int argc, char *argv[])
 {
@@ -198,6 +399,18 @@ main (int argc, char *argv[])
     tc = tcase_create ("connect/disconnect callback to/from hook");
     tcase_add_test (tc, test_connect);
     suite_add_tcase (s, tc);
+
+    tc = tcase_create ("accepted input keys");
+    tcase_add_test (tc, test_input_keys);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("collect metrics");
+    tcase_add_test (tc, test_metrics);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("prewarm predicted events");
+    tcase_add_test (tc, test_prewarm);
+    suite_add_tcase (s, tc);
     
     sr = srunner_create (s);
     srunner_run_all (sr, CK_NORMAL);
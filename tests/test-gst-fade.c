@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <check.h>
+#include <glib.h>
+#include <gst/gst.h>
+#include <gst/controller/gstinterpolationcontrolsource.h>
+
+#include "src/plugins/gst/fade.h"
+
+#define EPSILON         (1e-9)
+#define WAIT_LENGTH     (0.2)
+#define WAIT_TIMEOUT_MS (2000)
+
+typedef struct _WaitRun
+{
+    GMainLoop *loop;
+    guint      calls;
+    gint64     fired_at;
+} WaitRun;
+
+static gdouble
+source_value (GstControlSource *source, gdouble time)
+{
+    gdouble value = -1.0;
+
+    ck_assert (gst_control_source_get_value (source, (GstClockTime) (time * GST_SECOND), &value));
+    return value;
+}
+
+START_TEST (test_timeline_value)
+{
+    FadeTimeline *timeline = fade_timeline_new ();
+
+    ck_assert (fade_timeline_is_empty (timeline));
+
+    /* fade in over 2 s, fade out from 10 s to 12 s */
+    fade_timeline_add (timeline, 0.0, 2.0, 0.0, 1.0);
+    fade_timeline_add (timeline, 10.0, 2.0, 1.0, 0.0);
+    ck_assert (!fade_timeline_is_empty (timeline));
+
+    ck_assert (fade_timeline_value (timeline, -1.0) == 0.0);
+    ck_assert (fabs (fade_timeline_value (timeline, 0.5) - 0.25) < EPSILON);
+    ck_assert (fade_timeline_value (timeline, 2.0) == 1.0);
+    ck_assert (fade_timeline_value (timeline, 6.0) == 1.0);
+    ck_assert (fabs (fade_timeline_value (timeline, 11.0) - 0.5) < EPSILON);
+    ck_assert (fade_timeline_value (timeline, 20.0) == 0.0);
+
+    fade_timeline_clear (timeline);
+    ck_assert (fade_timeline_is_empty (timeline));
+
+    fade_timeline_free (timeline);
+}
+END_TEST
+
+START_TEST (test_timeline_rounds)
+{
+    FadeTimeline *timeline = fade_timeline_new ();
+    GstControlSource *source = gst_interpolation_control_source_new ();
+
+    g_object_set (G_OBJECT (source), "mode", GST_INTERPOLATION_MODE_LINEAR, NULL);
+
+    /* 4 s fade in over rounds of 1.5 s */
+    fade_timeline_add (timeline, 0.0, 4.0, 0.0, 1.0);
+
+    fade_timeline_apply (timeline, GST_TIMED_VALUE_CONTROL_SOURCE (source), 0.0);
+    ck_assert (fabs (source_value (source, 1.0) - 0.25) < EPSILON);
+
+    /* second round continues where the first one ended */
+    fade_timeline_apply (timeline, GST_TIMED_VALUE_CONTROL_SOURCE (source), 1.5);
+    ck_assert (fabs (source_value (source, 0.0) - 0.375) < EPSILON);
+    ck_assert (fabs (source_value (source, 0.5) - 0.5) < EPSILON);
+    ck_assert (fabs (source_value (source, 2.5) - 1.0) < EPSILON);
+
+    /* fade done, end value is held */
+    fade_timeline_apply (timeline, GST_TIMED_VALUE_CONTROL_SOURCE (source), 6.0);
+    ck_assert (gst_timed_value_control_source_get_count (GST_TIMED_VALUE_CONTROL_SOURCE (source)) == 1);
+    ck_assert (source_value (source, 1.0) == 1.0);
+
+    gst_object_unref (source);
+    fade_timeline_free (timeline);
+}
+END_TEST
+
+static void
+wait_done_cb (gpointer userdata)
+{
+    WaitRun *run = userdata;
+
+    run->calls++;
+    run->fired_at = g_get_monotonic_time ();
+    g_main_loop_quit (run->loop);
+}
+
+static gboolean
+wait_timeout_cb (gpointer userdata)
+{
+    WaitRun *run = userdata;
+
+    g_main_loop_quit (run->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+run_wait (WaitRun *run, GstElement *element, gboolean cancel)
+{
+    FadeWait *wait;
+    gint64 started;
+    guint timeout_id;
+
+    run->loop = g_main_loop_new (NULL, FALSE);
+    timeout_id = g_timeout_add (WAIT_TIMEOUT_MS, wait_timeout_cb, run);
+
+    started = g_get_monotonic_time ();
+    wait = fade_wait_new (element, WAIT_LENGTH, wait_done_cb, run);
+    if (cancel)
+        fade_wait_cancel (wait);
+
+    g_main_loop_run (run->loop);
+
+    if (run->calls)
+        g_source_remove (timeout_id);
+    run->fired_at -= started;
+
+    g_main_loop_unref (run->loop);
+}
+
+START_TEST (test_wait_clock)
+{
+    GstElement *pipeline = gst_pipeline_new (NULL);
+    WaitRun run;
+
+    ck_assert (gst_element_set_state (pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE);
+    ck_assert (gst_element_get_state (pipeline, NULL, NULL, GST_SECOND) == GST_STATE_CHANGE_SUCCESS);
+
+    memset (&run, 0, sizeof (run));
+    run_wait (&run, pipeline, FALSE);
+    ck_assert_int_eq (run.calls, 1);
+    ck_assert (run.fired_at >= WAIT_LENGTH * G_USEC_PER_SEC);
+
+    printf ("fade of %.0f ms completed after %" G_GINT64_FORMAT " us\n",
+            WAIT_LENGTH * 1000, run.fired_at);
+
+    /* cancelled wait is never completed */
+    memset (&run, 0, sizeof (run));
+    run_wait (&run, pipeline, TRUE);
+    ck_assert_int_eq (run.calls, 0);
+
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+    gst_object_unref (pipeline);
+}
+END_TEST
+
+START_TEST (test_wait_no_clock)
+{
+    GstElement *pipeline = gst_pipeline_new (NULL);
+    WaitRun run;
+
+    /* without a clock the fade completes right away */
+    memset (&run, 0, sizeof (run));
+    run_wait (&run, pipeline, FALSE);
+    ck_assert_int_eq (run.calls, 1);
+    ck_assert (run.fired_at < WAIT_LENGTH * G_USEC_PER_SEC);
+
+    gst_object_unref (pipeline);
+}
+END_TEST
+
+int
+main ()
+{
+    Suite *s = NULL;
+    SRunner *sr = NULL;
+    TCase *tc = NULL;
+    int num_failed = 0;
+
+    gst_init (NULL, NULL);
+
+    s = suite_create ("\tGStreamer fade tests");
+
+    tc = tcase_create ("fade timeline");
+    tcase_add_test (tc, test_timeline_value);
+    tcase_add_test (tc, test_timeline_rounds);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("fade completion");
+    tcase_add_test (tc, test_wait_clock);
+    tcase_add_test (tc, test_wait_no_clock);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
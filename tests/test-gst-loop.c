@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#include "src/plugins/gst/loop.h"
+
+#define SOUND_RATE      8000
+#define SOUND_FRAMES    800     /* 100 ms of mono S16LE */
+#define LOOP_ROUNDS     5
+#define LOOP_TIMEOUT_S  10
+
+typedef struct _LoopRun
+{
+    GMainLoop    *loop;
+    GstElement   *pipeline;
+    gboolean      segment;      /* loop with segment seeks, else rewind on eos */
+    guint         rounds;
+    gboolean      timed_out;
+
+    GstSegment    sink_segment;
+    GstClockTime  last_end;     /* running time where previous buffer ended */
+    GstClockTime  max_gap;      /* largest running time gap between buffers */
+
+    gint64        last_render;
+    GstClockTime  last_duration;
+    gint64        max_delay;    /* largest render delay over buffer length (us) */
+} LoopRun;
+
+static gchar*
+write_sound ()
+{
+    gchar *path = NULL;
+    guint8 header[44];
+    gint16 samples[SOUND_FRAMES];
+    guint32 data_size = sizeof (samples);
+    int fd, i;
+
+    fd = g_file_open_tmp ("ngfd-loop-XXXXXX.wav", &path, NULL);
+    ck_assert (fd >= 0);
+
+    memcpy (header, "RIFF", 4);
+    GST_WRITE_UINT32_LE (header + 4, 36 + data_size);
+    memcpy (header + 8, "WAVEfmt ", 8);
+    GST_WRITE_UINT32_LE (header + 16, 16);
+    GST_WRITE_UINT16_LE (header + 20, 1);               /* PCM */
+    GST_WRITE_UINT16_LE (header + 22, 1);               /* channels */
+    GST_WRITE_UINT32_LE (header + 24, SOUND_RATE);
+    GST_WRITE_UINT32_LE (header + 28, SOUND_RATE * 2);  /* byte rate */
+    GST_WRITE_UINT16_LE (header + 32, 2);               /* block align */
+    GST_WRITE_UINT16_LE (header + 34, 16);
+    memcpy (header + 36, "data", 4);
+    GST_WRITE_UINT32_LE (header + 40, data_size);
+
+    /* square wave, the content does not matter */
+    for (i = 0; i < SOUND_FRAMES; i++)
+        samples[i] = (i / 10) % 2 ? 8000 : -8000;
+
+    ck_assert (write (fd, header, sizeof (header)) == (ssize_t) sizeof (header));
+    ck_assert (write (fd, samples, sizeof (samples)) == (ssize_t) sizeof (samples));
+    close (fd);
+
+    return path;
+}
+
+static GstPadProbeReturn
+sink_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer userdata)
+{
+    LoopRun *run = userdata;
+    GstBuffer *buffer;
+    GstEvent *event;
+    GstClockTime start, gap;
+
+    (void) pad;
+
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        event = GST_PAD_PROBE_INFO_EVENT (info);
+        if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+            gst_event_copy_segment (event, &run->sink_segment);
+        else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+            run->last_end = GST_CLOCK_TIME_NONE;    /* running time restarts */
+        return GST_PAD_PROBE_OK;
+    }
+
+    buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    start = gst_segment_to_running_time (&run->sink_segment, GST_FORMAT_TIME,
+                                         GST_BUFFER_PTS (buffer));
+
+    if (GST_CLOCK_TIME_IS_VALID (run->last_end)) {
+        gap = start > run->last_end ? start - run->last_end : run->last_end - start;
+        if (gap > run->max_gap)
+            run->max_gap = gap;
+    }
+
+    run->last_end = start + GST_BUFFER_DURATION (buffer);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+handoff_cb (GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer userdata)
+{
+    LoopRun *run = userdata;
+    gint64 now = g_get_monotonic_time ();
+    gint64 delay;
+
+    (void) sink;
+    (void) pad;
+
+    /* buffers are rendered in sync with the clock, anything on top of the
+       length of the previous buffer is silence heard by the user. */
+    if (run->last_render) {
+        delay = now - run->last_render - (gint64) (run->last_duration / GST_USECOND);
+        if (delay > run->max_delay)
+            run->max_delay = delay;
+    }
+
+    run->last_render = now;
+    run->last_duration = GST_BUFFER_DURATION (buffer);
+}
+
+static gboolean
+bus_cb (GstBus *bus, GstMessage *msg, gpointer userdata)
+{
+    LoopRun *run = userdata;
+    GError *error = NULL;
+
+    (void) bus;
+
+    switch (GST_MESSAGE_TYPE (msg)) {
+        case GST_MESSAGE_ERROR:
+            gst_message_parse_error (msg, &error, NULL);
+            ck_abort_msg ("pipeline error: %s", error->message);
+            break;
+
+        case GST_MESSAGE_SEGMENT_DONE:
+            if (++run->rounds == LOOP_ROUNDS)
+                g_main_loop_quit (run->loop);
+            else
+                ck_assert (loop_continue (run->pipeline));
+            break;
+
+        case GST_MESSAGE_EOS:
+            ck_assert (!run->segment);
+            /* previous implementation of repeating sounds */
+            if (++run->rounds == LOOP_ROUNDS)
+                g_main_loop_quit (run->loop);
+            else
+                ck_assert (gst_element_seek_simple (run->pipeline, GST_FORMAT_TIME,
+                                                    GST_SEEK_FLAG_FLUSH, 0));
+            break;
+
+        default:
+            break;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+timeout_cb (gpointer userdata)
+{
+    LoopRun *run = userdata;
+
+    run->timed_out = TRUE;
+    g_main_loop_quit (run->loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+run_loop (LoopRun *run, const char *path)
+{
+    GstElement *source, *decoder, *sink;
+    GstBus *bus;
+    GstPad *pad;
+    guint bus_watch_id, timeout_id;
+    gchar *description;
+
+    /* fakesink is the null audio sink, synced to the clock like pulsesink. */
+    description = g_strdup_printf ("filesrc name=source location=\"%s\" ! decodebin name=decoder ! "
+                                   "audioconvert ! fakesink name=sink sync=true signal-handoffs=true",
+                                   path);
+    run->pipeline = gst_parse_launch (description, NULL);
+    g_free (description);
+    ck_assert (run->pipeline != NULL);
+
+    run->loop = g_main_loop_new (NULL, FALSE);
+    run->last_end = GST_CLOCK_TIME_NONE;
+    gst_segment_init (&run->sink_segment, GST_FORMAT_TIME);
+
+    source = gst_bin_get_by_name (GST_BIN (run->pipeline), "source");
+    decoder = gst_bin_get_by_name (GST_BIN (run->pipeline), "decoder");
+    sink = gst_bin_get_by_name (GST_BIN (run->pipeline), "sink");
+    ck_assert (source && decoder && sink);
+
+    g_signal_connect (sink, "handoff", G_CALLBACK (handoff_cb), run);
+    pad = gst_element_get_static_pad (sink, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                       sink_probe_cb, run, NULL);
+    gst_object_unref (pad);
+
+    bus = gst_element_get_bus (run->pipeline);
+    bus_watch_id = gst_bus_add_watch (bus, bus_cb, run);
+    gst_object_unref (bus);
+
+    /* same order as in the plugin: preroll, then segment seek, then play */
+    gst_element_set_state (run->pipeline, GST_STATE_PAUSED);
+    ck_assert (gst_element_get_state (run->pipeline, NULL, NULL, GST_CLOCK_TIME_NONE) ==
+               GST_STATE_CHANGE_SUCCESS);
+
+    if (run->segment) {
+        ck_assert (loop_start (run->pipeline));
+        ck_assert (gst_element_get_state (run->pipeline, NULL, NULL, GST_CLOCK_TIME_NONE) ==
+                   GST_STATE_CHANGE_SUCCESS);
+    }
+
+    timeout_id = g_timeout_add_seconds (LOOP_TIMEOUT_S, timeout_cb, run);
+    gst_element_set_state (run->pipeline, GST_STATE_PLAYING);
+    g_main_loop_run (run->loop);
+
+    if (!run->timed_out)
+        g_source_remove (timeout_id);
+    g_source_remove (bus_watch_id);
+
+    gst_element_set_state (run->pipeline, GST_STATE_NULL);
+    gst_object_unref (sink);
+    gst_object_unref (decoder);
+    gst_object_unref (source);
+    gst_object_unref (run->pipeline);
+    g_main_loop_unref (run->loop);
+}
+
+START_TEST (test_segment_loop_gap)
+{
+    LoopRun segment_run, rewind_run;
+    gchar *path = write_sound ();
+
+    memset (&segment_run, 0, sizeof (segment_run));
+    segment_run.segment = TRUE;
+    run_loop (&segment_run, path);
+
+    ck_assert (!segment_run.timed_out);
+    ck_assert_int_eq (segment_run.rounds, LOOP_ROUNDS);
+
+    /* every round continues exactly where the previous ended, allow
+       rounding of a single frame. */
+    ck_assert_msg (segment_run.max_gap <= GST_SECOND / SOUND_RATE,
+                   "gap of %" GST_TIME_FORMAT " between rounds",
+                   GST_TIME_ARGS (segment_run.max_gap));
+
+    memset (&rewind_run, 0, sizeof (rewind_run));
+    rewind_run.segment = FALSE;
+    run_loop (&rewind_run, path);
+
+    ck_assert (!rewind_run.timed_out);
+    ck_assert_int_eq (rewind_run.rounds, LOOP_ROUNDS);
+
+    printf ("loop boundary delay over %d rounds: segment seek %" G_GINT64_FORMAT " us, "
+            "flushing seek %" G_GINT64_FORMAT " us\n",
+            LOOP_ROUNDS, segment_run.max_delay, rewind_run.max_delay);
+
+    g_unlink (path);
+    g_free (path);
+}
+END_TEST
+
+int
+main ()
+{
+    Suite *s = NULL;
+    SRunner *sr = NULL;
+    TCase *tc = NULL;
+    int num_failed = 0;
+
+    gst_init (NULL, NULL);
+
+    s = suite_create ("\tGStreamer loop tests");
+
+    tc = tcase_create ("gapless looping");
+    tcase_set_timeout (tc, 2 * LOOP_TIMEOUT_S + 5);
+    tcase_add_test (tc, test_segment_loop_gap);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#include "src/plugins/gst/sound-info.h"
+
+#define SOUND_RATE      8000
+#define SOUND_FRAMES    4000    /* 500 ms of mono S16LE */
+#define WAIT_TIMEOUT_S  10
+
+static void
+write_sound (const char *path, guint frames)
+{
+    guint8 header[44];
+    guint32 data_size = frames * 2;
+    gint16 *samples;
+    FILE *fp;
+
+    memcpy (header, "RIFF", 4);
+    GST_WRITE_UINT32_LE (header + 4, 36 + data_size);
+    memcpy (header + 8, "WAVEfmt ", 8);
+    GST_WRITE_UINT32_LE (header + 16, 16);
+    GST_WRITE_UINT16_LE (header + 20, 1);               /* PCM */
+    GST_WRITE_UINT16_LE (header + 22, 1);               /* channels */
+    GST_WRITE_UINT32_LE (header + 24, SOUND_RATE);
+    GST_WRITE_UINT32_LE (header + 28, SOUND_RATE * 2);  /* byte rate */
+    GST_WRITE_UINT16_LE (header + 32, 2);               /* block align */
+    GST_WRITE_UINT16_LE (header + 34, 16);
+    memcpy (header + 36, "data", 4);
+    GST_WRITE_UINT32_LE (header + 40, data_size);
+
+    samples = g_malloc0 (data_size);
+
+    fp = fopen (path, "wb");
+    ck_assert (fp != NULL);
+    ck_assert (fwrite (header, sizeof (header), 1, fp) == 1);
+    ck_assert (fwrite (samples, data_size, 1, fp) == 1);
+    fclose (fp);
+
+    g_free (samples);
+}
+
+static gboolean
+wait_cb (gpointer userdata)
+{
+    GMainLoop *loop = userdata;
+    guint entries, invalid, pending;
+
+    sound_info_get_stats (&entries, &invalid, &pending);
+    if (pending == 0)
+        g_main_loop_quit (loop);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+wait_timeout_cb (gpointer userdata)
+{
+    ck_abort_msg ("discovery did not finish");
+    g_main_loop_quit (userdata);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* run the main loop until all discoveries are done */
+static void
+wait_discovered ()
+{
+    GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+    guint poll_id, timeout_id;
+
+    poll_id = g_timeout_add (10, wait_cb, loop);
+    timeout_id = g_timeout_add_seconds (WAIT_TIMEOUT_S, wait_timeout_cb, loop);
+    g_main_loop_run (loop);
+    g_source_remove (poll_id);
+    g_source_remove (timeout_id);
+    g_main_loop_unref (loop);
+}
+
+static const char *saved_path;
+
+static gboolean
+saved_cb (gpointer userdata)
+{
+    if (g_file_test (saved_path, G_FILE_TEST_EXISTS))
+        g_main_loop_quit (userdata);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+saved_timeout_cb (gpointer userdata)
+{
+    ck_abort_msg ("sound info was not saved");
+    g_main_loop_quit (userdata);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* run the main loop until the file is written in the background */
+static void
+wait_saved (const char *path)
+{
+    GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+    guint poll_id, timeout_id;
+
+    saved_path = path;
+    poll_id = g_timeout_add (10, saved_cb, loop);
+    timeout_id = g_timeout_add_seconds (WAIT_TIMEOUT_S, saved_timeout_cb, loop);
+    g_main_loop_run (loop);
+    g_source_remove (poll_id);
+    g_source_remove (timeout_id);
+    g_main_loop_unref (loop);
+}
+
+/* what the sink does after statting the file in its worker */
+static SoundInfoState
+update (const char *filename, GstClockTime *duration)
+{
+    SoundFileStat st;
+
+    sound_info_stat (filename, &st);
+    return sound_info_update (filename, &st, duration);
+}
+
+START_TEST (test_sound_info)
+{
+    gchar *dir, *sound, *broken, *missing, *cache;
+    GstClockTime duration;
+    guint entries, invalid, pending;
+
+    dir = g_dir_make_tmp ("ngfd-info-XXXXXX", NULL);
+    ck_assert (dir != NULL);
+
+    sound = g_build_filename (dir, "sound.wav", NULL);
+    broken = g_build_filename (dir, "broken.wav", NULL);
+    missing = g_build_filename (dir, "missing.wav", NULL);
+    cache = g_build_filename (dir, "cache", "sound-info", NULL);
+
+    write_sound (sound, SOUND_FRAMES);
+    ck_assert (g_file_set_contents (broken, "not a sound", -1, NULL));
+
+    sound_info_init (cache);
+
+    /* missing files are known invalid without discovery */
+    ck_assert_int_eq (update (missing, &duration), SOUND_INFO_INVALID);
+    ck_assert (!GST_CLOCK_TIME_IS_VALID (duration));
+
+    /* lookup alone does not look at the file or discover it */
+    ck_assert_int_eq (sound_info_lookup (sound, &duration), SOUND_INFO_UNKNOWN);
+    sound_info_get_stats (&entries, &invalid, &pending);
+    ck_assert_int_eq (pending, 0);
+
+    ck_assert_int_eq (update (sound, &duration), SOUND_INFO_UNKNOWN);
+    ck_assert_int_eq (update (broken, &duration), SOUND_INFO_UNKNOWN);
+    wait_discovered ();
+
+    ck_assert_int_eq (sound_info_lookup (sound, &duration), SOUND_INFO_VALID);
+    ck_assert (duration == 500 * GST_MSECOND);
+    ck_assert_int_eq (sound_info_lookup (broken, &duration), SOUND_INFO_INVALID);
+
+    sound_info_get_stats (&entries, &invalid, &pending);
+    ck_assert_int_eq (entries, 2);
+    ck_assert_int_eq (invalid, 1);
+    ck_assert_int_eq (pending, 0);
+
+    /* discoveries are saved a while later, off the main loop */
+    wait_saved (cache);
+
+    sound_info_shutdown ();
+    ck_assert (g_file_test (cache, G_FILE_TEST_EXISTS));
+
+    /* known after restart without discovering again */
+    sound_info_init (cache);
+    ck_assert_int_eq (sound_info_lookup (sound, &duration), SOUND_INFO_VALID);
+    ck_assert (duration == 500 * GST_MSECOND);
+    ck_assert_int_eq (sound_info_lookup (broken, &duration), SOUND_INFO_INVALID);
+
+    sound_info_get_stats (&entries, &invalid, &pending);
+    ck_assert_int_eq (pending, 0);
+
+    /* changed file is discovered again */
+    write_sound (sound, SOUND_FRAMES / 2);
+    ck_assert_int_eq (update (sound, &duration), SOUND_INFO_UNKNOWN);
+    ck_assert_int_eq (sound_info_lookup (sound, &duration), SOUND_INFO_UNKNOWN);
+    wait_discovered ();
+    ck_assert_int_eq (sound_info_lookup (sound, &duration), SOUND_INFO_VALID);
+    ck_assert (duration == 250 * GST_MSECOND);
+
+    sound_info_shutdown ();
+
+    g_unlink (cache);
+    g_unlink (sound);
+    g_unlink (broken);
+    g_free (missing);
+    missing = g_path_get_dirname (cache);
+    g_rmdir (missing);
+    g_rmdir (dir);
+    g_free (cache);
+    g_free (missing);
+    g_free (broken);
+    g_free (sound);
+    g_free (dir);
+}
+END_TEST
+
+int
+main ()
+{
+    Suite *s = NULL;
+    SRunner *sr = NULL;
+    TCase *tc = NULL;
+    int num_failed = 0;
+
+    gst_init (NULL, NULL);
+
+    s = suite_create ("\tGStreamer sound info tests");
+
+    tc = tcase_create ("sound info");
+    tcase_set_timeout (tc, 3 * WAIT_TIMEOUT_S);
+    tcase_add_test (tc, test_sound_info);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include <glib.h>
+#include <gst/gst.h>
+#include <ngf/proplist.h>
+
+#include "src/plugins/gst/stream-spec.h"
+
+#define CUSTOM_SOUND    "/home/user/ringtone.ogg"
+#define SYSTEM_SOUND    "/usr/share/sounds/ringtone.ogg"
+
+static int event_a;
+static int event_b;
+
+static NProplist*
+create_props (const char *filename)
+{
+    NProplist *props = n_proplist_new ();
+
+    n_proplist_set_string (props, "sound.filename", filename);
+    n_proplist_set_string (props, "sound.stream.event.id", "ringtone");
+    n_proplist_set_bool (props, "sound.repeat", TRUE);
+
+    return props;
+}
+
+START_TEST (test_shared)
+{
+    NProplist *props = NULL;
+    StreamSpec *first = NULL;
+    StreamSpec *second = NULL;
+    guint hits, misses, entries;
+
+    stream_spec_init ();
+
+    props = create_props (CUSTOM_SOUND);
+    first = stream_spec_get (&event_a, props);
+    ck_assert (first != NULL);
+
+    ck_assert_str_eq (gst_structure_get_string (first->properties, "media.filename"), CUSTOM_SOUND);
+    ck_assert_str_eq (gst_structure_get_string (first->properties, "media.role"), "media");
+    ck_assert_str_eq (gst_structure_get_string (first->properties, "event.id"), "ringtone");
+
+    /* keys not used by the spec do not matter */
+    n_proplist_set_int (props, "sound.delay-stop", 100);
+    second = stream_spec_get (&event_a, props);
+    ck_assert (second == first);
+
+    stream_spec_get_stats (&hits, &misses, &entries);
+    ck_assert_int_eq (hits, 1);
+    ck_assert_int_eq (misses, 1);
+    ck_assert_int_eq (entries, 1);
+
+    /* other event has a spec of its own */
+    second = stream_spec_get (&event_b, props);
+    ck_assert (second != first);
+    stream_spec_unref (second);
+
+    stream_spec_unref (first);
+    stream_spec_unref (first);
+    n_proplist_free (props);
+
+    stream_spec_shutdown ();
+}
+END_TEST
+
+START_TEST (test_variants)
+{
+    NProplist *props = NULL;
+    StreamSpec *first = NULL;
+    StreamSpec *second = NULL;
+    StreamSpec *third = NULL;
+    guint hits, misses, entries;
+
+    stream_spec_init ();
+
+    props = create_props (CUSTOM_SOUND);
+    first = stream_spec_get (&event_a, props);
+
+    /* changed and added stream properties need a new spec */
+    n_proplist_set_string (props, "sound.stream.event.id", "alarm");
+    second = stream_spec_get (&event_a, props);
+    ck_assert (second != first);
+    ck_assert_str_eq (gst_structure_get_string (second->properties, "event.id"), "alarm");
+
+    n_proplist_set_string (props, "sound.stream.media.role", "alarm");
+    third = stream_spec_get (&event_a, props);
+    ck_assert (third != second);
+    ck_assert_str_eq (gst_structure_get_string (third->properties, "media.role"), "alarm");
+    stream_spec_unref (third);
+
+    /* previous variants are still cached */
+    n_proplist_unset (props, "sound.stream.media.role");
+    third = stream_spec_get (&event_a, props);
+    ck_assert (third == second);
+    stream_spec_unref (third);
+
+    stream_spec_get_stats (&hits, &misses, &entries);
+    ck_assert_int_eq (entries, 3);
+
+    /* spec stays valid after the cache is gone */
+    stream_spec_shutdown ();
+    ck_assert_str_eq (gst_structure_get_string (first->properties, "event.id"), "ringtone");
+
+    stream_spec_unref (first);
+    stream_spec_unref (second);
+    n_proplist_free (props);
+}
+END_TEST
+
+START_TEST (test_volume)
+{
+    NProplist *props = NULL;
+    StreamSpec *spec = NULL;
+
+    stream_spec_init ();
+
+    props = create_props (CUSTOM_SOUND);
+    n_proplist_set_string (props, "sound.volume", "max:60");
+    spec = stream_spec_get (&event_a, props);
+    ck_assert (spec->volume_limit);
+    ck_assert_int_eq (spec->volume_min, 0);
+    ck_assert_int_eq (spec->volume_max, 60);
+    ck_assert (!spec->volume_fixed);
+    stream_spec_unref (spec);
+
+    n_proplist_set_string (props, "sound.volume", "fixed:40");
+    spec = stream_spec_get (&event_a, props);
+    ck_assert (!spec->volume_limit);
+    ck_assert (spec->volume_fixed);
+    ck_assert_int_eq (spec->volume_set, 40);
+    stream_spec_unref (spec);
+
+    n_proplist_free (props);
+    stream_spec_shutdown ();
+}
+END_TEST
+
+START_TEST (test_fades)
+{
+    NProplist *props = NULL;
+    StreamSpec *spec = NULL;
+
+    stream_spec_init ();
+
+    props = create_props (CUSTOM_SOUND);
+    n_proplist_set_string (props, "sound.fade-in", "0,2,0,1000");
+    n_proplist_set_string (props, "sound.fade-out", "10,x,1000,0");
+    n_proplist_set_bool (props, "sound.fade-only-custom", TRUE);
+
+    spec = stream_spec_get (&event_a, props);
+    ck_assert (spec->fade_enabled);
+    ck_assert (spec->fade_in != NULL);
+    ck_assert (spec->fade_in->length == 2.0);
+    ck_assert (spec->fade_in->end == 1.0);
+    ck_assert (spec->fade_out == NULL);
+    stream_spec_unref (spec);
+    n_proplist_free (props);
+
+    /* system sounds are not faded with fade-only-custom */
+    props = create_props (SYSTEM_SOUND);
+    n_proplist_set_string (props, "sound.fade-in", "0,2,0,1000");
+    n_proplist_set_bool (props, "sound.fade-only-custom", TRUE);
+
+    spec = stream_spec_get (&event_a, props);
+    ck_assert (!spec->fade_enabled);
+    ck_assert (spec->fade_in == NULL);
+    stream_spec_unref (spec);
+    n_proplist_free (props);
+
+    stream_spec_shutdown ();
+}
+END_TEST
+
+int
+main ()
+{
+    Suite *s = NULL;
+    SRunner *sr = NULL;
+    TCase *tc = NULL;
+    int num_failed = 0;
+
+    gst_init (NULL, NULL);
+
+    s = suite_create ("\tGStreamer stream spec tests");
+
+    tc = tcase_create ("stream spec cache");
+    tcase_add_test (tc, test_shared);
+    tcase_add_test (tc, test_variants);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("stream spec parsing");
+    tcase_add_test (tc, test_volume);
+    tcase_add_test (tc, test_fades);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include <glib.h>
+
+#include "src/plugins/gst/worker.h"
+
+#define STALL_JOBS      10
+#define STALL_JOB_MS    20      /* blocking state change or file open */
+#define HEARTBEAT_MS    2
+
+typedef struct _Counter
+{
+    GThread *main_thread;
+    GMainLoop *loop;
+    guint run[STALL_JOBS];
+    guint done[STALL_JOBS];
+    guint num_run;
+    guint num_done;
+    gboolean done_in_main;
+} Counter;
+
+typedef struct _Slot
+{
+    Counter *counter;
+    guint index;
+} Slot;
+
+static void
+order_run (gpointer data)
+{
+    Slot *slot = data;
+
+    /* only the worker touches run and num_run until done is called */
+    slot->counter->run[slot->counter->num_run++] = slot->index;
+}
+
+static void
+order_done (gpointer data)
+{
+    Slot *slot = data;
+    Counter *counter = slot->counter;
+
+    if (g_thread_self () != counter->main_thread)
+        counter->done_in_main = FALSE;
+
+    counter->done[counter->num_done++] = slot->index;
+    if (counter->num_done == STALL_JOBS && counter->loop)
+        g_main_loop_quit (counter->loop);
+
+    g_free (slot);
+}
+
+static void
+push_ordered (Counter *counter)
+{
+    Slot *slot;
+    guint i;
+
+    for (i = 0; i < STALL_JOBS; i++) {
+        slot = g_new0 (Slot, 1);
+        slot->counter = counter;
+        slot->index = i;
+        worker_push (order_run, order_done, slot);
+    }
+}
+
+START_TEST (test_order)
+{
+    Counter counter;
+    guint i;
+
+    memset (&counter, 0, sizeof (counter));
+    counter.main_thread = g_thread_self ();
+    counter.loop = g_main_loop_new (NULL, FALSE);
+    counter.done_in_main = TRUE;
+
+    worker_init ();
+    push_ordered (&counter);
+    g_main_loop_run (counter.loop);
+    worker_shutdown ();
+
+    ck_assert_int_eq (counter.num_run, STALL_JOBS);
+    ck_assert_int_eq (counter.num_done, STALL_JOBS);
+    ck_assert (counter.done_in_main);
+
+    for (i = 0; i < STALL_JOBS; i++) {
+        ck_assert_int_eq (counter.run[i], i);
+        ck_assert_int_eq (counter.done[i], i);
+    }
+
+    g_main_loop_unref (counter.loop);
+}
+END_TEST
+
+START_TEST (test_shutdown)
+{
+    Counter counter;
+
+    memset (&counter, 0, sizeof (counter));
+    counter.main_thread = g_thread_self ();
+    counter.done_in_main = TRUE;
+
+    /* queued jobs are completed without running the main loop */
+    worker_init ();
+    push_ordered (&counter);
+    worker_shutdown ();
+
+    ck_assert_int_eq (counter.num_run, STALL_JOBS);
+    ck_assert_int_eq (counter.num_done, STALL_JOBS);
+    ck_assert (counter.done_in_main);
+}
+END_TEST
+
+typedef struct _Stall
+{
+    GMainLoop *loop;
+    gboolean use_worker;
+    gint64 last_beat;
+    gint64 max_stall;   /* longest time the main loop did not run (us) */
+    guint num_done;
+} Stall;
+
+static void
+stall_run (gpointer data)
+{
+    (void) data;
+
+    g_usleep (STALL_JOB_MS * 1000);
+}
+
+static void
+stall_done (gpointer data)
+{
+    Stall *stall = data;
+
+    if (++stall->num_done == STALL_JOBS)
+        g_main_loop_quit (stall->loop);
+}
+
+static gboolean
+heartbeat_cb (gpointer userdata)
+{
+    Stall *stall = userdata;
+    gint64 now = g_get_monotonic_time ();
+
+    if (stall->last_beat && now - stall->last_beat > stall->max_stall)
+        stall->max_stall = now - stall->last_beat;
+    stall->last_beat = now;
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+start_jobs_cb (gpointer userdata)
+{
+    Stall *stall = userdata;
+    guint i;
+
+    for (i = 0; i < STALL_JOBS; i++) {
+        if (stall->use_worker) {
+            worker_push (stall_run, stall_done, stall);
+        } else {
+            /* previous behaviour, pipelines set up in the main loop */
+            stall_run (stall);
+            stall_done (stall);
+        }
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+run_stall (Stall *stall)
+{
+    guint heartbeat_id;
+
+    stall->loop = g_main_loop_new (NULL, FALSE);
+
+    worker_init ();
+    heartbeat_id = g_timeout_add (HEARTBEAT_MS, heartbeat_cb, stall);
+    g_timeout_add (10 * HEARTBEAT_MS, start_jobs_cb, stall);
+    g_main_loop_run (stall->loop);
+    g_source_remove (heartbeat_id);
+    worker_shutdown ();
+
+    g_main_loop_unref (stall->loop);
+}
+
+START_TEST (test_stall_benchmark)
+{
+    Stall inline_stall, worker_stall;
+
+    memset (&inline_stall, 0, sizeof (inline_stall));
+    memset (&worker_stall, 0, sizeof (worker_stall));
+
+    inline_stall.use_worker = FALSE;
+    run_stall (&inline_stall);
+
+    worker_stall.use_worker = TRUE;
+    run_stall (&worker_stall);
+
+    ck_assert_int_eq (inline_stall.num_done, STALL_JOBS);
+    ck_assert_int_eq (worker_stall.num_done, STALL_JOBS);
+
+    printf ("main loop stall with %d blocking jobs of %d ms: inline %" G_GINT64_FORMAT " us, "
+            "worker %" G_GINT64_FORMAT " us\n",
+            STALL_JOBS, STALL_JOB_MS, inline_stall.max_stall, worker_stall.max_stall);
+
+    ck_assert (inline_stall.max_stall >= STALL_JOBS * STALL_JOB_MS * 1000);
+    /* done callbacks are short, leave room for a loaded machine */
+    ck_assert (worker_stall.max_stall < STALL_JOBS * STALL_JOB_MS * 1000 / 4);
+}
+END_TEST
+
+int
+main ()
+{
+    Suite *s = NULL;
+    SRunner *sr = NULL;
+    TCase *tc = NULL;
+    int num_failed = 0;
+
+    s = suite_create ("\tGStreamer worker tests");
+
+    tc = tcase_create ("job order");
+    tcase_add_test (tc, test_order);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("shutdown");
+    tcase_add_test (tc, test_shutdown);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("main loop stall benchmark");
+    tcase_add_test (tc, test_stall_benchmark);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,826 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <check.h>
+#include <glib.h>
+
+#include "src/plugins/tonegen/ausrv.h"
+#include "src/plugins/tonegen/stream.h"
+#include "src/plugins/tonegen/tone.h"
+#include "src/plugins/tonegen/indicator.h"
+#include "src/plugins/tonegen/dtmf.h"
+#include "src/plugins/tonegen/offline.h"
+#include "src/plugins/tonegen/metrics.h"
+#include "src/plugins/tonegen/pattern.h"
+
+#define RATE            (48000)
+#define MS(ms)          ((ms) * RATE / 1000)
+#define FFT_SIZE        (8192)
+#define SETTLE          MS (20)     /* past the ramp-up */
+#define FREQ_TOLERANCE  (0.01)
+#define PEAK_BINS       (6)         /* window main lobe and leakage */
+#define MIN_PURITY      (0.999)
+#define ON_LEVEL        (1000)
+#define CADENCE_MS      (2)
+#define RAMP_UP_MS      (10)
+#define MIN_GAP_MS      (10)
+
+typedef struct _ToneSpec
+{
+    indicator_standard standard;
+    int                type;
+    int                freq[2];
+} ToneSpec;
+
+typedef struct _CadenceSpec
+{
+    indicator_standard standard;
+    int                type;
+    int                on_ms;
+    int                period_ms;
+} CadenceSpec;
+
+static const int dtmf_freq[DTMF_MAX][2] = {
+    { 941, 1336 }, { 697, 1209 }, { 697, 1336 }, { 697, 1477 },
+    { 770, 1209 }, { 770, 1336 }, { 770, 1477 }, { 852, 1209 },
+    { 852, 1336 }, { 852, 1477 }, { 941, 1209 }, { 941, 1477 },
+    { 697, 1633 }, { 770, 1633 }, { 852, 1633 }, { 941, 1633 }
+};
+
+static const ToneSpec indicator_tones[] = {
+    { STD_CEPT,  TONE_DIAL,      { 425, 0 } },
+    { STD_CEPT,  TONE_BUSY,      { 425, 0 } },
+    { STD_CEPT,  TONE_CONGEST,   { 425, 0 } },
+    { STD_CEPT,  TONE_ERROR,     { 900, 0 } },
+    { STD_CEPT,  TONE_WAIT,      { 425, 0 } },
+    { STD_CEPT,  TONE_RING,      { 425, 0 } },
+    { STD_ANSI,  TONE_DIAL,      { 350, 440 } },
+    { STD_ANSI,  TONE_BUSY,      { 480, 620 } },
+    { STD_ANSI,  TONE_CONGEST,   { 480, 620 } },
+    { STD_ANSI,  TONE_WAIT,      { 440, 0 } },
+    { STD_ANSI,  TONE_RING,      { 440, 480 } },
+    { STD_JAPAN, TONE_DIAL,      { 400, 0 } },
+    { STD_JAPAN, TONE_BUSY,      { 400, 0 } },
+    { STD_JAPAN, TONE_RADIO_ACK, { 400, 0 } },
+    { STD_ATNT,  TONE_DIAL,      { 350, 440 } },
+    { STD_ATNT,  TONE_BUSY,      { 480, 620 } },
+    { STD_ATNT,  TONE_RING,      { 440, 480 } }
+};
+
+static const CadenceSpec indicator_cadences[] = {
+    { STD_CEPT,  TONE_BUSY,      500, 1000 },
+    { STD_CEPT,  TONE_CONGEST,   200,  400 },
+    { STD_CEPT,  TONE_RING,     1000, 5000 },
+    { STD_ANSI,  TONE_BUSY,      500, 1000 },
+    { STD_ANSI,  TONE_CONGEST,   250,  500 },
+    { STD_ANSI,  TONE_RING,     2000, 6000 },
+    { STD_JAPAN, TONE_BUSY,      500, 1000 },
+    { STD_JAPAN, TONE_RADIO_ACK,1000, 3000 }
+};
+
+static struct ausrv *ausrv = NULL;
+
+int
+dbusif_send_signal (struct tonegend *tonegend, const char *intf, const char *name, int type, ...)
+{
+    (void) tonegend;
+    (void) intf;
+    (void) name;
+    (void) type;
+    return 0;
+}
+
+static void
+setup (void)
+{
+    stream_set_default_samplerate (RATE);
+    stream_use_sink_rate (FALSE);
+    tone_init ();
+    tone_set_oscillator (OSCILLATOR_RECURRENCE);
+    indicator_init ();
+    indicator_set_standard (STD_CEPT);
+    ausrv = offline_create ();
+    ck_assert (ausrv != NULL);
+}
+
+static void
+teardown (void)
+{
+    offline_destroy (ausrv);
+    ausrv = NULL;
+    indicator_exit ();
+    metrics_reset ();
+}
+
+static int16_t*
+render (const char *name, int length)
+{
+    int16_t *samples = g_new0 (int16_t, length);
+
+    ck_assert_int_eq (offline_render (ausrv, name, samples, length), length);
+    return samples;
+}
+
+static void
+fft (double *re, double *im, int n)
+{
+    double wr, wi, tr, ti, ur, ui, angle;
+    int i, j, k, len;
+
+    for (i = 1, j = 0; i < n; i++) {
+        for (k = n >> 1; j & k; k >>= 1)
+            j ^= k;
+        j |= k;
+
+        if (i < j) {
+            tr = re[i]; re[i] = re[j]; re[j] = tr;
+            ti = im[i]; im[i] = im[j]; im[j] = ti;
+        }
+    }
+
+    for (len = 2; len <= n; len <<= 1) {
+        angle = -2.0 * M_PI / len;
+
+        for (i = 0; i < n; i += len) {
+            for (k = 0; k < len / 2; k++) {
+                wr = cos (angle * k);
+                wi = sin (angle * k);
+                ur = re[i + k];
+                ui = im[i + k];
+                tr = re[i + k + len / 2] * wr - im[i + k + len / 2] * wi;
+                ti = re[i + k + len / 2] * wi + im[i + k + len / 2] * wr;
+                re[i + k] = ur + tr;
+                im[i + k] = ui + ti;
+                re[i + k + len / 2] = ur - tr;
+                im[i + k + len / 2] = ui - ti;
+            }
+        }
+    }
+}
+
+/* power spectrum of FFT_SIZE samples, Hann windowed */
+static double*
+spectrum (const int16_t *samples)
+{
+    double *re = g_new0 (double, FFT_SIZE);
+    double *im = g_new0 (double, FFT_SIZE);
+    double *power = g_new0 (double, FFT_SIZE / 2);
+    int i;
+
+    for (i = 0; i < FFT_SIZE; i++)
+        re[i] = samples[i] * (0.5 - 0.5 * cos (2.0 * M_PI * i / (FFT_SIZE - 1)));
+
+    fft (re, im, FFT_SIZE);
+
+    for (i = 0; i < FFT_SIZE / 2; i++)
+        power[i] = re[i] * re[i] + im[i] * im[i];
+
+    g_free (re);
+    g_free (im);
+
+    return power;
+}
+
+/* frequency of the strongest peak, interpolated, ignoring bins near skip */
+static double
+find_peak (const double *power, double skip)
+{
+    double a, b, c, delta;
+    int i, peak = 1;
+
+    for (i = 1; i < FFT_SIZE / 2 - 1; i++) {
+        if (skip > 0.0 && fabs (i - skip * FFT_SIZE / RATE) <= PEAK_BINS)
+            continue;
+        if (power[i] > power[peak])
+            peak = i;
+    }
+
+    a = log (power[peak - 1] + 1.0);
+    b = log (power[peak] + 1.0);
+    c = log (power[peak + 1] + 1.0);
+    delta = 0.5 * (a - c) / (a - 2.0 * b + c);
+
+    return (peak + delta) * RATE / FFT_SIZE;
+}
+
+/* checks the tone has the frequencies in freq, and nothing else */
+static void
+check_frequencies (const int16_t *samples, const int freq[2], const char *name)
+{
+    double *power = spectrum (samples);
+    double found[2] = { 0.0, 0.0 };
+    double total = 0.0, tone = 0.0;
+    int count = freq[1] ? 2 : 1;
+    int i, j;
+
+    found[0] = find_peak (power, 0.0);
+    if (count == 2) {
+        found[1] = find_peak (power, found[0]);
+        if (found[1] < found[0]) {
+            found[1] = found[0];
+            found[0] = find_peak (power, found[1]);
+        }
+    }
+
+    for (j = 0; j < count; j++) {
+        ck_assert_msg (fabs (found[j] - freq[j]) <= freq[j] * FREQ_TOLERANCE,
+                       "%s: found %.1f Hz instead of %d Hz", name, found[j], freq[j]);
+    }
+
+    for (i = 0; i < FFT_SIZE / 2; i++) {
+        total += power[i];
+
+        for (j = 0; j < count; j++) {
+            if (fabs (i - (double) freq[j] * FFT_SIZE / RATE) <= PEAK_BINS) {
+                tone += power[i];
+                break;
+            }
+        }
+    }
+
+    ck_assert_msg (tone >= total * MIN_PURITY,
+                   "%s: %.3f%% of the power is off the tone frequencies",
+                   name, 100.0 * (total - tone) / total);
+
+    g_free (power);
+}
+
+/* counts samples at the limits that a sine of full amplitude can't reach */
+static int
+count_clipped (const int16_t *samples, int length)
+{
+    int clipped = 0;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        if (samples[i] == SHRT_MIN)
+            clipped++;
+        else if (i > 0 && ABS (samples[i]) == SHRT_MAX && samples[i - 1] == samples[i])
+            clipped++;
+    }
+
+    return clipped;
+}
+
+/*
+ * Finds the tone bursts of the rendered samples in 1 ms steps, and
+ * checks each complete one plays for on_ms and repeats every period_ms.
+ * Dips shorter than MIN_GAP_MS, like the beat of two tones, are part of
+ * the burst. The first burst is left out if it starts with the stream,
+ * as the ramp-up of the stream shapes it too. Returns the number of
+ * bursts checked.
+ */
+static int
+check_cadence (const int16_t *samples, int length, int on_ms, int period_ms,
+               const char *name)
+{
+    int step = MS (1);
+    int ms, i, level;
+    int start = -1, end = -1, prev = -1;
+    int bursts = 0;
+
+    for (ms = 0; ms < length / step; ms++) {
+        for (i = ms * step, level = 0; i < (ms + 1) * step; i++)
+            level = MAX (level, ABS (samples[i]));
+
+        if (level >= ON_LEVEL) {
+            if (start < 0)
+                start = ms;
+            end = ms + 1;
+            continue;
+        }
+
+        if (start < 0 || ms - end < MIN_GAP_MS)
+            continue;
+
+        if (start >= RAMP_UP_MS) {
+            ck_assert_msg (ABS (end - start - on_ms) <= CADENCE_MS,
+                           "%s: burst at %d ms plays %d ms instead of %d ms",
+                           name, start, end - start, on_ms);
+
+            if (prev >= 0) {
+                ck_assert_msg (ABS (start - prev - period_ms) <= CADENCE_MS,
+                               "%s: burst at %d ms repeats after %d ms instead of %d ms",
+                               name, start, start - prev, period_ms);
+            }
+
+            prev = start;
+            bursts++;
+        }
+
+        start = -1;
+    }
+
+    return bursts;
+}
+
+START_TEST (test_dtmf_frequencies)
+{
+    int16_t *samples = NULL;
+    gchar *name = NULL;
+    int digit;
+
+    for (digit = 0; digit < DTMF_MAX; digit++) {
+        dtmf_play (ausrv, digit, 100, 0, NULL);
+        samples = render (STREAM_DTMF, SETTLE + FFT_SIZE);
+
+        name = g_strdup_printf ("dtmf %d", digit);
+        check_frequencies (samples + SETTLE, dtmf_freq[digit], name);
+        g_free (name);
+        g_free (samples);
+
+        stream_destroy (stream_find (ausrv, STREAM_DTMF));
+    }
+}
+END_TEST
+
+START_TEST (test_oscillators)
+{
+    int16_t *samples[2] = { NULL, NULL };
+    gchar *name = NULL;
+    int length = MS (1000);
+    int digit, osc, i;
+
+    /* the wavetable is in tune and plays the same sine as the recurrence */
+    for (digit = 0; digit < DTMF_MAX; digit++) {
+        for (osc = OSCILLATOR_RECURRENCE; osc <= OSCILLATOR_WAVETABLE; osc++) {
+            tone_set_oscillator (osc);
+            dtmf_play (ausrv, digit, 100, 0, NULL);
+            samples[osc] = render (STREAM_DTMF, length);
+            stream_destroy (stream_find (ausrv, STREAM_DTMF));
+        }
+
+        name = g_strdup_printf ("wavetable dtmf %d", digit);
+        check_frequencies (samples[OSCILLATOR_WAVETABLE] + SETTLE, dtmf_freq[digit], name);
+
+        for (i = 0; i < length; i++) {
+            ck_assert_msg (ABS (samples[0][i] - samples[1][i]) <= 2,
+                           "%s: sample %d is %d instead of %d", name, i,
+                           samples[1][i], samples[0][i]);
+        }
+
+        g_free (name);
+        g_free (samples[0]);
+        g_free (samples[1]);
+    }
+}
+END_TEST
+
+START_TEST (test_indicator_frequencies)
+{
+    const ToneSpec *spec = NULL;
+    int16_t *samples = NULL;
+    gchar *name = NULL;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (indicator_tones); i++) {
+        spec = &indicator_tones[i];
+
+        indicator_set_standard (spec->standard);
+        indicator_play (ausrv, spec->type, 100, 0);
+        samples = render (STREAM_INDICATOR, SETTLE + FFT_SIZE);
+
+        name = g_strdup_printf ("standard %d tone %d", spec->standard, spec->type);
+        check_frequencies (samples + SETTLE, spec->freq, name);
+        g_free (name);
+        g_free (samples);
+
+        indicator_stop (ausrv, true);
+    }
+}
+END_TEST
+
+START_TEST (test_indicator_cadence)
+{
+    static const size_t caches[] = { 0, 1024 * 1024 };
+    const CadenceSpec *spec = NULL;
+    int16_t *samples = NULL;
+    gchar *name = NULL;
+    int length;
+    guint i, c;
+
+    /* endless tones play from prerendered loops when cached */
+    for (c = 0; c < G_N_ELEMENTS (caches); c++) {
+        indicator_set_loop_cache (caches[c]);
+
+        for (i = 0; i < G_N_ELEMENTS (indicator_cadences); i++) {
+            spec = &indicator_cadences[i];
+            length = MS (3 * spec->period_ms);
+
+            indicator_set_standard (spec->standard);
+            indicator_play (ausrv, spec->type, 100, 0);
+            samples = render (STREAM_INDICATOR, length);
+
+            name = g_strdup_printf ("standard %d tone %d cache %zu",
+                                    spec->standard, spec->type, caches[c]);
+            ck_assert_msg (check_cadence (samples, length, spec->on_ms,
+                                          spec->period_ms, name) >= 2,
+                           "%s: less than two bursts", name);
+            g_free (name);
+            g_free (samples);
+
+            indicator_stop (ausrv, true);
+        }
+    }
+
+    indicator_set_loop_cache (0);
+}
+END_TEST
+
+START_TEST (test_indicator_stop)
+{
+    static const size_t caches[] = { 0, 1024 * 1024 };
+    int16_t *samples = NULL;
+    int ramp = MS (TONE_STOP_RAMP / 1000);
+    int i, peak;
+    guint c;
+
+    /* endless tones fade out on stop, from loops too */
+    for (c = 0; c < G_N_ELEMENTS (caches); c++) {
+        indicator_set_loop_cache (caches[c]);
+        indicator_play (ausrv, TONE_DIAL, 100, 0);
+
+        samples = render (STREAM_INDICATOR, MS (50));
+        for (i = SETTLE, peak = 0; i < MS (50); i++)
+            peak = MAX (peak, ABS (samples[i]));
+        g_free (samples);
+
+        indicator_stop (ausrv, true);
+        ck_assert (stream_find (ausrv, STREAM_INDICATOR) != NULL);
+
+        samples = render (STREAM_INDICATOR, 2 * ramp);
+        for (i = 0; i < ramp; i++) {
+            ck_assert_msg (ABS (samples[i]) <= peak * (ramp - i) / ramp + peak / 50 + 2,
+                           "cache %zu: sample %d of the ramp is %d", caches[c], i, samples[i]);
+        }
+        for (i = ramp + 1; i < 2 * ramp; i++)
+            ck_assert_int_eq (samples[i], 0);
+        g_free (samples);
+
+        /* the stream goes once the ramp has been played */
+        ck_assert (stream_find (ausrv, STREAM_INDICATOR) == NULL);
+    }
+
+    indicator_set_loop_cache (0);
+}
+END_TEST
+
+START_TEST (test_dtmf_sequence)
+{
+    static const char sequence[] = "159#";
+    struct dtmf_digit digits[sizeof (sequence) - 1];
+    int16_t *samples = NULL;
+    int length = MS (600);
+    int per = MS (120);
+    int first = -1, burst = 0, peak = 0;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (digits); i++) {
+        ck_assert (dtmf_parse_digit (sequence[i]) >= 0);
+        digits[i].tone = dtmf_parse_digit (sequence[i]);
+        digits[i].on = 70000;
+        digits[i].off = 50000;
+    }
+
+    ck_assert_int_eq (dtmf_parse_digit ('a'), DTMF_A);
+    ck_assert_int_eq (dtmf_parse_digit ('x'), -1);
+
+    dtmf_play_sequence (ausrv, digits, G_N_ELEMENTS (digits), 100, NULL);
+    samples = render (STREAM_DTMF, length);
+    /* the first digit starts with the stream and is not counted */
+    ck_assert_int_eq (check_cadence (samples, length, 70, 120, "dtmf sequence"), 3);
+
+    /* the digits start to the sample every on + off */
+    for (i = 1; i < (guint) length; i++) {
+        if (samples[i] != 0 && samples[i - 1] == 0 &&
+            (first < 0 || (int) i - first >= burst * per - MS (10))) {
+            if (first < 0)
+                first = i;
+            ck_assert_msg (ABS ((int) i - first - burst * per) <= 1,
+                           "digit %d starts at sample %d instead of %d",
+                           burst, i, first + burst * per);
+            burst++;
+        }
+    }
+
+    ck_assert_int_eq (burst, 4);
+    g_free (samples);
+
+    /* stopping fades out the digit playing and drops the ones queued */
+    dtmf_play_sequence (ausrv, digits, G_N_ELEMENTS (digits), 100, NULL);
+    g_free (render (STREAM_DTMF, MS (40)));
+    dtmf_stop_sequence (ausrv);
+    samples = render (STREAM_DTMF, length);
+    for (i = 0; i < (guint) MS (TONE_STOP_RAMP / 2000); i++)
+        peak = MAX (peak, ABS (samples[i]));
+    ck_assert_msg (peak > 0, "stopped dtmf sequence is cut");
+    for (i = MS (TONE_STOP_RAMP / 1000) + 1; i < (guint) length; i++)
+        ck_assert_int_eq (samples[i], 0);
+    g_free (samples);
+
+    stream_destroy (stream_find (ausrv, STREAM_DTMF));
+}
+END_TEST
+
+START_TEST (test_pattern)
+{
+    static const char *invalid[] = {
+        "", "425", "425 1000", "425 500/1000", "0 1000/500", "425 1000/500 at",
+        "425 1000/500 for 100 forever", "425 1000/500; never", "425 1000/500,"
+    };
+    static const int busy[] = { 400, 450 };
+    static const int hum[] = { 425, 0 };
+    struct tone_pattern *pattern = NULL;
+    int16_t *samples = NULL;
+    int length = MS (1800);
+    uint32_t count, loops, hits, hits_after, misses, misses_after;
+    size_t size;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (invalid); i++)
+        ck_assert_msg (pattern_compile (invalid[i]) == NULL,
+                       "pattern '%s' accepted", invalid[i]);
+
+    pattern = pattern_compile ("350+440 1000/1000 forever, 480 500/250 at 100 ramp 5; long");
+    ck_assert (pattern != NULL);
+    ck_assert_int_eq (pattern->timeout, PATTERN_TIMEOUT_LONG);
+    /* a segment for each frequency */
+    ck_assert_int_eq (pattern->length, 3);
+    ck_assert_int_eq (pattern->segments[1].parts, 2);
+    ck_assert_int_eq (pattern->segments[2].start, 100000);
+    ck_assert_int_eq (pattern->segments[2].ramp, 5000);
+    pattern_free (pattern);
+
+    ck_assert (!indicator_set_pattern ("cept", "busy", "400+450"));
+    ck_assert (!indicator_set_pattern ("cept", "hum", "400 300/150"));
+    ck_assert (!indicator_set_pattern ("mars", "busy", "400 300/150"));
+    ck_assert (indicator_set_pattern ("cept", "busy", "400+450 600/300"));
+
+    indicator_play (ausrv, TONE_BUSY, 100, 0);
+    samples = render (STREAM_INDICATOR, length);
+    check_frequencies (samples + SETTLE, busy, "custom busy");
+    ck_assert_msg (check_cadence (samples, length, 300, 600, "custom busy") >= 2,
+                   "custom busy: less than two bursts");
+    ck_assert_int_eq (count_clipped (samples, length), 0);
+    g_free (samples);
+
+    indicator_stop (ausrv, true);
+
+    /* 42.5 cycles in a period do not loop, so the tone is played live */
+    indicator_set_loop_cache (1024 * 1024);
+    ck_assert (indicator_set_pattern ("cept", "busy", "425 100/100 forever"));
+    indicator_get_loop_stats (&count, &size, &hits, &misses);
+
+    indicator_play (ausrv, TONE_BUSY, 100, 0);
+    samples = render (STREAM_INDICATOR, length);
+    check_frequencies (samples + SETTLE, hum, "half cycle busy");
+    g_free (samples);
+    indicator_stop (ausrv, true);
+
+    indicator_get_loop_stats (&loops, &size, &hits_after, &misses_after);
+    ck_assert_int_eq (loops, count);
+    ck_assert_int_eq (hits_after, hits);
+    ck_assert_int_eq (misses_after, misses);
+
+    indicator_set_loop_cache (0);
+}
+END_TEST
+
+START_TEST (test_dtmf_keypress)
+{
+    int16_t *samples = NULL;
+    int length = MS (300);
+
+    /* tones of 60 ms and longer leave a 20 ms pause at the end */
+    dtmf_play (ausrv, DTMF_5, 100, 100000, NULL);
+    samples = render (STREAM_DTMF, length);
+    g_free (samples);
+
+    dtmf_play (ausrv, DTMF_5, 100, 100000, NULL);
+    samples = g_new0 (int16_t, 2 * length);
+    ck_assert_int_eq (offline_render (ausrv, STREAM_DTMF, samples + length, length), length);
+    ck_assert_int_eq (check_cadence (samples, 2 * length, 80, 0, "dtmf keypress"), 1);
+    g_free (samples);
+
+    stream_destroy (stream_find (ausrv, STREAM_DTMF));
+}
+END_TEST
+
+START_TEST (test_clipping)
+{
+    int16_t *samples = NULL;
+    int length = MS (2500);
+    int std, type, digit;
+
+    for (std = STD_CEPT; std <= STD_ATNT; std++) {
+        indicator_set_standard (std);
+
+        for (type = TONE_DIAL; type <= TONE_RING; type++) {
+            indicator_play (ausrv, type, 100, 0);
+            samples = render (STREAM_INDICATOR, length);
+            ck_assert_msg (count_clipped (samples, length) == 0,
+                           "standard %d tone %d clips", std, type);
+            g_free (samples);
+
+            indicator_stop (ausrv, true);
+        }
+    }
+
+    for (digit = 0; digit < DTMF_MAX; digit++) {
+        dtmf_play (ausrv, digit, 100, 0, NULL);
+        samples = render (STREAM_DTMF, length);
+        ck_assert_msg (count_clipped (samples, length) == 0,
+                       "dtmf %d clips", digit);
+        g_free (samples);
+
+        stream_destroy (stream_find (ausrv, STREAM_DTMF));
+    }
+}
+END_TEST
+
+START_TEST (test_sink_rate)
+{
+    static const guint32 rates[] = { 44100, 16000, 96000 };
+    struct stream *stream = NULL;
+    int16_t *samples = NULL;
+    int i, j, crossings;
+
+    stream_use_sink_rate (TRUE);
+
+    /* the default rate is used until the sink rate is known */
+    indicator_play (ausrv, TONE_DIAL, 100, 0);
+    stream = stream_find (ausrv, STREAM_INDICATOR);
+    ck_assert (stream != NULL);
+    ck_assert_int_eq (stream->rate, RATE);
+    indicator_stop (ausrv, true);
+
+    /* each new stream follows the sink, like after a route change */
+    for (i = 0; i < (int) G_N_ELEMENTS (rates); i++) {
+        offline_set_sink_rate (ausrv, rates[i]);
+
+        indicator_play (ausrv, TONE_DIAL, 100, 0);
+        stream = stream_find (ausrv, STREAM_INDICATOR);
+        ck_assert (stream != NULL);
+        ck_assert_int_eq (stream->rate, rates[i]);
+
+        /* 425 Hz dial tone crosses zero 850 times a second at any rate */
+        samples = render (STREAM_INDICATOR, rates[i] + rates[i] / 10);
+        for (j = rates[i] / 10 + 1, crossings = 0; j < (int) (rates[i] + rates[i] / 10); j++) {
+            if ((samples[j - 1] < 0) != (samples[j] < 0))
+                crossings++;
+        }
+        ck_assert_msg (ABS (crossings - 850) <= 2,
+                       "%u Hz: %d zero crossings instead of 850", rates[i], crossings);
+
+        g_free (samples);
+        indicator_stop (ausrv, true);
+    }
+
+    /* a corked warm DTMF stream is made again when the sink changes */
+    dtmf_enable_warm_stream (TRUE);
+    dtmf_set_warm (ausrv, DTMF_WARM_HINT, TRUE, NULL);
+    stream = stream_find (ausrv, STREAM_DTMF);
+    ck_assert (stream != NULL && stream->corked);
+    ck_assert_int_eq (stream->rate, rates[G_N_ELEMENTS (rates) - 1]);
+
+    offline_set_sink_rate (ausrv, rates[0]);
+    stream = stream_find (ausrv, STREAM_DTMF);
+    ck_assert (stream != NULL && stream->corked && stream->warm);
+    ck_assert_int_eq (stream->rate, rates[0]);
+
+    /* a playing one is left alone, and made again for the next digit */
+    dtmf_play (ausrv, 1, 100, 0, NULL);
+    g_free (render (STREAM_DTMF, rates[0] / 10));
+    offline_set_sink_rate (ausrv, rates[1]);
+    ck_assert_int_eq (stream_find (ausrv, STREAM_DTMF)->rate, rates[0]);
+    dtmf_stop (ausrv);
+    g_free (render (STREAM_DTMF, rates[0] / 10));
+    dtmf_play (ausrv, 2, 100, 0, NULL);
+    ck_assert_int_eq (stream_find (ausrv, STREAM_DTMF)->rate, rates[1]);
+
+    dtmf_stop (ausrv);
+    dtmf_set_warm (ausrv, DTMF_WARM_HINT, FALSE, NULL);
+    dtmf_enable_warm_stream (FALSE);
+    stream_kill_all (ausrv);
+
+    /* the default rate is used when not following the sink */
+    stream_use_sink_rate (FALSE);
+    indicator_play (ausrv, TONE_DIAL, 100, 0);
+    ck_assert_int_eq (stream_find (ausrv, STREAM_INDICATOR)->rate, RATE);
+    indicator_stop (ausrv, true);
+}
+END_TEST
+
+START_TEST (test_metrics)
+{
+    NProplist *metrics = NULL;
+    int16_t *samples = NULL;
+    int i;
+
+    dtmf_play (ausrv, 1, 100, 0, NULL);
+    for (i = 0; i < 10; i++)
+        g_free (render (STREAM_DTMF, MS (20)));
+    stream_destroy (stream_find (ausrv, STREAM_DTMF));
+
+    dtmf_play (ausrv, 2, 100, 0, NULL);
+    g_free (render (STREAM_DTMF, MS (20)));
+
+    indicator_play (ausrv, TONE_DIAL, 100, 0);
+    samples = render (STREAM_INDICATOR, MS (20));
+    g_free (samples);
+
+    metrics = n_proplist_new ();
+    metrics_collect (metrics);
+
+    ck_assert_int_eq (n_proplist_get_uint (metrics, "tonegen.dtmf.streams"), 2);
+    ck_assert_int_eq (n_proplist_get_uint (metrics, "tonegen.dtmf.writes"), 11);
+    ck_assert_int_eq (n_proplist_get_uint (metrics, "tonegen.dtmf.render.samples"), 11);
+    ck_assert (n_proplist_has_key (metrics, "tonegen.dtmf.render.p50_us"));
+    ck_assert (n_proplist_has_key (metrics, "tonegen.dtmf.render.p99_us"));
+    ck_assert (n_proplist_get_uint (metrics, "tonegen.dtmf.render.p50_us") <=
+               n_proplist_get_uint (metrics, "tonegen.dtmf.render.p99_us"));
+    ck_assert_int_eq (n_proplist_get_uint (metrics, "tonegen.dtmf.late_percent"), 0);
+    ck_assert_int_eq (n_proplist_get_uint (metrics, "tonegen.dtmf.underflows"), 0);
+
+    /* nothing measures the server latency offline */
+    ck_assert_int_eq (n_proplist_get_uint (metrics, "tonegen.dtmf.latency.samples"), 0);
+    ck_assert (!n_proplist_has_key (metrics, "tonegen.dtmf.latency.p50_us"));
+
+    ck_assert_int_eq (n_proplist_get_uint (metrics, "tonegen.indtone.streams"), 1);
+    ck_assert_int_eq (n_proplist_get_uint (metrics, "tonegen.indtone.writes"), 1);
+
+    ck_assert_int_eq (n_proplist_get_uint (metrics, "tonegen.all.streams"), 3);
+    ck_assert_int_eq (n_proplist_get_uint (metrics, "tonegen.all.writes"), 12);
+    ck_assert_int_eq (n_proplist_get_uint (metrics, "tonegen.all.render.samples"), 12);
+
+    n_proplist_free (metrics);
+}
+END_TEST
+
+START_TEST (test_wav)
+{
+    gchar *path = g_build_filename (g_get_tmp_dir (), "test-tonegen.wav", NULL);
+    gchar *data = NULL;
+    gsize size = 0;
+
+    indicator_play (ausrv, TONE_DIAL, 100, 0);
+    ck_assert_int_eq (offline_render_wav (ausrv, STREAM_INDICATOR, path, 100000), MS (100));
+
+    ck_assert (g_file_get_contents (path, &data, &size, NULL));
+    ck_assert_int_eq (size, 44 + MS (100) * 2);
+    ck_assert (memcmp (data, "RIFF", 4) == 0);
+    ck_assert (memcmp (data + 8, "WAVEfmt ", 8) == 0);
+    ck_assert (memcmp (data + 36, "data", 4) == 0);
+    ck_assert_int_eq ((guint8) data[24] | (guint8) data[25] << 8 | (guint8) data[26] << 16, RATE);
+
+    g_free (data);
+    unlink (path);
+    g_free (path);
+}
+END_TEST
+
+int
+main ()
+{
+    Suite *s = NULL;
+    SRunner *sr = NULL;
+    TCase *tc = NULL;
+    int num_failed = 0;
+
+    s = suite_create ("\tTone generator tests");
+
+    tc = tcase_create ("tone frequencies");
+    tcase_add_checked_fixture (tc, setup, teardown);
+    tcase_add_test (tc, test_dtmf_frequencies);
+    tcase_add_test (tc, test_indicator_frequencies);
+    tcase_add_test (tc, test_oscillators);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("tone cadence");
+    tcase_add_checked_fixture (tc, setup, teardown);
+    tcase_set_timeout (tc, 30);
+    tcase_add_test (tc, test_indicator_cadence);
+    tcase_add_test (tc, test_indicator_stop);
+    tcase_add_test (tc, test_dtmf_keypress);
+    tcase_add_test (tc, test_pattern);
+    tcase_add_test (tc, test_dtmf_sequence);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("tone output");
+    tcase_add_checked_fixture (tc, setup, teardown);
+    tcase_add_test (tc, test_clipping);
+    tcase_add_test (tc, test_sink_rate);
+    tcase_add_test (tc, test_metrics);
+    tcase_add_test (tc, test_wav);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    num_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}